@@ -0,0 +1,44 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/contract_util.h>
+
+#include <qtum/qtumstate.h>
+#include <util/strencodings.h>
+
+namespace benchmark {
+namespace contracts {
+
+CBlock EnvironmentBlock()
+{
+    CBlock block;
+    CMutableTransaction tx;
+    std::vector<unsigned char> address(ParseHex("abababababababababababababababababababab"));
+    tx.vout.push_back(CTxOut(0, CScript() << OP_DUP << OP_HASH160 << address << OP_EQUALVERIFY << OP_CHECKSIG));
+    block.vtx.push_back(MakeTransactionRef(CTransaction(tx)));
+    return block;
+}
+
+dev::Address ContractAddress(const dev::h256& hashTx, uint32_t nOut)
+{
+    return QtumState::createQtumAddress(hashTx, nOut);
+}
+
+QtumTransaction ContractTransaction(const std::vector<unsigned char>& data, const dev::u256& value, const dev::u256& gasLimit, const dev::u256& gasPrice, const dev::h256& hashTx, const dev::Address& recipient, uint32_t nOut)
+{
+    QtumTransaction txEth;
+    if (recipient == dev::Address()) {
+        txEth = QtumTransaction(value, gasPrice, gasLimit, data, dev::u256(0));
+    } else {
+        txEth = QtumTransaction(value, gasPrice, gasLimit, recipient, data, dev::u256(0));
+    }
+    txEth.forceSender(dev::Address("0101010101010101010101010101010101010101"));
+    txEth.setHashWith(hashTx);
+    txEth.setNVout(nOut);
+    txEth.setVersion(VersionVM::GetEVMDefault());
+    return txEth;
+}
+
+} // namespace contracts
+} // namespace benchmark
@@ -0,0 +1,28 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BENCH_CONTRACT_UTIL_H
+#define BITCOIN_BENCH_CONTRACT_UTIL_H
+
+#include <primitives/block.h>
+#include <qtum/qtumtransaction.h>
+
+#include <vector>
+
+namespace benchmark {
+namespace contracts {
+
+/** Block with a coinbase only, the environment the contract transactions are executed in */
+CBlock EnvironmentBlock();
+
+/** Address of the contract created by the output nOut of the transaction hashTx */
+dev::Address ContractAddress(const dev::h256& hashTx, uint32_t nOut);
+
+/** EVM transaction from a fixed sender, a creation when recipient is null */
+QtumTransaction ContractTransaction(const std::vector<unsigned char>& data, const dev::u256& value, const dev::u256& gasLimit, const dev::u256& gasPrice, const dev::h256& hashTx, const dev::Address& recipient, uint32_t nOut = 0);
+
+} // namespace contracts
+} // namespace benchmark
+
+#endif // BITCOIN_BENCH_CONTRACT_UTIL_H
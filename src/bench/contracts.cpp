@@ -0,0 +1,162 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <bench/contract_util.h>
+#include <chainparams.h>
+#include <qtum/qtumDGP.h>
+#include <qtum/qtumstate.h>
+#include <util/convert.h>
+#include <util/strencodings.h>
+#include <validation.h>
+
+#include <vector>
+
+using namespace benchmark::contracts;
+
+// The benchmarks run against the state of the bench setup, which lives in a temporary directory
+// and starts from the genesis contracts. Every iteration executes one batch, like a block would.
+
+// Token with mint(address,uint256), balanceOf(address) and transfer(address,uint256)
+static const valtype TOKEN_CODE = ParseHex("608060405234801561001057600080fd5b506101e3806100206000396000f3006080604052600436106100565763ffffffff7c010000000000000000000000000000000000000000000000000000000060003504166340c10f19811461005b57806370a082311461008e578063a9059cbb146100ce575b600080fd5b34801561006757600080fd5b5061008c73ffffffffffffffffffffffffffffffffffffffff600435166024356100ff565b005b34801561009a57600080fd5b506100bc73ffffffffffffffffffffffffffffffffffffffff60043516610134565b60408051918252519081900360200190f35b3480156100da57600080fd5b5061008c73ffffffffffffffffffffffffffffffffffffffff6004351660243561015c565b73ffffffffffffffffffffffffffffffffffffffff909116600090815260208190526040902080546002909202919091019055565b73ffffffffffffffffffffffffffffffffffffffff1660009081526020819052604090205490565b3360009081526020819052604090205481111561017857600080fd5b336000908152602081905260408082208054849003905573ffffffffffffffffffffffffffffffffffffffff93909316815291909120805490910190555600a165627a7a72305820c517c25d8609e1668bebed32141ed2c2415e8b77ba9f2aef29c6d84e5756b4c20029");
+
+// Contract with a payable fallback, calls with value to it are refunded through condensing transactions
+static const valtype PAYABLE_CODE = ParseHex("6060604052346000575b60398060166000396000f30060606040525b600b5b5b565b0000a165627a7a723058209cedb722bf57a30e3eb00eeefc392103ea791a2001deed29f5c3809ff10eb1dd0029");
+
+static const std::string SENDER = "0101010101010101010101010101010101010101";
+static const std::string RECEIVER = "abababababababababababababababababababab";
+
+static const uint64_t GAS_LIMIT = 500000;
+static const uint64_t GAS_PRICE = 40;
+
+// Number of contract transactions executed together
+static const size_t BATCH_SIZE = 10;
+
+static dev::h256 BenchTxHash()
+{
+    static uint64_t nTx = 0;
+    return sha3(dev::h256(dev::u256(++nTx)));
+}
+
+static std::string AbiArgument(const std::string& hex)
+{
+    return std::string(64 - hex.size(), '0') + hex;
+}
+
+static std::vector<ResultExecute> ExecuteContracts(const std::vector<QtumTransaction>& txs, ByteCodeExecResult* pbceExecRes = nullptr)
+{
+    CBlock block(EnvironmentBlock());
+    QtumDGP qtumDGP(globalState.get(), fGettingValuesDGP);
+    uint64_t blockGasLimit = qtumDGP.getBlockGasLimit(ChainActive().Tip()->nHeight + 1);
+    ByteCodeExec exec(block, txs, blockGasLimit, ChainActive().Tip());
+    bool ret = exec.performByteCode();
+    assert(ret);
+    // a failing execution would measure the exception path instead of the contract
+    std::vector<ResultExecute> result = exec.getResult();
+    assert(result.size() == txs.size());
+    for (const ResultExecute& res : result) {
+        assert(res.execRes.excepted == dev::eth::TransactionException::None);
+    }
+    ByteCodeExecResult bceExecRes;
+    ret = exec.processingResults(bceExecRes);
+    assert(ret);
+    if (pbceExecRes) {
+        *pbceExecRes = bceExecRes;
+    }
+    return result;
+}
+
+static dev::Address DeployContract(const valtype& code)
+{
+    dev::h256 hashTx = BenchTxHash();
+    std::vector<ResultExecute> result = ExecuteContracts({ContractTransaction(code, 0, GAS_LIMIT, GAS_PRICE, hashTx, dev::Address())});
+    dev::Address address = result[0].execRes.newAddress;
+    assert(address != dev::Address() && address == ContractAddress(hashTx, 0));
+    assert(!globalState->code(address).empty());
+    return address;
+}
+
+static void ContractCreate(benchmark::State& state)
+{
+    LOCK(cs_main);
+    while (state.KeepRunning()) {
+        DeployContract(TOKEN_CODE);
+    }
+}
+
+static void ERC20Transfer(benchmark::State& state)
+{
+    LOCK(cs_main);
+    dev::Address token = DeployContract(TOKEN_CODE);
+    valtype mint = ParseHex("40c10f19" + AbiArgument(SENDER) + AbiArgument("ffffffffffffffffffffffff"));
+    ExecuteContracts({ContractTransaction(mint, 0, GAS_LIMIT, GAS_PRICE, BenchTxHash(), token)});
+
+    valtype transfer = ParseHex("a9059cbb" + AbiArgument(RECEIVER) + AbiArgument("01"));
+    while (state.KeepRunning()) {
+        std::vector<QtumTransaction> txs;
+        for (size_t i = 0; i < BATCH_SIZE; i++) {
+            txs.push_back(ContractTransaction(transfer, 0, GAS_LIMIT, GAS_PRICE, BenchTxHash(), token));
+        }
+        ExecuteContracts(txs);
+    }
+}
+
+static void ValueTransferCondensing(benchmark::State& state)
+{
+    LOCK(cs_main);
+    dev::Address payable = DeployContract(PAYABLE_CODE);
+    while (state.KeepRunning()) {
+        std::vector<QtumTransaction> txs;
+        for (size_t i = 0; i < BATCH_SIZE; i++) {
+            txs.push_back(ContractTransaction(valtype(), 1000, GAS_LIMIT, GAS_PRICE, BenchTxHash(), payable));
+        }
+        ByteCodeExecResult result;
+        ExecuteContracts(txs, &result);
+        assert(!result.valueTransfers.empty());
+    }
+}
+
+static void DGPLookups(benchmark::State& state)
+{
+    LOCK(cs_main);
+    unsigned int nHeight = ChainActive().Height() + 1;
+    while (state.KeepRunning()) {
+        QtumDGP qtumDGP(globalState.get(), fGettingValuesDGP);
+        qtumDGP.getGasSchedule(nHeight);
+        qtumDGP.getBlockSize(nHeight);
+        qtumDGP.getMinGasPrice(nHeight);
+        qtumDGP.getBlockGasLimit(nHeight);
+    }
+}
+
+static void ExtractContractTransactions(benchmark::State& state)
+{
+    std::vector<unsigned char> address(ParseHex(RECEIVER));
+    CMutableTransaction parent;
+    parent.vin.resize(1);
+    parent.vout.push_back(CTxOut(COIN, CScript() << OP_DUP << OP_HASH160 << address << OP_EQUALVERIFY << OP_CHECKSIG));
+    std::vector<CTransactionRef> blockTxs{MakeTransactionRef(parent)};
+
+    valtype transfer = ParseHex("a9059cbb" + AbiArgument(RECEIVER) + AbiArgument("01"));
+    CScript script = CScript() << CScriptNum(VersionVM::GetEVMDefault().toRaw()) << CScriptNum(int64_t(GAS_LIMIT)) << CScriptNum(int64_t(GAS_PRICE)) << transfer << ParseHex(SENDER) << OP_CALL;
+    CMutableTransaction mtx;
+    mtx.vin.push_back(CTxIn(COutPoint(blockTxs[0]->GetHash(), 0)));
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+        mtx.vout.push_back(CTxOut(0, script));
+    }
+    CTransaction tx(mtx);
+
+    while (state.KeepRunning()) {
+        QtumTxConverter converter(tx, nullptr, &blockTxs);
+        ExtractQtumTX qtumTx;
+        bool ret = converter.extractionQtumTransactions(qtumTx);
+        assert(ret && qtumTx.first.size() == BATCH_SIZE);
+    }
+}
+
+BENCHMARK(ContractCreate, 200);
+BENCHMARK(ERC20Transfer, 100);
+BENCHMARK(ValueTransferCondensing, 100);
+BENCHMARK(DGPLookups, 500);
+BENCHMARK(ExtractContractTransactions, 5000);
@@ -134,6 +134,8 @@ public:
 
     void SeekToFirst();
 
+    void SeekToLast();
+
     template<typename K> void Seek(const K& key) {
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
@@ -144,6 +146,8 @@ public:
 
     void Next();
 
+    void Prev();
+
     template<typename K> bool GetKey(K& key) {
         leveldb::Slice slKey = piter->key();
         try {
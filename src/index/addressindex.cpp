@@ -0,0 +1,464 @@
+// Copyright (c) 2017-2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <index/addressindex.h>
+
+#ifdef ENABLE_BITCORE_RPC
+#include <chainparams.h>
+#include <script/standard.h>
+#include <undo.h>
+#include <util/system.h>
+#include <validation.h>
+
+#include <algorithm>
+#include <map>
+#include <set>
+
+#include <boost/thread.hpp>
+
+constexpr char DB_ADDRESSINDEX = 'a';
+constexpr char DB_ADDRESSUNSPENTINDEX = 'u';
+constexpr char DB_TIMESTAMPINDEX = 'S';
+constexpr char DB_BLOCKHASHINDEX = 'z';
+constexpr char DB_SPENTINDEX = 'p';
+constexpr char DB_ADDRESSSUMMARY = 'A';
+
+std::unique_ptr<AddressIndex> g_addressindex;
+
+
+/**
+ * Access to the address index database (indexes/addrindex/)
+ *
+ * The entries use the same keys as the address index that older versions kept
+ * in the block tree database.
+ */
+class AddressIndex::DB : public BaseIndex::DB
+{
+public:
+    explicit DB(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    /// Read the entries of an address, at most nLimit when it is set. Reading starts at
+    /// pCursor when it is not null and pCursor is set to the next entry when the limit is reached.
+    bool ReadAddressIndex(const uint256& addressHash, int type,
+                          std::vector<std::pair<CAddressIndexKey, CAmount>>& addressIndex,
+                          int start, int end, size_t nLimit, CAddressIndexKey* pCursor);
+
+    /// Height of the last entry of an address up to nMaxHeight, -1 if there is none.
+    int ReadLastHeight(const CAddressIndexIteratorKey& address, int nMaxHeight);
+
+    /// Read the summary of an address, a null summary when it has no entries.
+    bool ReadAddressSummary(const CAddressIndexIteratorKey& address, CAddressSummary& summary) const;
+
+    bool ReadAddressUnspentIndex(const uint256& addressHash, int type,
+                                 std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue>>& unspentOutputs);
+
+    bool ReadSpentIndex(const CSpentIndexKey& key, CSpentIndexValue& value) const;
+
+    bool ReadTimestampIndex(unsigned int high, unsigned int low, bool fActiveOnly,
+                            std::vector<std::pair<uint256, unsigned int>>& hashes);
+
+    /// Read the logical timestamp of a block, which is its time made strictly increasing along the chain.
+    bool ReadTimestampBlockIndex(const uint256& hash, unsigned int& logicalTS) const;
+};
+
+AddressIndex::DB::DB(size_t n_cache_size, bool f_memory, bool f_wipe) :
+    BaseIndex::DB(GetDataDir() / "indexes" / "addrindex", n_cache_size, f_memory, f_wipe)
+{}
+
+bool AddressIndex::DB::ReadAddressIndex(const uint256& addressHash, int type,
+                                        std::vector<std::pair<CAddressIndexKey, CAmount>>& addressIndex,
+                                        int start, int end, size_t nLimit, CAddressIndexKey* pCursor)
+{
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+
+    if (pCursor && !pCursor->hashBytes.IsNull()) {
+        pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, *pCursor));
+    } else if (start > 0 && end > 0) {
+        pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start)));
+    } else {
+        pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
+    }
+
+    if (pCursor) {
+        pCursor->SetNull();
+    }
+    for (size_t nRead = 0; pcursor->Valid(); pcursor->Next(), nRead++) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CAddressIndexKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ADDRESSINDEX || key.second.hashBytes != addressHash) {
+            break;
+        }
+        if (end > 0 && key.second.blockHeight > end) {
+            break;
+        }
+        if (nLimit > 0 && nRead == nLimit) {
+            if (pCursor) {
+                *pCursor = key.second;
+            }
+            break;
+        }
+        CAmount nValue;
+        if (!pcursor->GetValue(nValue)) {
+            return error("failed to get address index value");
+        }
+        addressIndex.emplace_back(key.second, nValue);
+    }
+    return true;
+}
+
+int AddressIndex::DB::ReadLastHeight(const CAddressIndexIteratorKey& address, int nMaxHeight)
+{
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+
+    // the entries are ordered by height, so the last one is right before the first entry above nMaxHeight
+    pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(address.type, address.hashBytes, nMaxHeight + 1)));
+    if (pcursor->Valid()) {
+        pcursor->Prev();
+    } else {
+        pcursor->SeekToLast();
+    }
+    std::pair<char, CAddressIndexKey> key;
+    if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_ADDRESSINDEX ||
+        key.second.type != address.type || key.second.hashBytes != address.hashBytes) {
+        return -1;
+    }
+    return key.second.blockHeight;
+}
+
+bool AddressIndex::DB::ReadAddressSummary(const CAddressIndexIteratorKey& address, CAddressSummary& summary) const
+{
+    if (!Read(std::make_pair(DB_ADDRESSSUMMARY, address), summary)) {
+        summary.SetNull();
+    }
+    return true;
+}
+
+bool AddressIndex::DB::ReadAddressUnspentIndex(const uint256& addressHash, int type,
+                                               std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue>>& unspentOutputs)
+{
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+
+    for (pcursor->Seek(std::make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash))); pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CAddressUnspentKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ADDRESSUNSPENTINDEX || key.second.hashBytes != addressHash) {
+            break;
+        }
+        CAddressUnspentValue nValue;
+        if (!pcursor->GetValue(nValue)) {
+            return error("failed to get address unspent value");
+        }
+        unspentOutputs.emplace_back(key.second, nValue);
+    }
+    return true;
+}
+
+bool AddressIndex::DB::ReadSpentIndex(const CSpentIndexKey& key, CSpentIndexValue& value) const
+{
+    return Read(std::make_pair(DB_SPENTINDEX, key), value);
+}
+
+bool AddressIndex::DB::ReadTimestampIndex(unsigned int high, unsigned int low, bool fActiveOnly,
+                                          std::vector<std::pair<uint256, unsigned int>>& hashes)
+{
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+
+    for (pcursor->Seek(std::make_pair(DB_TIMESTAMPINDEX, CTimestampIndexIteratorKey(low))); pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CTimestampIndexKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_TIMESTAMPINDEX || key.second.timestamp >= high) {
+            break;
+        }
+        // entries of disconnected blocks are kept, like the blocks themselves
+        if (fActiveOnly) {
+            LOCK(cs_main);
+            const CBlockIndex* pindex = LookupBlockIndex(key.second.blockHash);
+            if (!pindex || !::ChainActive().Contains(pindex)) {
+                continue;
+            }
+        }
+        hashes.emplace_back(key.second.blockHash, key.second.timestamp);
+    }
+    return true;
+}
+
+bool AddressIndex::DB::ReadTimestampBlockIndex(const uint256& hash, unsigned int& logicalTS) const
+{
+    CTimestampBlockIndexValue lts;
+    if (!Read(std::make_pair(DB_BLOCKHASHINDEX, CTimestampBlockIndexKey(hash)), lts)) {
+        return false;
+    }
+    logicalTS = lts.ltimestamp;
+    return true;
+}
+
+/** Key of the address an output pays to, false for outputs that are not indexed */
+static bool GetAddressKey(const COutPoint& outpoint, const CScript& scriptPubKey, int& type, uint256& addressHash)
+{
+    CTxDestination dest;
+    if (!ExtractDestination(outpoint, scriptPubKey, dest)) {
+        return false;
+    }
+    valtype bytesID(boost::apply_visitor(DataVisitor(), dest));
+    if (bytesID.empty()) {
+        return false;
+    }
+    valtype addressBytes(32);
+    std::copy(bytesID.begin(), bytesID.end(), addressBytes.begin());
+    type = dest.which();
+    addressHash = uint256(addressBytes);
+    return true;
+}
+
+/** Change of the summary of an address by the entries of a batch */
+struct AddressActivity
+{
+    CAmount balance = 0;
+    CAmount received = 0;
+    std::set<uint256> txids;
+};
+
+typedef std::map<std::pair<unsigned int, uint256>, AddressActivity> AddressActivityMap;
+
+static void AddActivity(AddressActivityMap& activity, int type, const uint256& addressHash, const uint256& txid, CAmount nValue, bool fSpending)
+{
+    AddressActivity& entry = activity[std::make_pair(type, addressHash)];
+    entry.balance += nValue;
+    if (!fSpending) {
+        entry.received += nValue;
+    }
+    entry.txids.insert(txid);
+}
+
+/** Record the spends and outputs of a connected block, in the order of the block */
+static void WriteBlockEntries(CDBBatch& batch, AddressActivityMap& activity, const CBlock& block, const CBlockUndo& block_undo, int nHeight)
+{
+    int type;
+    uint256 addressHash;
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        const uint256& txid = tx.GetHash();
+
+        if (!tx.IsCoinBase()) {
+            const CTxUndo& tx_undo = block_undo.vtxundo[i - 1];
+            for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                const CTxIn& input = tx.vin[j];
+                const CTxOut& prevout = tx_undo.vprevout[j].out;
+                if (!GetAddressKey(input.prevout, prevout.scriptPubKey, type, addressHash)) {
+                    continue;
+                }
+                batch.Write(std::make_pair(DB_ADDRESSINDEX, CAddressIndexKey(type, addressHash, nHeight, i, txid, j, true)), prevout.nValue * -1);
+                batch.Erase(std::make_pair(DB_ADDRESSUNSPENTINDEX, CAddressUnspentKey(type, addressHash, input.prevout.hash, input.prevout.n)));
+                batch.Write(std::make_pair(DB_SPENTINDEX, CSpentIndexKey(input.prevout.hash, input.prevout.n)),
+                            CSpentIndexValue(txid, j, nHeight, prevout.nValue, type, addressHash));
+                AddActivity(activity, type, addressHash, txid, prevout.nValue * -1, true);
+            }
+        }
+
+        for (unsigned int k = 0; k < tx.vout.size(); k++) {
+            const CTxOut& out = tx.vout[k];
+            if (!GetAddressKey({txid, k}, out.scriptPubKey, type, addressHash)) {
+                continue;
+            }
+            batch.Write(std::make_pair(DB_ADDRESSINDEX, CAddressIndexKey(type, addressHash, nHeight, i, txid, k, false)), out.nValue);
+            batch.Write(std::make_pair(DB_ADDRESSUNSPENTINDEX, CAddressUnspentKey(type, addressHash, txid, k)),
+                        CAddressUnspentValue(out.nValue, out.scriptPubKey, nHeight, tx.IsCoinStake()));
+            AddActivity(activity, type, addressHash, txid, out.nValue, false);
+        }
+    }
+}
+
+/** Remove the entries of a disconnected block and restore the outputs it spent, in reverse order */
+static void EraseBlockEntries(CDBBatch& batch, AddressActivityMap& activity, const CBlock& block, const CBlockUndo& block_undo, int nHeight)
+{
+    int type;
+    uint256 addressHash;
+    for (unsigned int i = block.vtx.size(); i-- > 0;) {
+        const CTransaction& tx = *block.vtx[i];
+        const uint256& txid = tx.GetHash();
+
+        for (unsigned int k = tx.vout.size(); k-- > 0;) {
+            const CTxOut& out = tx.vout[k];
+            if (!GetAddressKey({txid, k}, out.scriptPubKey, type, addressHash)) {
+                continue;
+            }
+            batch.Erase(std::make_pair(DB_ADDRESSINDEX, CAddressIndexKey(type, addressHash, nHeight, i, txid, k, false)));
+            batch.Erase(std::make_pair(DB_ADDRESSUNSPENTINDEX, CAddressUnspentKey(type, addressHash, txid, k)));
+            AddActivity(activity, type, addressHash, txid, out.nValue, false);
+        }
+
+        if (!tx.IsCoinBase()) {
+            const CTxUndo& tx_undo = block_undo.vtxundo[i - 1];
+            for (unsigned int j = tx.vin.size(); j-- > 0;) {
+                const CTxIn& input = tx.vin[j];
+                const Coin& coin = tx_undo.vprevout[j];
+                if (!GetAddressKey(input.prevout, coin.out.scriptPubKey, type, addressHash)) {
+                    continue;
+                }
+                batch.Erase(std::make_pair(DB_ADDRESSINDEX, CAddressIndexKey(type, addressHash, nHeight, i, txid, j, true)));
+                batch.Write(std::make_pair(DB_ADDRESSUNSPENTINDEX, CAddressUnspentKey(type, addressHash, input.prevout.hash, input.prevout.n)),
+                            CAddressUnspentValue(coin.out.nValue, coin.out.scriptPubKey, coin.nHeight, coin.fCoinStake));
+                batch.Erase(std::make_pair(DB_SPENTINDEX, CSpentIndexKey(input.prevout.hash, input.prevout.n)));
+                AddActivity(activity, type, addressHash, txid, coin.out.nValue * -1, true);
+            }
+        }
+    }
+}
+
+static bool ReadBlockUndo(CBlockUndo& block_undo, const CBlock& block, const CBlockIndex* pindex)
+{
+    // the genesis block has no undo data and only a coinbase
+    if (pindex->nHeight == 0) {
+        return true;
+    }
+    if (!UndoReadFromDisk(block_undo, pindex)) {
+        return false;
+    }
+    if (block_undo.vtxundo.size() + 1 != block.vtx.size()) {
+        return error("%s: block and undo data of %s inconsistent", __func__, pindex->GetBlockHash().ToString());
+    }
+    for (unsigned int i = 1; i < block.vtx.size(); i++) {
+        if (block_undo.vtxundo[i - 1].vprevout.size() != block.vtx[i]->vin.size()) {
+            return error("%s: transaction and undo data of %s inconsistent", __func__, pindex->GetBlockHash().ToString());
+        }
+    }
+    return true;
+}
+
+AddressIndex::AddressIndex(size_t n_cache_size, bool f_memory, bool f_wipe)
+    : m_db(MakeUnique<AddressIndex::DB>(n_cache_size, f_memory, f_wipe))
+{}
+
+AddressIndex::~AddressIndex() {}
+
+bool AddressIndex::Init()
+{
+    LOCK(cs_main);
+
+    // The index is rebuilt here from the blocks, the entries of the old location are only removed.
+    if (!pblocktree->EraseLegacyAddressIndex()) {
+        return error("%s: cannot remove the address index from the block index database", __func__);
+    }
+
+    return BaseIndex::Init();
+}
+
+bool AddressIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    CBlockUndo block_undo;
+    if (!ReadBlockUndo(block_undo, block, pindex)) {
+        return false;
+    }
+
+    CDBBatch batch(*m_db);
+    AddressActivityMap activity;
+    WriteBlockEntries(batch, activity, block, block_undo, pindex->nHeight);
+
+    // the summaries are written in the same batch as the entries they total
+    for (const auto& entry : activity) {
+        CAddressIndexIteratorKey address(entry.first.first, entry.first.second);
+        CAddressSummary summary;
+        m_db->ReadAddressSummary(address, summary);
+        if (summary.IsNull()) {
+            summary.firstHeight = pindex->nHeight;
+        }
+        summary.balance += entry.second.balance;
+        summary.received += entry.second.received;
+        summary.txCount += entry.second.txids.size();
+        summary.lastHeight = pindex->nHeight;
+        batch.Write(std::make_pair(DB_ADDRESSSUMMARY, address), summary);
+    }
+
+    unsigned int logicalTS = pindex->nTime;
+    unsigned int prevLogicalTS = 0;
+
+    // retrieve logical timestamp of the previous block
+    if (pindex->pprev && !m_db->ReadTimestampBlockIndex(pindex->pprev->GetBlockHash(), prevLogicalTS)) {
+        LogPrintf("%s: Failed to read previous block's logical timestamp\n", __func__);
+    }
+
+    if (logicalTS <= prevLogicalTS) {
+        logicalTS = prevLogicalTS + 1;
+        LogPrintf("%s: Previous logical timestamp is newer Actual[%d] prevLogical[%d] Logical[%d]\n", __func__, pindex->nTime, prevLogicalTS, logicalTS);
+    }
+
+    batch.Write(std::make_pair(DB_TIMESTAMPINDEX, CTimestampIndexKey(logicalTS, pindex->GetBlockHash())), 0);
+    batch.Write(std::make_pair(DB_BLOCKHASHINDEX, CTimestampBlockIndexKey(pindex->GetBlockHash())), CTimestampBlockIndexValue(logicalTS));
+    return m_db->WriteBatch(batch);
+}
+
+bool AddressIndex::Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip)
+{
+    assert(current_tip->GetAncestor(new_tip->nHeight) == new_tip);
+
+    const Consensus::Params& consensus_params = Params().GetConsensus();
+    CDBBatch batch(*m_db);
+    AddressActivityMap activity;
+    for (const CBlockIndex* pindex = current_tip; pindex != new_tip; pindex = pindex->pprev) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, consensus_params)) {
+            return error("%s: Failed to read block %s from disk", __func__, pindex->GetBlockHash().ToString());
+        }
+        CBlockUndo block_undo;
+        if (!ReadBlockUndo(block_undo, block, pindex)) {
+            return false;
+        }
+        EraseBlockEntries(batch, activity, block, block_undo, pindex->nHeight);
+    }
+
+    for (const auto& entry : activity) {
+        CAddressIndexIteratorKey address(entry.first.first, entry.first.second);
+        CAddressSummary summary;
+        m_db->ReadAddressSummary(address, summary);
+        summary.balance -= entry.second.balance;
+        summary.received -= entry.second.received;
+        summary.txCount -= std::min<uint64_t>(summary.txCount, entry.second.txids.size());
+        if (summary.IsNull()) {
+            batch.Erase(std::make_pair(DB_ADDRESSSUMMARY, address));
+            continue;
+        }
+        // the batch is not written yet, so the entries above new_tip are still there and skipped
+        if (summary.lastHeight > new_tip->nHeight) {
+            summary.lastHeight = m_db->ReadLastHeight(address, new_tip->nHeight);
+        }
+        batch.Write(std::make_pair(DB_ADDRESSSUMMARY, address), summary);
+    }
+    if (!m_db->WriteBatch(batch)) {
+        return false;
+    }
+
+    return BaseIndex::Rewind(current_tip, new_tip);
+}
+
+BaseIndex::DB& AddressIndex::GetDB() const { return *m_db; }
+
+bool AddressIndex::FindAddressIndex(const uint256& addressHash, int type,
+                                    std::vector<std::pair<CAddressIndexKey, CAmount>>& addressIndex,
+                                    int start, int end, size_t nLimit, CAddressIndexKey* pCursor) const
+{
+    return m_db->ReadAddressIndex(addressHash, type, addressIndex, start, end, nLimit, pCursor);
+}
+
+bool AddressIndex::FindAddressSummary(const uint256& addressHash, int type, CAddressSummary& summary) const
+{
+    return m_db->ReadAddressSummary(CAddressIndexIteratorKey(type, addressHash), summary);
+}
+
+bool AddressIndex::FindAddressUnspent(const uint256& addressHash, int type,
+                                      std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue>>& unspentOutputs) const
+{
+    return m_db->ReadAddressUnspentIndex(addressHash, type, unspentOutputs);
+}
+
+bool AddressIndex::FindSpent(const CSpentIndexKey& key, CSpentIndexValue& value) const
+{
+    return m_db->ReadSpentIndex(key, value);
+}
+
+bool AddressIndex::FindTimestamps(unsigned int high, unsigned int low, bool fActiveOnly,
+                                  std::vector<std::pair<uint256, unsigned int>>& hashes) const
+{
+    return m_db->ReadTimestampIndex(high, low, fActiveOnly, hashes);
+}
+#endif
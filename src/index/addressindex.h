@@ -0,0 +1,78 @@
+// Copyright (c) 2017-2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_ADDRESSINDEX_H
+#define BITCOIN_INDEX_ADDRESSINDEX_H
+
+#if defined(HAVE_CONFIG_H)
+#include <config/bitcoin-config.h>
+#endif
+
+#include <chain.h>
+#include <index/base.h>
+#include <txdb.h>
+
+#ifdef ENABLE_BITCORE_RPC
+/**
+ * AddressIndex is used by the -addrindex RPCs to look up the activity and unspent
+ * outputs of an address, the input spending an output and the blocks by time.
+ * The index is written to its own LevelDB database and synced in the background,
+ * so it can be enabled without a reindex and costs nothing on the validation thread.
+ */
+class AddressIndex final : public BaseIndex
+{
+protected:
+    class DB;
+
+private:
+    const std::unique_ptr<DB> m_db;
+
+protected:
+    /// Override base class init to remove the index of older versions from the block tree DB.
+    bool Init() override;
+
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+
+    /// Undo the entries of the disconnected blocks, which needs their undo data.
+    bool Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip) override;
+
+    BaseIndex::DB& GetDB() const override;
+
+    const char* GetName() const override { return "addrindex"; }
+
+public:
+    /// Constructs the index, which becomes available to be queried.
+    explicit AddressIndex(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    // Destructor is declared because this class contains a unique_ptr to an incomplete type.
+    virtual ~AddressIndex() override;
+
+    /// Outputs received and spent by an address, optionally limited to the blocks from start to end.
+    /// With nLimit set, at most nLimit entries are read starting at *pCursor when it is not null,
+    /// and *pCursor is set to the next entry or to null when there are no more.
+    bool FindAddressIndex(const uint256& addressHash, int type,
+                          std::vector<std::pair<CAddressIndexKey, CAmount>>& addressIndex,
+                          int start = 0, int end = 0, size_t nLimit = 0, CAddressIndexKey* pCursor = nullptr) const;
+
+    /// Balance, received amount, transaction count and first and last height of an address,
+    /// without reading its entries. The summary is null for an address without entries.
+    bool FindAddressSummary(const uint256& addressHash, int type, CAddressSummary& summary) const;
+
+    /// Unspent outputs of an address.
+    bool FindAddressUnspent(const uint256& addressHash, int type,
+                            std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue>>& unspentOutputs) const;
+
+    /// Input spending an output, false if the output is not spent in the indexed chain.
+    bool FindSpent(const CSpentIndexKey& key, CSpentIndexValue& value) const;
+
+    /// Blocks with a logical timestamp from low up to but excluding high.
+    bool FindTimestamps(unsigned int high, unsigned int low, bool fActiveOnly,
+                        std::vector<std::pair<uint256, unsigned int>>& hashes) const;
+};
+
+/// The global address index, used by the address RPCs. May be null.
+extern std::unique_ptr<AddressIndex> g_addressindex;
+#endif
+
+#endif // BITCOIN_INDEX_ADDRESSINDEX_H
@@ -20,6 +20,7 @@
 #include <fs.h>
 #include <httprpc.h>
 #include <httpserver.h>
+#include <index/addressindex.h>
 #include <index/blockfilterindex.h>
 #include <index/txindex.h>
 #include <interfaces/chain.h>
@@ -34,6 +35,8 @@
 #include <policy/fees.h>
 #include <policy/policy.h>
 #include <policy/settings.h>
+#include <qtum/flatstate.h>
+#include <qtum/stateprune.h>
 #include <rpc/blockchain.h>
 #include <rpc/register.h>
 #include <rpc/server.h>
@@ -173,6 +176,11 @@ void Interrupt()
     if (g_txindex) {
         g_txindex->Interrupt();
     }
+#ifdef ENABLE_BITCORE_RPC
+    if (g_addressindex) {
+        g_addressindex->Interrupt();
+    }
+#endif
     ForEachBlockFilterIndex([](BlockFilterIndex& index) { index.Interrupt(); });
 }
 
@@ -205,6 +213,9 @@ void Shutdown(InitInterfaces& interfaces)
     if (peerLogic) UnregisterValidationInterface(peerLogic.get());
     if (g_connman) g_connman->Stop();
     if (g_txindex) g_txindex->Stop();
+#ifdef ENABLE_BITCORE_RPC
+    if (g_addressindex) g_addressindex->Stop();
+#endif
     ForEachBlockFilterIndex([](BlockFilterIndex& index) { index.Stop(); });
 
     StopTorControl();
@@ -220,6 +231,9 @@ void Shutdown(InitInterfaces& interfaces)
     g_connman.reset();
     g_banman.reset();
     g_txindex.reset();
+#ifdef ENABLE_BITCORE_RPC
+    g_addressindex.reset();
+#endif
     DestroyAllBlockFilterIndexes();
 
     if (::mempool.IsLoaded() && gArgs.GetArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
@@ -267,6 +281,7 @@ void Shutdown(InitInterfaces& interfaces)
         }
         pblocktree.reset();
         pstorageresult.reset();
+        pflatstate.reset();
         globalState.reset();
         globalSealEngine.reset();
     }
@@ -397,6 +412,8 @@ void SetupServerArgs()
     gArgs.AddArg("-prune=<n>", strprintf("Reduce storage requirements by enabling pruning (deleting) of old blocks. This allows the pruneblockchain RPC to be called to delete specific blocks, and enables automatic pruning of old blocks if a target size in MiB is provided. This mode is incompatible with -txindex and -rescan. "
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, 1 = allow manual pruning via RPC, >=%u = automatically prune block files to stay under the specified target size in MiB)", MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-prunestate=<n>", strprintf("Delete the contract state that is not needed by the last <n> blocks when starting. Contract calls on older blocks are no longer possible. "
+            "(default: %u = keep all contract state, >=%u = number of blocks to keep)", DEFAULT_PRUNE_STATE, MIN_STATE_ROOTS_TO_KEEP), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-reindex", "Rebuild chain state and block index from the blk*.dat files on disk", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-reindex-chainstate", "Rebuild chain state from the currently indexed blocks. When in pruning mode or if blocks on disk might be corrupted, use full -reindex instead.", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-record-log-opcodes", "Logs all EVM LOG opcode operations to the file vmExecLogs.json", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
@@ -410,6 +427,7 @@ void SetupServerArgs()
                  strprintf("Maintain an index of compact filters by block (default: %s, values: %s).", DEFAULT_BLOCKFILTERINDEX, ListBlockFilterTypes()) +
                  " If <type> is not supplied or if <type> = 1, indexes for all known types are enabled.",
                  ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-flatstate", strprintf("Maintain a flat copy of the contract state, used by getaccountinfo and getstorage (default: %u)", DEFAULT_FLATSTATE), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-logevents", strprintf("Maintain a full EVM log index, used by searchlogs and gettransactionreceipt rpc calls (default: %u)", DEFAULT_LOGEVENTS), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
 #ifdef ENABLE_BITCORE_RPC
     gArgs.AddArg("-addrindex", strprintf("Maintain a full address index (default: %u)", DEFAULT_ADDRINDEX), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
@@ -555,6 +573,7 @@ void SetupServerArgs()
     gArgs.AddArg("-staker-min-tx-gas-price=<amt>", "Any contract execution with a gas price below this will not be included in a block (defaults to the value specified by the DGP)", ArgsManager::ALLOW_ANY, OptionsCategory::BLOCK_CREATION);
     gArgs.AddArg("-staker-max-tx-gas-limit=<n>", "Any contract execution with a gas limit over this amount will not be included in a block (defaults to soft block gas limit)", ArgsManager::ALLOW_ANY, OptionsCategory::BLOCK_CREATION);
     gArgs.AddArg("-staker-soft-block-gas-limit=<n>", "After this amount of gas is surpassed in a block, no more contract executions will be added to the block (defaults to consensus-critical maximum block gas limit)", ArgsManager::ALLOW_ANY, OptionsCategory::BLOCK_CREATION);
+    gArgs.AddArg("-stakerthreads=<n>", strprintf("Set the number of threads searching for stake kernels (%u to %d, 0 = auto, default: %d)", 1, MAX_STAKER_THREADS, DEFAULT_STAKER_THREADS), ArgsManager::ALLOW_ANY, OptionsCategory::BLOCK_CREATION);
     gArgs.AddArg("-aggressive-staking", "Check more often to publish immediately when valid block is found.", ArgsManager::ALLOW_ANY, OptionsCategory::BLOCK_CREATION);
     gArgs.AddArg("-disablecontractstaking", "Makes it so that no contracts will be added to any PoW or PoS blocks made by this node, useful for when there is a bug for contracts that affects the staker.", ArgsManager::ALLOW_ANY, OptionsCategory::BLOCK_CREATION);
     gArgs.AddArg("-emergencystaking", "Allows for staking to happen even if the node doesn't think it is up to date (Useful for when the chain gets stuck and then nodes think they aren't synced and so they don't stake, waiting for a new block)", ArgsManager::ALLOW_ANY, OptionsCategory::BLOCK_CREATION);
@@ -1022,6 +1041,10 @@ bool AppInitParameterInteraction()
         if (!g_enabled_filter_types.empty()) {
             return InitError(_("Prune mode is incompatible with -blockfilterindex.").translated);
         }
+#ifdef ENABLE_BITCORE_RPC
+        if (gArgs.GetBoolArg("-addrindex", DEFAULT_ADDRINDEX))
+            return InitError(_("Prune mode is incompatible with -addrindex.").translated);
+#endif
     }
 
     // -bind and -whitebind can't be set when not listening
@@ -1143,6 +1166,11 @@ bool AppInitParameterInteraction()
         fPruneMode = true;
     }
 
+    int64_t nPruneStateArg = gArgs.GetArg("-prunestate", DEFAULT_PRUNE_STATE);
+    if (nPruneStateArg < 0 || (nPruneStateArg > 0 && nPruneStateArg < MIN_STATE_ROOTS_TO_KEEP)) {
+        return InitError(strprintf(_("Contract state pruning must keep at least %d blocks.").translated, MIN_STATE_ROOTS_TO_KEEP));
+    }
+
     nConnectTimeout = gArgs.GetArg("-timeout", DEFAULT_CONNECT_TIMEOUT);
     if (nConnectTimeout <= 0) {
         nConnectTimeout = DEFAULT_CONNECT_TIMEOUT;
@@ -1381,6 +1409,10 @@ bool AppInitMain(InitInterfaces& interfaces)
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread([i]() { return ThreadScriptCheck(i); });
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread([i]() { return ThreadBlockSignatureCheck(i); });
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread([i]() { return ThreadMemPoolScriptCheck(i); });
     }
 
     // Start the lightweight task scheduler thread
@@ -1555,19 +1587,14 @@ bool AppInitMain(InitInterfaces& interfaces)
     nTotalCache = std::max(nTotalCache, nMinDbCache << 20); // total cache cannot be less than nMinDbCache
     nTotalCache = std::min(nTotalCache, nMaxDbCache << 20); // total cache cannot be greater than nMaxDbcache
     int64_t nBlockTreeDBCache = std::min(nTotalCache / 8, nMaxBlockDBCache << 20);
-#ifdef ENABLE_BITCORE_RPC
-    if (gArgs.GetBoolArg("-addrindex", DEFAULT_ADDRINDEX)) {
-        // enable 3/4 of the cache if addressindex and/or spentindex is enabled
-        nBlockTreeDBCache = nTotalCache * 3 / 4;
-    } else {
-        if (nBlockTreeDBCache > (1 << 21) && !gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
-            nBlockTreeDBCache = (1 << 21); // block tree db cache shouldn't be larger than 2 MiB
-        }
-    }
-#endif
     nTotalCache -= nBlockTreeDBCache;
     int64_t nTxIndexCache = std::min(nTotalCache / 8, gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxTxIndexCache << 20 : 0);
     nTotalCache -= nTxIndexCache;
+#ifdef ENABLE_BITCORE_RPC
+    fAddressIndex = gArgs.GetBoolArg("-addrindex", DEFAULT_ADDRINDEX);
+    int64_t nAddrIndexCache = std::min(nTotalCache / 4, fAddressIndex ? nMaxAddrIndexCache << 20 : 0);
+    nTotalCache -= nAddrIndexCache;
+#endif
     int64_t filter_index_cache = 0;
     if (!g_enabled_filter_types.empty()) {
         size_t n_indexes = g_enabled_filter_types.size();
@@ -1585,6 +1612,11 @@ bool AppInitMain(InitInterfaces& interfaces)
     if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
         LogPrintf("* Using %.1f MiB for transaction index database\n", nTxIndexCache * (1.0 / 1024 / 1024));
     }
+#ifdef ENABLE_BITCORE_RPC
+    if (fAddressIndex) {
+        LogPrintf("* Using %.1f MiB for address index database\n", nAddrIndexCache * (1.0 / 1024 / 1024));
+    }
+#endif
     for (BlockFilterType filter_type : g_enabled_filter_types) {
         LogPrintf("* Using %.1f MiB for %s block filter index database\n",
                   filter_index_cache * (1.0 / 1024 / 1024), BlockFilterTypeName(filter_type));
@@ -1612,6 +1644,7 @@ bool AppInitMain(InitInterfaces& interfaces)
                 // fails if it's still open from the previous loop. Close it first:
                 pblocktree.reset();
                 pstorageresult.reset();
+                pflatstate.reset();
                 globalState.reset();
                 globalSealEngine.reset();
                 pblocktree.reset(new CBlockTreeDB(nBlockTreeDBCache, false, fReset));
@@ -1718,6 +1751,29 @@ bool AppInitMain(InitInterfaces& interfaces)
                 bool fStatus = fs::exists(qtumStateDir);
                 const std::string dirQtum(qtumStateDir.string());
                 const dev::h256 hashDB(dev::sha3(dev::rlp("")));
+                int nPruneState = gArgs.GetArg("-prunestate", DEFAULT_PRUNE_STATE);
+                if (nPruneState > 0 && fStatus && !fReset && !globalState) {
+                    // keep the state of recent blocks on every branch, blocks that were never connected are skipped
+                    std::set<dev::h256> stateRoots, utxoRoots;
+                    {
+                        LOCK(cs_main);
+                        if (::ChainActive().Tip() != nullptr) {
+                            int nPruneHeight = ::ChainActive().Height() - nPruneState;
+                            for (const std::pair<const uint256, CBlockIndex*>& item : ::BlockIndex()) {
+                                if (item.second->nHeight >= nPruneHeight) {
+                                    stateRoots.insert(uintToh256(item.second->hashStateRoot));
+                                    utxoRoots.insert(uintToh256(item.second->hashUTXORoot));
+                                }
+                            }
+                        }
+                    }
+                    if (!stateRoots.empty()) {
+                        uiInterface.InitMessage(_("Pruning contract state...").translated);
+                        if (!PruneContractState(qtumStateDir, stateRoots, utxoRoots)) {
+                            LogPrintf("Contract state was not pruned\n");
+                        }
+                    }
+                }
                 dev::eth::BaseState existsQtumstate = fStatus ? dev::eth::BaseState::PreExisting : dev::eth::BaseState::Empty;
                 globalState = std::unique_ptr<QtumState>(new QtumState(dev::u256(0), QtumState::openDB(dirQtum, hashDB, dev::WithExisting::Trust), dirQtum, existsQtumstate));
                 dev::eth::Network ethNetwork;// = dev::eth::Network::qtumMainNetwork;
@@ -1745,6 +1801,15 @@ bool AppInitMain(InitInterfaces& interfaces)
                 globalState->db().commit();
                 globalState->dbUtxo().commit();
 
+                if (gArgs.GetBoolArg("-flatstate", DEFAULT_FLATSTATE)) {
+                    uiInterface.InitMessage(_("Loading flat contract state...").translated);
+                    pflatstate.reset(new FlatState(qtumStateDir / "flatState", fReset));
+                    if (!pflatstate->Sync(globalState->db(), globalState->rootHash())) {
+                        pflatstate->StartRebuild(std::make_shared<const dev::OverlayDB>(globalState->db()), globalState->rootHash());
+                    }
+                    globalState->setFlatState(pflatstate.get());
+                }
+
                 fRecordLogOpcodes = gArgs.IsArgSet("-record-log-opcodes");
                 fIsVMlogFile = fs::exists(GetDataDir() / "vmExecLogs.json");
                 ///////////////////////////////////////////////////////////
@@ -1755,14 +1820,6 @@ bool AppInitMain(InitInterfaces& interfaces)
                 }
                 /////////////////////////////////////////////////////////////
 
-#ifdef ENABLE_BITCORE_RPC
-                /////////////////////////////////////////////////////////////// // qtum
-                if (fAddressIndex != gArgs.GetBoolArg("-addrindex", DEFAULT_ADDRINDEX)) {
-                    strLoadError = _("You need to rebuild the database using -reindex-chainstate to change -addrindex").translated;
-                    break;
-                }
-                ///////////////////////////////////////////////////////////////
-#endif
                 // Check for changed -logevents state
                 if (fLogEvents != gArgs.GetBoolArg("-logevents", DEFAULT_LOGEVENTS) && !fLogEvents) {
                     strLoadError = _("You need to rebuild the database using -reindex to enable -logevents").translated;
@@ -1776,6 +1833,11 @@ bool AppInitMain(InitInterfaces& interfaces)
                     fLogEvents = false;
                     pblocktree->WriteFlag("logevents", fLogEvents);
                 }
+                else if (::ChainActive().Tip() == nullptr)
+                {
+                    // Log blooms are written for every block connected from genesis on
+                    pblocktree->WriteFlag("logbloom", true);
+                }
 
             if (!fReset) {
                 // Note that RewindBlockIndex MUST run even if we're about to -reindex-chainstate.
@@ -1863,6 +1925,13 @@ bool AppInitMain(InitInterfaces& interfaces)
         g_txindex->Start();
     }
 
+#ifdef ENABLE_BITCORE_RPC
+    if (fAddressIndex) {
+        g_addressindex = MakeUnique<AddressIndex>(nAddrIndexCache, false, fReindex);
+        g_addressindex->Start();
+    }
+#endif
+
     for (const auto& filter_type : g_enabled_filter_types) {
         InitBlockFilterIndex(filter_type, filter_index_cache, false, fReindex);
         GetBlockFilterIndex(filter_type)->Start();
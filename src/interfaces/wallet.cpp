@@ -747,6 +747,10 @@ public:
         }
         return result;
     }
+    bool getTokenBalance(const uint256& id, uint256& balance) override
+    {
+        return m_wallet->GetTokenBalance(id, balance);
+    }
     bool tryGetTokenTxStatus(const uint256& txid, int& block_number, bool& in_mempool, int& num_blocks) override
     {
         auto locked_chain = m_wallet->chain().lock(true);
@@ -300,6 +300,9 @@ public:
     //! Get list of all tokens.
     virtual std::vector<TokenInfo> getTokens() = 0;
 
+    //! Get the balance of the token address, cached by the wallet until the storage of the token contract changes.
+    virtual bool getTokenBalance(const uint256& id, uint256& balance) = 0;
+
     //! Try to get updated status for a particular token transaction, if possible without blocking.
     virtual bool tryGetTokenTxStatus(const uint256& txid, int& block_number, bool& in_mempool, int& num_blocks) = 0;
 
@@ -30,7 +30,9 @@
 #endif
 
 #include <algorithm>
+#include <atomic>
 #include <queue>
+#include <thread>
 #include <utility>
 
 unsigned int nMinerSleep = STAKER_POLLING_PERIOD;
@@ -488,6 +490,7 @@ bool BlockAssembler::AttemptToAddContractToBlock(CTxMemPool::txiter iter, uint64
     }
     // We need to pass the DGP's block gas limit (not the soft limit) since it is consensus critical.
     ByteCodeExec exec(*pblock, qtumTransactions, hardBlockGasLimit, ::ChainActive().Tip());
+    exec.enableResultCache(nHeight);
     if(!exec.performByteCode()){
         //error, don't add contract
         globalState->setRoot(oldHashStateRoot);
@@ -879,6 +882,73 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
 }
 
+void StakeTemplateCache::SetAuthor(const CScript& script)
+{
+    LOCK(cs);
+    scriptAuthor = script;
+}
+
+int StakeTemplateCache::Update(uint32_t nBeginningTime)
+{
+    // the best block has its own lock, polling an unchanged window costs no cs_main
+    uint256 hashTip = WITH_LOCK(g_best_block_mutex, return g_best_block);
+    unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    int64_t nNow = GetTime();
+    CScript script;
+    dev::Address author;
+    std::vector<uint32_t> vStaleSlots;
+    {
+        LOCK(cs);
+        if (scriptAuthor.empty())
+            return 0;
+        script = scriptAuthor;
+        author = ByteCodeExec::EthAddrFromScript(script);
+
+        // slots before the window can not be staked anymore
+        entries.erase(entries.begin(), entries.lower_bound(nBeginningTime));
+        for (uint32_t nTime = nBeginningTime; nTime < nBeginningTime + MAX_STAKE_LOOKAHEAD; nTime += STAKE_TIMESTAMP_MASK + 1) {
+            auto it = entries.find(nTime);
+            if (it != entries.end() && it->second.blocktemplate->block.hashPrevBlock == hashTip && it->second.author == author &&
+                (it->second.nTransactionsUpdated == nTransactionsUpdated || nNow - it->second.nTimeBuilt < STAKE_TEMPLATE_REFRESH_INTERVAL))
+                continue;
+            vStaleSlots.push_back(nTime);
+        }
+    }
+
+    int nBuilt = 0;
+    for (uint32_t nTime : vStaleSlots) {
+        Entry entry;
+        entry.author = author;
+        entry.nTotalFees = 0;
+        // read before the build, a mempool change during the build makes the template stale
+        entry.nTransactionsUpdated = mempool.GetTransactionsUpdated();
+        entry.nTimeBuilt = GetTime();
+        entry.blocktemplate = BlockAssembler(Params()).CreateNewBlock(script, true, true, &entry.nTotalFees,
+                                                                      nTime, FutureDrift(GetAdjustedTime()) - STAKE_TIME_BUFFER);
+        // stop when the tip moved during the build, the next update starts over for the new tip
+        if (!entry.blocktemplate || entry.blocktemplate->block.hashPrevBlock != hashTip)
+            break;
+
+        // publish every slot as soon as it is built, the earliest one is the most likely to be needed
+        LOCK(cs);
+        entries[nTime] = std::move(entry);
+        nBuilt++;
+    }
+    return nBuilt;
+}
+
+bool StakeTemplateCache::Get(const uint256& hashPrevBlock, const CScript& scriptPubKey, uint32_t nTime, std::unique_ptr<CBlockTemplate>& blocktemplate, int64_t& nTotalFees)
+{
+    dev::Address author = ByteCodeExec::EthAddrFromScript(scriptPubKey);
+    LOCK(cs);
+    auto it = entries.find(nTime);
+    if (it == entries.end() || it->second.blocktemplate->block.hashPrevBlock != hashPrevBlock || it->second.author != author)
+        return false;
+    blocktemplate.reset(new CBlockTemplate(*it->second.blocktemplate));
+    nTotalFees = it->second.nTotalFees;
+    return true;
+}
+
 #ifdef ENABLE_WALLET
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -928,7 +998,108 @@ bool CheckStake(const std::shared_ptr<const CBlock> pblock, CWallet& wallet)
     return true;
 }
 
-void ThreadStakeMiner(CWallet *pwallet, CConnman* connman)
+static int GetStakerThreads()
+{
+    int nThreads = gArgs.GetArg("-stakerthreads", DEFAULT_STAKER_THREADS);
+    if (nThreads <= 0)
+        nThreads += GetNumCores();
+    return std::max(1, std::min(nThreads, MAX_STAKER_THREADS));
+}
+
+/**
+ * Search the kernels for one that meets the target of the slot.
+ * The kernels are checked in chunks by nThreads threads, the search stops on the first hit
+ * or when the tip is no longer pindexPrev.
+ */
+static bool FindStakeKernel(const std::vector<std::pair<COutPoint, CStakeCache> >& vKernels, const CStakeKernelSlot& slot, const CBlockIndex* pindexPrev, int nThreads, COutPoint& prevoutKernel)
+{
+    static const size_t KERNEL_CHUNK_SIZE = 256;
+
+    std::atomic<size_t> nextChunk{0};
+    std::atomic<bool> fDone{false};
+    std::atomic<size_t> found{vKernels.size()};
+
+    auto search = [&]() {
+        while (!fDone) {
+            size_t begin = nextChunk.fetch_add(KERNEL_CHUNK_SIZE);
+            if (begin >= vKernels.size())
+                break;
+            if (WITH_LOCK(cs_main, return ::ChainActive().Tip()) != pindexPrev) {
+                fDone = true;
+                break;
+            }
+            size_t end = std::min(begin + KERNEL_CHUNK_SIZE, vKernels.size());
+            for (size_t i = begin; i < end && !fDone; i++) {
+                const CStakeCache& stake = vKernels[i].second;
+                if (CheckStakeKernelHash(slot, stake.blockFromTime, stake.amount, vKernels[i].first)) {
+                    size_t expected = vKernels.size();
+                    found.compare_exchange_strong(expected, i);
+                    fDone = true;
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    nThreads = std::min<size_t>(nThreads, (vKernels.size() + KERNEL_CHUNK_SIZE - 1) / KERNEL_CHUNK_SIZE);
+    for (int i = 1; i < nThreads; i++)
+        workers.emplace_back(search);
+    search();
+    for (std::thread& worker : workers)
+        worker.join();
+
+    if (found == vKernels.size())
+        return false;
+    prevoutKernel = vKernels[found].first;
+    return true;
+}
+
+/** The author with the largest stake is the most likely one to find the next kernel */
+static CScript GetLikelyStakeAuthor(const std::set<std::pair<const CWalletTx*,unsigned int> >& setCoins)
+{
+    std::map<dev::Address, std::pair<CAmount, CScript> > weights;
+    for (const std::pair<const CWalletTx*,unsigned int>& pcoin : setCoins) {
+        const CTxOut& txout = pcoin.first->tx->vout[pcoin.second];
+        auto& weight = weights[ByteCodeExec::EthAddrFromScript(txout.scriptPubKey)];
+        weight.first += txout.nValue;
+        weight.second = txout.scriptPubKey;
+    }
+    CScript script;
+    CAmount nMaxWeight = 0;
+    for (const auto& weight : weights) {
+        if (weight.second.first > nMaxWeight) {
+            nMaxWeight = weight.second.first;
+            script = weight.second.second;
+        }
+    }
+    return script;
+}
+
+static void ThreadStakeTemplateBuilder(CWallet *pwallet, std::shared_ptr<StakeTemplateCache> templateCache)
+{
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+
+    std::string threadName = "qtumstaketmpl";
+    if(pwallet && pwallet->GetName() != "")
+    {
+        threadName = threadName + "-" + pwallet->GetName();
+    }
+    util::ThreadRename(threadName.c_str());
+
+    while (true)
+    {
+        if (!pwallet->IsLocked() && pwallet->m_enabled_staking && !::ChainstateActive().IsInitialBlockDownload())
+        {
+            // only the slots that are missing or stale are built, polling an unchanged window is cheap
+            uint32_t beginningTime = GetAdjustedTime();
+            beginningTime &= ~STAKE_TIMESTAMP_MASK;
+            templateCache->Update(beginningTime);
+        }
+        MilliSleep(STAKE_TEMPLATE_POLLING_PERIOD);
+    }
+}
+
+static void ThreadStakeMiner(CWallet *pwallet, CConnman* connman, std::shared_ptr<StakeTemplateCache> templateCache)
 {
     SetThreadPriority(THREAD_PRIORITY_LOWEST);
 
@@ -942,6 +1113,8 @@ void ThreadStakeMiner(CWallet *pwallet, CConnman* connman)
 
     bool fTryToSync = true;
     bool regtestMode = Params().MineBlocksOnDemand();
+    int nStakerThreads = GetStakerThreads();
+    std::vector<std::pair<COutPoint, CStakeCache> > vKernels;
     if(regtestMode){
         nMinerSleep = 30000; //limit regtest to 30s, otherwise it'll create 2 blocks per second
     }
@@ -981,7 +1154,9 @@ void ThreadStakeMiner(CWallet *pwallet, CConnman* connman)
             auto locked_chain = pwallet->chain().lock();
             LOCK(pwallet->cs_wallet);
             pwallet->SelectCoinsForStaking(*locked_chain, nTargetValue, setCoins, nValueIn);
+            pwallet->GetStakeKernels(*locked_chain, setCoins, vKernels);
         }
+        templateCache->SetAuthor(GetLikelyStakeAuthor(setCoins));
         if(setCoins.size() > 0)
         {
             int64_t nTotalFees = 0;
@@ -1000,10 +1175,18 @@ void ThreadStakeMiner(CWallet *pwallet, CConnman* connman)
                 // nLastCoinStakeSearchInterval > 0 mean that the staker is running
                 pwallet->m_last_coin_stake_search_interval = i - pwallet->m_last_coin_stake_search_time;
 
+                // Search the kernels for the slot first, only a hit is worth building and signing a block
+                COutPoint prevoutKernel;
+                if (!FindStakeKernel(vKernels, CStakeKernelSlot(pindexPrev, pblocktemplate->block.nBits, i), pindexPrev, nStakerThreads, prevoutKernel)) {
+                    if (::ChainActive().Tip() != pindexPrev)
+                        break;
+                    continue;
+                }
+
                 // Try to sign a block (this also checks for a PoS stake)
                 pblocktemplate->block.nTime = i;
                 std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>(pblocktemplate->block);
-                if (SignBlock(pblock, *pwallet, nTotalFees, i, setCoins)) {
+                if (SignBlock(pblock, *pwallet, nTotalFees, i, setCoins, &prevoutKernel)) {
                     // increase priority so we can build the full PoS block ASAP to ensure the timestamp doesn't expire
                     SetThreadPriority(THREAD_PRIORITY_ABOVE_NORMAL);
 
@@ -1012,10 +1195,12 @@ void ThreadStakeMiner(CWallet *pwallet, CConnman* connman)
                         LogPrintf("ThreadStakeMiner(): Valid future PoS block was orphaned before becoming valid");
                         break;
                     }
-                    // Create a block that's properly populated with transactions
-                    std::unique_ptr<CBlockTemplate> pblocktemplatefilled(
-                            BlockAssembler(Params()).CreateNewBlock(pblock->vtx[1]->vout[1].scriptPubKey, true, true, &nTotalFees,
-                                                                    i, FutureDrift(GetAdjustedTime()) - STAKE_TIME_BUFFER));
+                    // Use the block prebuilt for this slot and author, or create one that's properly populated with transactions
+                    std::unique_ptr<CBlockTemplate> pblocktemplatefilled;
+                    if (!templateCache->Get(pblock->hashPrevBlock, pblock->vtx[1]->vout[1].scriptPubKey, i, pblocktemplatefilled, nTotalFees)) {
+                        pblocktemplatefilled = BlockAssembler(Params()).CreateNewBlock(pblock->vtx[1]->vout[1].scriptPubKey, true, true, &nTotalFees,
+                                                                                       i, FutureDrift(GetAdjustedTime()) - STAKE_TIME_BUFFER);
+                    }
                     if (!pblocktemplatefilled.get())
                         return;
                     if (::ChainActive().Tip()->GetBlockHash() != pblock->hashPrevBlock) {
@@ -1025,7 +1210,7 @@ void ThreadStakeMiner(CWallet *pwallet, CConnman* connman)
                     }
                     // Sign the full block and use the timestamp from earlier for a valid stake
                     std::shared_ptr<CBlock> pblockfilled = std::make_shared<CBlock>(pblocktemplatefilled->block);
-                    if (SignBlock(pblockfilled, *pwallet, nTotalFees, i, setCoins)) {
+                    if (SignBlock(pblockfilled, *pwallet, nTotalFees, i, setCoins, &prevoutKernel)) {
                         // Should always reach here unless we spent too much time processing transactions and the timestamp is now invalid
                         // CheckStake also does CheckBlock and AcceptBlock to propogate it to the network
                         bool validBlock = false;
@@ -1083,7 +1268,9 @@ void StakeQtums(bool fStake, CWallet *pwallet, CConnman* connman, boost::thread_
     if(fStake)
     {
         stakeThread = new boost::thread_group();
-        stakeThread->create_thread(boost::bind(&ThreadStakeMiner, pwallet, connman));
+        std::shared_ptr<StakeTemplateCache> templateCache = std::make_shared<StakeTemplateCache>();
+        stakeThread->create_thread(boost::bind(&ThreadStakeMiner, pwallet, connman, templateCache));
+        stakeThread->create_thread(boost::bind(&ThreadStakeTemplateBuilder, pwallet, templateCache));
     }
 }
 #endif
@@ -11,6 +11,7 @@
 #include <txmempool.h>
 #include <validation.h>
 
+#include <map>
 #include <memory>
 #include <stdint.h>
 
@@ -34,6 +35,10 @@ static const bool DEFAULT_STAKE = true;
 
 static const bool DEFAULT_STAKE_CACHE = true;
 
+//Number of threads searching for stake kernels, 0 = number of cores
+static const int DEFAULT_STAKER_THREADS = 1;
+static const int MAX_STAKER_THREADS = 16;
+
 //How many seconds to look ahead and prepare a block for staking
 //Look ahead up to 3 "timeslots" in the future, 48 seconds
 //Reduce this to reduce computational waste for stakers, increase this to increase the amount of time available to construct full blocks
@@ -51,6 +56,12 @@ static const int32_t STAKE_TIME_BUFFER = 2;
 //Note this is overridden for regtest mode
 static const int32_t STAKER_POLLING_PERIOD = 5000;
 
+//How often the template builder checks for a new tip, block author or timestamp slot in milliseconds
+static const int32_t STAKE_TEMPLATE_POLLING_PERIOD = 1000;
+
+//Minimum age in seconds of a prebuilt staking template before it is rebuilt for a changed mempool
+static const int64_t STAKE_TEMPLATE_REFRESH_INTERVAL = 5;
+
 //How much time to spend trying to process transactions when using the generate RPC call
 static const int32_t POW_MINER_MAX_TIME = 60;
 
@@ -308,6 +319,41 @@ private:
     void AddCoinstakeContracts(CMutableTransaction* coinstakeTx);
 };
 
+/**
+ * Full PoS block templates prebuilt for the timestamp slots of the staker's lookahead window, so that
+ * after a kernel hit only the coinstake has to be added and signed.
+ * The EVM results of a template depend on the tip, the block time and the block author. Every slot of
+ * the window is invalidated on its own: it is rebuilt when the tip or the author changed since it was
+ * built, or when the mempool changed and the template is older than STAKE_TEMPLATE_REFRESH_INTERVAL.
+ * Slots that left the window are dropped. A slot without a template is built by the staker on a kernel hit.
+ */
+class StakeTemplateCache
+{
+public:
+    /** Set the author the templates are built for */
+    void SetAuthor(const CScript& script);
+
+    /** Build the slots of the window from nBeginningTime that are missing or stale, return the number built */
+    int Update(uint32_t nBeginningTime);
+
+    /** Copy the template of the slot nTime if it was built on hashPrevBlock for the author of scriptPubKey */
+    bool Get(const uint256& hashPrevBlock, const CScript& scriptPubKey, uint32_t nTime, std::unique_ptr<CBlockTemplate>& blocktemplate, int64_t& nTotalFees);
+
+private:
+    struct Entry {
+        dev::Address author;
+        int64_t nTotalFees;
+        //! Mempool update counter and time when the template was built
+        unsigned int nTransactionsUpdated;
+        int64_t nTimeBuilt;
+        std::unique_ptr<CBlockTemplate> blocktemplate;
+    };
+
+    Mutex cs;
+    CScript scriptAuthor GUARDED_BY(cs);
+    std::map<uint32_t, Entry> entries GUARDED_BY(cs);
+};
+
 #ifdef ENABLE_WALLET
 /** Generate a new block, without valid proof-of-work */
 void StakeQtums(bool fStake, CWallet *pwallet, CConnman* connman, boost::thread_group*& stakeThread);
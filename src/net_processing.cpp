@@ -2671,10 +2671,23 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
+        // Check the transaction against a snapshot of its spent coins and verify its scripts on the
+        // mempool check threads before taking the locks, the admission then only checks the conflicts
+        MemPoolPreCheck precheck;
+        CValidationState state;
+        bool fPreChecked = false;
+        bool fAlreadyHave;
+        {
+            LOCK(cs_main);
+            fAlreadyHave = AlreadyHave(inv);
+        }
+        if (!fAlreadyHave) {
+            fPreChecked = PreCheckMemPoolTransaction(mempool, state, ptx, precheck);
+        }
+
         LOCK2(cs_main, g_cs_orphans);
 
         bool fMissingInputs = false;
-        CValidationState state;
 
         CNodeState* nodestate = State(pfrom->GetId());
         nodestate->m_tx_download.m_tx_announced.erase(inv.hash);
@@ -2683,8 +2696,9 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
 
         std::list<CTransactionRef> lRemovedTxn;
 
-        if (!AlreadyHave(inv) &&
-            AcceptToMemoryPool(mempool, state, ptx, &fMissingInputs, &lRemovedTxn, false /* bypass_limits */, 0 /* nAbsurdFee */)) {
+        if (!AlreadyHave(inv) && !state.IsInvalid() &&
+            AcceptToMemoryPool(mempool, state, ptx, &fMissingInputs, &lRemovedTxn, false /* bypass_limits */, 0 /* nAbsurdFee */,
+                               false /* test_accept */, false /* rawTx */, fPreChecked ? &precheck : nullptr)) {
             mempool.check(&::ChainstateActive().CoinsTip());
             RelayTransaction(tx.GetHash(), *connman);
             for (unsigned int i = 0; i < tx.vout.size(); i++) {
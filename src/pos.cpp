@@ -14,6 +14,7 @@
 #include <chainparams.h>
 #include <script/sign.h>
 #include <consensus/consensus.h>
+#include <undo.h>
 
 using namespace std;
 
@@ -32,6 +33,28 @@ uint256 ComputeStakeModifier(const CBlockIndex* pindexPrev, const uint256& kerne
     return Hash(ss.begin(), ss.end());
 }
 
+static arith_uint256 GetKernelTarget(const arith_uint256& bnTargetBase, unsigned int nBits, CAmount prevoutValue, const COutPoint& prevout)
+{
+    // Weighted target
+    int64_t nValueIn = prevoutValue;
+    ///////////////////////////////////////////// // metrix
+    unsigned int nValueInAdjustment = (nBits ^ UintToArith256(prevout.hash).GetCompact()) % 10;
+    if (nValueInAdjustment > 0)
+        nValueIn = nValueIn - (nValueInAdjustment * nValueIn / 10);
+    /////////////////////////////////////////////
+    arith_uint256 bnTarget = bnTargetBase;
+    bnTarget *= arith_uint256(nValueIn);
+    return bnTarget;
+}
+
+static uint256 GetKernelHash(const uint256& nStakeModifier, uint32_t blockFromTime, const COutPoint& prevout, uint32_t nTimeBlock)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << nStakeModifier;
+    ss << blockFromTime << prevout.hash << prevout.n << nTimeBlock;
+    return ss.GetHash();
+}
+
 // BlackCoin kernel protocol
 // coinstake must meet hash target according to the protocol:
 // kernel (input 0) must meet the formula
@@ -59,26 +82,14 @@ bool CheckStakeKernelHash(CBlockIndex* pindexPrev, unsigned int nBits, uint32_t
     // Base target
     arith_uint256 bnTarget;
     bnTarget.SetCompact(nBits);
-
-    // Weighted target
-    int64_t nValueIn = prevoutValue;
-    ///////////////////////////////////////////// // metrix
-    unsigned int nValueInAdjustment = (nBits ^ UintToArith256(prevout.hash).GetCompact()) % 10;
-    if (nValueInAdjustment > 0)
-        nValueIn = nValueIn - (nValueInAdjustment * nValueIn / 10);
-    /////////////////////////////////////////////
-    arith_uint256 bnWeight = arith_uint256(nValueIn);
-    bnTarget *= bnWeight;
+    bnTarget = GetKernelTarget(bnTarget, nBits, prevoutValue, prevout);
 
     targetProofOfStake = ArithToUint256(bnTarget);
 
     uint256 nStakeModifier = pindexPrev->nStakeModifier;
 
     // Calculate hash
-    CDataStream ss(SER_GETHASH, 0);
-    ss << nStakeModifier;
-    ss << blockFromTime << prevout.hash << prevout.n << nTimeBlock;
-    hashProofOfStake = Hash(ss.begin(), ss.end());
+    hashProofOfStake = GetKernelHash(nStakeModifier, blockFromTime, prevout, nTimeBlock);
 
     if (fPrintProofOfStake)
     {
@@ -103,6 +114,21 @@ bool CheckStakeKernelHash(CBlockIndex* pindexPrev, unsigned int nBits, uint32_t
     return true;
 }
 
+CStakeKernelSlot::CStakeKernelSlot(const CBlockIndex* pindexPrev, unsigned int nBitsIn, uint32_t nTimeBlockIn) :
+    nStakeModifier(pindexPrev->nStakeModifier), nBits(nBitsIn), nTimeBlock(nTimeBlockIn)
+{
+    bnTargetBase.SetCompact(nBits);
+}
+
+bool CheckStakeKernelHash(const CStakeKernelSlot& slot, uint32_t blockFromTime, CAmount prevoutValue, const COutPoint& prevout)
+{
+    if (slot.nTimeBlock < blockFromTime)
+        return false;
+
+    arith_uint256 bnTarget = GetKernelTarget(slot.bnTargetBase, slot.nBits, prevoutValue, prevout);
+    return UintToArith256(GetKernelHash(slot.nStakeModifier, blockFromTime, prevout, slot.nTimeBlock)) <= bnTarget;
+}
+
 // Check kernel hash target and coinstake signature
 bool CheckProofOfStake(CBlockIndex* pindexPrev, CValidationState& state, const CTransaction& tx, unsigned int nBits, uint32_t nTimeBlock, uint256& hashProofOfStake, uint256& targetProofOfStake, CCoinsViewCache& view)
 {
@@ -223,17 +249,38 @@ bool CheckRecoveredPubKeyFromBlockSignature(CBlockIndex* pindexPrev, const CBloc
     return false;
 }
 
+bool CheckHeaderKernel(CBlockIndex* pindexPrev, const CBlockHeader& block, CCoinsViewCache& view)
+{
+    Coin coinPrev;
+    if(!view.GetCoin(block.prevoutStake, coinPrev) && !g_spent_coins.Find(block.prevoutStake, coinPrev))
+        return true;
+
+    // The coin is only known to exist when the header builds on the block that created it
+    if(coinPrev.nHeight > pindexPrev->nHeight)
+        return true;
+    CBlockIndex* blockFrom = pindexPrev->GetAncestor(coinPrev.nHeight);
+    if(!blockFrom || blockFrom != ::ChainActive()[coinPrev.nHeight])
+        return true;
+
+    if(pindexPrev->nHeight + 1 - coinPrev.nHeight < COINBASE_MATURITY)
+        return error("CheckHeaderKernel(): Coin not matured");
+
+    uint256 hashProofOfStake, targetProofOfStake;
+    return CheckStakeKernelHash(pindexPrev, block.nBits, blockFrom->nTime, coinPrev.out.nValue, block.prevoutStake,
+                                block.StakeTime(), hashProofOfStake, targetProofOfStake);
+}
+
 bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, uint32_t nTimeBlock, const COutPoint& prevout, CCoinsViewCache& view)
 {
-    std::map<COutPoint, CStakeCache> tmp;
+    CStakeCacheMap tmp;
     return CheckKernel(pindexPrev, nBits, nTimeBlock, prevout, view, tmp);
 }
 
-bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, uint32_t nTimeBlock, const COutPoint& prevout, CCoinsViewCache& view, const std::map<COutPoint, CStakeCache>& cache)
+bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, uint32_t nTimeBlock, const COutPoint& prevout, CCoinsViewCache& view, const CStakeCacheMap& cache)
 {
     uint256 hashProofOfStake, targetProofOfStake;
-    auto it=cache.find(prevout);
-    if(it == cache.end()) {
+    const CStakeCache* pstake = cache.Find(prevout);
+    if(!pstake) {
         //not found in cache (shouldn't happen during staking, only during verification which does not use cache)
         Coin coinPrev;
         if(!view.GetCoin(prevout, coinPrev)){
@@ -257,7 +304,7 @@ bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, uint32_t nTimeBloc
                                     nTimeBlock, hashProofOfStake, targetProofOfStake);
     }else{
         //found in cache
-        const CStakeCache& stake = it->second;
+        const CStakeCache& stake = *pstake;
         if(CheckStakeKernelHash(pindexPrev, nBits, stake.blockFromTime, stake.amount, prevout,
                                     nTimeBlock, hashProofOfStake, targetProofOfStake)){
             //Cache could potentially cause false positive stakes in the event of deep reorgs, so check without cache also
@@ -267,8 +314,8 @@ bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, uint32_t nTimeBloc
     return false;
 }
 
-void CacheKernel(std::map<COutPoint, CStakeCache>& cache, const COutPoint& prevout, CBlockIndex* pindexPrev, CCoinsViewCache& view){
-    if(cache.find(prevout) != cache.end()){
+void CacheKernel(CStakeCacheMap& cache, const COutPoint& prevout, CBlockIndex* pindexPrev, CCoinsViewCache& view){
+    if(cache.Find(prevout)){
         //already in cache
         return;
     }
@@ -278,16 +325,124 @@ void CacheKernel(std::map<COutPoint, CStakeCache>& cache, const COutPoint& prevo
         return;
     }
 
-    if(pindexPrev->nHeight + 1 - coinPrev.nHeight < COINBASE_MATURITY){
-        return;
-    }
+    // Immature coins are cached too, the block time and amount do not change until the block is disconnected
     CBlockIndex* blockFrom = pindexPrev->GetAncestor(coinPrev.nHeight);
     if(!blockFrom) {
         return;
     }
 
-    CStakeCache c(blockFrom->nTime, coinPrev.out.nValue);
-    cache.insert({prevout, c});
+    cache.Add(prevout, CStakeCache(blockFrom->nTime, coinPrev.out.nValue, coinPrev.nHeight));
+}
+
+const CStakeCache* CStakeCacheMap::Find(const COutPoint& prevout) const
+{
+    auto it = index.find(prevout);
+    if(it == index.end())
+        return nullptr;
+    return &entries[it->second].second;
+}
+
+void CStakeCacheMap::Add(const COutPoint& prevout, const CStakeCache& stake)
+{
+    auto it = index.find(prevout);
+    if(it != index.end()) {
+        entries[it->second].second = stake;
+        return;
+    }
+    index.emplace(prevout, entries.size());
+    entries.emplace_back(prevout, stake);
+}
+
+void CStakeCacheMap::Remove(const COutPoint& prevout)
+{
+    auto it = index.find(prevout);
+    if(it == index.end())
+        return;
+    size_t pos = it->second;
+    index.erase(it);
+    if(pos != entries.size() - 1) {
+        entries[pos] = std::move(entries.back());
+        index[entries[pos].first] = pos;
+    }
+    entries.pop_back();
+}
+
+void CStakeCacheMap::Clear()
+{
+    entries.clear();
+    index.clear();
+}
+
+CSpentCoinsCache g_spent_coins;
+
+void CSpentCoinsCache::ConnectBlock(const CBlockIndex* pindex, const CBlock& block, const CBlockUndo& blockundo)
+{
+    // a block connected again at the same height replaces the previous one
+    auto it = blocks.find(pindex->nHeight);
+    if(it != blocks.end())
+        EraseBlock(it);
+
+    auto& entry = blocks[pindex->nHeight];
+    entry.first = pindex->GetBlockHash();
+    for(size_t j = 1; j < block.vtx.size() && j - 1 < blockundo.vtxundo.size(); ++j) {
+        const CTransaction& tx = *block.vtx[j];
+        const CTxUndo& txundo = blockundo.vtxundo[j - 1]; // no vtxundo for coinbase
+        for(size_t k = 0; k < tx.vin.size() && k < txundo.vprevout.size(); ++k) {
+            spent[tx.vin[k].prevout] = std::make_pair(pindex->nHeight, txundo.vprevout[k]);
+            entry.second.push_back(tx.vin[k].prevout);
+        }
+    }
+
+    // only forks from the last COINBASE_MATURITY blocks are checked against the main chain
+    while(!blocks.empty() && blocks.begin()->first <= pindex->nHeight - COINBASE_MATURITY)
+        EraseBlock(blocks.begin());
+}
+
+void CSpentCoinsCache::DisconnectBlock(const CBlockIndex* pindex)
+{
+    auto it = blocks.find(pindex->nHeight);
+    if(it != blocks.end() && it->second.first == pindex->GetBlockHash())
+        EraseBlock(it);
+}
+
+bool CSpentCoinsCache::HasBlock(const CBlockIndex* pindex) const
+{
+    auto it = blocks.find(pindex->nHeight);
+    return it != blocks.end() && it->second.first == pindex->GetBlockHash();
+}
+
+bool CSpentCoinsCache::GetSpentCoin(const CBlockIndex* pindex, const COutPoint& prevout, Coin& coin) const
+{
+    auto it = spent.find(prevout);
+    if(it == spent.end() || it->second.first != pindex->nHeight || !HasBlock(pindex))
+        return false;
+    coin = it->second.second;
+    return true;
+}
+
+bool CSpentCoinsCache::Find(const COutPoint& prevout, Coin& coin) const
+{
+    auto it = spent.find(prevout);
+    if(it == spent.end())
+        return false;
+    coin = it->second.second;
+    return true;
+}
+
+void CSpentCoinsCache::Clear()
+{
+    spent.clear();
+    blocks.clear();
+}
+
+void CSpentCoinsCache::EraseBlock(std::map<int, std::pair<uint256, std::vector<COutPoint> > >::iterator it)
+{
+    for(const COutPoint& prevout : it->second.second) {
+        auto itSpent = spent.find(prevout);
+        if(itSpent != spent.end() && itSpent->second.first == it->first)
+            spent.erase(itSpent);
+    }
+    blocks.erase(it);
 }
 
 /**
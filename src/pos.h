@@ -21,13 +21,73 @@
 static const uint32_t STAKE_TIMESTAMP_MASK = 15;
 
 struct CStakeCache{
-    CStakeCache(uint32_t blockFromTime_, CAmount amount_) : blockFromTime(blockFromTime_), amount(amount_){
+    CStakeCache(uint32_t blockFromTime_, CAmount amount_, int nHeight_ = 0) : blockFromTime(blockFromTime_), amount(amount_), nHeight(nHeight_){
     }
     uint32_t blockFromTime;
     CAmount amount;
+    int nHeight;
 };
 
-void CacheKernel(std::map<COutPoint, CStakeCache>& cache, const COutPoint& prevout, CBlockIndex* pindexPrev, CCoinsViewCache& view);
+/**
+ * Stake kernel data of the wallet coins, kept in a flat array so that the kernel search walks
+ * contiguous memory. Entries are added and removed as blocks are connected and disconnected,
+ * removal moves the last entry into the freed slot.
+ */
+class CStakeCacheMap{
+public:
+    typedef std::vector<std::pair<COutPoint, CStakeCache> >::const_iterator const_iterator;
+
+    const CStakeCache* Find(const COutPoint& prevout) const;
+    void Add(const COutPoint& prevout, const CStakeCache& stake);
+    void Remove(const COutPoint& prevout);
+    void Clear();
+    size_t Size() const { return entries.size(); }
+    const_iterator begin() const { return entries.begin(); }
+    const_iterator end() const { return entries.end(); }
+
+private:
+    std::vector<std::pair<COutPoint, CStakeCache> > entries;
+    std::unordered_map<COutPoint, size_t, SaltedOutpointHasher> index;
+};
+
+void CacheKernel(CStakeCacheMap& cache, const COutPoint& prevout, CBlockIndex* pindexPrev, CCoinsViewCache& view);
+
+class CBlockUndo;
+
+/**
+ * Coins spent by the last COINBASE_MATURITY blocks of the active chain, with the block that spent them.
+ * A stake on a fork may spend a coin that the main chain spent after the fork, the cache finds that coin
+ * without reading the blocks and undo data back to the fork from disk. Used under cs_main.
+ */
+class CSpentCoinsCache{
+public:
+    /** Add the coins spent by a connected block, blocks that fall out of the window are dropped */
+    void ConnectBlock(const CBlockIndex* pindex, const CBlock& block, const CBlockUndo& blockundo);
+    void DisconnectBlock(const CBlockIndex* pindex);
+
+    /** Whether the spent coins of the block are in the cache, otherwise they have to be read from disk */
+    bool HasBlock(const CBlockIndex* pindex) const;
+
+    /** Find a coin spent by the block, false if the block did not spend it or is not in the cache */
+    bool GetSpentCoin(const CBlockIndex* pindex, const COutPoint& prevout, Coin& coin) const;
+
+    /** Find a coin spent by any of the blocks in the cache */
+    bool Find(const COutPoint& prevout, Coin& coin) const;
+
+    void Clear();
+    size_t Size() const { return spent.size(); }
+
+private:
+    void EraseBlock(std::map<int, std::pair<uint256, std::vector<COutPoint> > >::iterator it);
+
+    //! Spent coin and the height of the block that spent it
+    std::unordered_map<COutPoint, std::pair<int, Coin>, SaltedOutpointHasher> spent;
+    //! Hash and spent prevouts of the blocks in the cache by height
+    std::map<int, std::pair<uint256, std::vector<COutPoint> > > blocks;
+};
+
+/** Coins spent by the recent blocks of the active chain, fed from ConnectBlock */
+extern CSpentCoinsCache g_spent_coins;
 
 // Compute the hash modifier for proof-of-stake
 uint256 ComputeStakeModifier(const CBlockIndex* pindexPrev, const uint256& kernel);
@@ -36,10 +96,27 @@ uint256 ComputeStakeModifier(const CBlockIndex* pindexPrev, const uint256& kerne
 // Sets hashProofOfStake on success return
 bool CheckStakeKernelHash(CBlockIndex* pindexPrev, unsigned int nBits, uint32_t blockFromTime, CAmount prevoutAmount, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, uint256& targetProofOfStake, bool fPrintProofOfStake=false);
 
+// Stake modifier and base target shared by all the kernels checked for one block timestamp
+struct CStakeKernelSlot{
+    CStakeKernelSlot(const CBlockIndex* pindexPrev, unsigned int nBits, uint32_t nTimeBlock);
+    uint256 nStakeModifier;
+    unsigned int nBits;
+    arith_uint256 bnTargetBase;
+    uint32_t nTimeBlock;
+};
+
+// Check whether stake kernel meets hash target, without logging
+// Used when searching for a kernel, the found kernel is checked again by CheckKernel
+bool CheckStakeKernelHash(const CStakeKernelSlot& slot, uint32_t blockFromTime, CAmount prevoutAmount, const COutPoint& prevout);
+
 // Check kernel hash target and coinstake signature
 // Sets hashProofOfStake on success return
 bool CheckProofOfStake(CBlockIndex* pindexPrev, CValidationState& state, const CTransaction& tx, unsigned int nBits, uint32_t nTimeBlock, uint256& hashProofOfStake, uint256& targetProofOfStake, CCoinsViewCache& view);
 
+// Check the kernel hash of a proof-of-stake header whose stake coin was created by a block of the active chain
+// Headers with an unknown coin pass, their stake is checked with the block
+bool CheckHeaderKernel(CBlockIndex* pindexPrev, const CBlockHeader& block, CCoinsViewCache& view);
+
 // Check whether the coinstake timestamp meets protocol
 bool CheckCoinStakeTimestamp(uint32_t nTimeBlock);
 
@@ -54,7 +131,7 @@ bool CheckRecoveredPubKeyFromBlockSignature(CBlockIndex* pindexPrev, const CBloc
 // Also checks existence of kernel input and min age
 // Convenient for searching a kernel
 bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, uint32_t nTimeBlock, const COutPoint& prevout, CCoinsViewCache& view);
-bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, uint32_t nTimeBlock, const COutPoint& prevout, CCoinsViewCache& view, const std::map<COutPoint, CStakeCache>& cache);
+bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, uint32_t nTimeBlock, const COutPoint& prevout, CCoinsViewCache& view, const CStakeCacheMap& cache);
 
 unsigned int GetStakeMaxCombineInputs();
 
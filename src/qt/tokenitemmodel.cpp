@@ -88,6 +88,11 @@ private Q_SLOTS:
             // Find the token tx in the wallet
             tokenInfo = walletModel->wallet().getToken(tokenHash);
             found = tokenInfo.hash == tokenHash;
+
+            // The wallet adds the events of the blocks connected after the token was synced
+            if(found && tokenInfo.block_number == toBlock && tokenInfo.block_hash == blockHash)
+                return;
+
             if(found)
             {
                 // Get the start location for search the event log
@@ -146,6 +151,14 @@ private Q_SLOTS:
 
     void updateBalance(QString hash, QString contractAddress, QString senderAddress)
     {
+        // The wallet keeps the balance until the storage of the token contract changes
+        uint256 balance;
+        if(walletModel->wallet().getTokenBalance(uint256S(hash.toStdString()), balance))
+        {
+            Q_EMIT balanceChanged(hash, QString::fromStdString(uintTou256(balance).str()));
+            return;
+        }
+
         tokenAbi.setAddress(contractAddress.toStdString());
         tokenAbi.setSender(senderAddress.toStdString());
         std::string strBalance;
@@ -0,0 +1,330 @@
+#include <qtum/flatstate.h>
+#include <logging.h>
+#include <util/system.h>
+
+#include <libdevcore/RLP.h>
+#include <libdevcore/SHA3.h>
+
+#include <functional>
+#include <stdexcept>
+
+static const char DB_ROOT = 'R';
+static const char DB_ACCOUNT = 'a';
+static const char DB_STORAGE = 's';
+
+//! Changes written per batch when a large diff is applied
+static const size_t FLATSTATE_BATCH_SIZE = 16 << 20;
+
+namespace {
+
+const dev::h256 EMPTY_TRIE = dev::sha3(dev::rlp(""));
+
+uint256 ToKey(const dev::h256& hash){
+    return uint256(hash.asBytes());
+}
+
+dev::h256 FromKey(const uint256& key){
+    return dev::h256(key.begin(), dev::h256::ConstructFromPointer);
+}
+
+dev::h256 StorageRoot(const dev::bytes& account){
+    return account.empty() ? EMPTY_TRIE : dev::RLP(account)[2].toHash<dev::h256>();
+}
+
+/** Position in a trie reached by following a path one nibble at a time */
+struct TrieCursor
+{
+    //! Node the cursor is in, loaded when it is needed
+    std::shared_ptr<const dev::bytes> node;
+    //! Hash of the node when the cursor is at its start and the node is stored by hash
+    dev::h256 hash;
+    //! Nibbles of the path of an extension or leaf node that were already followed
+    size_t offset = 0;
+
+    bool IsNull() const { return !node && !hash; }
+};
+
+/** Leaf values that differ between two tries, visiting only the subtrees whose hashes differ */
+class TrieDiff
+{
+public:
+    typedef std::function<void(const dev::h256&, const dev::bytes&, const dev::bytes&)> Handler;
+
+    explicit TrieDiff(const dev::OverlayDB& _db) : db(_db) {}
+
+    /** Calls handler with the key, old and new value of every changed leaf, a missing leaf has an empty value */
+    void Diff(const dev::h256& rootOld, const dev::h256& rootNew, const Handler& handler) const
+    {
+        if(rootOld == rootNew)
+            return;
+        std::vector<uint8_t> path;
+        Walk(Reference(rootOld), Reference(rootNew), path, handler);
+    }
+
+private:
+    TrieCursor Reference(const dev::h256& hash) const
+    {
+        TrieCursor cursor;
+        if(hash != EMPTY_TRIE)
+            cursor.hash = hash;
+        return cursor;
+    }
+
+    TrieCursor Reference(const dev::RLP& ref) const
+    {
+        // nodes shorter than a hash are embedded in their parent
+        if(ref.isList()){
+            TrieCursor cursor;
+            cursor.node = std::make_shared<const dev::bytes>(ref.data().toBytes());
+            return cursor;
+        }
+        if(ref.isEmpty())
+            return TrieCursor();
+        return Reference(ref.toHash<dev::h256>());
+    }
+
+    void Load(TrieCursor& cursor) const
+    {
+        if(cursor.node)
+            return;
+        std::string node = db.lookup(cursor.hash);
+        if(node.empty())
+            throw std::runtime_error("missing trie node " + cursor.hash.hex());
+        cursor.node = std::make_shared<const dev::bytes>(node.begin(), node.end());
+    }
+
+    void Expand(TrieCursor cursor, std::vector<TrieCursor>& children, dev::bytes& value) const
+    {
+        children.assign(16, TrieCursor());
+        value.clear();
+        if(cursor.IsNull())
+            return;
+        Load(cursor);
+        dev::RLP node(*cursor.node);
+        if(node.isList() && node.itemCount() == 17){
+            for(unsigned int i = 0; i < 16; i++)
+                children[i] = Reference(node[i]);
+            if(!node[16].isEmpty())
+                value = node[16].toBytes();
+            return;
+        }
+        if(!node.isList() || node.itemCount() != 2 || !node[0].isData() || node[0].isEmpty())
+            throw std::runtime_error("malformed trie node");
+
+        // hex prefix encoding, the first nibble holds the flags and an even path is padded with a zero nibble
+        dev::bytes prefix = node[0].toBytes();
+        bool fLeaf = prefix[0] & 0x20;
+        size_t nStart = (prefix[0] & 0x10) ? 1 : 2;
+        size_t nNibbles = prefix.size() * 2 - nStart;
+        if(cursor.offset < nNibbles){
+            size_t pos = nStart + cursor.offset;
+            uint8_t nibble = (prefix[pos / 2] >> (pos % 2 ? 0 : 4)) & 0x0f;
+            children[nibble].node = cursor.node;
+            children[nibble].offset = cursor.offset + 1;
+            return;
+        }
+        if(fLeaf){
+            value = node[1].toBytes();
+            return;
+        }
+        Expand(Reference(node[1]), children, value);
+    }
+
+    void Walk(TrieCursor a, TrieCursor b, std::vector<uint8_t>& path, const Handler& handler) const
+    {
+        if(a.IsNull() && b.IsNull())
+            return;
+        if(a.offset == 0 && b.offset == 0 && a.hash && a.hash == b.hash)
+            return;
+        if(!a.IsNull() && !b.IsNull() && a.offset == b.offset){
+            Load(a);
+            Load(b);
+            if(*a.node == *b.node)
+                return;
+        }
+
+        std::vector<TrieCursor> childrenA, childrenB;
+        dev::bytes valueA, valueB;
+        Expand(a, childrenA, valueA);
+        Expand(b, childrenB, valueB);
+        if(valueA != valueB){
+            // the secure tries are keyed by hashes, so every leaf is at the end of a 64 nibble path
+            if(path.size() != 64)
+                throw std::runtime_error("unexpected trie key length");
+            dev::h256 key;
+            for(size_t i = 0; i < 32; i++)
+                key[i] = (path[i * 2] << 4) | path[i * 2 + 1];
+            handler(key, valueA, valueB);
+        }
+        for(uint8_t i = 0; i < 16; i++){
+            if(childrenA[i].IsNull() && childrenB[i].IsNull())
+                continue;
+            path.push_back(i);
+            Walk(childrenA[i], childrenB[i], path, handler);
+            path.pop_back();
+        }
+    }
+
+    const dev::OverlayDB& db;
+};
+
+}
+
+FlatState::FlatState(const fs::path& _path, bool fWipe) : path(_path), hashStateRoot(EMPTY_TRIE)
+{
+    db.reset(new CDBWrapper(path, FLATSTATE_CACHE_SIZE, false, fWipe));
+    uint256 root;
+    if(db->Read(DB_ROOT, root)){
+        hashStateRoot = FromKey(root);
+    } else if(!db->IsEmpty()){
+        // an update was interrupted
+        Wipe();
+    }
+}
+
+FlatState::~FlatState()
+{
+    StopRebuild();
+}
+
+void FlatState::Wipe()
+{
+    db.reset();
+    db.reset(new CDBWrapper(path, FLATSTATE_CACHE_SIZE, false, true));
+}
+
+void FlatState::StopRebuild()
+{
+    fInterrupt = true;
+    if(rebuildThread.joinable())
+        rebuildThread.join();
+    fInterrupt = false;
+}
+
+bool FlatState::Sync(const dev::OverlayDB& stateDB, const dev::h256& root)
+{
+    // readers wait for the diff, a read never sees the copy between two roots
+    LOCK(cs);
+    if(fRebuilding || !hashStateRoot)
+        return false;
+    if(root == hashStateRoot)
+        return true;
+    bool fApplied = Apply(stateDB, hashStateRoot, root);
+    // a diff that failed part way leaves the copy somewhere between the two roots
+    hashStateRoot = fApplied ? root : dev::h256();
+    return fApplied;
+}
+
+void FlatState::StartRebuild(std::shared_ptr<const dev::OverlayDB> stateDB, const dev::h256& root)
+{
+    StopRebuild();
+    {
+        LOCK(cs);
+        hashStateRoot = dev::h256();
+        fRebuilding = true;
+    }
+    LogPrintf("%s: rebuilding the flat state for root %s in the background\n", __func__, root.hex());
+    rebuildThread = std::thread(&TraceThread<std::function<void()>>, "flatstate", std::function<void()>(std::bind(&FlatState::Rebuild, this, stateDB, root)));
+}
+
+void FlatState::Rebuild(std::shared_ptr<const dev::OverlayDB> stateDB, const dev::h256& root)
+{
+    // the nodes of the previous root can be gone after -prunestate, build the copy from the new root
+    Wipe();
+    bool fBuilt = Apply(*stateDB, EMPTY_TRIE, root);
+    if(fBuilt)
+        LogPrintf("%s: rebuilt the flat state for root %s\n", __func__, root.hex());
+    LOCK(cs);
+    hashStateRoot = fBuilt ? root : dev::h256();
+    fRebuilding = false;
+}
+
+bool FlatState::IsRebuilding() const
+{
+    LOCK(cs);
+    return fRebuilding;
+}
+
+dev::h256 FlatState::GetRoot() const
+{
+    LOCK(cs);
+    return hashStateRoot;
+}
+
+bool FlatState::Apply(const dev::OverlayDB& stateDB, const dev::h256& rootOld, const dev::h256& root)
+{
+    TrieDiff diff(stateDB);
+    CDBBatch batch(*db);
+    auto flush = [&]() {
+        if(fInterrupt)
+            throw std::runtime_error("interrupted");
+        if(batch.SizeEstimate() < FLATSTATE_BATCH_SIZE)
+            return;
+        // without a root the copy is rebuilt when the update does not complete
+        batch.Erase(DB_ROOT);
+        db->WriteBatch(batch);
+        batch.Clear();
+    };
+
+    try {
+        diff.Diff(rootOld, root, [&](const dev::h256& hashedAddress, const dev::bytes& accountOld, const dev::bytes& accountNew){
+            if(accountNew.empty())
+                batch.Erase(std::make_pair(DB_ACCOUNT, ToKey(hashedAddress)));
+            else
+                batch.Write(std::make_pair(DB_ACCOUNT, ToKey(hashedAddress)), accountNew);
+
+            diff.Diff(StorageRoot(accountOld), StorageRoot(accountNew), [&](const dev::h256& hashedKey, const dev::bytes&, const dev::bytes& valueNew){
+                auto key = std::make_pair(DB_STORAGE, std::make_pair(ToKey(hashedAddress), ToKey(hashedKey)));
+                if(valueNew.empty())
+                    batch.Erase(key);
+                else
+                    batch.Write(key, std::make_pair(stateDB.lookupAux(hashedKey), valueNew));
+                flush();
+            });
+            flush();
+        });
+    } catch(const std::exception& e) {
+        LogPrintf("%s: unable to diff %s and %s: %s\n", __func__, rootOld.hex(), root.hex(), e.what());
+        return false;
+    }
+
+    batch.Write(DB_ROOT, ToKey(root));
+    return db->WriteBatch(batch);
+}
+
+bool FlatState::ReadAccount(const dev::h256& root, const dev::Address& address, FlatAccount& account) const
+{
+    LOCK(cs);
+    if(!root || root != hashStateRoot)
+        return false;
+    dev::bytes value;
+    if(!db->Read(std::make_pair(DB_ACCOUNT, ToKey(dev::sha3(address))), value))
+        return false;
+    dev::RLP rlp(value);
+    account.nonce = rlp[0].toInt<dev::u256>();
+    account.balance = rlp[1].toInt<dev::u256>();
+    account.storageRoot = rlp[2].toHash<dev::h256>();
+    account.codeHash = rlp[3].toHash<dev::h256>();
+    return true;
+}
+
+bool FlatState::ReadStorage(const dev::h256& root, const dev::Address& address, std::map<dev::h256, std::pair<dev::u256, dev::u256>>& storage) const
+{
+    LOCK(cs);
+    if(!root || root != hashStateRoot)
+        return false;
+    uint256 hashedAddress = ToKey(dev::sha3(address));
+    std::unique_ptr<CDBIterator> it(db->NewIterator());
+    it->Seek(std::make_pair(DB_STORAGE, std::make_pair(hashedAddress, uint256())));
+    for(; it->Valid(); it->Next()){
+        std::pair<char, std::pair<uint256, uint256>> key;
+        if(!it->GetKey(key) || key.first != DB_STORAGE || key.second.first != hashedAddress)
+            break;
+        std::pair<dev::bytes, dev::bytes> value;
+        if(!it->GetValue(value))
+            return false;
+        // the slot is the preimage kept next to the trie, as in dev::eth::State::storage
+        storage[FromKey(key.second.second)] = std::make_pair(dev::u256(dev::h256(value.first)), dev::RLP(value.second).toInt<dev::u256>());
+    }
+    return true;
+}
@@ -0,0 +1,88 @@
+#ifndef QTUM_FLATSTATE_H
+#define QTUM_FLATSTATE_H
+
+#include <dbwrapper.h>
+#include <fs.h>
+#include <sync.h>
+#include <libdevcore/Address.h>
+#include <libdevcore/OverlayDB.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <thread>
+
+/** Default for -flatstate */
+static const bool DEFAULT_FLATSTATE = false;
+
+/** Cache of the flat state database, in bytes */
+static const size_t FLATSTATE_CACHE_SIZE = 8 << 20;
+
+/** Contract account as stored in the account trie */
+struct FlatAccount
+{
+    dev::u256 nonce;
+    dev::u256 balance;
+    dev::h256 storageRoot;
+    dev::h256 codeHash;
+};
+
+/**
+ * Flat copy of the contract account and storage tries, keyed by the hashed address and hashed storage slot
+ * that are the paths in the tries. An account is a single lookup and the storage of a contract is one range
+ * scan, instead of a walk from the state root through the trie nodes.
+ *
+ * The copy follows globalState by diffing the account trie between the root it reflects and the new root.
+ * Subtrees with equal hashes are skipped, so the work is proportional to the changes, and disconnecting a
+ * block is the same diff in the other direction. QtumState loads the accounts a transaction starts from
+ * out of the copy, the storage slots the EVM reads and the accounts it reaches through calls come from the trie.
+ *
+ * Reads name the state root they expect and fail when the copy reflects another root, the reader then uses
+ * the trie. When a diff can not be applied the copy is stale until a rebuild, which runs in its own thread
+ * on its own view of the state database, completes. The calls that update the copy or start a rebuild are
+ * serialized by the caller (cs_main), reads can come from any thread.
+ */
+class FlatState
+{
+public:
+    FlatState(const fs::path& path, bool fWipe = false);
+    ~FlatState();
+
+    /** Bring the copy to the state at root by applying the changes since the root it reflects, the trie nodes of both roots must be in stateDB */
+    bool Sync(const dev::OverlayDB& stateDB, const dev::h256& root);
+
+    /** Discard the copy and build it for root in the background, stateDB is only used by the rebuild thread */
+    void StartRebuild(std::shared_ptr<const dev::OverlayDB> stateDB, const dev::h256& root);
+
+    bool IsRebuilding() const;
+
+    /** State root the copy reflects, null while the copy is stale */
+    dev::h256 GetRoot() const;
+
+    /** Read an account of the state at root, false if the copy does not reflect root or the account does not exist */
+    bool ReadAccount(const dev::h256& root, const dev::Address& address, FlatAccount& account) const;
+
+    /** Storage of a contract at root in the format of dev::eth::State::storage, false if the copy does not reflect root */
+    bool ReadStorage(const dev::h256& root, const dev::Address& address, std::map<dev::h256, std::pair<dev::u256, dev::u256>>& storage) const;
+
+private:
+    bool Apply(const dev::OverlayDB& stateDB, const dev::h256& rootOld, const dev::h256& root);
+
+    void Rebuild(std::shared_ptr<const dev::OverlayDB> stateDB, const dev::h256& root);
+
+    void Wipe();
+
+    void StopRebuild();
+
+    fs::path path;
+    std::unique_ptr<CDBWrapper> db;
+
+    mutable Mutex cs;
+    dev::h256 hashStateRoot GUARDED_BY(cs);
+    bool fRebuilding GUARDED_BY(cs) = false;
+
+    std::thread rebuildThread;
+    std::atomic<bool> fInterrupt{false};
+};
+
+#endif // QTUM_FLATSTATE_H
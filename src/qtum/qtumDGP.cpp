@@ -255,10 +255,10 @@ dev::Address QtumDGP::getGovernanceWinner(unsigned int blockHeight){
 }
 
 bool QtumDGP::initStorages(const dev::Address& addr, unsigned int blockHeight, std::vector<unsigned char> data, uint64_t defaultGasLimit){
-    initStorageDGP(addr);
     // metrix DGP contract address does not change so no need to check for it every time
     if(blockHeight > 0){
         if(!dgpevm){
+            initStorageDGP(addr);
             initStorageTemplate(addr);
         } else {
             initDataTemplate(addr, data, defaultGasLimit);
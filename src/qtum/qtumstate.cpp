@@ -3,6 +3,7 @@
 #include <validation.h>
 #include <chainparams.h>
 #include <qtum/qtumstate.h>
+#include <qtum/flatstate.h>
 
 using namespace std;
 using namespace dev;
@@ -19,10 +20,20 @@ QtumState::QtumState() : dev::eth::State(dev::Invalid256, dev::OverlayDB(), dev:
     stateUTXO = SecureTrieDB<Address, OverlayDB>(&dbUTXO);
 }
 
+QtumState::QtumState(QtumState const& _state, h256 const& _stateRoot, h256 const& _utxoRoot) :
+        State(_state), dbUTXO(_state.dbUTXO), stateUTXO(&dbUTXO), flatState(_state.flatState) {
+    setRoot(_stateRoot);
+    stateUTXO.setRoot(_utxoRoot);
+}
+
 ResultExecute QtumState::execute(EnvInfo const& _envInfo, SealEngineFace const& _sealEngine, QtumTransaction const& _t, Permanence _p, OnOpFunc const& _onOp){
 
     assert(_t.getVersion().toRaw() == VersionVM::GetEVMDefault().toRaw());
 
+    loadFlatAccount(_t.sender());
+    if(!_t.isCreation())
+        loadFlatAccount(_t.receiveAddress());
+    loadFlatAccount(_envInfo.author());
     addBalance(_t.sender(), _t.value() + (_t.gas() * _t.gasPrice()));
     newAddress = _t.isCreation() ? createQtumAddress(_t.getHashWith(), _t.getNVout()) : dev::Address();
 
@@ -48,6 +59,10 @@ ResultExecute QtumState::execute(EnvInfo const& _envInfo, SealEngineFace const&
     CTransactionRef tx;
     u256 startGasUsed;
     const Consensus::Params& consensusParams = Params().GetConsensus();
+    // Fork rules follow the block the environment builds on rather than the
+    // active tip, so calls against a snapshot or an older block need no cs_main
+    // and see the rules that were in force at that block.
+    const int64_t nHeight = _envInfo.number() - 1;
     try{
         if (_t.isCreation() && _t.value())
             BOOST_THROW_EXCEPTION(CreateWithValue());
@@ -57,7 +72,7 @@ ResultExecute QtumState::execute(EnvInfo const& _envInfo, SealEngineFace const&
         startGasUsed = _envInfo.gasUsed();
         if (!e.execute()){
             e.go(onOp);
-            if(ChainActive().Height() >= consensusParams.QIP7Height){
+            if(nHeight >= consensusParams.QIP7Height){
             	validateTransfersWithChangeLog();
             }
         } else {
@@ -84,6 +99,11 @@ ResultExecute QtumState::execute(EnvInfo const& _envInfo, SealEngineFace const&
                 printfErrorLog(res.excepted);
             }
 
+            // The account cache is committed into the tries after every transaction, it can not be carried over
+            // to the next one: a failed transaction below commits or clears the whole cache rather than rolling back
+            // to a savepoint (the change log is only rolled back within an Executive), empty accounts are removed per
+            // transaction, and the original values of SSTORE net gas metering are read from the committed storage
+            // root. ConnectBlock only defers the database writes of the trie nodes, see ByteCodeExec::deferDBCommit.
             qtum::commit(cacheUTXO, stateUTXO, m_cache);
             cacheUTXO.clear();
             bool removeEmptyAccounts = _envInfo.number() >= _sealEngine.chainParams().EIP158ForkBlock;
@@ -94,7 +114,7 @@ ResultExecute QtumState::execute(EnvInfo const& _envInfo, SealEngineFace const&
         printfErrorLog(dev::eth::toTransactionException(_e));
         res.excepted = dev::eth::toTransactionException(_e);
         res.gasUsed = _t.gas();
-        if(ChainActive().Height() < consensusParams.nFixUTXOCacheHFHeight  && _p != Permanence::Reverted){
+        if(nHeight < consensusParams.nFixUTXOCacheHFHeight  && _p != Permanence::Reverted){
             deleteAccounts(_sealEngine.deleteAddresses);
             commit(CommitBehaviour::RemoveEmptyAccounts);
         } else {
@@ -166,6 +186,38 @@ std::unordered_map<dev::Address, Vin> QtumState::vins() const // temp
     return ret;
 }
 
+bool QtumState::accountStateAvailable(dev::Address const& _addr){
+    try{
+        stateUTXO.at(_addr);
+        if(!addressHasCode(_addr))
+            return true;
+        h256 root = storageRoot(_addr);
+        return (root == EmptyTrie || db().exists(root)) && !code(_addr).empty();
+    }
+    catch(std::exception const&){
+        // a trie node on the path to the account is missing
+        return false;
+    }
+}
+
+bool QtumState::rootsAvailable(dev::h256 const& _stateRoot, dev::h256 const& _utxoRoot) const{
+    return (_stateRoot == EmptyTrie || db().exists(_stateRoot)) && (_utxoRoot == EmptyTrie || dbUTXO.exists(_utxoRoot));
+}
+
+void QtumState::loadFlatAccount(dev::Address const& _addr) const
+{
+    // a cached account can have changes that are not committed, the flat copy only has committed roots
+    if(!flatState || m_cache.count(_addr))
+        return;
+    // the same entry account() would create from the trie, the trie is read when the copy is at another root
+    FlatAccount account;
+    if(!flatState->ReadAccount(rootHash(), _addr, account))
+        return;
+    m_cache.emplace(std::piecewise_construct, std::forward_as_tuple(_addr),
+                    std::forward_as_tuple(account.nonce, account.balance, account.storageRoot, account.codeHash, Account::Unchanged));
+    m_unchangedCacheEntries.push_back(_addr);
+}
+
 void QtumState::transferBalance(dev::Address const& _from, dev::Address const& _to, dev::u256 const& _value) {
     subBalance(_from, _value);
     addBalance(_to, _value);
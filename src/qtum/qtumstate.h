@@ -84,6 +84,7 @@ namespace qtum{
 }
 
 class CondensingTX;
+class FlatState;
 
 class QtumState : public dev::eth::State {
     
@@ -93,6 +94,9 @@ public:
 
     QtumState(dev::u256 const& _accountStartNonce, dev::OverlayDB const& _db, const std::string& _path, dev::eth::BaseState _bs = dev::eth::BaseState::PreExisting);
 
+    /** Independent view of _state positioned at the given roots, the databases are shared */
+    QtumState(QtumState const& _state, dev::h256 const& _stateRoot, dev::h256 const& _utxoRoot);
+
     ResultExecute execute(dev::eth::EnvInfo const& _envInfo, dev::eth::SealEngineFace const& _sealEngine, QtumTransaction const& _t, dev::eth::Permanence _p = dev::eth::Permanence::Committed, dev::eth::OnOpFunc const& _onOp = OnOpFunc());
 
     void setRootUTXO(dev::h256 const& _r) { cacheUTXO.clear(); stateUTXO.setRoot(_r); }
@@ -103,6 +107,15 @@ public:
 
     std::unordered_map<dev::Address, Vin> vins() const; // temp
 
+    /** Whether the account, UTXO, code and storage root of an address can be read from the databases */
+    bool accountStateAvailable(dev::Address const& _addr);
+
+    /** Whether the state and UTXO roots are stored in the databases, a pruned root cannot be set */
+    bool rootsAvailable(dev::h256 const& _stateRoot, dev::h256 const& _utxoRoot) const;
+
+    /** Load the accounts a transaction starts from out of the flat copy of the state when it reflects the root of this state */
+    void setFlatState(FlatState const* _flatState) { flatState = _flatState; }
+
     dev::OverlayDB const& dbUtxo() const { return dbUTXO; }
 
     dev::OverlayDB& dbUtxo() { return dbUTXO; }
@@ -132,6 +145,8 @@ private:
 
     void transferBalance(dev::Address const& _from, dev::Address const& _to, dev::u256 const& _value);
 
+    void loadFlatAccount(dev::Address const& _addr) const;
+
     Vin const* vin(dev::Address const& _a) const;
 
     Vin* vin(dev::Address const& _addr);
@@ -158,6 +173,8 @@ private:
 
 	std::unordered_map<dev::Address, Vin> cacheUTXO;
 
+    FlatState const* flatState = nullptr;
+
 	void validateTransfersWithChangeLog();
 };
 
@@ -0,0 +1,204 @@
+#include <qtum/stateprune.h>
+#include <logging.h>
+#include <util/strencodings.h>
+
+#include <libdevcore/RLP.h>
+#include <libdevcore/SHA3.h>
+
+#include <leveldb/db.h>
+#include <leveldb/write_batch.h>
+
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+//! Deletions written per batch when sweeping a database
+static const size_t PRUNE_BATCH_SIZE = 16 << 20;
+
+namespace {
+
+/** Node and code hashes reachable from the kept roots of one database */
+class StateMarker
+{
+public:
+    explicit StateMarker(leveldb::DB* _db) : db(_db) { marked.insert(emptyTrie); }
+
+    /** Marks every node of the trie at root, for the account trie also the storage trie and code of each account */
+    bool Mark(const dev::h256& root, bool fAccounts)
+    {
+        std::vector<std::pair<dev::h256, bool>> pending{{root, fAccounts}};
+        while(!pending.empty()){
+            dev::h256 hash = pending.back().first;
+            bool fAccountTrie = pending.back().second;
+            pending.pop_back();
+            // the empty trie is always kept and not necessarily stored
+            if(!marked.insert(hash).second)
+                continue;
+            std::string node;
+            if(!db->Get(leveldb::ReadOptions(), leveldb::Slice((const char*)hash.data(), hash.size), &node).ok()){
+                LogPrintf("%s: missing trie node %s\n", __func__, hash.hex());
+                return false;
+            }
+            if(!VisitNode(dev::RLP(node), fAccountTrie, pending)){
+                LogPrintf("%s: malformed trie node %s\n", __func__, hash.hex());
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool IsMarked(const dev::h256& hash) const { return marked.count(hash) > 0; }
+
+    bool IsStored(const dev::h256& hash) const
+    {
+        std::string value;
+        return hash == emptyTrie || db->Get(leveldb::ReadOptions(), leveldb::Slice((const char*)hash.data(), hash.size), &value).ok();
+    }
+
+    size_t Size() const { return marked.size(); }
+
+private:
+    bool VisitNode(const dev::RLP& node, bool fAccountTrie, std::vector<std::pair<dev::h256, bool>>& pending)
+    {
+        if(!node.isList())
+            return node.isEmpty();
+        if(node.itemCount() == 17){
+            // keys are hashes of the same length, so branches never carry a value
+            for(unsigned int i = 0; i < 16; i++){
+                if(!VisitChild(node[i], fAccountTrie, pending))
+                    return false;
+            }
+            return true;
+        }
+        if(node.itemCount() != 2 || !node[0].isData() || node[0].isEmpty())
+            return false;
+        // hex prefix encoding of the path, the second flag bit marks a leaf
+        if(node[0].payload()[0] & 0x20){
+            return !fAccountTrie || VisitAccount(dev::RLP(node[1].payload()), pending);
+        }
+        return VisitChild(node[1], fAccountTrie, pending);
+    }
+
+    bool VisitChild(const dev::RLP& child, bool fAccountTrie, std::vector<std::pair<dev::h256, bool>>& pending)
+    {
+        // nodes shorter than a hash are embedded in their parent
+        if(child.isList())
+            return VisitNode(child, fAccountTrie, pending);
+        if(child.isEmpty())
+            return true;
+        if(!child.isData() || child.size() != dev::h256::size)
+            return false;
+        pending.emplace_back(child.toHash<dev::h256>(), fAccountTrie);
+        return true;
+    }
+
+    bool VisitAccount(const dev::RLP& account, std::vector<std::pair<dev::h256, bool>>& pending)
+    {
+        if(!account.isList() || account.itemCount() < 4)
+            return false;
+        pending.emplace_back(account[2].toHash<dev::h256>(), false);
+        // code is stored under its hash next to the nodes
+        marked.insert(account[3].toHash<dev::h256>());
+        return true;
+    }
+
+    leveldb::DB* db;
+    std::unordered_set<dev::h256> marked;
+    const dev::h256 emptyTrie = dev::sha3(dev::rlp(""));
+};
+
+/** Path of the database dev::eth::State::openDB uses for the given base path */
+bool FindStateDatabase(const fs::path& path, fs::path& database)
+{
+    fs::path base = path / dev::toHex(dev::sha3(dev::rlp("")).ref().cropped(0, 4));
+    if(!fs::is_directory(base))
+        return false;
+    std::vector<fs::path> found;
+    for(fs::directory_iterator it(base); it != fs::directory_iterator(); ++it){
+        if(fs::exists(it->path() / "state" / "CURRENT"))
+            found.push_back(it->path() / "state");
+    }
+    // more than one database version, the one in use is unknown
+    if(found.size() != 1)
+        return false;
+    database = found.front();
+    return true;
+}
+
+bool PruneDatabase(const fs::path& path, const std::set<dev::h256>& roots, bool fAccounts)
+{
+    leveldb::Options options;
+    options.create_if_missing = false;
+    leveldb::DB* dbPtr;
+    leveldb::Status status = leveldb::DB::Open(options, path.string(), &dbPtr);
+    if(!status.ok()){
+        LogPrintf("%s: unable to open %s: %s\n", __func__, path.string(), status.ToString());
+        return false;
+    }
+    std::unique_ptr<leveldb::DB> db(dbPtr);
+
+    StateMarker marker(db.get());
+    size_t nRoots = 0;
+    try {
+        for(const dev::h256& root : roots){
+            // blocks of side chains that were never connected have no state
+            if(!marker.IsStored(root))
+                continue;
+            if(!marker.Mark(root, fAccounts))
+                return false;
+            nRoots++;
+        }
+    } catch(const std::exception& e) {
+        LogPrintf("%s: unable to read trie in %s: %s\n", __func__, path.string(), e.what());
+        return false;
+    }
+    if(nRoots == 0){
+        LogPrintf("%s: none of the kept roots are stored in %s\n", __func__, path.string());
+        return false;
+    }
+
+    // every key of the database is a node or code hash, anything else is left alone
+    size_t nErased = 0;
+    size_t nBatchSize = 0;
+    leveldb::WriteBatch batch;
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    for(it->SeekToFirst(); it->Valid(); it->Next()){
+        leveldb::Slice key = it->key();
+        if(key.size() != dev::h256::size)
+            continue;
+        if(marker.IsMarked(dev::h256((const dev::byte*)key.data(), dev::h256::ConstructFromPointer)))
+            continue;
+        batch.Delete(key);
+        nErased++;
+        nBatchSize += key.size();
+        if(nBatchSize > PRUNE_BATCH_SIZE){
+            db->Write(leveldb::WriteOptions(), &batch);
+            batch.Clear();
+            nBatchSize = 0;
+        }
+    }
+    if(!it->status().ok()){
+        LogPrintf("%s: error reading %s: %s\n", __func__, path.string(), it->status().ToString());
+        return false;
+    }
+    it.reset();
+    db->Write(leveldb::WriteOptions(), &batch);
+    db->CompactRange(nullptr, nullptr);
+
+    LogPrintf("%s: kept %u and deleted %u entries of %s\n", __func__, marker.Size(), nErased, path.string());
+    return true;
+}
+
+}
+
+bool PruneContractState(const fs::path& stateDir, const std::set<dev::h256>& stateRoots, const std::set<dev::h256>& utxoRoots)
+{
+    fs::path stateDB, utxoDB;
+    if(!FindStateDatabase(stateDir, stateDB) || !FindStateDatabase(stateDir / "qtumDB", utxoDB)){
+        LogPrintf("%s: contract state databases not found in %s\n", __func__, stateDir.string());
+        return false;
+    }
+    bool fPrunedState = PruneDatabase(stateDB, stateRoots, true);
+    bool fPrunedUTXO = PruneDatabase(utxoDB, utxoRoots, false);
+    return fPrunedState && fPrunedUTXO;
+}
@@ -0,0 +1,24 @@
+#ifndef QTUM_STATEPRUNE_H
+#define QTUM_STATEPRUNE_H
+
+#include <fs.h>
+#include <libdevcore/FixedHash.h>
+
+#include <set>
+
+/** Default for -prunestate, 0 keeps every contract state */
+static const int DEFAULT_PRUNE_STATE = 0;
+
+/** Minimum number of recent blocks whose contract state is kept by -prunestate, deeper reorganizations would need pruned states */
+static const int MIN_STATE_ROOTS_TO_KEEP = 1000;
+
+/**
+ * Mark and sweep garbage collection of the contract state databases in stateDir.
+ * Every trie node and contract code entry of the account database (stateQtum) that is not reachable
+ * from stateRoots, and every node of the UTXO database (qtumDB) that is not reachable from utxoRoots,
+ * is deleted. The databases must not be open, so this runs before globalState is created.
+ * Nothing is deleted from a database when one of its roots or nodes is missing.
+ */
+bool PruneContractState(const fs::path& stateDir, const std::set<dev::h256>& stateRoots, const std::set<dev::h256>& utxoRoots);
+
+#endif // QTUM_STATEPRUNE_H
@@ -1,13 +1,154 @@
 #include <qtum/storageresults.h>
+#include <clientversion.h>
+#include <streams.h>
 #include <util/convert.h>
+#include <util/strencodings.h>
 
-StorageResults::StorageResults(std::string const& _path){
+#include <leveldb/write_batch.h>
+
+static const char DB_RESULT = 'r';
+static const std::string DB_VERSION_KEY = "version";
+
+//! Receipts converted per batch when upgrading the database
+static const size_t UPGRADE_BATCH_SIZE = 16 << 20;
+
+namespace {
+
+//! Receipt flags of the compact encoding
+enum : uint8_t {
+    RECEIPT_SAME_STATE_ROOT = 1 << 0,
+    RECEIPT_SAME_UTXO_ROOT = 1 << 1,
+    RECEIPT_OWN_HEADER = 1 << 2,
+};
+
+//! Log data encodings of the compact encoding
+enum : uint8_t {
+    LOG_DATA_RAW = 0,
+    LOG_DATA_ZERO_RUNS = 1,
+};
+
+template<typename Stream, unsigned N>
+void WriteHash(Stream& s, dev::FixedHash<N> const& h){
+    s.write((const char*)h.data(), N);
+}
+
+template<typename Stream, unsigned N>
+void ReadHash(Stream& s, dev::FixedHash<N>& h){
+    s.read((char*)h.data(), N);
+}
+
+template<typename Stream>
+void WriteBytes(Stream& s, dev::bytes const& b){
+    WriteCompactSize(s, b.size());
+    if(b.size())
+        s.write((const char*)b.data(), b.size());
+}
+
+template<typename Stream>
+void ReadBytes(Stream& s, dev::bytes& b){
+    b.resize(ReadCompactSize(s));
+    if(b.size())
+        s.read((char*)b.data(), b.size());
+}
+
+/** ABI encoded log data is mostly zero padding, store it as literal bytes followed by zero run lengths */
+dev::bytes CompressZeroRuns(dev::bytes const& data){
+    CDataStream s(SER_DISK, CLIENT_VERSION);
+    size_t pos = 0;
+    while(pos < data.size()){
+        size_t literal = pos;
+        while(literal < data.size() && data[literal] != 0)
+            literal++;
+        size_t zeros = literal;
+        while(zeros < data.size() && data[zeros] == 0)
+            zeros++;
+        uint64_t literalSize = literal - pos;
+        uint64_t zerosSize = zeros - literal;
+        s << VARINT(literalSize);
+        s.write((const char*)data.data() + pos, literalSize);
+        s << VARINT(zerosSize);
+        pos = zeros;
+    }
+    return dev::bytes(s.begin(), s.end());
+}
+
+bool DecompressZeroRuns(dev::bytes const& compressed, uint64_t size, dev::bytes& data){
+    if(size > MAX_SIZE)
+        return false;
+    CDataStream s((const char*)compressed.data(), (const char*)compressed.data() + compressed.size(), SER_DISK, CLIENT_VERSION);
+    data.clear();
+    data.reserve(size);
+    while(!s.empty()){
+        uint64_t literalSize = 0, zerosSize = 0;
+        s >> VARINT(literalSize);
+        if(literalSize > size - data.size() || literalSize > s.size())
+            return false;
+        data.insert(data.end(), s.begin(), s.begin() + literalSize);
+        s.ignore(literalSize);
+        s >> VARINT(zerosSize);
+        if(zerosSize > size - data.size())
+            return false;
+        data.resize(data.size() + zerosSize, 0);
+    }
+    return data.size() == size;
+}
+
+template<typename Stream>
+void WriteLogData(Stream& s, dev::bytes const& data){
+    dev::bytes compressed = CompressZeroRuns(data);
+    if(compressed.size() < data.size()){
+        uint64_t size = data.size();
+        s << uint8_t(LOG_DATA_ZERO_RUNS) << VARINT(size);
+        WriteBytes(s, compressed);
+    } else {
+        s << uint8_t(LOG_DATA_RAW);
+        WriteBytes(s, data);
+    }
+}
+
+template<typename Stream>
+bool ReadLogData(Stream& s, dev::bytes& data){
+    uint8_t encoding;
+    s >> encoding;
+    if(encoding == LOG_DATA_RAW){
+        ReadBytes(s, data);
+        return true;
+    }
+    if(encoding == LOG_DATA_ZERO_RUNS){
+        uint64_t size = 0;
+        dev::bytes compressed;
+        s >> VARINT(size);
+        ReadBytes(s, compressed);
+        return DecompressZeroRuns(compressed, size, data);
+    }
+    return false;
+}
+
+template<typename Stream>
+void WriteReceiptHeader(Stream& s, TransactionReceiptInfo const& tri){
+    s << tri.blockHash << VARINT(tri.blockNumber) << tri.transactionHash << VARINT(tri.transactionIndex);
+}
+
+template<typename Stream>
+void ReadReceiptHeader(Stream& s, TransactionReceiptInfo& tri){
+    s >> tri.blockHash >> VARINT(tri.blockNumber) >> tri.transactionHash >> VARINT(tri.transactionIndex);
+}
+
+bool SameReceiptHeader(TransactionReceiptInfo const& a, TransactionReceiptInfo const& b){
+    return a.blockHash == b.blockHash && a.blockNumber == b.blockNumber &&
+        a.transactionHash == b.transactionHash && a.transactionIndex == b.transactionIndex;
+}
+
+}
+
+StorageResults::StorageResults(std::string const& _path, size_t _cacheSize) : m_cache_usage(0), m_cache_size(_cacheSize){
 	path = _path + "/resultsDB";
     leveldb::Options options;
     options.create_if_missing = true;
     leveldb::Status status = leveldb::DB::Open(options, path, &db);
     assert(status.ok());
     LogPrintf("Opened LevelDB successfully\n");
+    upgradeResults();
 }
 
 StorageResults::~StorageResults()
@@ -17,14 +158,22 @@ StorageResults::~StorageResults()
 }
 
 void StorageResults::addResult(dev::h256 hashTx, std::vector<TransactionReceiptInfo>& result){
-	m_cache_result.insert(std::make_pair(hashTx, result));
+    LOCK(cs);
+	m_pending_result.insert(std::make_pair(hashTx, result));
 }
 
 void StorageResults::clearCacheResult(){
-    m_cache_result.clear();
+    LOCK(cs);
+    m_pending_result.clear();
 }
 
 void StorageResults::wipeResults(){
+    LOCK(cs);
+    m_pending_result.clear();
+    m_lru_result.clear();
+    m_cache_result.clear();
+    m_cache_usage = 0;
+
     LogPrintf("Wiping LevelDB in %s\n", path);
     bool opened = db;
     if (opened) {
@@ -36,92 +185,334 @@ void StorageResults::wipeResults(){
         options.create_if_missing = true;
         leveldb::Status status = leveldb::DB::Open(options, path, &db);
         assert(status.ok());
+        writeVersion();
     }
 }
 
 void StorageResults::deleteResults(std::vector<CTransactionRef> const& txs){
-
+    LOCK(cs);
+    leveldb::WriteBatch batch;
     for(CTransactionRef tx : txs){
         dev::h256 hashTx = uintToh256(tx->GetHash());
-        m_cache_result.erase(hashTx);
-
-        std::string keyTemp = hashTx.hex();
-	    leveldb::Slice key(keyTemp);
-        leveldb::Status status = db->Delete(leveldb::WriteOptions(), key);
-        assert(status.ok());
+        m_pending_result.erase(hashTx);
+        uncacheResult(hashTx);
+        batch.Delete(resultKey(hashTx));
     }
+    leveldb::Status status = db->Write(leveldb::WriteOptions(), &batch);
+    assert(status.ok());
 }
 
-std::vector<TransactionReceiptInfo> StorageResults::getResult(dev::h256 const& hashTx){
+std::vector<TransactionReceiptInfo> StorageResults::getResult(dev::h256 const& hashTx, bool fCache){
     std::vector<TransactionReceiptInfo> result;
-	auto it = m_cache_result.find(hashTx);
-	if (it == m_cache_result.end()){
-		if(readResult(hashTx, result))
-			m_cache_result.insert(std::make_pair(hashTx, result));
-    } else {
-		result = it->second;
+    {
+        LOCK(cs);
+        auto itPending = m_pending_result.find(hashTx);
+        if (itPending != m_pending_result.end()){
+            return itPending->second;
+        }
+        auto it = m_cache_result.find(hashTx);
+        if (it != m_cache_result.end()){
+            m_lru_result.splice(m_lru_result.begin(), m_lru_result, it->second);
+            return it->second->second;
+        }
+        if (fCache){
+            if(readResult(hashTx, result))
+                cacheResult(hashTx, result);
+            return result;
+        }
     }
+    // the read and decode do not need the lock, so several threads can read at once
+    readResult(hashTx, result);
 	return result;
 }
 
 void StorageResults::commitResults(){
-    if(m_cache_result.size()){
-
-        for (auto const& i: m_cache_result){
-            std::string valueTemp;
-            std::string keyTemp = i.first.hex();
-            leveldb::Slice key(keyTemp);
-            leveldb::Status status = db->Get(leveldb::ReadOptions(), key, &valueTemp);
-
-            if(status.IsNotFound()){
-
-                TransactionReceiptInfoSerialized tris;
-
-                for (auto const& receipt_info: i.second) {
-                    tris.blockHashes.push_back(uintToh256(receipt_info.blockHash));
-                    tris.blockNumbers.push_back(receipt_info.blockNumber);
-                    tris.transactionHashes.push_back(uintToh256(receipt_info.transactionHash));
-                    tris.transactionIndexes.push_back(receipt_info.transactionIndex);
-                    tris.outputIndexes.push_back(receipt_info.outputIndex);
-                    tris.senders.push_back(receipt_info.from);
-                    tris.receivers.push_back(receipt_info.to);
-                    tris.cumulativeGasUsed.push_back(dev::u256(receipt_info.cumulativeGasUsed));
-                    tris.gasUsed.push_back(dev::u256(receipt_info.gasUsed));
-                    tris.contractAddresses.push_back(receipt_info.contractAddress);
-                    tris.logs.push_back(logEntriesSerialization(receipt_info.logs));
-                    tris.excepted.push_back(uint32_t(static_cast<int>(receipt_info.excepted)));
-                    tris.exceptedMessage.push_back(receipt_info.exceptedMessage);
-                    tris.stateRoots.push_back(receipt_info.stateRoot);
-                    tris.utxoRoots.push_back(receipt_info.utxoRoot);
-                    tris.createdContracts.push_back(receipt_info.createdContracts);
-                    tris.destructedContracts.push_back(receipt_info.destructedContracts);
-                }
-
-                dev::RLPStream streamRLP(17);
-                streamRLP << tris.blockHashes << tris.blockNumbers << tris.transactionHashes << tris.transactionIndexes << tris.outputIndexes;
-                streamRLP << tris.senders << tris.receivers << tris.cumulativeGasUsed << tris.gasUsed << tris.contractAddresses << tris.logs << tris.excepted << tris.exceptedMessage;
-                streamRLP << tris.stateRoots << tris.utxoRoots << tris.createdContracts << tris.destructedContracts;
-
-                dev::bytes data = streamRLP.out();
-                std::string stringData(data.begin(), data.end());
-                leveldb::Slice value(stringData);
-                status = db->Put(leveldb::WriteOptions(), key, value);
-                assert(status.ok());
-            }
+    LOCK(cs);
+    if(m_pending_result.size()){
+        // The receipts of a transaction only depend on the block it is connected in, and they are
+        // deleted when that block is disconnected. A stored entry for the same transaction is from
+        // the same block (a replay after a restart), so it is overwritten without reading it first.
+        leveldb::WriteBatch batch;
+        for (auto const& i: m_pending_result){
+            batch.Put(resultKey(i.first), serializeResult(i.second));
+        }
+        // all receipts of the block are written at once
+        leveldb::Status status = db->Write(leveldb::WriteOptions(), &batch);
+        assert(status.ok());
+
+        // receipts of a new block are likely to be requested soon (waitforlogs)
+        for (auto const& i: m_pending_result){
+            uncacheResult(i.first);
+            cacheResult(i.first, i.second);
+        }
+        m_pending_result.clear();
+    }
+}
+
+size_t StorageResults::cacheUsage(){
+    LOCK(cs);
+    return m_cache_usage;
+}
+
+void StorageResults::cacheResult(dev::h256 const& hashTx, std::vector<TransactionReceiptInfo> const& result){
+    size_t usage = resultMemoryUsage(result);
+    if(usage > m_cache_size)
+        return;
+    m_lru_result.emplace_front(hashTx, result);
+    m_cache_result[hashTx] = m_lru_result.begin();
+    m_cache_usage += usage;
+    while(m_cache_usage > m_cache_size){
+        uncacheResult(m_lru_result.back().first);
+    }
+}
+
+void StorageResults::uncacheResult(dev::h256 const& hashTx){
+    auto it = m_cache_result.find(hashTx);
+    if(it == m_cache_result.end())
+        return;
+    m_cache_usage -= resultMemoryUsage(it->second->second);
+    m_lru_result.erase(it->second);
+    m_cache_result.erase(it);
+}
+
+size_t StorageResults::resultMemoryUsage(std::vector<TransactionReceiptInfo> const& result){
+    // list node, map entry and the receipts with their heap allocated members
+    size_t usage = sizeof(ResultsList::value_type) + 4 * sizeof(void*) + sizeof(dev::h256) + sizeof(ResultsList::iterator);
+    for(auto const& receipt_info: result){
+        usage += sizeof(TransactionReceiptInfo) + receipt_info.exceptedMessage.size();
+        for(auto const& log: receipt_info.logs){
+            usage += sizeof(dev::eth::LogEntry) + log.topics.size() * sizeof(dev::h256) + log.data.size();
         }
-        m_cache_result.clear();
+        for(auto const& created: receipt_info.createdContracts){
+            usage += sizeof(created) + created.second.size();
+        }
+        usage += receipt_info.destructedContracts.size() * sizeof(dev::Address);
     }
+    return usage;
 }
 
 bool StorageResults::readResult(dev::h256 const& _key, std::vector<TransactionReceiptInfo>& _result){
 
     std::string value;
-    std::string keyTemp = _key.hex();;
-    leveldb::Slice key(keyTemp);
-    leveldb::Status s = db->Get(leveldb::ReadOptions(), key, &value);
+    leveldb::Status s = db->Get(leveldb::ReadOptions(), resultKey(_key), &value);
 
 	if(!s.IsNotFound() && s.ok()){
-        
+        if(deserializeResult(value, _result))
+            return true;
+        LogPrintf("%s: Failed to decode the receipts of %s\n", __func__, _key.hex());
+        _result.clear();
+	}
+	return false;
+}
+
+void StorageResults::writeVersion(){
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << RESULTS_DB_VERSION;
+    leveldb::Status status = db->Put(leveldb::WriteOptions(), DB_VERSION_KEY, ss.str());
+    assert(status.ok());
+}
+
+void StorageResults::upgradeResults(){
+    std::string value;
+    uint32_t version = 0;
+    if(db->Get(leveldb::ReadOptions(), DB_VERSION_KEY, &value).ok()){
+        CDataStream ss(value.data(), value.data() + value.size(), SER_DISK, CLIENT_VERSION);
+        ss >> version;
+    }
+    if(version == RESULTS_DB_VERSION)
+        return;
+    if(version > RESULTS_DB_VERSION){
+        LogPrintf("%s: Unknown receipt encoding version %u in %s\n", __func__, version, path);
+        return;
+    }
+
+    // Legacy receipts are keyed by the hex transaction hash, each batch converts and deletes them atomically
+    // so an interrupted upgrade resumes where it stopped. The upgrade is one way, older versions can not
+    // read the converted receipts and need -reindex.
+    LogPrintf("Upgrading receipts in %s to the compact format, older versions will need -reindex to use this database...\n", path);
+    size_t converted = 0;
+    size_t undecodable = 0;
+    leveldb::WriteBatch batch;
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    for(it->SeekToFirst(); it->Valid(); it->Next()){
+        std::string key = it->key().ToString();
+        if(key.size() != 2 * sizeof(dev::h256) || !IsHex(key))
+            continue;
+        std::vector<TransactionReceiptInfo> result;
+        if(!deserializeLegacyResult(it->value().ToString(), result)){
+            // keep the entry as it is, it can still be inspected or recovered by a reindex
+            LogPrintf("%s: Keeping undecodable receipts of %s in the legacy format\n", __func__, key);
+            undecodable++;
+            continue;
+        }
+        batch.Put(resultKey(dev::h256(key)), serializeResult(result));
+        batch.Delete(key);
+        converted++;
+        if(batch.ApproximateSize() > UPGRADE_BATCH_SIZE){
+            leveldb::Status status = db->Write(leveldb::WriteOptions(), &batch);
+            assert(status.ok());
+            batch.Clear();
+        }
+    }
+    assert(it->status().ok());
+    it.reset();
+    leveldb::Status status = db->Write(leveldb::WriteOptions(), &batch);
+    assert(status.ok());
+    writeVersion();
+
+    if(undecodable){
+        LogPrintf("WARNING: %u transaction receipts in %s could not be upgraded and are not visible to RPC calls, restart with -reindex to rebuild them\n", undecodable, path);
+    }
+    if(converted){
+        LogPrintf("Upgraded %u transaction receipts, compacting %s\n", converted, path);
+        db->CompactRange(nullptr, nullptr);
+    }
+}
+
+std::string StorageResults::resultKey(dev::h256 const& hashTx){
+    std::string key(1, DB_RESULT);
+    key.append((const char*)hashTx.data(), dev::h256::size);
+    return key;
+}
+
+std::string StorageResults::serializeResult(std::vector<TransactionReceiptInfo> const& result){
+    // The receipts of one transaction share the block and transaction fields, which are written once
+    CDataStream s(SER_DISK, CLIENT_VERSION);
+    s << uint8_t(RESULTS_DB_VERSION);
+    WriteCompactSize(s, result.size());
+    if(result.empty())
+        return s.str();
+    WriteReceiptHeader(s, result[0]);
+
+    for(size_t j = 0; j < result.size(); j++){
+        TransactionReceiptInfo const& tri = result[j];
+        uint8_t flags = 0;
+        if(j > 0 && tri.stateRoot == result[j - 1].stateRoot)
+            flags |= RECEIPT_SAME_STATE_ROOT;
+        if(j > 0 && tri.utxoRoot == result[j - 1].utxoRoot)
+            flags |= RECEIPT_SAME_UTXO_ROOT;
+        if(!SameReceiptHeader(tri, result[0]))
+            flags |= RECEIPT_OWN_HEADER;
+
+        s << flags;
+        if(flags & RECEIPT_OWN_HEADER)
+            WriteReceiptHeader(s, tri);
+        s << VARINT(tri.outputIndex);
+        WriteHash(s, tri.from);
+        WriteHash(s, tri.to);
+        s << VARINT(tri.cumulativeGasUsed) << VARINT(tri.gasUsed);
+        WriteHash(s, tri.contractAddress);
+        s << VARINT(static_cast<uint32_t>(tri.excepted)) << tri.exceptedMessage;
+        if(!(flags & RECEIPT_SAME_STATE_ROOT))
+            WriteHash(s, tri.stateRoot);
+        if(!(flags & RECEIPT_SAME_UTXO_ROOT))
+            WriteHash(s, tri.utxoRoot);
+
+        WriteCompactSize(s, tri.logs.size());
+        for(auto const& log : tri.logs){
+            WriteHash(s, log.address);
+            WriteCompactSize(s, log.topics.size());
+            for(auto const& topic : log.topics)
+                WriteHash(s, topic);
+            WriteLogData(s, log.data);
+        }
+
+        WriteCompactSize(s, tri.createdContracts.size());
+        for(auto const& created : tri.createdContracts){
+            WriteHash(s, created.first);
+            WriteBytes(s, created.second);
+        }
+
+        WriteCompactSize(s, tri.destructedContracts.size());
+        for(auto const& destructed : tri.destructedContracts)
+            WriteHash(s, destructed);
+    }
+    return s.str();
+}
+
+bool StorageResults::deserializeResult(std::string const& value, std::vector<TransactionReceiptInfo>& result){
+    try {
+        CDataStream s(value.data(), value.data() + value.size(), SER_DISK, CLIENT_VERSION);
+        uint8_t version;
+        s >> version;
+        if(version != RESULTS_DB_VERSION)
+            return false;
+        size_t count = ReadCompactSize(s);
+        if(count == 0)
+            return true;
+        TransactionReceiptInfo header;
+        ReadReceiptHeader(s, header);
+
+        for(size_t j = 0; j < count; j++){
+            TransactionReceiptInfo tri;
+            uint8_t flags;
+            s >> flags;
+            if(flags & RECEIPT_OWN_HEADER){
+                ReadReceiptHeader(s, tri);
+            } else {
+                tri.blockHash = header.blockHash;
+                tri.blockNumber = header.blockNumber;
+                tri.transactionHash = header.transactionHash;
+                tri.transactionIndex = header.transactionIndex;
+            }
+            s >> VARINT(tri.outputIndex);
+            ReadHash(s, tri.from);
+            ReadHash(s, tri.to);
+            s >> VARINT(tri.cumulativeGasUsed) >> VARINT(tri.gasUsed);
+            ReadHash(s, tri.contractAddress);
+            uint32_t excepted = 0;
+            s >> VARINT(excepted) >> tri.exceptedMessage;
+            tri.excepted = static_cast<dev::eth::TransactionException>(excepted);
+            if(flags & RECEIPT_SAME_STATE_ROOT){
+                if(result.empty())
+                    return false;
+                tri.stateRoot = result.back().stateRoot;
+            } else {
+                ReadHash(s, tri.stateRoot);
+            }
+            if(flags & RECEIPT_SAME_UTXO_ROOT){
+                if(result.empty())
+                    return false;
+                tri.utxoRoot = result.back().utxoRoot;
+            } else {
+                ReadHash(s, tri.utxoRoot);
+            }
+
+            size_t logCount = ReadCompactSize(s);
+            for(size_t k = 0; k < logCount; k++){
+                dev::Address address;
+                ReadHash(s, address);
+                dev::h256s topics(ReadCompactSize(s));
+                for(auto& topic : topics)
+                    ReadHash(s, topic);
+                dev::bytes data;
+                if(!ReadLogData(s, data))
+                    return false;
+                tri.logs.push_back(dev::eth::LogEntry(address, topics, std::move(data)));
+            }
+
+            size_t createdCount = ReadCompactSize(s);
+            for(size_t k = 0; k < createdCount; k++){
+                std::pair<dev::Address, dev::bytes> created;
+                ReadHash(s, created.first);
+                ReadBytes(s, created.second);
+                tri.createdContracts.push_back(std::move(created));
+            }
+
+            tri.destructedContracts.resize(ReadCompactSize(s));
+            for(auto& destructed : tri.destructedContracts)
+                ReadHash(s, destructed);
+
+            result.push_back(std::move(tri));
+        }
+        return s.empty();
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+bool StorageResults::deserializeLegacyResult(std::string const& value, std::vector<TransactionReceiptInfo>& result){
+    try {
         TransactionReceiptInfoSerialized tris;
 
 		dev::RLP state(value);
@@ -146,36 +537,29 @@ bool StorageResults::readResult(dev::h256 const& _key, std::vector<TransactionRe
         for(size_t j = 0; j < tris.blockHashes.size(); j++){
             TransactionReceiptInfo tri{
                 h256Touint(tris.blockHashes[j]),
-                tris.blockNumbers[j],
-                h256Touint(tris.transactionHashes[j]),
-                tris.transactionIndexes[j],
-                tris.outputIndexes[j],
-                tris.senders[j],
-                tris.receivers[j],
-                uint64_t(tris.cumulativeGasUsed[j]),
-                uint64_t(tris.gasUsed[j]),
-                tris.contractAddresses[j],
-                logEntriesDeserialize(tris.logs[j]), 
-                static_cast<dev::eth::TransactionException>(tris.excepted[j]),
-                tris.exceptedMessage[j],
-                tris.stateRoots[j],
-                tris.utxoRoots[j],
-                tris.createdContracts[j],
-                tris.destructedContracts[j]
+                tris.blockNumbers.at(j),
+                h256Touint(tris.transactionHashes.at(j)),
+                tris.transactionIndexes.at(j),
+                tris.outputIndexes.at(j),
+                tris.senders.at(j),
+                tris.receivers.at(j),
+                uint64_t(tris.cumulativeGasUsed.at(j)),
+                uint64_t(tris.gasUsed.at(j)),
+                tris.contractAddresses.at(j),
+                logEntriesDeserialize(tris.logs.at(j)),
+                static_cast<dev::eth::TransactionException>(tris.excepted.at(j)),
+                tris.exceptedMessage.at(j),
+                tris.stateRoots.at(j),
+                tris.utxoRoots.at(j),
+                tris.createdContracts.at(j),
+                tris.destructedContracts.at(j)
             };
-            _result.push_back(tri);
+            result.push_back(tri);
         }
-		return true;
-	}
-	return false;
-}
-
-logEntriesSerialize StorageResults::logEntriesSerialization(dev::eth::LogEntries const& _logs){
-	logEntriesSerialize result;
-	for(dev::eth::LogEntry i : _logs){
-		result.push_back(std::make_pair(i.address, std::make_pair(i.topics, i.data)));
-	}
-	return result;
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
 }
 
 dev::eth::LogEntries StorageResults::logEntriesDeserialize(logEntriesSerialize const& _logs){
@@ -3,8 +3,20 @@
 #include <libethereum/State.h>
 #include <libethereum/Transaction.h>
 #include <leveldb/db.h>
+#include <sync.h>
 #include <util/system.h>
 
+#include <list>
+
+/** Default memory budget of the receipt read cache, in bytes */
+static const size_t DEFAULT_RESULTS_CACHE_SIZE = 32 << 20;
+
+/**
+ * Version of the receipt encoding in the resultsDB, databases without a version use the RLP hex keyed format.
+ * Such databases are upgraded once when opened, there is no downgrade and older versions need -reindex.
+ */
+static const uint32_t RESULTS_DB_VERSION = 1;
+
 using logEntriesSerialize = std::vector<std::pair<dev::Address, std::pair<dev::h256s, dev::bytes>>>;
 
 struct TransactionReceiptInfo{
@@ -51,32 +63,68 @@ class StorageResults{
 
 public:
 
-	StorageResults(std::string const& _path);
+	StorageResults(std::string const& _path, size_t _cacheSize = DEFAULT_RESULTS_CACHE_SIZE);
     ~StorageResults();
 
 	void addResult(dev::h256 hashTx, std::vector<TransactionReceiptInfo>& result);
 
     void deleteResults(std::vector<CTransactionRef> const& txs);
 
-    std::vector<TransactionReceiptInfo> getResult(dev::h256 const& hashTx);
+    /** Receipts of a transaction, fCache false reads without adding them to the cache so long scans do not evict it */
+    std::vector<TransactionReceiptInfo> getResult(dev::h256 const& hashTx, bool fCache = true);
 
+    /** Write the pending results in one batch, they replace receipts stored for the same transactions */
 	void commitResults();
 
     void clearCacheResult();
 
     void wipeResults();
 
+    /** Approximate memory used by the receipt read cache */
+    size_t cacheUsage();
+
 private:
 
+    typedef std::list<std::pair<dev::h256, std::vector<TransactionReceiptInfo>>> ResultsList;
+
+    void cacheResult(dev::h256 const& hashTx, std::vector<TransactionReceiptInfo> const& result) EXCLUSIVE_LOCKS_REQUIRED(cs);
+
+    void uncacheResult(dev::h256 const& hashTx) EXCLUSIVE_LOCKS_REQUIRED(cs);
+
+    static size_t resultMemoryUsage(std::vector<TransactionReceiptInfo> const& result);
+
 	bool readResult(dev::h256 const& _key, std::vector<TransactionReceiptInfo>& _result);
 
-	logEntriesSerialize logEntriesSerialization(dev::eth::LogEntries const& _logs);
+    /** Convert receipts written by older versions to the compact format, undecodable entries are kept as they are */
+    void upgradeResults();
+
+    void writeVersion();
 
-	dev::eth::LogEntries logEntriesDeserialize(logEntriesSerialize const& _logs);
+    static std::string resultKey(dev::h256 const& hashTx);
+
+    static std::string serializeResult(std::vector<TransactionReceiptInfo> const& result);
+
+    static bool deserializeResult(std::string const& value, std::vector<TransactionReceiptInfo>& result);
+
+    static bool deserializeLegacyResult(std::string const& value, std::vector<TransactionReceiptInfo>& result);
+
+	static dev::eth::LogEntries logEntriesDeserialize(logEntriesSerialize const& _logs);
 
 	std::string path;
 
     leveldb::DB* db;
 
-	std::unordered_map<dev::h256, std::vector<TransactionReceiptInfo>> m_cache_result;
+    Mutex cs;
+
+    //! Results of the block being connected, written by commitResults
+	std::unordered_map<dev::h256, std::vector<TransactionReceiptInfo>> m_pending_result GUARDED_BY(cs);
+
+    //! Least recently used results read from the database, most recent first
+    ResultsList m_lru_result GUARDED_BY(cs);
+
+    std::unordered_map<dev::h256, ResultsList::iterator> m_cache_result GUARDED_BY(cs);
+
+    size_t m_cache_usage GUARDED_BY(cs);
+
+    size_t m_cache_size;
 };
@@ -36,10 +36,12 @@
 #include <versionbitsinfo.h>
 #include <warnings.h>
 #include <libdevcore/CommonData.h>
+#include <libdevcore/SHA3.h>
 #include <pow.h>
 #include <pos.h>
 #include <txdb.h>
 #include <util/convert.h>
+#include <qtum/flatstate.h>
 
 #include <assert.h>
 #include <stdint.h>
@@ -48,9 +50,13 @@
 
 #include <boost/thread/thread.hpp> // boost::thread::interrupt
 
+#include <atomic>
 #include <condition_variable>
+#include <exception>
+#include <list>
 #include <memory>
 #include <mutex>
+#include <thread>
 
 /* Calculate the difficulty for a given block index.
  */
@@ -943,15 +949,20 @@ static UniValue getaccountinfo(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Incorrect address");
 
     dev::Address addrAccount(strAddr);
-    if(!globalState->addressInUse(addrAccount))
+    // the flat copy of the state answers with single lookups when it is at the tip
+    FlatAccount account;
+    bool fFlatState = pflatstate && pflatstate->ReadAccount(globalState->rootHash(), addrAccount, account);
+    if(!fFlatState && !globalState->addressInUse(addrAccount))
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Address does not exist");
     
     UniValue result(UniValue::VOBJ);
 
     result.pushKV("address", strAddr);
-    result.pushKV("balance", CAmount(globalState->balance(addrAccount)));
+    result.pushKV("balance", CAmount(fFlatState ? account.balance : globalState->balance(addrAccount)));
     std::vector<uint8_t> code(globalState->code(addrAccount));
-    auto storage(globalState->storage(addrAccount));
+    std::map<dev::h256, std::pair<dev::u256, dev::u256>> storage;
+    if(!fFlatState || !pflatstate->ReadStorage(globalState->rootHash(), addrAccount, storage))
+        storage = globalState->storage(addrAccount);
 
     UniValue storageUV(UniValue::VOBJ);
     for (auto j: storage)
@@ -977,6 +988,16 @@ static UniValue getaccountinfo(const JSONRPCRequest& request)
     return result;
 }
 
+/** Move the state to the roots of an older block, the roots of pruned blocks are not stored anymore */
+static void SetHistoricalStateRoot(TemporaryState& ts, const CBlockIndex* pblockindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    dev::h256 hashStateRoot = uintToh256(pblockindex->hashStateRoot);
+    dev::h256 hashUTXORoot = uintToh256(pblockindex->hashUTXORoot);
+    if (!globalState->rootsAvailable(hashStateRoot, hashUTXORoot))
+        throw JSONRPCError(RPC_MISC_ERROR, "State of the block is not available (pruned)");
+    ts.SetRoot(hashStateRoot, hashUTXORoot);
+}
+
 static UniValue getcontractcode(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 1)
@@ -1007,7 +1028,7 @@ static UniValue getcontractcode(const JSONRPCRequest& request)
             auto blockNum = request.params[1].get_int();
             if (blockNum < 0 || blockNum > ::ChainActive().Height())
                 throw JSONRPCError(RPC_INVALID_PARAMS, "Incorrect block number");
-            ts.SetRoot(uintToh256(::ChainActive()[blockNum]->hashStateRoot), uintToh256(::ChainActive()[blockNum]->hashUTXORoot));
+            SetHistoricalStateRoot(ts, ::ChainActive()[blockNum]);
         } else {
             throw JSONRPCError(RPC_INVALID_PARAMS, "Incorrect block number");
         }
@@ -1056,7 +1077,7 @@ static UniValue getstorage(const JSONRPCRequest& request)
                 throw JSONRPCError(RPC_INVALID_PARAMS, "Incorrect block number");
 
             if(blockNum != -1)
-                ts.SetRoot(uintToh256(::ChainActive()[blockNum]->hashStateRoot), uintToh256(::ChainActive()[blockNum]->hashUTXORoot));
+                SetHistoricalStateRoot(ts, ::ChainActive()[blockNum]);
                 
         } else {
             throw JSONRPCError(RPC_INVALID_PARAMS, "Incorrect block number");
@@ -1074,7 +1095,9 @@ static UniValue getstorage(const JSONRPCRequest& request)
     if (onlyIndex)
         index = request.params[2].get_int();
 
-    auto storage(globalState->storage(addrAccount));
+    std::map<dev::h256, std::pair<dev::u256, dev::u256>> storage;
+    if(!pflatstate || !pflatstate->ReadStorage(globalState->rootHash(), addrAccount, storage))
+        storage = globalState->storage(addrAccount);
 
     if (onlyIndex)
     {
@@ -1342,8 +1365,6 @@ UniValue callcontract(const JSONRPCRequest& request)
             }
                 .ToString());
 
-    LOCK(cs_main);
-    
     std::string strAddr = request.params[0].get_str();
     std::string data = request.params[1].get_str();
 
@@ -1369,28 +1390,33 @@ UniValue callcontract(const JSONRPCRequest& request)
         gasLimit = request.params[3].get_int64();
     }
 
-    TemporaryState ts(globalState);
-    int blockNum;
-    if (request.params.size() >= 5) {
-        if (request.params[4].isNum()) {
-            blockNum = request.params[4].get_int();
-            if (blockNum < 0 || blockNum > ::ChainActive().Height())
+    // cs_main is only needed to pick the snapshot, the call itself runs without it
+    std::shared_ptr<const ContractStateSnapshot> snapshot;
+    {
+        LOCK(cs_main);
+        CBlockIndex* pblockindex = ::ChainActive().Tip();
+        if (request.params.size() >= 5) {
+            if (request.params[4].isNum()) {
+                int blockNum = request.params[4].get_int();
+                if (blockNum < 0 || blockNum > ::ChainActive().Height())
+                    throw JSONRPCError(RPC_INVALID_PARAMS, "Incorrect block number");
+                pblockindex = ::ChainActive()[blockNum];
+            } else {
                 throw JSONRPCError(RPC_INVALID_PARAMS, "Incorrect block number");
-            ts.SetRoot(uintToh256(::ChainActive()[blockNum]->hashStateRoot), uintToh256(::ChainActive()[blockNum]->hashUTXORoot));
-        } else {
-            throw JSONRPCError(RPC_INVALID_PARAMS, "Incorrect block number");
+            }
         }
-    } else {
-        blockNum = latestblock.height;
+        snapshot = GetContractStateSnapshot(pblockindex);
     }
+    if (!snapshot)
+        throw JSONRPCError(RPC_MISC_ERROR, "State of the block is not available (pruned)");
 
     dev::Address addrAccount(strAddr);
-    if (!globalState->addressInUse(addrAccount))
+    std::vector<ResultExecute> execResults;
+    if (!snapshot->Call(addrAccount, ParseHex(data), execResults, senderAddress, gasLimit))
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Address does not exist");
 
-    std::vector<ResultExecute> execResults = CallContract(addrAccount, ParseHex(data), blockNum, senderAddress, gasLimit);
-
     if(fRecordLogOpcodes){
+        LOCK(cs_main);
         writeVMlog(execResults);
     }
 
@@ -1579,6 +1605,26 @@ void parseParam(const UniValue& val, std::vector<boost::optional<dev::h256>> &h2
     });
 }
 
+static bool LogBloomContains(const dev::h2048& bloom, const dev::h160& address) {
+    return bloom.containsBloom<3>(dev::sha3(address.ref()));
+}
+
+static bool LogBloomContains(const dev::h2048& bloom, const dev::h256& topic) {
+    return bloom.containsBloom<3>(dev::sha3(topic.ref()));
+}
+
+static bool LogBloomContainsAnyAddress(const dev::h2048& bloom, const std::set<dev::h160>& addresses) {
+    if (addresses.empty()) {
+        return true;
+    }
+    for (const auto& address : addresses) {
+        if (LogBloomContains(bloom, address)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 class WaitForLogsParams {
 public:
     int fromBlock;
@@ -1667,11 +1713,24 @@ UniValue waitforlogs(const JSONRPCRequest& request_) {
     auto& addresses = params.addresses;
     auto& filterTopics = params.topics;
 
+    // A log is returned only if it matches all the topics, so the block bloom must contain all of them
+    auto blockFilter = [&addresses, &filterTopics](const dev::h2048& bloom) {
+        if (!LogBloomContainsAnyAddress(bloom, addresses)) {
+            return false;
+        }
+        for (const auto& topic : filterTopics) {
+            if (topic && !LogBloomContains(bloom, topic.get())) {
+                return false;
+            }
+        }
+        return true;
+    };
+
     while (curheight == 0) {
         {
             LOCK(cs_main);
             curheight = pblocktree->ReadHeightIndex(params.fromBlock, params.toBlock, params.minconf,
-                    hashesToBlock, addresses);
+                    hashesToBlock, addresses, blockFilter);
         }
 
         // if curheight >= fromBlock. Blockchain extended with new log entries. Return next block height to client.
@@ -1776,11 +1835,83 @@ UniValue waitforlogs(const JSONRPCRequest& request_) {
     return result;
 }
 
+//! Transaction hashes read from the height index and decoded together by searchlogs
+static const size_t SEARCHLOGS_CHUNK_SIZE = 512;
+//! Maximum number of threads decoding receipts for all searchlogs calls together, besides the calling threads
+static const int MAX_SEARCHLOGS_THREADS = 8;
+//! Receipts decoded per thread, smaller chunks use fewer threads
+static const size_t SEARCHLOGS_RECEIPTS_PER_THREAD = 64;
+
+static CSemaphore semSearchLogsThreads(MAX_SEARCHLOGS_THREADS);
+
+/** Receipts of the transactions in the order of the hashes, read and decoded by several threads */
+static std::vector<std::vector<TransactionReceiptInfo>> ReadReceipts(const std::vector<uint256>& hashes)
+{
+    std::vector<std::vector<TransactionReceiptInfo>> receipts(hashes.size());
+    std::atomic<size_t> next{0};
+    std::mutex cs_error;
+    std::exception_ptr error;
+
+    // A scan reads each receipt once, keep it out of the receipt cache
+    auto read = [&]() {
+        try {
+            for (size_t i = next++; i < hashes.size(); i = next++) {
+                receipts[i] = pstorageresult->getResult(uintToh256(hashes[i]), false);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(cs_error);
+            if (!error)
+                error = std::current_exception();
+            next = hashes.size();
+        }
+    };
+
+    size_t nThreads = std::min<size_t>(std::max(1, std::min(GetNumCores(), MAX_SEARCHLOGS_THREADS)),
+                                       (hashes.size() + SEARCHLOGS_RECEIPTS_PER_THREAD - 1) / SEARCHLOGS_RECEIPTS_PER_THREAD);
+    // Workers only start while the shared budget allows, otherwise the calling thread does the rest
+    std::list<CSemaphoreGrant> grants;
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < nThreads; i++) {
+        grants.emplace_back(semSearchLogsThreads, true);
+        if (!grants.back())
+            break;
+        workers.emplace_back(read);
+    }
+    read();
+    for (std::thread& worker : workers)
+        worker.join();
+
+    if (error)
+        std::rethrow_exception(error);
+    return receipts;
+}
+
+/** A receipt matches when one of its logs has any of the topics at the same position */
+static bool ReceiptMatchesTopics(const TransactionReceiptInfo& receipt, const std::vector<boost::optional<dev::h256>>& topics)
+{
+    if (topics.empty()) {
+        return true;
+    }
+    for (size_t i = 0; i < topics.size(); i++) {
+        const auto& tc = topics[i];
+        if (!tc) {
+            continue;
+        }
+        for (const auto& log: receipt.logs) {
+            if (i < log.topics.size() && tc.get() == log.topics[i]) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 class SearchLogsParams {
 public:
     size_t fromBlock;
     size_t toBlock;
     size_t minconf;
+    size_t limit;
 
     std::set<dev::h160> addresses;
     std::vector<boost::optional<dev::h256>> topics;
@@ -1795,6 +1926,7 @@ public:
         parseParam(params[3]["topics"], topics);
 
         minconf = parseUInt(params[4], 0);
+        limit = parseUInt(params[5], 0);
     }
 
 private:
@@ -1826,6 +1958,7 @@ UniValue searchlogs(const JSONRPCRequest& request)
                     {"address", RPCArg::Type::STR, RPCArg::Optional::OMITTED_NAMED_ARG, "An address or a list of addresses to only get logs from particular account(s)."},
                     {"topics", RPCArg::Type::STR, RPCArg::Optional::OMITTED_NAMED_ARG, "An array of values from which at least one must appear in the log entries. The order is important, if you want to leave topics out use null, e.g. [\"null\", \"0x00...\"]."},
                     {"minconf", RPCArg::Type::NUM, /* default */ "0", "Minimal number of confirmations before a log is returned"},
+                    {"limit", RPCArg::Type::NUM, /* default */ "0", "Stop at the end of the block in which this many receipts are found and return a page (0 returns all receipts)"},
                 },
                 RPCResult{
             "[\n"
@@ -1852,88 +1985,102 @@ UniValue searchlogs(const JSONRPCRequest& request)
             "    ]\n"
             "  }\n"
             "]\n"
+            "With a limit the receipts are returned in an object:\n"
+            "{\n"
+            "  \"logs\": [...]        (array)  The receipts as above\n"
+            "  \"nextBlock\": n       (numeric, optional)  Pass it as fromBlock with the same parameters for the next page, not set on the last page\n"
+            "}\n"
                 },
                 RPCExamples{
                     HelpExampleCli("searchlogs", "0 100 '{\"addresses\": [\"12ae42729af478ca92c8c66773a3e32115717be4\"]}' '{\"topics\": [null,\"b436c2bf863ccd7b8f63171201efd4792066b4ce8e543dde9c3e9e9ab98e216c\"]}'")
             + HelpExampleRpc("searchlogs", "0 100 '{\"addresses\": [\"12ae42729af478ca92c8c66773a3e32115717be4\"]} {\"topics\": [null,\"b436c2bf863ccd7b8f63171201efd4792066b4ce8e543dde9c3e9e9ab98e216c\"]}'")
+            + HelpExampleCli("searchlogs", "0 -1 '{\"addresses\": [\"12ae42729af478ca92c8c66773a3e32115717be4\"]}' '{}' 0 1000")
                 },
             }.Check(request);
 
     if(!fLogEvents)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Events indexing disabled");
 
-    int curheight = 0;
-    
-    LOCK(cs_main);
-
     SearchLogsParams params(request.params);
-    
-    std::vector<std::vector<uint256>> hashesToBlock;
 
-    curheight = pblocktree->ReadHeightIndex(params.fromBlock, params.toBlock, params.minconf, hashesToBlock, params.addresses);
+    const auto& topics = params.topics;
 
-    if (curheight == -1) {
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "Incorrect params");
-    }
+    // A receipt is returned if any of the topics is matched, so the block bloom must contain at least one of them
+    auto blockFilter = [&params, &topics](const dev::h2048& bloom) {
+        if (!LogBloomContainsAnyAddress(bloom, params.addresses)) {
+            return false;
+        }
+        if (topics.empty()) {
+            return true;
+        }
+        for (const auto& topic : topics) {
+            if (topic && LogBloomContains(bloom, topic.get())) {
+                return true;
+            }
+        }
+        return false;
+    };
 
     UniValue result(UniValue::VARR);
 
-    auto topics = params.topics;
+    // The range is read in chunks of whole blocks, so only one chunk of hashes and receipts is held at a time.
+    // With a limit no more hashes are read than receipts are still missing from the page.
+    size_t fromBlock = params.fromBlock;
+    bool fMore = true;
+    while (fMore) {
+        size_t nChunkSize = SEARCHLOGS_CHUNK_SIZE;
+        if (params.limit > 0)
+            nChunkSize = std::min(nChunkSize, params.limit - result.size());
+        std::vector<std::vector<uint256>> hashesToBlock;
+        int curheight = WITH_LOCK(cs_main, return pblocktree->ReadHeightIndex(fromBlock, params.toBlock, params.minconf,
+                                                                               hashesToBlock, params.addresses, blockFilter, nChunkSize));
 
-    std::set<uint256> dupes;
-
-    for(const auto& hashesTx : hashesToBlock)
-    {
-        for(const auto& e : hashesTx)
-        {
-
-            if(dupes.find(e) != dupes.end()) {
-                continue;
-            }
-            dupes.insert(e);
-
-            std::vector<TransactionReceiptInfo> receipts = pstorageresult->getResult(uintToh256(e));
+        if (curheight == -1) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Incorrect params");
+        }
 
-            for(const auto& receipt : receipts) {
-                if(receipt.logs.empty()) {
-                    continue;
+        // A transaction is indexed under every contract it touched in the block
+        std::vector<uint256> hashes;
+        std::set<uint256> dupes;
+        size_t nHashes = 0;
+        for (const auto& hashesTx : hashesToBlock) {
+            nHashes += hashesTx.size();
+            for (const auto& e : hashesTx) {
+                if (dupes.insert(e).second) {
+                    hashes.push_back(e);
                 }
+            }
+        }
 
-                if (!topics.empty()) {
-                    for (size_t i = 0; i < topics.size(); i++) {
-                        const auto& tc = topics[i];
-
-                        if (!tc) {
-                            continue;
-                        }
-
-                        for (const auto& log: receipt.logs) {
-                            auto filterTopicContent = tc.get();
-
-                            if (i >= log.topics.size()) {
-                                continue;
-                            }
-
-                            if (filterTopicContent == log.topics[i]) {
-                                goto push;
-                            }
-                        }
-                    }
-
-                    // Skip the log if none of the topics are matched
+        for (const auto& receipts : ReadReceipts(hashes)) {
+            for (const auto& receipt : receipts) {
+                if (receipt.logs.empty() || !ReceiptMatchesTopics(receipt, topics)) {
                     continue;
                 }
-
-            push:
-
                 UniValue tri(UniValue::VOBJ);
                 transactionReceiptInfoToJSON(receipt, tri);
                 result.push_back(tri);
             }
         }
+
+        // A chunk that is not full ends at the last block of the range
+        fromBlock = curheight + 1;
+        fMore = nHashes >= nChunkSize && fromBlock <= params.toBlock;
+        if (params.limit > 0 && result.size() >= params.limit) {
+            break;
+        }
     }
 
-    return result;
+    if (params.limit == 0) {
+        return result;
+    }
+
+    UniValue page(UniValue::VOBJ);
+    page.pushKV("logs", result);
+    if (fMore) {
+        page.pushKV("nextBlock", (int64_t)fromBlock);
+    }
+    return page;
 }
 
 UniValue gettransactionreceipt(const JSONRPCRequest& request)
@@ -2153,7 +2300,7 @@ UniValue listallcontracts(const JSONRPCRequest& request)
         int blockNum = request.params[0].get_int();
         if (blockNum < 0 || blockNum > ::ChainActive().Height())
             throw JSONRPCError(RPC_INVALID_PARAMS, "Incorrect block number");
-        ts.SetRoot(uintToh256(::ChainActive()[blockNum]->hashStateRoot), uintToh256(::ChainActive()[blockNum]->hashUTXORoot));
+        SetHistoricalStateRoot(ts, ::ChainActive()[blockNum]);
     }
 
     UniValue result(UniValue::VARR);
@@ -3552,7 +3699,7 @@ static const CRPCCommand commands[] = {
     { "blockchain",         "listallcontracts",       &listallcontracts,       {"height"} },
     { "blockchain",         "gettransactionreceipt",  &gettransactionreceipt,  {"hash"} },
     { "blockchain",         "getblocktransactionreceipts",  &getblocktransactionreceipts,  {"hash"} },
-    { "blockchain",         "searchlogs",             &searchlogs,             {"fromBlock", "toBlock", "address", "topics"} },
+    { "blockchain",         "searchlogs",             &searchlogs,             {"fromBlock", "toBlock", "address", "topics", "minconf", "limit"} },
 
     { "blockchain",         "waitforlogs",            &waitforlogs,            {"fromBlock", "nblocks", "address", "topics"} },
     { "blockchain",         "getestimatedannualroi",  &getestimatedannualroi,  {} },
@@ -94,6 +94,8 @@ static const CRPCConvertParam vRPCConvertParams[] = {
     { "searchlogs", 1, "toBlock"},
     { "searchlogs", 2, "address"},
     { "searchlogs", 3, "topics"},
+    { "searchlogs", 4, "minconf"},
+    { "searchlogs", 5, "limit"},
     { "waitforlogs", 0, "fromBlock"},
     { "waitforlogs", 1, "nblocks"},
     { "waitforlogs", 2, "address"},
@@ -16,6 +16,8 @@
 #include <util/validation.h>
 
 #ifdef ENABLE_BITCORE_RPC
+#include <index/addressindex.h>
+#include <streams.h>
 #include <txmempool.h>
 #include <validation.h>
 #endif
@@ -178,6 +180,38 @@ bool getAddressFromIndex(const int &type, const uint256 &hash, std::string &addr
     return true;
 }
 
+/** Let the address index process the blocks that are already connected, so the results are for the tip */
+static void SyncAddressIndex()
+{
+    if (g_addressindex && !g_addressindex->BlockUntilSyncedToCurrentChain()) {
+        // an index that is still being built would give partial results
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index is still being built, try again later");
+    }
+}
+
+/** Cursor of a page of address deltas, the key of the first delta of the next page */
+static std::string EncodeAddressCursor(const CAddressIndexKey& key)
+{
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << key;
+    return HexStr(ssKey.begin(), ssKey.end());
+}
+
+static CAddressIndexKey DecodeAddressCursor(const UniValue& value)
+{
+    if (!value.isStr() || !IsHex(value.get_str())) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    }
+    CDataStream ssKey(ParseHex(value.get_str()), SER_DISK, CLIENT_VERSION);
+    CAddressIndexKey key;
+    try {
+        ssKey >> key;
+    } catch (const std::exception&) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    }
+    return key;
+}
+
 UniValue getaddressdeltas(const JSONRPCRequest& request)
 {
         RPCHelpMan{"getaddressdeltas",
@@ -193,6 +227,8 @@ UniValue getaddressdeltas(const JSONRPCRequest& request)
                         {"start", RPCArg::Type::NUM, RPCArg::Optional::OMITTED_NAMED_ARG, "The start block height"},
                         {"end", RPCArg::Type::NUM, RPCArg::Optional::OMITTED_NAMED_ARG, "The end block height"},
                         {"chainInfo", RPCArg::Type::BOOL, RPCArg::Optional::OMITTED_NAMED_ARG, "Include chain info in results, only applies if start and end specified"},
+                        {"limit", RPCArg::Type::NUM, RPCArg::Optional::OMITTED_NAMED_ARG, "The maximum number of deltas to return, the result is then an object with the deltas and a cursor for the next page"},
+                        {"cursor", RPCArg::Type::STR, RPCArg::Optional::OMITTED_NAMED_ARG, "The cursor of the previous page, to continue with the deltas after it"},
                     }
                 }
             },
@@ -206,12 +242,19 @@ UniValue getaddressdeltas(const JSONRPCRequest& request)
         "    \"address\"  (string) The metrix address\n"
         "  }\n"
         "]\n"
+        "With a limit or chainInfo the deltas are returned in an object:\n"
+        "{\n"
+        "  \"deltas\": [...]  (array) The deltas as above\n"
+        "  \"cursor\"  (string, optional) Pass it with the same parameters for the next page, not set on the last page\n"
+        "}\n"
             },
             RPCExamples{
                 HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"QD1ZrZNe3JUo7ZycKEYQQiQAWd9y54F4XX\"]}'")
         + HelpExampleRpc("getaddressdeltas", "{\"addresses\": [\"QD1ZrZNe3JUo7ZycKEYQQiQAWd9y54F4XX\"]}") +
                 HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"QD1ZrZNe3JUo7ZycKEYQQiQAWd9y54F4XX\"], \"start\": 5000, \"end\": 5500, \"chainInfo\": true}'")
-        + HelpExampleRpc("getaddressdeltas", "{\"addresses\": [\"QD1ZrZNe3JUo7ZycKEYQQiQAWd9y54F4XX\"], \"start\": 5000, \"end\": 5500, \"chainInfo\": true}")
+        + HelpExampleRpc("getaddressdeltas", "{\"addresses\": [\"QD1ZrZNe3JUo7ZycKEYQQiQAWd9y54F4XX\"], \"start\": 5000, \"end\": 5500, \"chainInfo\": true}") +
+                HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"QD1ZrZNe3JUo7ZycKEYQQiQAWd9y54F4XX\"], \"limit\": 1000}'")
+        + HelpExampleRpc("getaddressdeltas", "{\"addresses\": [\"QD1ZrZNe3JUo7ZycKEYQQiQAWd9y54F4XX\"], \"limit\": 1000}")
             },
         }.Check(request);
 
@@ -239,6 +282,24 @@ UniValue getaddressdeltas(const JSONRPCRequest& request)
         }
     }
 
+    size_t nLimit = 0;
+    UniValue limitValue = find_value(request.params[0].get_obj(), "limit");
+    if (!limitValue.isNull()) {
+        if (!limitValue.isNum() || limitValue.get_int() <= 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Limit is expected to be greater than zero");
+        }
+        nLimit = limitValue.get_int();
+    }
+
+    CAddressIndexKey cursor;
+    UniValue cursorValue = find_value(request.params[0].get_obj(), "cursor");
+    if (!cursorValue.isNull()) {
+        if (nLimit == 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "A cursor requires a limit");
+        }
+        cursor = DecodeAddressCursor(cursorValue);
+    }
+
     std::vector<std::pair<uint256, int> > addresses;
 
     if (!getAddressesFromParams(request.params, addresses)) {
@@ -246,17 +307,34 @@ UniValue getaddressdeltas(const JSONRPCRequest& request)
     }
 
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    CAddressIndexKey next;
 
+    SyncAddressIndex();
+    // the pages go through the addresses in the order they are given, the cursor is in one of them
+    bool fFoundCursor = cursor.hashBytes.IsNull();
     for (std::vector<std::pair<uint256, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (start > 0 && end > 0) {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+        if (!fFoundCursor) {
+            if ((*it).first != cursor.hashBytes || (unsigned int)(*it).second != cursor.type) {
+                continue;
             }
+            fFoundCursor = true;
         } else {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
+            cursor.SetNull();
+        }
+        if (nLimit > 0 && addressIndex.size() == nLimit) {
+            next = CAddressIndexKey((*it).second, (*it).first, start, 0, uint256(), 0, false);
+            break;
+        }
+        if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end, nLimit > 0 ? nLimit - addressIndex.size() : 0, &cursor)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
         }
+        if (!cursor.hashBytes.IsNull()) {
+            next = cursor;
+            break;
+        }
+    }
+    if (!fFoundCursor) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Cursor does not belong to the addresses");
     }
 
     UniValue deltas(UniValue::VARR);
@@ -279,6 +357,13 @@ UniValue getaddressdeltas(const JSONRPCRequest& request)
 
     UniValue result(UniValue::VOBJ);
 
+    if (nLimit > 0) {
+        result.pushKV("deltas", deltas);
+        if (!next.hashBytes.IsNull()) {
+            result.pushKV("cursor", EncodeAddressCursor(next));
+        }
+    }
+
     if (includeChainInfo && start > 0 && end > 0) {
         LOCK(cs_main);
 
@@ -298,10 +383,14 @@ UniValue getaddressdeltas(const JSONRPCRequest& request)
         endInfo.pushKV("hash", endIndex->GetBlockHash().GetHex());
         endInfo.pushKV("height", end);
 
-        result.pushKV("deltas", deltas);
+        if (nLimit == 0) {
+            result.pushKV("deltas", deltas);
+        }
         result.pushKV("start", startInfo);
         result.pushKV("end", endInfo);
 
+        return result;
+    } else if (nLimit > 0) {
         return result;
     } else {
         return deltas;
@@ -336,25 +425,38 @@ UniValue getaddressbalance(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    CAmount balance = 0;
+    CAmount received = 0;
+    CAmount immature = 0;
+
+    SyncAddressIndex();
+    int nHeight;
+    {
+        LOCK(cs_main);
+        nHeight = ::ChainActive().Height();
+    }
+    // only the stakes of the last blocks can be immature, older entries are covered by the summary
+    int nMatureHeight = std::max(1, nHeight - COINBASE_MATURITY + 1);
 
     for (std::vector<std::pair<uint256, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
+        CAddressSummary summary;
+        if (!GetAddressSummary((*it).first, (*it).second, summary)) {
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
         }
-    }
+        balance += summary.balance;
+        received += summary.received;
 
-    CAmount balance = 0;
-    CAmount received = 0;
-    CAmount immature = 0;
-
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++) {
-        if (it->second > 0) {
-            received += it->second;
+        if (summary.IsNull() || summary.lastHeight < nMatureHeight || nHeight < nMatureHeight) {
+            continue;
+        }
+        std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+        if (!GetAddressIndex((*it).first, (*it).second, addressIndex, nMatureHeight, nHeight)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+        }
+        for (const auto& entry : addressIndex) {
+            if (entry.first.txindex == 1)
+                immature += entry.second; //immature stake outputs
         }
-        balance += it->second;
-        if (it->first.txindex == 1 && ((::ChainActive().Height() - it->first.blockHeight) < COINBASE_MATURITY))
-            immature += it->second; //immature stake outputs
     }
 
     UniValue result(UniValue::VOBJ);
@@ -417,6 +519,7 @@ UniValue getaddressutxos(const JSONRPCRequest& request)
 
     std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
 
+    SyncAddressIndex();
     for (std::vector<std::pair<uint256, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
         if (!GetAddressUnspent((*it).first, (*it).second, unspentOutputs)) {
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
@@ -578,6 +681,7 @@ UniValue getblockhashes(const JSONRPCRequest& request)
 
     std::vector<std::pair<uint256, unsigned int> > blockHashes;
 
+    SyncAddressIndex();
     if (fActiveOnly)
         LOCK(cs_main);
 
@@ -639,6 +743,7 @@ UniValue getspentinfo(const JSONRPCRequest& request)
     CSpentIndexKey key(txid, outputIndex);
     CSpentIndexValue value;
 
+    SyncAddressIndex();
     if (!GetSpentIndex(key, value)) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unable to get spent info");
     }
@@ -701,6 +806,7 @@ UniValue getaddresstxids(const JSONRPCRequest& request)
 
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
 
+    SyncAddressIndex();
     for (std::vector<std::pair<uint256, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
         if (start > 0 && end > 0) {
             if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end)) {
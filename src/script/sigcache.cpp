@@ -79,16 +79,25 @@ void InitSignatureCache()
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+void AddSignatureCacheEntries(const std::vector<uint256>& entries)
+{
+    for (uint256 entry : entries) {
+        signatureCache.Set(entry);
+    }
+}
+
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
     uint256 entry;
     signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
-    if (signatureCache.Get(entry, !store))
+    if (signatureCache.Get(entry, !store && !pvDeferred))
         return true;
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
     if (store)
         signatureCache.Set(entry);
+    else if (pvDeferred)
+        pvDeferred->push_back(entry);
     return true;
 }
 
@@ -96,11 +105,13 @@ bool CachingTransactionSignatureOutputChecker::VerifySignature(const std::vector
 {
     uint256 entry;
     signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
-    if (signatureCache.Get(entry, !store))
+    if (signatureCache.Get(entry, !store && !pvDeferred))
         return true;
     if (!TransactionSignatureOutputChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
     if (store)
         signatureCache.Set(entry);
+    else if (pvDeferred)
+        pvDeferred->push_back(entry);
     return true;
 }
@@ -44,9 +44,10 @@ class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
     bool store;
+    std::vector<uint256>* pvDeferred;
 
 public:
-    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, bool storeIn, PrecomputedTransactionData& txdataIn) : TransactionSignatureChecker(txToIn, nInIn, amountIn, txdataIn), store(storeIn) {}
+    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, bool storeIn, PrecomputedTransactionData& txdataIn, std::vector<uint256>* pvDeferredIn = nullptr) : TransactionSignatureChecker(txToIn, nInIn, amountIn, txdataIn), store(storeIn), pvDeferred(pvDeferredIn) {}
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const override;
 };
@@ -55,13 +56,17 @@ class CachingTransactionSignatureOutputChecker : public TransactionSignatureOutp
 {
 private:
     bool store;
+    std::vector<uint256>* pvDeferred;
 
 public:
-    CachingTransactionSignatureOutputChecker(const CTransaction* txToIn, unsigned int nOutIn, const CAmount& amountIn, bool storeIn, PrecomputedTransactionData& txdataIn) : TransactionSignatureOutputChecker(txToIn, nOutIn, amountIn, txdataIn), store(storeIn) {}
+    CachingTransactionSignatureOutputChecker(const CTransaction* txToIn, unsigned int nOutIn, const CAmount& amountIn, bool storeIn, PrecomputedTransactionData& txdataIn, std::vector<uint256>* pvDeferredIn = nullptr) : TransactionSignatureOutputChecker(txToIn, nOutIn, amountIn, txdataIn), store(storeIn), pvDeferred(pvDeferredIn) {}
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const override;
 };
 
 void InitSignatureCache();
 
+/** Store the entries that a checker with pvDeferred set collected instead of storing them */
+void AddSignatureCacheEntries(const std::vector<uint256>& entries);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -0,0 +1,201 @@
+// Copyright (c) 2017-2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <index/addressindex.h>
+#include <script/standard.h>
+#include <test/setup_common.h>
+#include <txmempool.h>
+#include <util/time.h>
+#include <validation.h>
+
+#include <limits>
+#include <set>
+
+#include <boost/test/unit_test.hpp>
+
+#ifdef ENABLE_BITCORE_RPC
+BOOST_AUTO_TEST_SUITE(addressindex_tests)
+
+static std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>> MempoolDeltas(CTxMemPool& pool, const PKHash& address)
+{
+    valtype addressBytes(32);
+    std::copy(address.begin(), address.end(), addressBytes.begin());
+    std::vector<std::pair<uint256, int>> addresses{{uint256(addressBytes), CTxDestination(address).which()}};
+    std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>> deltas;
+    BOOST_CHECK(pool.getAddressIndex(addresses, deltas));
+    return deltas;
+}
+
+BOOST_FIXTURE_TEST_CASE(addressindex_initial_sync, TestChain100Setup)
+{
+    AddressIndex addressindex(1 << 20, true);
+
+    // the coinbases pay to the public key, which is indexed by its key id
+    CKeyID keyID = coinbaseKey.GetPubKey().GetID();
+    valtype addressBytes(32);
+    std::copy(keyID.begin(), keyID.end(), addressBytes.begin());
+    uint256 addressHash(addressBytes);
+    const int type = CTxDestination(PKHash(keyID)).which();
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue>> unspent;
+    BOOST_CHECK(addressindex.FindAddressUnspent(addressHash, type, unspent));
+    BOOST_CHECK(unspent.empty());
+
+    // BlockUntilSyncedToCurrentChain should return false before the index is started.
+    BOOST_CHECK(!addressindex.BlockUntilSyncedToCurrentChain());
+
+    addressindex.Start();
+
+    // Allow the index to catch up with the block index.
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (!addressindex.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        MilliSleep(100);
+    }
+
+    // Every coinbase output of the chain is still unspent and was received once.
+    BOOST_CHECK(addressindex.FindAddressUnspent(addressHash, type, unspent));
+    BOOST_CHECK(!unspent.empty());
+    for (const auto& txn : m_coinbase_txns) {
+        bool found = false;
+        for (const auto& entry : unspent) {
+            found |= entry.first.txhash == txn->GetHash();
+        }
+        BOOST_CHECK(found);
+    }
+    std::vector<std::pair<CAddressIndexKey, CAmount>> deltas;
+    BOOST_CHECK(addressindex.FindAddressIndex(addressHash, type, deltas));
+    BOOST_CHECK_EQUAL(deltas.size(), unspent.size());
+
+    // The summary totals the entries.
+    CAddressSummary summary;
+    BOOST_CHECK(addressindex.FindAddressSummary(addressHash, type, summary));
+    CAmount balance = 0;
+    std::set<uint256> txids;
+    for (const auto& entry : deltas) {
+        balance += entry.second;
+        txids.insert(entry.first.txhash);
+    }
+    BOOST_CHECK_EQUAL(summary.balance, balance);
+    BOOST_CHECK_EQUAL(summary.received, balance);
+    BOOST_CHECK_EQUAL(summary.txCount, txids.size());
+    BOOST_CHECK_EQUAL(summary.firstHeight, deltas.front().first.blockHeight);
+    BOOST_CHECK_EQUAL(summary.lastHeight, deltas.back().first.blockHeight);
+
+    // Reading the entries in pages gives the same entries.
+    std::vector<std::pair<CAddressIndexKey, CAmount>> paged;
+    CAddressIndexKey cursor;
+    do {
+        size_t nRead = paged.size();
+        BOOST_CHECK(addressindex.FindAddressIndex(addressHash, type, paged, 0, 0, 7, &cursor));
+        BOOST_CHECK(paged.size() - nRead <= 7);
+    } while (!cursor.hashBytes.IsNull());
+    BOOST_CHECK_EQUAL(paged.size(), deltas.size());
+    BOOST_CHECK(paged.back().first.txhash == deltas.back().first.txhash);
+
+    // Each block of the active chain has a logical timestamp.
+    std::vector<std::pair<uint256, unsigned int>> hashes;
+    BOOST_CHECK(addressindex.FindTimestamps(std::numeric_limits<unsigned int>::max(), 0, true, hashes));
+    {
+        LOCK(cs_main);
+        BOOST_CHECK_EQUAL(hashes.size(), (size_t)::ChainActive().Height() + 1);
+    }
+
+    // Outputs of new blocks make it into the index.
+    CScript coinbase_script_pub_key = GetScriptForDestination(PKHash(coinbaseKey.GetPubKey()));
+    std::vector<CMutableTransaction> no_txns;
+    const CBlock& block = CreateAndProcessBlock(no_txns, coinbase_script_pub_key);
+    BOOST_CHECK(addressindex.BlockUntilSyncedToCurrentChain());
+    unspent.clear();
+    BOOST_CHECK(addressindex.FindAddressUnspent(addressHash, type, unspent));
+    bool found = false;
+    for (const auto& entry : unspent) {
+        found |= entry.first.txhash == block.vtx[0]->GetHash();
+    }
+    BOOST_CHECK(found);
+
+    // shutdown sequence (c.f. Shutdown() in init.cpp)
+    addressindex.Stop();
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+
+    // Rest of shutdown sequence and destructors happen in ~TestingSetup()
+}
+
+BOOST_FIXTURE_TEST_CASE(addressindex_mempool, TestingSetup)
+{
+    CTxMemPool pool;
+    CCoinsView base;
+    CCoinsViewCache view(&base);
+    TestMemPoolEntryHelper entry;
+
+    const PKHash sender(uint160(valtype(20, 1)));
+    const PKHash receiver(uint160(valtype(20, 2)));
+    const COutPoint coin(InsecureRand256(), 0);
+    view.AddCoin(coin, Coin(CTxOut(3 * COIN, GetScriptForDestination(sender)), 1, false), false);
+
+    // Pays the receiver twice, both outputs are deltas of the same address
+    CMutableTransaction tx1;
+    tx1.vin.emplace_back(coin);
+    tx1.vout.emplace_back(COIN, GetScriptForDestination(receiver));
+    tx1.vout.emplace_back(COIN, GetScriptForDestination(receiver));
+    const CTransaction tx1Final(tx1);
+    AddCoins(view, tx1Final, MEMPOOL_HEIGHT);
+
+    CMutableTransaction tx2;
+    tx2.vin.emplace_back(COutPoint(tx1Final.GetHash(), 0));
+    tx2.vout.emplace_back(COIN, GetScriptForDestination(sender));
+    const CTransaction tx2Final(tx2);
+
+    LOCK2(cs_main, pool.cs);
+    for (const CTransaction* tx : {&tx1Final, &tx2Final}) {
+        pool.addAddressIndex(entry.FromTx(*tx), view);
+        pool.addSpentIndex(entry.FromTx(*tx), view);
+        pool.addUnchecked(entry.FromTx(*tx));
+    }
+
+    std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>> deltas = MempoolDeltas(pool, sender);
+    BOOST_CHECK_EQUAL(deltas.size(), 2U);
+    for (const auto& delta : deltas) {
+        if (delta.first.spending) {
+            BOOST_CHECK(delta.first.txhash == tx1Final.GetHash());
+            BOOST_CHECK_EQUAL(delta.second.amount, -3 * COIN);
+            BOOST_CHECK(delta.second.prevhash == coin.hash);
+        } else {
+            BOOST_CHECK(delta.first.txhash == tx2Final.GetHash());
+            BOOST_CHECK_EQUAL(delta.second.amount, COIN);
+        }
+    }
+    BOOST_CHECK_EQUAL(MempoolDeltas(pool, receiver).size(), 3U);
+
+    CSpentIndexKey coinKey(coin.hash, coin.n);
+    CSpentIndexKey tx1Key(tx1Final.GetHash(), 0);
+    CSpentIndexValue spent;
+    BOOST_CHECK(pool.getSpentIndex(coinKey, spent));
+    BOOST_CHECK(spent.txid == tx1Final.GetHash());
+    BOOST_CHECK_EQUAL(spent.satoshis, 3 * COIN);
+    BOOST_CHECK_EQUAL(spent.addressType, CTxDestination(sender).which());
+
+    // The index entries go with the transactions leaving the pool, however they leave
+    pool.removeRecursive(tx2Final, MemPoolRemovalReason::CONFLICT);
+    deltas = MempoolDeltas(pool, receiver);
+    BOOST_CHECK_EQUAL(deltas.size(), 2U);
+    for (const auto& delta : deltas) {
+        BOOST_CHECK(delta.first.txhash == tx1Final.GetHash());
+        BOOST_CHECK(!delta.first.spending);
+    }
+    BOOST_CHECK_EQUAL(MempoolDeltas(pool, sender).size(), 1U);
+    BOOST_CHECK(pool.getSpentIndex(coinKey, spent));
+    BOOST_CHECK(!pool.getSpentIndex(tx1Key, spent));
+
+    pool.removeRecursive(tx1Final, MemPoolRemovalReason::CONFLICT);
+    BOOST_CHECK(MempoolDeltas(pool, sender).empty());
+    BOOST_CHECK(MempoolDeltas(pool, receiver).empty());
+    BOOST_CHECK(!pool.getSpentIndex(coinKey, spent));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+#endif
@@ -9,6 +9,7 @@
 #include <consensus/tx_verify.h>
 #include <miner.h>
 #include <policy/policy.h>
+#include <pos.h>
 #include <script/standard.h>
 #include <txmempool.h>
 #include <uint256.h>
@@ -18,6 +19,7 @@
 #include <validation.h>
 
 #include <test/setup_common.h>
+#include <timedata.h>
 
 #include <memory>
 
@@ -640,4 +642,64 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+// Prebuilt PoS templates cover every slot of the window and are only rebuilt when they are stale
+BOOST_FIXTURE_TEST_CASE(stake_template_cache, TestChain100Setup)
+{
+    const uint32_t nSlotTime = STAKE_TIMESTAMP_MASK + 1;
+    const int nSlots = (MAX_STAKE_LOOKAHEAD + STAKE_TIMESTAMP_MASK) / nSlotTime;
+    int64_t nMockTime = GetTime();
+    SetMockTime(nMockTime);
+    uint32_t nBeginningTime = GetAdjustedTime() & ~STAKE_TIMESTAMP_MASK;
+    CScript scriptAuthor = GetScriptForRawPubKey(coinbaseKey.GetPubKey());
+    CScript scriptOther = CScript() << OP_DUP << OP_HASH160 << ToByteVector(CKeyID(uint160(ParseHex("0101010101010101010101010101010101010101")))) << OP_EQUALVERIFY << OP_CHECKSIG;
+    std::unique_ptr<CBlockTemplate> blocktemplate;
+    int64_t nTotalFees = 0;
+
+    StakeTemplateCache templateCache;
+    // nothing is built before the staker selected an author
+    BOOST_CHECK_EQUAL(templateCache.Update(nBeginningTime), 0);
+
+    templateCache.SetAuthor(scriptAuthor);
+    BOOST_CHECK_EQUAL(templateCache.Update(nBeginningTime), nSlots);
+    uint256 hashTip = ::ChainActive().Tip()->GetBlockHash();
+    BOOST_CHECK(templateCache.Get(hashTip, scriptAuthor, nBeginningTime, blocktemplate, nTotalFees));
+    BOOST_CHECK(blocktemplate->block.IsProofOfStake());
+    BOOST_CHECK(blocktemplate->block.nTime == nBeginningTime);
+    BOOST_CHECK(!templateCache.Get(hashTip, scriptOther, nBeginningTime, blocktemplate, nTotalFees));
+    BOOST_CHECK(!templateCache.Get(hashTip, scriptAuthor, nBeginningTime + nSlots * nSlotTime, blocktemplate, nTotalFees));
+
+    // polling an unchanged window builds nothing
+    BOOST_CHECK_EQUAL(templateCache.Update(nBeginningTime), 0);
+
+    // when the window moves on, only the slot that entered it is built and the one that left it is dropped
+    BOOST_CHECK_EQUAL(templateCache.Update(nBeginningTime + nSlotTime), 1);
+    BOOST_CHECK(!templateCache.Get(hashTip, scriptAuthor, nBeginningTime, blocktemplate, nTotalFees));
+    BOOST_CHECK(templateCache.Get(hashTip, scriptAuthor, nBeginningTime + nSlots * nSlotTime, blocktemplate, nTotalFees));
+    BOOST_CHECK(blocktemplate->block.nTime == nBeginningTime + nSlots * nSlotTime);
+    nBeginningTime += nSlotTime;
+
+    // a mempool change rebuilds the slots, but not more often than the refresh interval
+    mempool.AddTransactionsUpdated(1);
+    BOOST_CHECK_EQUAL(templateCache.Update(nBeginningTime), 0);
+    SetMockTime(nMockTime + STAKE_TEMPLATE_REFRESH_INTERVAL);
+    BOOST_CHECK_EQUAL(templateCache.Update(nBeginningTime), nSlots);
+    BOOST_CHECK_EQUAL(templateCache.Update(nBeginningTime), 0);
+
+    // a new tip makes every slot stale
+    CreateAndProcessBlock({}, scriptAuthor);
+    BOOST_CHECK(!templateCache.Get(::ChainActive().Tip()->GetBlockHash(), scriptAuthor, nBeginningTime, blocktemplate, nTotalFees));
+    BOOST_CHECK_EQUAL(templateCache.Update(nBeginningTime), nSlots);
+    BOOST_CHECK(templateCache.Get(::ChainActive().Tip()->GetBlockHash(), scriptAuthor, nBeginningTime, blocktemplate, nTotalFees));
+    BOOST_CHECK(blocktemplate->block.hashPrevBlock == ::ChainActive().Tip()->GetBlockHash());
+    BOOST_CHECK_EQUAL(templateCache.Update(nBeginningTime), 0);
+
+    // so does a new author
+    templateCache.SetAuthor(scriptOther);
+    BOOST_CHECK_EQUAL(templateCache.Update(nBeginningTime), nSlots);
+    BOOST_CHECK(templateCache.Get(::ChainActive().Tip()->GetBlockHash(), scriptOther, nBeginningTime, blocktemplate, nTotalFees));
+    BOOST_CHECK(!templateCache.Get(::ChainActive().Tip()->GetBlockHash(), scriptAuthor, nBeginningTime, blocktemplate, nTotalFees));
+
+    SetMockTime(0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,299 @@
+// Copyright (c) 2015-2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <arith_uint256.h>
+#include <chain.h>
+#include <coins.h>
+#include <consensus/consensus.h>
+#include <key.h>
+#include <pos.h>
+#include <random.h>
+#include <undo.h>
+#include <util/strencodings.h>
+#include <validation.h>
+#include <test/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(pos_tests, BasicTestingSetup)
+
+/* The kernel search must agree with the consensus check of the kernel hash */
+BOOST_AUTO_TEST_CASE(stake_kernel_slot_matches_consensus)
+{
+    CBlockIndex indexPrev;
+    indexPrev.nStakeModifier = InsecureRand256();
+    // easy target so that both outcomes are covered
+    unsigned int nBits = 0x1b00ffff;
+    uint32_t nTimeBlock = 1600000000;
+
+    int nHits = 0;
+    for (int i = 0; i < 2000; i++) {
+        COutPoint prevout(InsecureRand256(), InsecureRandRange(10));
+        CAmount amount = InsecureRandRange(100000) * COIN;
+        uint32_t blockFromTime = nTimeBlock - InsecureRandRange(100000);
+        uint256 hashProofOfStake, targetProofOfStake;
+
+        bool fConsensus = CheckStakeKernelHash(&indexPrev, nBits, blockFromTime, amount, prevout, nTimeBlock, hashProofOfStake, targetProofOfStake);
+        bool fSearch = CheckStakeKernelHash(CStakeKernelSlot(&indexPrev, nBits, nTimeBlock), blockFromTime, amount, prevout);
+        BOOST_CHECK_EQUAL(fConsensus, fSearch);
+        nHits += fSearch;
+    }
+    BOOST_CHECK(nHits > 0 && nHits < 2000);
+
+    // a coin newer than the block never meets the target
+    BOOST_CHECK(!CheckStakeKernelHash(CStakeKernelSlot(&indexPrev, nBits, nTimeBlock), nTimeBlock + 16, 100000 * COIN, COutPoint(InsecureRand256(), 0)));
+}
+
+BOOST_AUTO_TEST_CASE(stake_cache_map)
+{
+    CStakeCacheMap cache;
+    std::vector<COutPoint> prevouts;
+    for (int i = 0; i < 10; i++) {
+        prevouts.emplace_back(InsecureRand256(), i);
+        cache.Add(prevouts.back(), CStakeCache(1000 + i, i * COIN, i));
+    }
+    BOOST_CHECK_EQUAL(cache.Size(), 10U);
+
+    // removing from the middle keeps the other entries reachable
+    cache.Remove(prevouts[3]);
+    cache.Remove(prevouts[0]);
+    cache.Remove(COutPoint(InsecureRand256(), 0));
+    BOOST_CHECK_EQUAL(cache.Size(), 8U);
+    BOOST_CHECK(!cache.Find(prevouts[3]));
+    BOOST_CHECK(!cache.Find(prevouts[0]));
+    for (int i : {1, 2, 4, 5, 6, 7, 8, 9}) {
+        const CStakeCache* stake = cache.Find(prevouts[i]);
+        BOOST_CHECK(stake && stake->blockFromTime == uint32_t(1000 + i) && stake->amount == i * COIN && stake->nHeight == i);
+    }
+
+    // adding an existing coin replaces its entry
+    cache.Add(prevouts[9], CStakeCache(5, 5, 5));
+    BOOST_CHECK_EQUAL(cache.Size(), 8U);
+    BOOST_CHECK_EQUAL(cache.Find(prevouts[9])->blockFromTime, 5U);
+
+    size_t count = 0;
+    for (const auto& entry : cache) {
+        BOOST_CHECK(cache.Find(entry.first) == &entry.second);
+        count++;
+    }
+    BOOST_CHECK_EQUAL(count, 8U);
+
+    cache.Clear();
+    BOOST_CHECK_EQUAL(cache.Size(), 0U);
+}
+
+/* A block spending one coin per input and the undo data holding those coins */
+static void SpendingBlock(const std::vector<COutPoint>& prevouts, CBlock& block, CBlockUndo& blockundo)
+{
+    block.vtx.push_back(MakeTransactionRef(CMutableTransaction()));
+    CMutableTransaction tx;
+    CTxUndo txundo;
+    for (const COutPoint& prevout : prevouts) {
+        tx.vin.emplace_back(prevout);
+        txundo.vprevout.emplace_back(CTxOut(prevout.n * COIN, CScript()), 1, false, false);
+    }
+    block.vtx.push_back(MakeTransactionRef(tx));
+    blockundo.vtxundo.push_back(txundo);
+}
+
+BOOST_AUTO_TEST_CASE(spent_coins_cache)
+{
+    CSpentCoinsCache cache;
+    std::vector<uint256> hashes(COINBASE_MATURITY + 2);
+    std::vector<CBlockIndex> indexes(hashes.size());
+    std::vector<COutPoint> prevouts;
+    for (size_t i = 0; i < indexes.size(); i++) {
+        hashes[i] = InsecureRand256();
+        indexes[i].phashBlock = &hashes[i];
+        indexes[i].nHeight = i;
+        prevouts.emplace_back(InsecureRand256(), i + 1);
+
+        CBlock block;
+        CBlockUndo blockundo;
+        SpendingBlock({prevouts[i]}, block, blockundo);
+        cache.ConnectBlock(&indexes[i], block, blockundo);
+    }
+
+    // only the last COINBASE_MATURITY blocks are kept
+    Coin coin;
+    BOOST_CHECK_EQUAL(cache.Size(), (size_t)COINBASE_MATURITY);
+    BOOST_CHECK(!cache.HasBlock(&indexes[1]));
+    BOOST_CHECK(!cache.GetSpentCoin(&indexes[1], prevouts[1], coin));
+    BOOST_CHECK(cache.HasBlock(&indexes[2]));
+    BOOST_CHECK(cache.GetSpentCoin(&indexes[2], prevouts[2], coin));
+    BOOST_CHECK_EQUAL(coin.out.nValue, 3 * COIN);
+
+    // a coin is only found in the block that spent it
+    BOOST_CHECK(!cache.GetSpentCoin(&indexes[3], prevouts[2], coin));
+    BOOST_CHECK(cache.Find(prevouts[3], coin));
+    BOOST_CHECK_EQUAL(coin.out.nValue, 4 * COIN);
+    BOOST_CHECK(!cache.Find(prevouts[1], coin));
+
+    // a block of another chain at the same height is not in the cache
+    uint256 hashFork = InsecureRand256();
+    CBlockIndex indexFork;
+    indexFork.phashBlock = &hashFork;
+    indexFork.nHeight = indexes.back().nHeight;
+    BOOST_CHECK(!cache.HasBlock(&indexFork));
+    cache.DisconnectBlock(&indexFork);
+    BOOST_CHECK(cache.HasBlock(&indexes.back()));
+
+    cache.DisconnectBlock(&indexes.back());
+    BOOST_CHECK(!cache.HasBlock(&indexes.back()));
+    BOOST_CHECK(!cache.GetSpentCoin(&indexes.back(), prevouts.back(), coin));
+    BOOST_CHECK_EQUAL(cache.Size(), (size_t)COINBASE_MATURITY - 1);
+
+    cache.Clear();
+    BOOST_CHECK_EQUAL(cache.Size(), 0U);
+}
+
+/* A proof-of-stake block whose coinstake pays the key, signed by it */
+static CBlock SignedStakeBlock(const CKey& key)
+{
+    CBlock block;
+    block.nTime = 1600000000 + InsecureRandRange(100000);
+    block.prevoutStake = COutPoint(InsecureRand256(), 1);
+    block.vtx.push_back(MakeTransactionRef(CMutableTransaction()));
+    CMutableTransaction coinstake;
+    coinstake.vin.emplace_back(block.prevoutStake);
+    coinstake.vout.emplace_back();
+    coinstake.vout.emplace_back(COIN, CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG);
+    block.vtx.push_back(MakeTransactionRef(coinstake));
+    BOOST_CHECK(key.Sign(block.GetHashWithoutSign(), block.vchBlockSig));
+    return block;
+}
+
+/* The same signature with the high S value, valid but not canonically encoded */
+static std::vector<unsigned char> HighSSignature(const std::vector<unsigned char>& vchSig)
+{
+    size_t nLenR = vchSig[3];
+    std::vector<unsigned char> r(vchSig.begin() + 4, vchSig.begin() + 4 + nLenR);
+    std::vector<unsigned char> s(vchSig.begin() + 6 + nLenR, vchSig.end());
+    arith_uint256 order = UintToArith256(uint256S("fffffffffffffffffffffffffffffffebaaedce6af48a03bbfd25e8cd0364141"));
+    arith_uint256 high = order - UintToArith256(uint256S(HexStr(s)));
+    s = ParseHex(ArithToUint256(high).GetHex());
+    s.insert(s.begin(), 0);
+
+    std::vector<unsigned char> ret{0x30, (unsigned char)(4 + r.size() + s.size()), 0x02, (unsigned char)r.size()};
+    ret.insert(ret.end(), r.begin(), r.end());
+    ret.push_back(0x02);
+    ret.push_back(s.size());
+    ret.insert(ret.end(), s.begin(), s.end());
+    return ret;
+}
+
+BOOST_AUTO_TEST_CASE(block_signature_cache)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CBlock block = SignedStakeBlock(key);
+
+    // the first check leaves a verification to run, once it passed the signature is cached
+    std::vector<CBlockSignatureCheck> vChecks;
+    BOOST_CHECK(GetBlockSignatureChecks(block, vChecks));
+    BOOST_CHECK_EQUAL(vChecks.size(), 1U);
+    BOOST_CHECK(vChecks[0]());
+    vChecks.clear();
+    BOOST_CHECK(GetBlockSignatureChecks(block, vChecks));
+    BOOST_CHECK(vChecks.empty());
+    BOOST_CHECK(CheckBlockSignature(block));
+
+    // a changed header is a miss and fails verification
+    CBlock blockChanged = block;
+    blockChanged.nTime++;
+    BOOST_CHECK(GetBlockSignatureChecks(blockChanged, vChecks));
+    BOOST_CHECK_EQUAL(vChecks.size(), 1U);
+    BOOST_CHECK(!vChecks[0]());
+    BOOST_CHECK(!CheckBlockSignature(blockChanged));
+    vChecks.clear();
+
+    // a signature by another key is not a hit for the cached one
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    CBlock blockOther = block;
+    BOOST_CHECK(keyOther.Sign(blockOther.GetHashWithoutSign(), blockOther.vchBlockSig));
+    BOOST_CHECK(GetBlockSignatureChecks(blockOther, vChecks));
+    BOOST_CHECK_EQUAL(vChecks.size(), 1U);
+    BOOST_CHECK(!CheckBlockSignature(blockOther));
+    vChecks.clear();
+
+    // a valid signature that fails the canonical encoding check is verified on every check
+    CBlock blockHighS = SignedStakeBlock(key);
+    blockHighS.vchBlockSig = HighSSignature(blockHighS.vchBlockSig);
+    BOOST_CHECK(!CheckCanonicalBlockSignature(&blockHighS));
+    BOOST_CHECK(CheckBlockSignature(blockHighS));
+    BOOST_CHECK(GetBlockSignatureChecks(blockHighS, vChecks));
+    BOOST_CHECK_EQUAL(vChecks.size(), 1U);
+    vChecks.clear();
+
+    // a proof-of-work block has no signature to verify
+    CBlock blockWork;
+    BOOST_CHECK(GetBlockSignatureChecks(blockWork, vChecks));
+    BOOST_CHECK(vChecks.empty());
+    blockWork.vchBlockSig = block.vchBlockSig;
+    BOOST_CHECK(!GetBlockSignatureChecks(blockWork, vChecks));
+}
+
+/* Index entries building on pindexFrom, which must outlive them */
+static void ExtendIndex(CBlockIndex* pindexFrom, std::vector<CBlockIndex>& indexes)
+{
+    for (size_t i = 0; i < indexes.size(); i++) {
+        indexes[i].pprev = i ? &indexes[i - 1] : pindexFrom;
+        indexes[i].nHeight = indexes[i].pprev->nHeight + 1;
+        indexes[i].nTime = indexes[i].pprev->nTime + 16;
+        indexes[i].nStakeModifier = InsecureRand256();
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(header_kernel, TestingSetup)
+{
+    LOCK(cs_main);
+    CBlockIndex* pindexGenesis = ::ChainActive().Tip();
+    std::vector<CBlockIndex> indexes(COINBASE_MATURITY);
+    ExtendIndex(pindexGenesis, indexes);
+    CBlockIndex* pindexPrev = &indexes.back();
+
+    CCoinsView viewDummy;
+    CCoinsViewCache view(&viewDummy);
+
+    CBlockHeader header;
+    header.nBits = 0x1b00ffff;
+    header.nTime = pindexPrev->nTime + 16;
+
+    // the kernel of a coin created by the active chain decides
+    int nHits = 0;
+    for (int i = 0; i < 500; i++) {
+        header.prevoutStake = COutPoint(InsecureRand256(), InsecureRandRange(10));
+        CAmount amount = InsecureRandRange(100000) * COIN;
+        view.AddCoin(header.prevoutStake, Coin(CTxOut(amount, CScript()), 0, false, false), false);
+
+        uint256 hashProofOfStake, targetProofOfStake;
+        bool fKernel = CheckStakeKernelHash(pindexPrev, header.nBits, pindexGenesis->nTime, amount, header.prevoutStake, header.nTime, hashProofOfStake, targetProofOfStake);
+        BOOST_CHECK_EQUAL(CheckHeaderKernel(pindexPrev, header, view), fKernel);
+        nHits += fKernel;
+    }
+    BOOST_CHECK(nHits > 0 && nHits < 500);
+
+    // a coin that is not mature at the header fails
+    header.prevoutStake = COutPoint(InsecureRand256(), 0);
+    view.AddCoin(header.prevoutStake, Coin(CTxOut(COIN, CScript()), 0, false, false), false);
+    BOOST_CHECK(!CheckHeaderKernel(&indexes[COINBASE_MATURITY / 2], header, view));
+
+    // an unknown coin and a coin newer than the header pass, they are checked with the block
+    header.prevoutStake = COutPoint(InsecureRand256(), 0);
+    BOOST_CHECK(CheckHeaderKernel(pindexPrev, header, view));
+    view.AddCoin(header.prevoutStake, Coin(CTxOut(COIN, CScript()), pindexPrev->nHeight + 1, false, false), false);
+    BOOST_CHECK(CheckHeaderKernel(pindexPrev, header, view));
+
+    // a header of a chain that does not contain the block creating the coin passes
+    CBlockIndex indexFork;
+    indexFork.nStakeModifier = InsecureRand256();
+    std::vector<CBlockIndex> indexesFork(COINBASE_MATURITY);
+    ExtendIndex(&indexFork, indexesFork);
+    header.prevoutStake = COutPoint(InsecureRand256(), 0);
+    view.AddCoin(header.prevoutStake, Coin(CTxOut(COIN, CScript()), 0, false, false), false);
+    BOOST_CHECK(CheckHeaderKernel(&indexesFork.back(), header, view));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
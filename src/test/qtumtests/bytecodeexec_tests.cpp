@@ -114,6 +114,25 @@ void checkBCEResult(ByteCodeExecResult result, uint64_t usedGas, CAmount refundS
     BOOST_CHECK(result.valueTransfers.size() == nTxs);
 }
 
+/* Execute the transactions one ByteCodeExec each as ConnectBlock does, return the roots of the block */
+std::pair<dev::h256, dev::h256> executeBlockRoots(const std::vector<QtumTransaction>& txs, bool fDeferDBCommit, std::vector<std::pair<dev::h256, dev::h256>>& receiptRoots){
+    initState();
+    CBlock block(generateBlock());
+    QtumDGP qtumDGP(globalState.get(), fGettingValuesDGP);
+    uint64_t blockGasLimit = qtumDGP.getBlockGasLimit(ChainActive().Tip()->nHeight + 1);
+    for(const QtumTransaction& tx : txs){
+        ByteCodeExec exec(block, std::vector<QtumTransaction>(1, tx), blockGasLimit, ChainActive().Tip());
+        if(fDeferDBCommit)
+            exec.deferDBCommit();
+        BOOST_CHECK(exec.performByteCode());
+        for(const ResultExecute& res : exec.getResult())
+            receiptRoots.emplace_back(res.txRec.stateRoot(), res.txRec.utxoRoot());
+    }
+    globalState->db().commit();
+    globalState->dbUtxo().commit();
+    return std::make_pair(globalState->rootHash(), globalState->rootHashUTXO());
+}
+
 BOOST_FIXTURE_TEST_SUITE(bytecodeexec_tests, TestingSetup)
 
 BOOST_AUTO_TEST_CASE(bytecodeexec_txs_empty){
@@ -135,6 +154,93 @@ BOOST_AUTO_TEST_CASE(bytecodeexec_create_contract){
     checkBCEResult(result.second, 69382, 430618, 1, CAmount(GASLIMIT));
 }
 
+BOOST_AUTO_TEST_CASE(bytecodeexec_result_cache){
+    initState();
+    QtumTransaction txEth = createQtumTransaction(CODE[0], 0, GASLIMIT, dev::u256(1), HASHTX, dev::Address());
+    std::vector<QtumTransaction> txs(1, txEth);
+    CBlock block(generateBlock());
+    QtumDGP qtumDGP(globalState.get(), fGettingValuesDGP);
+    int nHeight = ChainActive().Tip()->nHeight + 1;
+    uint64_t blockGasLimit = qtumDGP.getBlockGasLimit(nHeight);
+    dev::h256 oldHashStateRoot(globalState->rootHash());
+    dev::h256 oldHashUTXORoot(globalState->rootHashUTXO());
+
+    ByteCodeExec exec(block, txs, blockGasLimit, ChainActive().Tip());
+    exec.enableResultCache(nHeight);
+    BOOST_CHECK(exec.performByteCode());
+    dev::h256 newHashStateRoot(globalState->rootHash());
+    dev::h256 newHashUTXORoot(globalState->rootHashUTXO());
+    BOOST_CHECK(newHashStateRoot != oldHashStateRoot);
+
+    // the same execution on the same parent state moves to the cached post state
+    globalState->setRoot(oldHashStateRoot);
+    globalState->setRootUTXO(oldHashUTXORoot);
+    ByteCodeExec execCached(block, txs, blockGasLimit, ChainActive().Tip());
+    execCached.enableResultCache(nHeight);
+    BOOST_CHECK(execCached.performByteCode());
+    BOOST_CHECK(globalState->rootHash() == newHashStateRoot);
+    BOOST_CHECK(globalState->rootHashUTXO() == newHashUTXORoot);
+    BOOST_CHECK(execCached.getResult().size() == 1);
+    BOOST_CHECK(execCached.getResult()[0].execRes.gasUsed == exec.getResult()[0].execRes.gasUsed);
+    BOOST_CHECK(execCached.getResult()[0].execRes.newAddress == exec.getResult()[0].execRes.newAddress);
+    BOOST_CHECK(globalState->addressInUse(exec.getResult()[0].execRes.newAddress));
+
+    ByteCodeExecResult bceExecRes;
+    BOOST_CHECK(execCached.processingResults(bceExecRes));
+    checkBCEResult(bceExecRes, 69382, 430618, 1, CAmount(GASLIMIT));
+}
+
+BOOST_AUTO_TEST_CASE(bytecodeexec_result_cache_missing_state){
+    initState();
+    QtumTransaction txEth = createQtumTransaction(CODE[0], 0, GASLIMIT, dev::u256(1), HASHTX, dev::Address());
+    std::vector<QtumTransaction> txs(1, txEth);
+    CBlock block(generateBlock());
+    QtumDGP qtumDGP(globalState.get(), fGettingValuesDGP);
+    int nHeight = ChainActive().Tip()->nHeight + 1;
+    uint64_t blockGasLimit = qtumDGP.getBlockGasLimit(nHeight);
+
+    ByteCodeExec exec(block, txs, blockGasLimit, ChainActive().Tip());
+    exec.enableResultCache(nHeight);
+    BOOST_CHECK(exec.performByteCode());
+    dev::Address newAddress = exec.getResult()[0].execRes.newAddress;
+    BOOST_CHECK(globalState->accountStateAvailable(newAddress));
+
+    // a new database has the same empty parent state but not the cached post state, the transactions are executed again
+    initState();
+    BOOST_CHECK(!globalState->addressInUse(newAddress));
+    ByteCodeExec execAgain(block, txs, blockGasLimit, ChainActive().Tip());
+    execAgain.enableResultCache(nHeight);
+    BOOST_CHECK(execAgain.performByteCode());
+    BOOST_CHECK(execAgain.getResult().size() == 1);
+    BOOST_CHECK(globalState->addressInUse(newAddress));
+    BOOST_CHECK(globalState->accountStateAvailable(newAddress));
+}
+
+BOOST_AUTO_TEST_CASE(bytecodeexec_deferred_db_commit_roots){
+    // contract creations, value transfers to the same contract and a call that runs out of gas
+    QtumTransaction txCreate = createQtumTransaction(CODE[0], 0, GASLIMIT, dev::u256(1), HASHTX, dev::Address());
+    QtumTransaction txCreateLoop = createQtumTransaction(CODE[2], 0, GASLIMIT, dev::u256(1), ~HASHTX, dev::Address());
+    dev::Address contract = createQtumAddress(txCreate.getHashWith(), txCreate.getNVout());
+    dev::Address contractLoop = createQtumAddress(txCreateLoop.getHashWith(), txCreateLoop.getNVout());
+    std::vector<QtumTransaction> txs = {txCreate, txCreateLoop};
+    for(uint32_t i = 0; i < 4; i++)
+        txs.push_back(createQtumTransaction(valtype(), 1000 * (i + 1), GASLIMIT, dev::u256(1), HASHTX, contract, i + 1));
+    txs.push_back(createQtumTransaction(valtype(), 500, GASLIMIT, dev::u256(1), ~HASHTX, contractLoop, 1));
+    txs.push_back(createQtumTransaction(valtype(), 100, GASLIMIT, dev::u256(1), ~HASHTX, contract, 2));
+
+    std::vector<std::pair<dev::h256, dev::h256>> receiptRoots, receiptRootsDeferred;
+    std::pair<dev::h256, dev::h256> roots = executeBlockRoots(txs, false, receiptRoots);
+    BOOST_CHECK(globalState->balance(contract) == 10100);
+    std::pair<dev::h256, dev::h256> rootsDeferred = executeBlockRoots(txs, true, receiptRootsDeferred);
+
+    // deferring the database writes to the end of the block gives the same hashStateRoot and hashUTXORoot
+    BOOST_CHECK(rootsDeferred.first == roots.first);
+    BOOST_CHECK(rootsDeferred.second == roots.second);
+    BOOST_CHECK(receiptRootsDeferred == receiptRoots);
+    BOOST_CHECK_EQUAL(receiptRoots.size(), txs.size());
+    BOOST_CHECK(globalState->balance(contract) == 10100);
+}
+
 BOOST_AUTO_TEST_CASE(bytecodeexec_create_contract_OutOfGasIntrinsic){
     initState();
     QtumTransaction txEth = createQtumTransaction(CODE[0], 0, dev::u256(100), dev::u256(1), HASHTX, dev::Address());
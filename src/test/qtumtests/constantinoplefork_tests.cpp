@@ -109,6 +109,17 @@ void genesisLoading(){
     globalState->db().commit();
 }
 
+ByteCodeExecResult executeOnBlock(std::vector<QtumTransaction> txs, const CBlockIndex* pindex){
+    CBlock block(generateBlock());
+    QtumDGP qtumDGP(globalState.get(), fGettingValuesDGP);
+    uint64_t blockGasLimit = qtumDGP.getBlockGasLimit(pindex->nHeight + 1);
+    ByteCodeExec exec(block, txs, blockGasLimit, pindex);
+    exec.performByteCode();
+    ByteCodeExecResult bceExecRes;
+    exec.processingResults(bceExecRes);
+    return bceExecRes;
+}
+
 void createNewBlocks(TestChain100Setup* testChain100Setup, size_t n){
     std::function<void(size_t n)> generateBlocks = [&](size_t n){
         dev::h256 oldHashStateRoot = globalState->rootHash();
@@ -222,6 +233,41 @@ BOOST_AUTO_TEST_CASE(checking_constantinople_before_fork){
     BOOST_CHECK(dev::h256(result.first[0].execRes.output) == dev::h256(0x0000000000000000000000000000000000000000000000000000000000000000));
 }
 
+BOOST_AUTO_TEST_CASE(checking_transfer_validation_follows_executed_block){
+    // Initialize
+    initState();
+    dev::h256 hashTx(HASHTX);
+
+    // Callee reverts every call, caller forwards the call value to the callee and ignores the failure
+    std::vector<QtumTransaction> txs;
+    txs.push_back(createQtumTransaction(ParseHex("6460006000fd6000526005601bf3"), 0, GASLIMIT, dev::u256(1), hashTx, dev::Address()));
+    dev::Address callee = createQtumAddress(txs[0].getHashWith(), txs[0].getNVout());
+    txs.push_back(createQtumTransaction(ParseHex("6022600c60003960226000f3600060006000600034" "73" + callee.hex() + "5af15000"), 0, GASLIMIT, dev::u256(1), ++hashTx, dev::Address()));
+    dev::Address caller = createQtumAddress(txs[1].getHashWith(), txs[1].getNVout());
+    executeBC(txs);
+
+    // QIP7 drops the reverted transfer from the condensing transaction, it is active from the tip onwards
+    UpdateConstantinopleBlockHeight(ChainActive().Height());
+    std::vector<QtumTransaction> txsCall;
+    txsCall.push_back(createQtumTransaction(valtype(), 1000, GASLIMIT, dev::u256(1), ++hashTx, caller));
+    dev::h256 oldHashStateRoot(globalState->rootHash());
+    dev::h256 oldHashUTXORoot(globalState->rootHashUTXO());
+
+    // Executed on top of the previous block the old rules apply even though the tip is past the fork
+    ByteCodeExecResult result = executeOnBlock(txsCall, ChainActive().Tip()->pprev);
+    BOOST_CHECK(result.valueTransfers.size() == 1);
+    BOOST_CHECK(result.valueTransfers[0].vout.size() == 1);
+    BOOST_CHECK(result.valueTransfers[0].vout[0].scriptPubKey == CScript() << valtype{0} << valtype{0} << valtype{0} << valtype{0} << callee.asBytes() << OP_CALL);
+
+    // Executed on top of the tip the reverted transfer is dropped
+    globalState->setRoot(oldHashStateRoot);
+    globalState->setRootUTXO(oldHashUTXORoot);
+    result = executeOnBlock(txsCall, ChainActive().Tip());
+    BOOST_CHECK(result.valueTransfers.size() == 1);
+    BOOST_CHECK(result.valueTransfers[0].vout.size() == 1);
+    BOOST_CHECK(result.valueTransfers[0].vout[0].scriptPubKey == CScript() << valtype{0} << valtype{0} << valtype{0} << valtype{0} << caller.asBytes() << OP_CALL);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 }
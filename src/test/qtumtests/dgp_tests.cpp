@@ -592,6 +592,30 @@ BOOST_AUTO_TEST_CASE(min_gas_price_passage_from_130_to_0_three_paramsInstance_te
     }
 }
 
+BOOST_AUTO_TEST_CASE(dgp_follows_contract_state){
+    initState();
+    contractLoading();
+    QtumDGP qtumDGP(globalState.get());
+    BOOST_CHECK(qtumDGP.getBlockSize(502) == DEFAULT_BLOCK_SIZE_DGP);
+    dev::h256 oldHashStateRoot = globalState->rootHash();
+    dev::h256 oldHashUTXORoot = globalState->rootHashUTXO();
+
+    // the change of the contract storage is seen by the next call
+    dev::h256 hashTemp(hash);
+    std::vector<QtumTransaction> txs;
+    txs.push_back(createQtumTransaction(code[0], 0, dev::u256(500000), dev::u256(1), hashTemp, DGPContract, 0));
+    txs.push_back(createQtumTransaction(code[7], 0, dev::u256(500000), dev::u256(1), ++hashTemp, dev::Address(), 0));
+    txs.push_back(createQtumTransaction(code[2], 0, dev::u256(500000), dev::u256(1), ++hashTemp, DGPContract, 0));
+    auto result = executeBC(txs);
+    BOOST_CHECK(qtumDGP.getBlockSize(502) == 1000000);
+    BOOST_CHECK(qtumDGP.getBlockSize(502) == 1000000);
+
+    // rewinding the state, as a disconnected block does, gives the older value again
+    globalState->setRoot(oldHashStateRoot);
+    globalState->setRootUTXO(oldHashUTXORoot);
+    BOOST_CHECK(qtumDGP.getBlockSize(502) == DEFAULT_BLOCK_SIZE_DGP);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 }
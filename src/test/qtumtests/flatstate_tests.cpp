@@ -0,0 +1,124 @@
+#include <boost/test/unit_test.hpp>
+#include <qtum/flatstate.h>
+#include <qtumtests/test_utils.h>
+
+namespace flatstateTest{
+
+const dev::u256 GASLIMIT = dev::u256(500000);
+const dev::h256 HASHTX = dev::h256(ParseHex("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"));
+// constructor stores 0x2a in slot 1 and deploys a single STOP as code
+const valtype CODE(ParseHex("602a6001556001601160003960016000f300"));
+
+BOOST_FIXTURE_TEST_SUITE(flatstate_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(flatstate_follows_state_root){
+    initState();
+    fs::path path = GetDataDir() / "flatstate";
+    dev::h256 oldHashStateRoot(globalState->rootHash());
+    {
+        FlatState flat(path);
+        BOOST_CHECK(flat.Sync(globalState->db(), oldHashStateRoot));
+    }
+
+    QtumTransaction txCreate = createQtumTransaction(CODE, 0, GASLIMIT, dev::u256(1), HASHTX, dev::Address());
+    dev::Address contract = createQtumAddress(txCreate.getHashWith(), txCreate.getNVout());
+    executeBC(std::vector<QtumTransaction>(1, txCreate));
+    QtumTransaction txCall = createQtumTransaction(valtype(), 1000, GASLIMIT, dev::u256(1), ~HASHTX, contract);
+    executeBC(std::vector<QtumTransaction>(1, txCall));
+    dev::h256 newHashStateRoot(globalState->rootHash());
+
+    FlatState flat(path);
+    BOOST_CHECK(flat.GetRoot() == oldHashStateRoot);
+    BOOST_CHECK(flat.Sync(globalState->db(), newHashStateRoot));
+    BOOST_CHECK(flat.GetRoot() == newHashStateRoot);
+
+    FlatAccount account;
+    BOOST_CHECK(flat.ReadAccount(flat.GetRoot(), contract, account));
+    BOOST_CHECK(account.balance == 1000);
+    BOOST_CHECK(account.codeHash == dev::sha3(ParseHex("00")));
+    std::map<dev::h256, std::pair<dev::u256, dev::u256>> storage;
+    BOOST_CHECK(flat.ReadStorage(flat.GetRoot(), contract, storage));
+    BOOST_CHECK(storage.size() == 1);
+    BOOST_CHECK(storage == globalState->storage(contract));
+    // reads at another root fall back to the trie
+    BOOST_CHECK(!flat.ReadAccount(oldHashStateRoot, contract, account));
+    BOOST_CHECK(!flat.ReadStorage(oldHashStateRoot, contract, storage));
+
+    // disconnecting is the same diff in the other direction
+    BOOST_CHECK(flat.Sync(globalState->db(), oldHashStateRoot));
+    BOOST_CHECK(!flat.ReadAccount(flat.GetRoot(), contract, account));
+    storage.clear();
+    BOOST_CHECK(flat.ReadStorage(flat.GetRoot(), contract, storage));
+    BOOST_CHECK(storage.empty());
+}
+
+BOOST_AUTO_TEST_CASE(flatstate_execution_matches_trie){
+    initState();
+    FlatState flat(GetDataDir() / "flatstate_execution");
+    QtumTransaction txCreate = createQtumTransaction(CODE, 0, GASLIMIT, dev::u256(1), HASHTX, dev::Address());
+    dev::Address contract = createQtumAddress(txCreate.getHashWith(), txCreate.getNVout());
+    executeBC(std::vector<QtumTransaction>(1, txCreate));
+    dev::h256 hashStateRoot(globalState->rootHash());
+    dev::h256 hashUTXORoot(globalState->rootHashUTXO());
+    BOOST_CHECK(flat.Sync(globalState->db(), hashStateRoot));
+
+    // the accounts of the call are loaded from the flat copy
+    QtumTransaction txCall = createQtumTransaction(valtype(), 1000, GASLIMIT, dev::u256(1), ~HASHTX, contract);
+    globalState->setFlatState(&flat);
+    executeBC(std::vector<QtumTransaction>(1, txCall));
+    dev::h256 hashStateRootFlat(globalState->rootHash());
+    dev::h256 hashUTXORootFlat(globalState->rootHashUTXO());
+    // the copy is behind the new root, the next call reads the trie
+    FlatAccount account;
+    BOOST_CHECK(!flat.ReadAccount(globalState->rootHash(), contract, account));
+    executeBC(std::vector<QtumTransaction>(1, txCall));
+    dev::h256 hashStateRootFlatNext(globalState->rootHash());
+    globalState->setFlatState(nullptr);
+
+    // the same calls from the trie end in the same state
+    globalState->setRoot(hashStateRoot);
+    globalState->setRootUTXO(hashUTXORoot);
+    executeBC(std::vector<QtumTransaction>(1, txCall));
+    BOOST_CHECK(globalState->rootHash() == hashStateRootFlat);
+    BOOST_CHECK(globalState->rootHashUTXO() == hashUTXORootFlat);
+    BOOST_CHECK(globalState->balance(contract) == 1000);
+    executeBC(std::vector<QtumTransaction>(1, txCall));
+    BOOST_CHECK(globalState->rootHash() == hashStateRootFlatNext);
+}
+
+BOOST_AUTO_TEST_CASE(flatstate_rebuilds_in_background){
+    initState();
+    fs::path path = GetDataDir() / "flatstate_rebuild";
+    QtumTransaction txCreate = createQtumTransaction(CODE, 0, GASLIMIT, dev::u256(1), HASHTX, dev::Address());
+    dev::Address contract = createQtumAddress(txCreate.getHashWith(), txCreate.getNVout());
+    executeBC(std::vector<QtumTransaction>(1, txCreate));
+    QtumTransaction txCall = createQtumTransaction(valtype(), 1000, GASLIMIT, dev::u256(1), ~HASHTX, contract);
+    executeBC(std::vector<QtumTransaction>(1, txCall));
+
+    FlatState flat(path);
+    BOOST_CHECK(flat.Sync(globalState->db(), globalState->rootHash()));
+
+    // a state database without the nodes of the root the copy reflects, as after -prunestate
+    initState();
+    executeBC(std::vector<QtumTransaction>(1, txCreate));
+    dev::h256 hashStateRoot(globalState->rootHash());
+    BOOST_CHECK(!flat.Sync(globalState->db(), hashStateRoot));
+    BOOST_CHECK(!flat.GetRoot());
+
+    flat.StartRebuild(std::make_shared<const dev::OverlayDB>(globalState->db()), hashStateRoot);
+    // updates are skipped until the rebuild completes
+    BOOST_CHECK(!flat.Sync(globalState->db(), hashStateRoot) || !flat.IsRebuilding());
+    while(flat.IsRebuilding())
+        MilliSleep(10);
+    BOOST_CHECK(flat.GetRoot() == hashStateRoot);
+    FlatAccount account;
+    BOOST_CHECK(flat.ReadAccount(flat.GetRoot(), contract, account));
+    BOOST_CHECK(account.balance == 0);
+    std::map<dev::h256, std::pair<dev::u256, dev::u256>> storage;
+    BOOST_CHECK(flat.ReadStorage(flat.GetRoot(), contract, storage));
+    BOOST_CHECK(storage == globalState->storage(contract));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}
@@ -0,0 +1,102 @@
+#include <boost/test/unit_test.hpp>
+#include <qtumtests/test_utils.h>
+#include <txdb.h>
+
+namespace logbloomTest{
+
+const dev::Address addressA(0x55);
+const dev::Address addressB(0x66);
+
+dev::h2048 createBloom(const dev::Address& address, const dev::h256& topic){
+    return dev::eth::LogEntry(address, {topic}, dev::bytes()).bloom();
+}
+
+void connectLogs(CBlockTreeDB& db, unsigned int height, const dev::Address& address, const dev::h256& topic){
+    BOOST_CHECK(db.WriteHeightIndex(CHeightTxIndexKey(height, address), {uint256S(std::to_string(height))}));
+    BOOST_CHECK(db.WriteLogBloom(height, createBloom(address, topic)));
+}
+
+std::function<bool(const dev::h2048&)> addressFilter(const dev::Address& address){
+    dev::h2048 wanted = dev::h2048().shiftBloom<3>(dev::sha3(address.ref()));
+    return [wanted](const dev::h2048& bloom){ return bloom.contains(wanted); };
+}
+
+BOOST_FIXTURE_TEST_SUITE(logbloom_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(logbloom_skips_blocks_and_ranges){
+    CBlockTreeDB db(1 << 20, true, false);
+    db.WriteFlag("logbloom", true);
+
+    connectLogs(db, 1, addressA, dev::h256(0x11));
+    connectLogs(db, 2, addressB, dev::h256(0x22));
+    connectLogs(db, LOG_BLOOM_RANGE_SIZE + 1, addressA, dev::h256(0x33));
+
+    // Blocks without the address are skipped but the cursor still advances past them
+    std::vector<std::vector<uint256>> hashes;
+    int height = db.ReadHeightIndex(1, -1, 0, hashes, {}, addressFilter(addressB));
+    BOOST_CHECK_EQUAL(height, (int)LOG_BLOOM_RANGE_SIZE + 1);
+    BOOST_CHECK_EQUAL(hashes.size(), 1U);
+    BOOST_CHECK(hashes[0][0] == uint256S("2"));
+
+    hashes.clear();
+    height = db.ReadHeightIndex(1, -1, 0, hashes, {}, addressFilter(addressA));
+    BOOST_CHECK_EQUAL(height, (int)LOG_BLOOM_RANGE_SIZE + 1);
+    BOOST_CHECK_EQUAL(hashes.size(), 2U);
+
+    // The range bloom is rebuilt from the remaining blocks on disconnect
+    dev::h2048 rangeBloom;
+    unsigned int lastHeight = 0;
+    BOOST_CHECK(db.EraseHeightIndex(2));
+    BOOST_CHECK(db.EraseLogBloom(2));
+    BOOST_CHECK(db.ReadLogBloomRange(0, rangeBloom, lastHeight));
+    BOOST_CHECK_EQUAL(lastHeight, 1U);
+    BOOST_CHECK(rangeBloom == createBloom(addressA, dev::h256(0x11)));
+
+    BOOST_CHECK(db.EraseHeightIndex(1));
+    BOOST_CHECK(db.EraseLogBloom(1));
+    BOOST_CHECK(!db.ReadLogBloomRange(0, rangeBloom, lastHeight));
+
+    // Wiping the height index drops the blooms and the completeness flag
+    bool fLogBloom = true;
+    BOOST_CHECK(db.WipeHeightIndex());
+    BOOST_CHECK(!db.ReadLogBloom(LOG_BLOOM_RANGE_SIZE + 1, rangeBloom));
+    BOOST_CHECK(db.ReadFlag("logbloom", fLogBloom));
+    BOOST_CHECK(!fLogBloom);
+}
+
+BOOST_AUTO_TEST_CASE(logbloom_missing_bloom_may_match){
+    CBlockTreeDB db(1 << 20, true, false);
+
+    BOOST_CHECK(db.WriteHeightIndex(CHeightTxIndexKey(5, addressA), {uint256S("5")}));
+
+    std::vector<std::vector<uint256>> hashes;
+    int height = db.ReadHeightIndex(1, -1, 0, hashes, {}, addressFilter(addressB));
+    BOOST_CHECK_EQUAL(height, 5);
+    BOOST_CHECK_EQUAL(hashes.size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(heightindex_limit_stops_at_block_end){
+    CBlockTreeDB db(1 << 20, true, false);
+
+    BOOST_CHECK(db.WriteHeightIndex(CHeightTxIndexKey(1, addressA), {uint256S("1")}));
+    BOOST_CHECK(db.WriteHeightIndex(CHeightTxIndexKey(2, addressA), {uint256S("2")}));
+    BOOST_CHECK(db.WriteHeightIndex(CHeightTxIndexKey(2, addressB), {uint256S("2")}));
+    BOOST_CHECK(db.WriteHeightIndex(CHeightTxIndexKey(3, addressA), {uint256S("3")}));
+
+    // The limit is reached in block 2 but its other address is still read
+    std::vector<std::vector<uint256>> hashes;
+    int height = db.ReadHeightIndex(1, -1, 0, hashes, {}, nullptr, 2);
+    BOOST_CHECK_EQUAL(height, 2);
+    BOOST_CHECK_EQUAL(hashes.size(), 3U);
+
+    // The next call continues after the last block read
+    hashes.clear();
+    height = db.ReadHeightIndex(height + 1, -1, 0, hashes, {}, nullptr, 2);
+    BOOST_CHECK_EQUAL(height, 3);
+    BOOST_CHECK_EQUAL(hashes.size(), 1U);
+    BOOST_CHECK(hashes[0][0] == uint256S("3"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}
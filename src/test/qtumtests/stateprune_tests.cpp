@@ -0,0 +1,70 @@
+#include <boost/test/unit_test.hpp>
+#include <qtum/stateprune.h>
+#include <qtumtests/test_utils.h>
+
+namespace statepruneTest{
+
+const dev::u256 GASLIMIT = dev::u256(500000);
+const dev::h256 HASHTX = dev::h256(ParseHex("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"));
+/*
+    contract Temp {
+        function () payable {}
+    }
+*/
+const valtype CODE(ParseHex("6060604052346000575b60398060166000396000f30060606040525b600b5b5b565b0000a165627a7a723058209cedb722bf57a30e3eb00eeefc392103ea791a2001deed29f5c3809ff10eb1dd0029"));
+
+void openState(const fs::path& path, dev::eth::BaseState baseState){
+    const dev::h256 hashDB(dev::sha3(dev::rlp("")));
+    globalState = std::unique_ptr<QtumState>(new QtumState(dev::u256(0), QtumState::openDB(path.string(), hashDB, dev::WithExisting::Trust), path.string(), baseState));
+}
+
+BOOST_FIXTURE_TEST_SUITE(stateprune_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(stateprune_keeps_reachable_state){
+    fs::path pathState = GetDataDir() / "stateprune";
+    fs::create_directories(pathState);
+    openState(pathState, dev::eth::BaseState::Empty);
+    globalState->setRootUTXO(dev::sha3(dev::rlp("")));
+
+    QtumTransaction txCreate = createQtumTransaction(CODE, 0, GASLIMIT, dev::u256(1), HASHTX, dev::Address());
+    dev::Address contract = createQtumAddress(txCreate.getHashWith(), txCreate.getNVout());
+    executeBC(std::vector<QtumTransaction>(1, txCreate));
+    dev::h256 oldHashStateRoot(globalState->rootHash());
+
+    QtumTransaction txCall = createQtumTransaction(valtype(), 1000, GASLIMIT, dev::u256(1), ~HASHTX, contract);
+    executeBC(std::vector<QtumTransaction>(1, txCall));
+    dev::h256 newHashStateRoot(globalState->rootHash());
+    dev::h256 newHashUTXORoot(globalState->rootHashUTXO());
+    BOOST_CHECK(oldHashStateRoot != newHashStateRoot);
+    globalState.reset();
+
+    // nothing is deleted when none of the roots are known
+    BOOST_CHECK(!PruneContractState(pathState, {dev::h256(1)}, {dev::h256(2)}));
+    openState(pathState, dev::eth::BaseState::PreExisting);
+    BOOST_CHECK(globalState->db().exists(oldHashStateRoot));
+    globalState.reset();
+
+    BOOST_CHECK(PruneContractState(pathState, {newHashStateRoot}, {newHashUTXORoot}));
+    openState(pathState, dev::eth::BaseState::PreExisting);
+    BOOST_CHECK(!globalState->db().exists(oldHashStateRoot));
+    BOOST_CHECK(globalState->db().exists(newHashStateRoot));
+    BOOST_CHECK(!globalState->rootsAvailable(oldHashStateRoot, newHashUTXORoot));
+    BOOST_CHECK(globalState->rootsAvailable(newHashStateRoot, newHashUTXORoot));
+
+    // no snapshot is made of a block whose state was pruned
+    {
+        LOCK(cs_main);
+        CBlockIndex index;
+        index.hashStateRoot = h256Touint(oldHashStateRoot);
+        index.hashUTXORoot = h256Touint(newHashUTXORoot);
+        BOOST_CHECK(!ContractStateSnapshot::Create(&index));
+    }
+    globalState->setRoot(newHashStateRoot);
+    globalState->setRootUTXO(newHashUTXORoot);
+    BOOST_CHECK(globalState->balance(contract) == 1000);
+    BOOST_CHECK(globalState->code(contract) == ParseHex("60606040525b600b5b5b565b0000a165627a7a723058209cedb722bf57a30e3eb00eeefc392103ea791a2001deed29f5c3809ff10eb1dd0029"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}
@@ -0,0 +1,212 @@
+#include <boost/test/unit_test.hpp>
+#include <qtumtests/test_utils.h>
+
+namespace storageresultsTest{
+
+TransactionReceiptInfo createReceipt(const uint256& hashTx, size_t logSize){
+    dev::eth::LogEntries logs;
+    logs.push_back(dev::eth::LogEntry(dev::Address(0x55), {dev::h256(0x11), dev::h256(0x22)}, dev::bytes(logSize, 0x33)));
+    return TransactionReceiptInfo{
+        uint256S("0x01"), 10, hashTx, 2, 0,
+        dev::Address(0x01), dev::Address(0x02),
+        21000, 21000, dev::Address(),
+        logs,
+        dev::eth::TransactionException::None, "",
+        dev::h256(0x44), dev::h256(0x45),
+        {}, {}
+    };
+}
+
+CTransactionRef createTransaction(uint32_t n){
+    CMutableTransaction tx;
+    tx.nLockTime = n;
+    return MakeTransactionRef(tx);
+}
+
+bool sameReceipt(const TransactionReceiptInfo& a, const TransactionReceiptInfo& b){
+    if(a.logs.size() != b.logs.size())
+        return false;
+    for(size_t i = 0; i < a.logs.size(); i++){
+        if(a.logs[i].address != b.logs[i].address || a.logs[i].topics != b.logs[i].topics || a.logs[i].data != b.logs[i].data)
+            return false;
+    }
+    return a.blockHash == b.blockHash && a.blockNumber == b.blockNumber && a.transactionHash == b.transactionHash &&
+        a.transactionIndex == b.transactionIndex && a.outputIndex == b.outputIndex && a.from == b.from && a.to == b.to &&
+        a.cumulativeGasUsed == b.cumulativeGasUsed && a.gasUsed == b.gasUsed && a.contractAddress == b.contractAddress &&
+        a.excepted == b.excepted && a.exceptedMessage == b.exceptedMessage && a.stateRoot == b.stateRoot &&
+        a.utxoRoot == b.utxoRoot && a.createdContracts == b.createdContracts && a.destructedContracts == b.destructedContracts;
+}
+
+BOOST_FIXTURE_TEST_SUITE(storageresults_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(storageresults_pending_and_commit){
+    StorageResults storage((GetDataDir() / "storageresults_pending").string());
+    CTransactionRef tx = createTransaction(1);
+    dev::h256 hashTx = uintToh256(tx->GetHash());
+
+    std::vector<TransactionReceiptInfo> receipts{createReceipt(tx->GetHash(), 32)};
+    storage.addResult(hashTx, receipts);
+    BOOST_CHECK_EQUAL(storage.getResult(hashTx).size(), 1U);
+
+    // dropped results of a failed block are not written
+    storage.clearCacheResult();
+    BOOST_CHECK(storage.getResult(hashTx).empty());
+
+    storage.addResult(hashTx, receipts);
+    storage.commitResults();
+    std::vector<TransactionReceiptInfo> result = storage.getResult(hashTx);
+    BOOST_CHECK_EQUAL(result.size(), 1U);
+    BOOST_CHECK(result[0].transactionHash == tx->GetHash());
+    BOOST_CHECK(result[0].logs[0].data == dev::bytes(32, 0x33));
+
+    storage.deleteResults({tx});
+    BOOST_CHECK(storage.getResult(hashTx).empty());
+}
+
+BOOST_AUTO_TEST_CASE(storageresults_commit_replaces_stored){
+    std::string path = (GetDataDir() / "storageresults_replace").string();
+    CTransactionRef tx = createTransaction(1);
+    dev::h256 hashTx = uintToh256(tx->GetHash());
+    {
+        StorageResults storage(path);
+        std::vector<TransactionReceiptInfo> receipts{createReceipt(tx->GetHash(), 32)};
+        storage.addResult(hashTx, receipts);
+        storage.commitResults();
+
+        // receipts committed again for the same transaction replace the stored ones, in the cache too
+        receipts[0].blockNumber = 11;
+        storage.addResult(hashTx, receipts);
+        storage.commitResults();
+        std::vector<TransactionReceiptInfo> result = storage.getResult(hashTx);
+        BOOST_CHECK_EQUAL(result.size(), 1U);
+        BOOST_CHECK(result.size() == 1 && result[0].blockNumber == 11);
+    }
+
+    StorageResults storage(path);
+    std::vector<TransactionReceiptInfo> result = storage.getResult(hashTx);
+    BOOST_CHECK_EQUAL(result.size(), 1U);
+    BOOST_CHECK(result.size() == 1 && result[0].blockNumber == 11);
+}
+
+BOOST_AUTO_TEST_CASE(storageresults_bounded_cache){
+    const size_t cacheSize = 16 << 10;
+    StorageResults storage((GetDataDir() / "storageresults_bounded").string(), cacheSize);
+
+    std::vector<CTransactionRef> txs;
+    for(uint32_t i = 0; i < 200; i++){
+        CTransactionRef tx = createTransaction(i);
+        std::vector<TransactionReceiptInfo> receipts{createReceipt(tx->GetHash(), 1000)};
+        storage.addResult(uintToh256(tx->GetHash()), receipts);
+        txs.push_back(tx);
+    }
+    storage.commitResults();
+    BOOST_CHECK(storage.cacheUsage() <= cacheSize);
+
+    // evicted results are read back from the database
+    for(const CTransactionRef& tx : txs){
+        std::vector<TransactionReceiptInfo> result = storage.getResult(uintToh256(tx->GetHash()));
+        BOOST_CHECK_EQUAL(result.size(), 1U);
+        BOOST_CHECK(storage.cacheUsage() <= cacheSize);
+    }
+    BOOST_CHECK(storage.cacheUsage() > 0);
+}
+
+BOOST_AUTO_TEST_CASE(storageresults_compact_encoding){
+    std::string path = (GetDataDir() / "storageresults_compact").string();
+    CTransactionRef tx = createTransaction(1);
+    dev::h256 hashTx = uintToh256(tx->GetHash());
+
+    std::vector<TransactionReceiptInfo> receipts{createReceipt(tx->GetHash(), 0), createReceipt(tx->GetHash(), 100), createReceipt(tx->GetHash(), 7)};
+    receipts[1].outputIndex = 1;
+    receipts[1].logs[0].data[50] = 0x01;
+    receipts[1].stateRoot = dev::h256(0x46);
+    receipts[1].excepted = dev::eth::TransactionException::OutOfGas;
+    receipts[1].exceptedMessage = "out of gas";
+    receipts[1].createdContracts.push_back(std::make_pair(dev::Address(0x03), dev::bytes(10, 0x60)));
+    receipts[2].blockNumber = 11;
+    receipts[2].cumulativeGasUsed = uint64_t(1) << 40;
+    receipts[2].destructedContracts.push_back(dev::Address(0x04));
+    {
+        StorageResults storage(path);
+        storage.addResult(hashTx, receipts);
+        storage.commitResults();
+    }
+
+    // reopening the database bypasses the read cache
+    StorageResults storage(path);
+    std::vector<TransactionReceiptInfo> result = storage.getResult(hashTx);
+    BOOST_CHECK_EQUAL(result.size(), receipts.size());
+    for(size_t i = 0; i < result.size() && i < receipts.size(); i++){
+        BOOST_CHECK(sameReceipt(result[i], receipts[i]));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(storageresults_upgrade_legacy){
+    std::string path = (GetDataDir() / "storageresults_legacy").string();
+    CTransactionRef tx = createTransaction(1);
+    dev::h256 hashTx = uintToh256(tx->GetHash());
+    TransactionReceiptInfo receipt = createReceipt(tx->GetHash(), 64);
+
+    {
+        // write the receipt the way older versions did, RLP encoded and keyed by the hex hash
+        leveldb::DB* db;
+        leveldb::Options options;
+        options.create_if_missing = true;
+        fs::create_directories(path);
+        BOOST_CHECK(leveldb::DB::Open(options, path + "/resultsDB", &db).ok());
+
+        logEntriesSerialize logs;
+        for(const auto& log : receipt.logs){
+            logs.push_back(std::make_pair(log.address, std::make_pair(log.topics, log.data)));
+        }
+        dev::RLPStream streamRLP(17);
+        streamRLP << std::vector<dev::h256>{uintToh256(receipt.blockHash)} << std::vector<uint32_t>{receipt.blockNumber};
+        streamRLP << std::vector<dev::h256>{hashTx} << std::vector<uint32_t>{receipt.transactionIndex} << std::vector<uint32_t>{receipt.outputIndex};
+        streamRLP << std::vector<dev::h160>{receipt.from} << std::vector<dev::h160>{receipt.to};
+        streamRLP << std::vector<dev::u256>{receipt.cumulativeGasUsed} << std::vector<dev::u256>{receipt.gasUsed};
+        streamRLP << std::vector<dev::h160>{receipt.contractAddress} << std::vector<logEntriesSerialize>{logs};
+        streamRLP << std::vector<uint32_t>{uint32_t(receipt.excepted)} << std::vector<std::string>{receipt.exceptedMessage};
+        streamRLP << std::vector<dev::h256>{receipt.stateRoot} << std::vector<dev::h256>{receipt.utxoRoot};
+        streamRLP << std::vector<std::vector<std::pair<dev::h160, dev::bytes>>>{receipt.createdContracts};
+        streamRLP << std::vector<std::vector<dev::h160>>{receipt.destructedContracts};
+        dev::bytes data = streamRLP.out();
+        BOOST_CHECK(db->Put(leveldb::WriteOptions(), hashTx.hex(), leveldb::Slice((const char*)data.data(), data.size())).ok());
+        delete db;
+    }
+
+    StorageResults storage(path);
+    std::vector<TransactionReceiptInfo> result = storage.getResult(hashTx);
+    BOOST_CHECK_EQUAL(result.size(), 1U);
+    BOOST_CHECK(result.size() == 1 && sameReceipt(result[0], receipt));
+}
+
+BOOST_AUTO_TEST_CASE(storageresults_upgrade_keeps_undecodable){
+    std::string path = (GetDataDir() / "storageresults_undecodable").string();
+    dev::h256 hashTx = uintToh256(createTransaction(1)->GetHash());
+    leveldb::Options options;
+    options.create_if_missing = true;
+    {
+        leveldb::DB* db;
+        fs::create_directories(path);
+        BOOST_CHECK(leveldb::DB::Open(options, path + "/resultsDB", &db).ok());
+        BOOST_CHECK(db->Put(leveldb::WriteOptions(), hashTx.hex(), "not rlp").ok());
+        delete db;
+    }
+
+    {
+        StorageResults storage(path);
+        BOOST_CHECK(storage.getResult(hashTx).empty());
+    }
+
+    // the entry that could not be converted is left in place
+    leveldb::DB* db;
+    BOOST_CHECK(leveldb::DB::Open(options, path + "/resultsDB", &db).ok());
+    std::string value;
+    BOOST_CHECK(db->Get(leveldb::ReadOptions(), hashTx.hex(), &value).ok());
+    BOOST_CHECK_EQUAL(value, "not rlp");
+    delete db;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}
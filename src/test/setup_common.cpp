@@ -120,6 +120,10 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
     nScriptCheckThreads = 3;
     for (int i = 0; i < nScriptCheckThreads - 1; i++)
         threadGroup.create_thread([i]() { return ThreadScriptCheck(i); });
+    for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        threadGroup.create_thread([i]() { return ThreadBlockSignatureCheck(i); });
+    for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        threadGroup.create_thread([i]() { return ThreadMemPoolScriptCheck(i); });
 
     g_banman = MakeUnique<BanMan>(GetDataDir() / "banlist.dat", nullptr, DEFAULT_MISBEHAVING_BANTIME);
     g_connman = MakeUnique<CConnman>(0x1337, 0x1337); // Deterministic randomness for tests.
@@ -2,8 +2,11 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <consensus/merkle.h>
 #include <consensus/validation.h>
 #include <key.h>
+#include <miner.h>
+#include <pow.h>
 #include <validation.h>
 #include <txmempool.h>
 #include <script/standard.h>
@@ -97,6 +100,187 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0U);
 }
 
+BOOST_FIXTURE_TEST_CASE(contract_tx_invalid_signature_block, TestChain100Setup)
+{
+    // The signature checks of contract transactions run on the script check
+    // threads while the contracts of the block are executed. A block with an
+    // invalid signature in such a transaction must still be rejected.
+
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    // Call to an address without a contract, it does not change the state
+    const uint64_t gasLimit = 100000;
+    const uint64_t gasPrice = DEFAULT_MIN_GAS_PRICE_DGP;
+    CMutableTransaction call;
+    call.nVersion = 1;
+    call.vin.resize(1);
+    call.vin[0].prevout.hash = m_coinbase_txns[0]->GetHash();
+    call.vin[0].prevout.n = 0;
+    call.vout.resize(2);
+    call.vout[0].nValue = 0;
+    call.vout[0].scriptPubKey = CScript() << CScriptNum(VersionVM::GetEVMDefault().toRaw()) << CScriptNum(gasLimit) << CScriptNum(gasPrice)
+                                          << ParseHex("00") << ParseHex("abababababababababababababababababababab") << OP_CALL;
+    call.vout[1].nValue = m_coinbase_txns[0]->vout[0].nValue - gasLimit * gasPrice - COIN;
+    call.vout[1].scriptPubKey = scriptPubKey;
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, call, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    CMutableTransaction bad_call = call;
+    std::vector<unsigned char> vchBadSig = vchSig;
+    vchBadSig[vchBadSig.size() - 2] ^= 1;
+    call.vin[0].scriptSig << vchSig;
+    bad_call.vin[0].scriptSig << vchBadSig;
+
+    // The block assembler adds the gas refund and the state roots of the call
+    BOOST_CHECK(ToMemPool(call));
+    const CChainParams& chainparams = Params();
+    std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+    CBlock block = pblocktemplate->block;
+    BOOST_REQUIRE_EQUAL(block.vtx.size(), 2U);
+    BOOST_REQUIRE(block.vtx[1]->GetHash() == call.GetHash());
+
+    // The same block with the invalid signature is rejected
+    CBlock bad_block = block;
+    bad_block.vtx[1] = MakeTransactionRef(bad_call);
+    bad_block.hashMerkleRoot = BlockMerkleRoot(bad_block);
+    while (!CheckProofOfWork(bad_block.GetHash(), bad_block.nBits, chainparams.GetConsensus())) ++bad_block.nNonce;
+    ProcessNewBlock(chainparams, std::make_shared<const CBlock>(bad_block), true, nullptr);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(::ChainActive().Tip()->GetBlockHash() != bad_block.GetHash());
+    }
+
+    // and the block with the valid signature is connected
+    while (!CheckProofOfWork(block.GetHash(), block.nBits, chainparams.GetConsensus())) ++block.nNonce;
+    ProcessNewBlock(chainparams, std::make_shared<const CBlock>(block), true, nullptr);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(::ChainActive().Tip()->GetBlockHash() == block.GetHash());
+    }
+    BOOST_CHECK_EQUAL(mempool.size(), 0U);
+}
+
+BOOST_FIXTURE_TEST_CASE(tx_mempool_precheck, TestChain100Setup)
+{
+    // The pre-check before admission runs the context-free, input and script
+    // checks against a snapshot of the spent coins. It does not store the
+    // verified signatures in the signature cache, AcceptToMemoryPool does once
+    // the transaction is accepted and skips the checks the pre-check ran.
+
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout.hash = m_coinbase_txns[0]->GetHash();
+    spend.vin[0].prevout.n = 0;
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11*CENT;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+
+    // Same spend with a signature that does not verify
+    CMutableTransaction bad_spend = spend;
+    std::vector<unsigned char> vchBadSig = vchSig;
+    vchBadSig[vchBadSig.size() - 2] ^= 1;
+    bad_spend.vin[0].scriptSig << vchBadSig;
+    spend.vin[0].scriptSig << vchSig;
+
+    // Spends an output that does not exist
+    CMutableTransaction orphan = spend;
+    orphan.vin[0].prevout.hash = InsecureRand256();
+
+    // Valid signature but a non-standard version, rejected by the policy checks
+    CMutableTransaction non_standard = spend;
+    non_standard.nVersion = CTransaction::MAX_STANDARD_VERSION + 1;
+
+    MemPoolPreCheck precheck;
+    for (const CMutableTransaction& tx : {bad_spend, orphan}) {
+        // Failed scripts and missing inputs are left to AcceptToMemoryPool
+        CValidationState state;
+        BOOST_CHECK(!PreCheckMemPoolTransaction(mempool, state, MakeTransactionRef(tx), precheck));
+        BOOST_CHECK(state.IsValid());
+        BOOST_CHECK(precheck.m_sigcache_entries.empty());
+    }
+    {
+        CValidationState state;
+        BOOST_CHECK(!PreCheckMemPoolTransaction(mempool, state, MakeTransactionRef(non_standard), precheck));
+        BOOST_CHECK(state.IsInvalid());
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), "version");
+        BOOST_CHECK(precheck.m_sigcache_entries.empty());
+    }
+
+    // The signature is verified but left out of the cache, so a second
+    // pre-check has to verify it again
+    CTransactionRef spend_ref = MakeTransactionRef(spend);
+    for (int i = 0; i < 2; i++) {
+        CValidationState state;
+        BOOST_CHECK(PreCheckMemPoolTransaction(mempool, state, spend_ref, precheck));
+        BOOST_CHECK(precheck.m_wtxid == spend_ref->GetWitnessHash());
+        BOOST_CHECK_EQUAL(precheck.m_spent_coins.size(), 1U);
+        BOOST_CHECK(precheck.m_fees > 0);
+        BOOST_CHECK_EQUAL(precheck.m_sigcache_entries.size(), 1U);
+    }
+    BOOST_CHECK_EQUAL(mempool.size(), 0U);
+
+    // A pre-check of another transaction is not used
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(!AcceptToMemoryPool(mempool, state, MakeTransactionRef(bad_spend), nullptr /* pfMissingInputs */,
+                                        nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */,
+                                        true /* test_accept */, false /* rawTx */, &precheck));
+    }
+
+    // Admission stores the signature once the transaction is accepted, the
+    // next pre-check finds it in the cache
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, spend_ref, nullptr /* pfMissingInputs */,
+                                       nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */,
+                                       false /* test_accept */, false /* rawTx */, &precheck));
+    }
+    BOOST_CHECK_EQUAL(mempool.size(), 1U);
+    {
+        CValidationState state;
+        BOOST_CHECK(PreCheckMemPoolTransaction(mempool, state, spend_ref, precheck));
+        BOOST_CHECK(precheck.m_sigcache_entries.empty());
+    }
+
+    // The conflict checks of the admission still see the transaction in the pool
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(!AcceptToMemoryPool(mempool, state, spend_ref, nullptr /* pfMissingInputs */,
+                                        nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */,
+                                        false /* test_accept */, false /* rawTx */, &precheck));
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), "txn-already-in-mempool");
+    }
+    BOOST_CHECK(!ToMemPool(bad_spend));
+    BOOST_CHECK(!ToMemPool(orphan));
+    BOOST_CHECK_EQUAL(mempool.size(), 1U);
+    mempool.clear();
+
+    // A pre-check of another tip is not used, the fees are computed again
+    {
+        LOCK(cs_main);
+        MemPoolPreCheck stale_precheck = precheck;
+        stale_precheck.m_best_block = uint256();
+        stale_precheck.m_fees = 0;
+        CValidationState state;
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, spend_ref, nullptr /* pfMissingInputs */,
+                                       nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */,
+                                       true /* test_accept */, false /* rawTx */, &stale_precheck));
+    }
+}
+
 // Run CheckInputs (using CoinsTip()) on the given transaction, for all script
 // flags.  Test that CheckInputs passes for all flags that don't overlap with
 // the failing_flags argument, but otherwise fails.
@@ -27,6 +27,8 @@ static const char DB_BLOCK_INDEX = 'b';
 ////////////////////////////////////////// // qtum
 static const char DB_HEIGHTINDEX = 'h';
 static const char DB_STAKEINDEX = 's';
+static const char DB_LOGBLOOM = 'L';
+static const char DB_LOGBLOOMRANGE = 'G';
 //////////////////////////////////////////
 
 static const char DB_BEST_BLOCK = 'B';
@@ -271,19 +273,40 @@ bool CBlockTreeDB::WriteHeightIndex(const CHeightTxIndexKey &heightIndex, const
 
 int CBlockTreeDB::ReadHeightIndex(int low, int high, int minconf,
         std::vector<std::vector<uint256>> &blocksOfHashes,
-        std::set<dev::h160> const &addresses) {
+        std::set<dev::h160> const &addresses,
+        std::function<bool(const dev::h2048&)> const &bloomFilter,
+        size_t nLimit) {
 
     if ((high < low && high > -1) || (high == 0 && low == 0) || (high < -1 || low < 0)) {
        return -1;
     }
 
+    // Range blooms can only be trusted when every block with logs has a bloom
+    bool fRangeBlooms = false;
+    if (bloomFilter) {
+        ReadFlag("logbloom", fRangeBlooms);
+    }
+
+    auto inBounds = [high, minconf](int height) {
+        if (high > -1 && height > high) {
+            return false;
+        }
+        if (minconf > 0 && ::ChainActive().Height() - height < minconf) {
+            return false;
+        }
+        return true;
+    };
+
     std::unique_ptr<CDBIterator> pcursor(NewIterator());
 
     pcursor->Seek(std::make_pair(DB_HEIGHTINDEX, CHeightTxIndexIteratorKey(low)));
 
     int curheight = 0;
+    int checkedRange = -1;
+    int checkedBlock = -1;
+    size_t nHashes = 0;
 
-    for (size_t count = 0; pcursor->Valid(); pcursor->Next()) {
+    while (pcursor->Valid()) {
 
         std::pair<char, CHeightTxIndexKey> key;
         if (!pcursor->GetKey(key) || key.first != DB_HEIGHTINDEX) {
@@ -292,33 +315,55 @@ int CBlockTreeDB::ReadHeightIndex(int low, int high, int minconf,
 
         int nextHeight = key.second.height;
 
-        if (high > -1 && nextHeight > high) {
+        if (!inBounds(nextHeight)) {
             break;
         }
 
-        if (minconf > 0) {
-            int conf = ::ChainActive().Height() - nextHeight;
-            if (conf < minconf) {
-                break;
+        // Blocks are not split, so a transaction indexed under several addresses is never in two calls
+        if (nLimit > 0 && nHashes >= nLimit && nextHeight != curheight) {
+            break;
+        }
+
+        if (bloomFilter && nextHeight != checkedBlock) {
+            checkedBlock = nextHeight;
+
+            // Skip the whole range when none of its blocks can match
+            int range = nextHeight / LOG_BLOOM_RANGE_SIZE;
+            if (fRangeBlooms && range != checkedRange) {
+                checkedRange = range;
+                dev::h2048 rangeBloom;
+                unsigned int lastHeight = 0;
+                if (ReadLogBloomRange(range, rangeBloom, lastHeight) && inBounds(lastHeight) && !bloomFilter(rangeBloom)) {
+                    curheight = lastHeight;
+                    pcursor->Seek(std::make_pair(DB_HEIGHTINDEX, CHeightTxIndexIteratorKey(lastHeight + 1)));
+                    continue;
+                }
+            }
+
+            // Skip the block when its bloom rules out a match, blocks without a bloom may match
+            dev::h2048 blockBloom;
+            if (ReadLogBloom(nextHeight, blockBloom) && !bloomFilter(blockBloom)) {
+                curheight = nextHeight;
+                pcursor->Seek(std::make_pair(DB_HEIGHTINDEX, CHeightTxIndexIteratorKey(nextHeight + 1)));
+                continue;
             }
         }
 
         curheight = nextHeight;
 
         auto address = key.second.address;
-        if (!addresses.empty() && addresses.find(address) == addresses.end()) {
-            continue;
-        }
+        if (addresses.empty() || addresses.find(address) != addresses.end()) {
+            std::vector<uint256> hashesTx;
 
-        std::vector<uint256> hashesTx;
+            if (!pcursor->GetValue(hashesTx)) {
+                break;
+            }
 
-        if (!pcursor->GetValue(hashesTx)) {
-            break;
+            nHashes += hashesTx.size();
+            blocksOfHashes.push_back(hashesTx);
         }
 
-        count += hashesTx.size();
-
-        blocksOfHashes.push_back(hashesTx);
+        pcursor->Next();
     }
 
     return curheight;
@@ -363,9 +408,96 @@ bool CBlockTreeDB::WipeHeightIndex() {
         }
     }
 
+    for (char prefix : {DB_LOGBLOOM, DB_LOGBLOOMRANGE}) {
+        pcursor->Seek(prefix);
+
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            std::pair<char, CHeightTxIndexIteratorKey> key;
+            if (pcursor->GetKey(key) && key.first == prefix) {
+                batch.Erase(key);
+                pcursor->Next();
+            } else {
+                break;
+            }
+        }
+    }
+
+    batch.Write(std::make_pair(DB_FLAG, std::string("logbloom")), '0');
+
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::WriteLogBloom(unsigned int height, const dev::h2048 &bloom) {
+    CDBBatch batch(*this);
+    batch.Write(std::make_pair(DB_LOGBLOOM, CHeightTxIndexIteratorKey(height)), bloom.asBytes());
+
+    unsigned int range = height / LOG_BLOOM_RANGE_SIZE;
+    dev::h2048 rangeBloom;
+    unsigned int lastHeight = 0;
+    ReadLogBloomRange(range, rangeBloom, lastHeight);
+    rangeBloom |= bloom;
+    lastHeight = std::max(lastHeight, height);
+    batch.Write(std::make_pair(DB_LOGBLOOMRANGE, CHeightTxIndexIteratorKey(range)), std::make_pair(rangeBloom.asBytes(), lastHeight));
+
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadLogBloom(unsigned int height, dev::h2048 &bloom) {
+    valtype data;
+    if (!Read(std::make_pair(DB_LOGBLOOM, CHeightTxIndexIteratorKey(height)), data) || data.size() != dev::h2048::size)
+        return false;
+    bloom = dev::h2048(data);
+    return true;
+}
+
+bool CBlockTreeDB::ReadLogBloomRange(unsigned int range, dev::h2048 &bloom, unsigned int &lastHeight) {
+    std::pair<valtype, unsigned int> data;
+    if (!Read(std::make_pair(DB_LOGBLOOMRANGE, CHeightTxIndexIteratorKey(range)), data) || data.first.size() != dev::h2048::size)
+        return false;
+    bloom = dev::h2048(data.first);
+    lastHeight = data.second;
+    return true;
+}
+
+bool CBlockTreeDB::EraseLogBloom(unsigned int height) {
+
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    CDBBatch batch(*this);
+
+    batch.Erase(std::make_pair(DB_LOGBLOOM, CHeightTxIndexIteratorKey(height)));
+
+    // Rebuild the range bloom from the remaining blocks of the range
+    unsigned int range = height / LOG_BLOOM_RANGE_SIZE;
+    dev::h2048 rangeBloom;
+    unsigned int lastHeight = 0;
+    bool fEmpty = true;
+
+    pcursor->Seek(std::make_pair(DB_LOGBLOOM, CHeightTxIndexIteratorKey(range * LOG_BLOOM_RANGE_SIZE)));
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CHeightTxIndexIteratorKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_LOGBLOOM || key.second.height / LOG_BLOOM_RANGE_SIZE != range) {
+            break;
+        }
+        valtype data;
+        if (key.second.height != height && pcursor->GetValue(data) && data.size() == dev::h2048::size) {
+            rangeBloom |= dev::h2048(data);
+            lastHeight = key.second.height;
+            fEmpty = false;
+        }
+        pcursor->Next();
+    }
+
+    if (fEmpty) {
+        batch.Erase(std::make_pair(DB_LOGBLOOMRANGE, CHeightTxIndexIteratorKey(range)));
+    } else {
+        batch.Write(std::make_pair(DB_LOGBLOOMRANGE, CHeightTxIndexIteratorKey(range)), std::make_pair(rangeBloom.asBytes(), lastHeight));
+    }
+
+    return WriteBatch(batch);
+}
 
 bool CBlockTreeDB::WriteStakeIndex(unsigned int height, uint160 address) {
     CDBBatch batch(*this);
@@ -435,164 +567,42 @@ bool CBlockTreeDB::EraseStakeIndex(unsigned int height) {
 }
 
 #ifdef ENABLE_BITCORE_RPC
-bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
-    CDBBatch batch(*this);
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Write(std::make_pair(DB_ADDRESSINDEX, it->first), it->second);
-    return WriteBatch(batch);
-}
-
-bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
-    CDBBatch batch(*this);
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Erase(std::make_pair(DB_ADDRESSINDEX, it->first));
-    return WriteBatch(batch);
-}
-
-bool CBlockTreeDB::ReadAddressIndex(uint256 addressHash, int type,
-                                    std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                                    int start, int end) {
-
-    std::unique_ptr<CDBIterator> pcursor(NewIterator());
-
-    if (start > 0 && end > 0) {
-        pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start)));
-    } else {
-        pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
-    }
-
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        std::pair<char,CAddressIndexKey> key;
-        if (pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX && key.second.hashBytes == addressHash) {
-            if (end > 0 && key.second.blockHeight > end) {
-                break;
-            }
-            CAmount nValue;
-            if (pcursor->GetValue(nValue)) {
-                addressIndex.push_back(std::make_pair(key.second, nValue));
-                pcursor->Next();
-            } else {
-                return error("failed to get address index value");
-            }
-        } else {
-            break;
-        }
-    }
-
-    return true;
-}
-
-bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect) {
-    CDBBatch batch(*this);
-    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
-        if (it->second.IsNull()) {
-            batch.Erase(std::make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
-        } else {
-            batch.Write(std::make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
-        }
-    }
-    return WriteBatch(batch);
-}
-
-bool CBlockTreeDB::ReadAddressUnspentIndex(uint256 addressHash, int type,
-                                           std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs) {
-
-    std::unique_ptr<CDBIterator> pcursor(NewIterator());
-    pcursor->Seek(std::make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
-
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        std::pair<char,CAddressUnspentKey> key;
-        if (pcursor->GetKey(key) && key.first == DB_ADDRESSUNSPENTINDEX && key.second.hashBytes == addressHash) {
-            CAddressUnspentValue nValue;
-            if (pcursor->GetValue(nValue)) {
-                unspentOutputs.push_back(std::make_pair(key.second, nValue));
-                pcursor->Next();
-            } else {
-                return error("failed to get address unspent value");
-            }
-        } else {
-            break;
-        }
-    }
-
-    return true;
-}
-
-bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex) {
-    CDBBatch batch(*this);
-    batch.Write(std::make_pair(DB_TIMESTAMPINDEX, timestampIndex), 0);
-    return WriteBatch(batch);
-}
-
-bool CBlockTreeDB::ReadTimestampIndex(const unsigned int &high, const unsigned int &low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &hashes) {
-
-    std::unique_ptr<CDBIterator> pcursor(NewIterator());
-
-    pcursor->Seek(std::make_pair(DB_TIMESTAMPINDEX, CTimestampIndexIteratorKey(low)));
-
-    while (pcursor->Valid()) {
+template<typename K>
+static bool EraseKeys(CDBWrapper& db, char prefix) {
+    CDBBatch batch(db);
+    std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
+    for (pcursor->Seek(prefix); pcursor->Valid(); pcursor->Next()) {
         boost::this_thread::interruption_point();
-        std::pair<char, CTimestampIndexKey> key;
-        if (pcursor->GetKey(key) && key.first == DB_TIMESTAMPINDEX && key.second.timestamp < high) {
-            if (fActiveOnly) {
-                if (blockOnchainActive(key.second.blockHash)) {
-                    hashes.push_back(std::make_pair(key.second.blockHash, key.second.timestamp));
-                }
-            } else {
-                hashes.push_back(std::make_pair(key.second.blockHash, key.second.timestamp));
-            }
-
-            pcursor->Next();
-        } else {
+        std::pair<char, K> key;
+        if (!pcursor->GetKey(key) || key.first != prefix)
             break;
+        batch.Erase(key);
+        if (batch.SizeEstimate() > (size_t)nDefaultDbBatchSize) {
+            if (!db.WriteBatch(batch))
+                return false;
+            batch.Clear();
         }
     }
-
-    return true;
-}
-
-bool CBlockTreeDB::WriteTimestampBlockIndex(const CTimestampBlockIndexKey &blockhashIndex, const CTimestampBlockIndexValue &logicalts) {
-    CDBBatch batch(*this);
-    batch.Write(std::make_pair(DB_BLOCKHASHINDEX, blockhashIndex), logicalts);
-    return WriteBatch(batch);
-}
-
-bool CBlockTreeDB::ReadTimestampBlockIndex(const uint256 &hash, unsigned int &ltimestamp) {
-
-    CTimestampBlockIndexValue(lts);
-    if (!Read(std::make_pair(DB_BLOCKHASHINDEX, hash), lts))
-       return false;
-
-    ltimestamp = lts.ltimestamp;
+    if (!db.WriteBatch(batch))
+        return false;
+    db.CompactRange(prefix, (char)(prefix + 1));
     return true;
 }
 
-bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
-    return Read(std::make_pair(DB_SPENTINDEX, key), value);
-}
-
-bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect) {
-    CDBBatch batch(*this);
-    for (std::vector<std::pair<CSpentIndexKey,CSpentIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
-        if (it->second.IsNull()) {
-            batch.Erase(std::make_pair(DB_SPENTINDEX, it->first));
-        } else {
-            batch.Write(std::make_pair(DB_SPENTINDEX, it->first), it->second);
-        }
-    }
-    return WriteBatch(batch);
-}
-
-bool CBlockTreeDB::blockOnchainActive(const uint256 &hash) {
-    CBlockIndex* pblockindex = ::BlockIndex()[hash];
-
-    if (!::ChainActive().Contains(pblockindex)) {
-       return false;
-    }
+bool CBlockTreeDB::EraseLegacyAddressIndex() {
+    bool fAddressIndex = false;
+    ReadFlag("addrindex", fAddressIndex);
+    if (!fAddressIndex)
+        return true;
 
-    return true;
+    LogPrintf("Removing the address index from the block index database...\n");
+    if (!EraseKeys<CAddressIndexKey>(*this, DB_ADDRESSINDEX) ||
+        !EraseKeys<CAddressUnspentKey>(*this, DB_ADDRESSUNSPENTINDEX) ||
+        !EraseKeys<CTimestampIndexKey>(*this, DB_TIMESTAMPINDEX) ||
+        !EraseKeys<CTimestampBlockIndexKey>(*this, DB_BLOCKHASHINDEX) ||
+        !EraseKeys<CSpentIndexKey>(*this, DB_SPENTINDEX))
+        return false;
+    return WriteFlag("addrindex", false);
 }
 #endif
 ///////////////////////////////////////////////////////
@@ -58,6 +58,12 @@ static const int64_t nMaxBlockDBCache = 2;
 static const int64_t nMaxTxIndexCache = 1024;
 //! Max memory allocated to all block filter index caches combined in MiB.
 static const int64_t max_filter_index_cache = 1024;
+#ifdef ENABLE_BITCORE_RPC
+//! Max memory allocated to the -addrindex database cache in MiB.
+static const int64_t nMaxAddrIndexCache = 1024;
+#endif
+//! Number of blocks covered by one combined log bloom of the height index
+static const unsigned int LOG_BLOOM_RANGE_SIZE = 128;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
 
@@ -157,15 +163,25 @@ public:
      * @param minconf stop iterating of the block height does not have enough confirmations (ignored if <= 0)
      * @param blocksOfHashes transaction hashes in blocks iterated are collected into this vector.
      * @param addresses filter out a block unless it matches one of the addresses in this set.
+     * @param bloomFilter skip blocks whose log bloom is rejected by this predicate (ignored if empty).
+     * @param nLimit stop at the end of the block in which nLimit transaction hashes are collected (ignored if 0).
      *
      * @return the height of the latest block iterated. 0 if no block is iterated.
      */
     int ReadHeightIndex(int low, int high, int minconf,
             std::vector<std::vector<uint256>> &blocksOfHashes,
-            std::set<dev::h160> const &addresses);
+            std::set<dev::h160> const &addresses,
+            std::function<bool(const dev::h2048&)> const &bloomFilter = nullptr,
+            size_t nLimit = 0);
     bool EraseHeightIndex(const unsigned int &height);
     bool WipeHeightIndex();
 
+    /** Log bloom of a block, also merged into the bloom of its LOG_BLOOM_RANGE_SIZE range. */
+    bool WriteLogBloom(unsigned int height, const dev::h2048 &bloom);
+    bool ReadLogBloom(unsigned int height, dev::h2048 &bloom);
+    bool ReadLogBloomRange(unsigned int range, dev::h2048 &bloom, unsigned int &lastHeight);
+    bool EraseLogBloom(unsigned int height);
+
 
     bool WriteStakeIndex(unsigned int height, uint160 address);
     bool ReadStakeIndex(unsigned int height, uint160& address);
@@ -173,22 +189,8 @@ public:
     bool EraseStakeIndex(unsigned int height);
 
 #ifdef ENABLE_BITCORE_RPC
-    // Block explorer database functions
-    bool WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
-    bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
-    bool ReadAddressIndex(uint256 addressHash, int type,
-                        std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                        int start = 0, int end = 0);
-    bool UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect);
-    bool ReadAddressUnspentIndex(uint256 addressHash, int type,
-                                std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
-    bool WriteTimestampIndex(const CTimestampIndexKey &timestampIndex);
-    bool ReadTimestampIndex(const unsigned int &high, const unsigned int &low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &vect);
-    bool WriteTimestampBlockIndex(const CTimestampBlockIndexKey &blockhashIndex, const CTimestampBlockIndexValue &logicalts);
-    bool ReadTimestampBlockIndex(const uint256 &hash, unsigned int &logicalTS);
-    bool ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
-    bool UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect);
-    bool blockOnchainActive(const uint256 &hash);
+    /** Erase the address index written here by older versions, it is now kept by AddressIndex */
+    bool EraseLegacyAddressIndex();
 #endif
 
     //////////////////////////////////////////////////////////////////////////////
@@ -461,6 +463,42 @@ struct CAddressUnspentValue {
     }
 };
 
+/** Totals of the address index entries of an address, kept up to date with them */
+struct CAddressSummary {
+    CAmount balance;
+    CAmount received;
+    uint64_t txCount;
+    int firstHeight;
+    int lastHeight;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(balance);
+        READWRITE(received);
+        READWRITE(txCount);
+        READWRITE(firstHeight);
+        READWRITE(lastHeight);
+    }
+
+    CAddressSummary() {
+        SetNull();
+    }
+
+    void SetNull() {
+        balance = 0;
+        received = 0;
+        txCount = 0;
+        firstHeight = -1;
+        lastHeight = -1;
+    }
+
+    bool IsNull() const {
+        return (txCount == 0);
+    }
+};
+
 struct CAddressIndexKey {
     unsigned int type;
     uint256 hashBytes;
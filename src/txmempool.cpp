@@ -425,6 +425,10 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
     cachedInnerUsage -= it->DynamicMemoryUsage();
     cachedInnerUsage -= memusage::DynamicUsage(mapLinks[it].parents) + memusage::DynamicUsage(mapLinks[it].children);
     mapLinks.erase(it);
+#ifdef ENABLE_BITCORE_RPC
+    removeAddressIndex(hash);
+    removeSpentIndex(it->GetTx());
+#endif
     mapTx.erase(it);
     nTransactionsUpdated++;
     if (minerPolicyEstimator) {minerPolicyEstimator->removeTx(hash, false);}
@@ -570,10 +574,6 @@ void CTxMemPool::removeForBlock(const std::vector<CTransactionRef>& vtx, unsigne
         }
         removeConflicts(*tx);
         ClearPrioritisation(tx->GetHash());
-#ifdef ENABLE_BITCORE_RPC
-        removeAddressIndex(tx->GetHash());
-        removeSpentIndex(tx->GetHash());
-#endif
     }
     lastRollingFeeUpdate = GetTime();
     blockSinceLastRollingFeeBump = true;
@@ -584,6 +584,11 @@ void CTxMemPool::_clear()
     mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
+#ifdef ENABLE_BITCORE_RPC
+    mapAddressInserted.clear();
+    mapAddress.clear();
+    mapSpent.clear();
+#endif
     totalTxSize = 0;
     cachedInnerUsage = 0;
     lastRollingFeeUpdate = GetTime();
@@ -1116,29 +1121,54 @@ SaltedTxidHasher::SaltedTxidHasher() : k0(GetRand(std::numeric_limits<uint64_t>:
 
 #ifdef ENABLE_BITCORE_RPC
 /////////////////////////////////////////////////////// // qtum
+/** Bytes of a destination as the address index keys them */
+class AddressBytesVisitor : public boost::static_visitor<bool>
+{
+private:
+    uint256& addressBytes;
+
+public:
+    explicit AddressBytesVisitor(uint256& bytes) : addressBytes(bytes) {}
+
+    bool operator()(const CNoDestination&) const { return false; }
+    bool operator()(const WitnessUnknown&) const { return false; }
+
+    template <typename T>
+    bool operator()(const T& hash) const
+    {
+        addressBytes.SetNull();
+        std::copy(hash.begin(), hash.end(), addressBytes.begin());
+        return true;
+    }
+};
+
+SaltedAddressIdHasher::SaltedAddressIdHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+void CTxMemPool::addAddressDelta(addressDeltaMapInserted::value_type& txDeltas, const CMempoolAddressId& address, uint32_t index, bool spending, CAmount amount)
+{
+    addressDeltaMap::iterator it = mapAddress.emplace(address, std::vector<addressDeltaRef>()).first;
+    txDeltas.second.push_back(CMempoolAddressDeltaEntry{&it->first, amount, index, (uint32_t)it->second.size(), spending});
+    it->second.emplace_back(&txDeltas, txDeltas.second.size() - 1);
+}
+
 void CTxMemPool::addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view)
 {
     LOCK(cs);
     const CTransaction& tx = entry.GetTx();
-    std::vector<CMempoolAddressDeltaKey> inserted;
+    const uint256& txhash = tx.GetHash();
+    removeAddressIndex(txhash);
+
+    addressDeltaMapInserted::iterator inserted = mapAddressInserted.emplace(txhash, std::vector<CMempoolAddressDeltaEntry>()).first;
+    inserted->second.reserve(tx.vin.size() + tx.vout.size());
 
-    uint256 txhash = tx.GetHash();
+    uint256 addressBytes;
     for (unsigned int j = 0; j < tx.vin.size(); j++) {
-        const CTxIn input = tx.vin[j];
+        const CTxIn& input = tx.vin[j];
         const CTxOut &prevout = view.GetOutputFor(input);
 
         CTxDestination dest;
-        if (ExtractDestination(input.prevout, prevout.scriptPubKey, dest)) {
-            valtype bytesID(boost::apply_visitor(DataVisitor(), dest));
-            if(bytesID.empty()) {
-                continue;
-            }
-            valtype addressBytes(32);
-            std::copy(bytesID.begin(), bytesID.end(), addressBytes.begin());
-            CMempoolAddressDeltaKey key(dest.which(), uint256(addressBytes), txhash, j, 1);
-            CMempoolAddressDelta delta(entry.GetTime(), prevout.nValue * -1, input.prevout.hash, input.prevout.n);
-            mapAddress.insert(std::make_pair(key, delta));
-            inserted.push_back(key);
+        if (ExtractDestination(input.prevout, prevout.scriptPubKey, dest) && boost::apply_visitor(AddressBytesVisitor(addressBytes), dest)) {
+            addAddressDelta(*inserted, CMempoolAddressId(dest.which(), addressBytes), j, true, prevout.nValue * -1);
         }
     }
 
@@ -1146,49 +1176,65 @@ void CTxMemPool::addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewC
         const CTxOut &out = tx.vout[k];
 
         CTxDestination dest;
-        if (ExtractDestination({tx.GetHash(), k}, out.scriptPubKey, dest)) {
-            valtype bytesID(boost::apply_visitor(DataVisitor(), dest));
-            if(bytesID.empty()) {
-                continue;
-            }
-            valtype addressBytes(32);
-            std::copy(bytesID.begin(), bytesID.end(), addressBytes.begin());
-            CMempoolAddressDeltaKey key(dest.which(), uint256(addressBytes), txhash, k, 0);
-            mapAddress.insert(std::make_pair(key, CMempoolAddressDelta(entry.GetTime(), out.nValue)));
-            inserted.push_back(key);
+        if (ExtractDestination({txhash, k}, out.scriptPubKey, dest) && boost::apply_visitor(AddressBytesVisitor(addressBytes), dest)) {
+            addAddressDelta(*inserted, CMempoolAddressId(dest.which(), addressBytes), k, false, out.nValue);
         }
     }
 
-    mapAddressInserted.insert(std::make_pair(txhash, inserted));
+    if (inserted->second.empty()) {
+        mapAddressInserted.erase(inserted);
+    }
 }
 
 bool CTxMemPool::getAddressIndex(std::vector<std::pair<uint256, int> > &addresses, std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > &results)
 {
     LOCK(cs);
-    for (std::vector<std::pair<uint256, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        addressDeltaMap::iterator ait = mapAddress.lower_bound(CMempoolAddressDeltaKey((*it).second, (*it).first));
-        while (ait != mapAddress.end() && (*ait).first.addressBytes == (*it).first && (*ait).first.type == (*it).second) {
-            results.push_back(*ait);
-            ait++;
+    for (const std::pair<uint256, int>& address : addresses) {
+        addressDeltaMap::const_iterator ait = mapAddress.find(CMempoolAddressId(address.second, address.first));
+        if (ait == mapAddress.end()) {
+            continue;
+        }
+        for (const addressDeltaRef& ref : ait->second) {
+            const uint256& txhash = ref.first->first;
+            const CMempoolAddressDeltaEntry& delta = ref.first->second[ref.second];
+            txiter it = mapTx.find(txhash);
+            if (it == mapTx.end()) {
+                continue;
+            }
+            CMempoolAddressDeltaKey key(address.second, address.first, txhash, delta.index, delta.spending);
+            if (delta.spending) {
+                const COutPoint& prevout = it->GetTx().vin[delta.index].prevout;
+                results.emplace_back(key, CMempoolAddressDelta(it->GetTime(), delta.amount, prevout.hash, prevout.n));
+            } else {
+                results.emplace_back(key, CMempoolAddressDelta(it->GetTime(), delta.amount));
+            }
         }
     }
     return true;
 }
 
-bool CTxMemPool::removeAddressIndex(const uint256 txhash)
+void CTxMemPool::removeAddressIndex(const uint256& txhash)
 {
-    LOCK(cs);
+    AssertLockHeld(cs);
     addressDeltaMapInserted::iterator it = mapAddressInserted.find(txhash);
+    if (it == mapAddressInserted.end()) {
+        return;
+    }
 
-    if (it != mapAddressInserted.end()) {
-        std::vector<CMempoolAddressDeltaKey> keys = (*it).second;
-        for (std::vector<CMempoolAddressDeltaKey>::iterator mit = keys.begin(); mit != keys.end(); mit++) {
-            mapAddress.erase(*mit);
+    for (const CMempoolAddressDeltaEntry& delta : it->second) {
+        addressDeltaMap::iterator ait = mapAddress.find(*delta.address);
+        assert(ait != mapAddress.end());
+        std::vector<addressDeltaRef>& refs = ait->second;
+        if (refs.size() == 1) {
+            mapAddress.erase(ait);
+            continue;
         }
-        mapAddressInserted.erase(it);
+        // Move the last delta of the address into the freed position
+        refs[delta.pos] = refs.back();
+        refs[delta.pos].first->second[refs[delta.pos].second].pos = delta.pos;
+        refs.pop_back();
     }
-
-    return true;
+    mapAddressInserted.erase(it);
 }
 
 void CTxMemPool::addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view)
@@ -1196,80 +1242,58 @@ void CTxMemPool::addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCac
     LOCK(cs);
 
     const CTransaction& tx = entry.GetTx();
-    std::vector<CSpentIndexKey> inserted;
-
-    uint256 txhash = tx.GetHash();
     for (unsigned int j = 0; j < tx.vin.size(); j++) {
-        const CTxIn input = tx.vin[j];
+        const CTxIn& input = tx.vin[j];
         const CTxOut &prevout = view.GetOutputFor(input);
-        uint256 addressHash;
-        int addressType;
-        std::vector<unsigned char> addressBytes(32);
-
-        if (prevout.scriptPubKey.IsPayToScriptHash()) {
-            std::copy(prevout.scriptPubKey.begin() + 2, prevout.scriptPubKey.begin() + 22, addressBytes.begin());
-            addressHash = uint256(addressBytes);
-            addressType = 2;
-        } else if (prevout.scriptPubKey.IsPayToPubkeyHash()) {
-            std::copy(prevout.scriptPubKey.begin() + 3, prevout.scriptPubKey.begin() + 23, addressBytes.begin());
-            addressHash = uint256(addressBytes);
-            addressType = 1;
-        } else if (prevout.scriptPubKey.IsPayToPubkey()) {
-            std::vector<unsigned char> pubkeyBytes(prevout.scriptPubKey.begin() + 1, prevout.scriptPubKey.end()-1);
-            uint160 hashBytes = Hash160(pubkeyBytes);
-            std::copy(hashBytes.begin(), hashBytes.end(), addressBytes.begin());
-            addressHash = uint256(addressBytes);
-            addressType = 1;
-        } else if (prevout.scriptPubKey.IsPayToWitnessPubkeyHash()) {
-            std::copy(prevout.scriptPubKey.begin() + 2, prevout.scriptPubKey.end(), addressBytes.begin());
-            addressHash = uint256(addressBytes);
-            addressType = 4;
-        } else if (prevout.scriptPubKey.IsPayToWitnessScriptHash()) {
-            std::copy(prevout.scriptPubKey.begin() + 2, prevout.scriptPubKey.end(), addressBytes.begin());
-            addressHash = uint256(addressBytes);
-            addressType = 3;
-        } else {
-            addressHash.SetNull();
-            addressType = 0;
+        const CScript& script = prevout.scriptPubKey;
+        CMempoolSpentEntry spent{j, 0, prevout.nValue, uint256()};
+
+        if (script.IsPayToScriptHash()) {
+            std::copy(script.begin() + 2, script.begin() + 22, spent.addressHash.begin());
+            spent.addressType = 2;
+        } else if (script.IsPayToPubkeyHash()) {
+            std::copy(script.begin() + 3, script.begin() + 23, spent.addressHash.begin());
+            spent.addressType = 1;
+        } else if (script.IsPayToPubkey()) {
+            uint160 hashBytes = Hash160(script.begin() + 1, script.end() - 1);
+            std::copy(hashBytes.begin(), hashBytes.end(), spent.addressHash.begin());
+            spent.addressType = 1;
+        } else if (script.IsPayToWitnessPubkeyHash()) {
+            std::copy(script.begin() + 2, script.end(), spent.addressHash.begin());
+            spent.addressType = 4;
+        } else if (script.IsPayToWitnessScriptHash()) {
+            std::copy(script.begin() + 2, script.end(), spent.addressHash.begin());
+            spent.addressType = 3;
         }
 
-        CSpentIndexKey key = CSpentIndexKey(input.prevout.hash, input.prevout.n);
-        CSpentIndexValue value = CSpentIndexValue(txhash, j, -1, prevout.nValue, addressType, addressHash);
-
-        mapSpent.insert(std::make_pair(key, value));
-        inserted.push_back(key);
+        mapSpent[input.prevout] = spent;
     }
-
-    mapSpentInserted.insert(std::make_pair(txhash, inserted));
 }
 
 bool CTxMemPool::getSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
 {
     LOCK(cs);
-    mapSpentIndex::iterator it;
-
-    it = mapSpent.find(key);
-    if (it != mapSpent.end()) {
-        value = it->second;
-        return true;
+    const COutPoint prevout(key.txid, key.outputIndex);
+    mapSpentIndex::const_iterator it = mapSpent.find(prevout);
+    auto nit = mapNextTx.find(prevout);
+    if (it == mapSpent.end() || nit == mapNextTx.end()) {
+        return false;
     }
-    return false;
+
+    const CMempoolSpentEntry& spent = it->second;
+    value = CSpentIndexValue(nit->second->GetHash(), spent.inputIndex, -1, spent.satoshis, spent.addressType, spent.addressHash);
+    return true;
 }
 
-bool CTxMemPool::removeSpentIndex(const uint256 txhash)
+void CTxMemPool::removeSpentIndex(const CTransaction& tx)
 {
-    LOCK(cs);
-    mapSpentIndexInserted::iterator it = mapSpentInserted.find(txhash);
-
-    if (it != mapSpentInserted.end()) {
-        std::vector<CSpentIndexKey> keys = (*it).second;
-        for (std::vector<CSpentIndexKey>::iterator mit = keys.begin(); mit != keys.end(); mit++) {
-            mapSpent.erase(*mit);
-        }
-        mapSpentInserted.erase(it);
+    AssertLockHeld(cs);
+    if (mapSpent.empty()) {
+        return;
+    }
+    for (const CTxIn& txin : tx.vin) {
+        mapSpent.erase(txin.prevout);
     }
-
-    return true;
 }
 ///////////////////////////////////////////////////////
 #endif
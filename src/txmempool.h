@@ -11,6 +11,7 @@
 #include <memory>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -54,17 +55,6 @@ class CTxMemPool;
 
 #ifdef ENABLE_BITCORE_RPC
 //////////////////////////////////////////////////////// // qtum
-struct CSpentIndexKeyCompare
-{
-    bool operator()(const CSpentIndexKey& a, const CSpentIndexKey& b) const {
-        if (a.txid == b.txid) {
-            return a.outputIndex < b.outputIndex;
-        } else {
-            return a.txid < b.txid;
-        }
-    }
-};
-
 struct CMempoolAddressDelta
 {
     int64_t time;
@@ -112,28 +102,56 @@ struct CMempoolAddressDeltaKey
     }
 };
 
-struct CMempoolAddressDeltaKeyCompare
+/** Address of the mempool address index, the destination type and the bytes it is indexed by */
+struct CMempoolAddressId
 {
-    bool operator()(const CMempoolAddressDeltaKey& a, const CMempoolAddressDeltaKey& b) const {
-        if (a.type == b.type) {
-            if (a.addressBytes == b.addressBytes) {
-                if (a.txhash == b.txhash) {
-                    if (a.index == b.index) {
-                        return a.spending < b.spending;
-                    } else {
-                        return a.index < b.index;
-                    }
-                } else {
-                    return a.txhash < b.txhash;
-                }
-            } else {
-                return a.addressBytes < b.addressBytes;
-            }
-        } else {
-            return a.type < b.type;
-        }
+    int type;
+    uint256 addressBytes;
+
+    CMempoolAddressId(int addressType, const uint256& addressHash) : type(addressType), addressBytes(addressHash) {}
+
+    bool operator==(const CMempoolAddressId& other) const {
+        return type == other.type && addressBytes == other.addressBytes;
+    }
+};
+
+class SaltedAddressIdHasher
+{
+private:
+    /** Salt */
+    const uint64_t k0, k1;
+
+public:
+    SaltedAddressIdHasher();
+
+    size_t operator()(const CMempoolAddressId& id) const noexcept {
+        return SipHashUint256Extra(k0, k1, id.addressBytes, id.type);
     }
 };
+
+/**
+ * Address delta of a mempool transaction. The address is the key of its entry in the address
+ * map, so its bytes are stored once however many deltas use it. The time and the spent outpoint
+ * are read from the mempool entry when the index is queried.
+ */
+struct CMempoolAddressDeltaEntry
+{
+    const CMempoolAddressId* address;
+    CAmount amount;
+    uint32_t index;
+    //! Position of the delta in the list of its address
+    uint32_t pos;
+    bool spending;
+};
+
+/** Output spent by a mempool transaction, the spending transaction is found through mapNextTx */
+struct CMempoolSpentEntry
+{
+    uint32_t inputIndex;
+    int addressType;
+    CAmount satoshis;
+    uint256 addressHash;
+};
 ////////////////////////////////////////////////////////
 #endif
 
@@ -688,17 +706,19 @@ private:
 
 #ifdef ENABLE_BITCORE_RPC
     //////////////////////////////////////////////////////////////// // qtum
-    typedef std::map<CMempoolAddressDeltaKey, CMempoolAddressDelta, CMempoolAddressDeltaKeyCompare> addressDeltaMap;
-    addressDeltaMap mapAddress;
-
-    typedef std::map<uint256, std::vector<CMempoolAddressDeltaKey> > addressDeltaMapInserted;
-    addressDeltaMapInserted mapAddressInserted;
-
-    typedef std::map<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyCompare> mapSpentIndex;
-    mapSpentIndex mapSpent;
-
-    typedef std::map<uint256, std::vector<CSpentIndexKey> > mapSpentIndexInserted;
-    mapSpentIndexInserted mapSpentInserted;
+    // The address deltas of a transaction are kept in one vector, they are added when the
+    // transaction enters the pool and dropped by removeUnchecked. The list of an address refers to
+    // the deltas by the map node of their transaction, which does not move when the map rehashes,
+    // so a delta is removed from its address by moving the last delta of the list into its place.
+    typedef std::unordered_map<uint256, std::vector<CMempoolAddressDeltaEntry>, SaltedTxidHasher> addressDeltaMapInserted;
+    addressDeltaMapInserted mapAddressInserted GUARDED_BY(cs);
+
+    typedef std::pair<addressDeltaMapInserted::value_type*, uint32_t> addressDeltaRef;
+    typedef std::unordered_map<CMempoolAddressId, std::vector<addressDeltaRef>, SaltedAddressIdHasher> addressDeltaMap;
+    addressDeltaMap mapAddress GUARDED_BY(cs);
+
+    typedef std::unordered_map<COutPoint, CMempoolSpentEntry, SaltedOutpointHasher> mapSpentIndex;
+    mapSpentIndex mapSpent GUARDED_BY(cs);
     ////////////////////////////////////////////////////////////////
 #endif
 
@@ -707,6 +727,14 @@ private:
 
     std::vector<indexed_transaction_set::const_iterator> GetSortedDepthAndScore() const EXCLUSIVE_LOCKS_REQUIRED(cs);
 
+#ifdef ENABLE_BITCORE_RPC
+    ///////////////////////////////////////////////////////// // qtum
+    void addAddressDelta(addressDeltaMapInserted::value_type& txDeltas, const CMempoolAddressId& address, uint32_t index, bool spending, CAmount amount) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    void removeAddressIndex(const uint256& txhash) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    void removeSpentIndex(const CTransaction& tx) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    /////////////////////////////////////////////////////////
+#endif
+
 public:
     indirectmap<COutPoint, const CTransaction*> mapNextTx GUARDED_BY(cs);
     std::map<uint256, CAmount> mapDeltas;
@@ -739,11 +767,9 @@ public:
     void addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view);
     bool getAddressIndex(std::vector<std::pair<uint256, int> > &addresses,
                          std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > &results);
-    bool removeAddressIndex(const uint256 txhash);
 
     void addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view);
     bool getSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
-    bool removeSpentIndex(const uint256 txhash);
     /////////////////////////////////////////////////////////
 #endif
 
@@ -15,9 +15,12 @@
 #include <consensus/tx_check.h>
 #include <consensus/tx_verify.h>
 #include <consensus/validation.h>
+#include <core_memusage.h>
+#include <crypto/sha256.h>
 #include <cuckoocache.h>
 #include <flatfile.h>
 #include <hash.h>
+#include <index/addressindex.h>
 #include <index/txindex.h>
 #include <policy/fees.h>
 #include <policy/policy.h>
@@ -56,8 +59,10 @@
 #include <key_io.h>
 #include <wallet/wallet.h>
 #include <util/convert.h>
+#include <qtum/flatstate.h>
 
 #include <algorithm>
+#include <deque>
 #include <future>
 #include <sstream>
 #include <string>
@@ -83,6 +88,115 @@ std::shared_ptr<dev::eth::SealEngineFace> globalSealEngine;
 bool fRecordLogOpcodes = false;
 bool fIsVMlogFile = false;
 bool fGettingValuesDGP = false;
+
+namespace {
+/**
+ * Results of committed contract executions, keyed by everything an execution depends on: the parent
+ * state and UTXO roots, the block environment, the gas schedule and the contract transactions.
+ * The block assembler executes mempool contracts on top of the tip, so when the node validates and
+ * connects the block it built, the executions are found here and only the state roots are moved.
+ */
+class ContractExecCache
+{
+public:
+    struct Entry
+    {
+        std::vector<ResultExecute> result;
+        dev::h256 hashStateRoot;
+        dev::h256 hashUTXORoot;
+        size_t usage;
+    };
+
+    bool Get(const dev::h256& key, Entry& entry)
+    {
+        LOCK(cs);
+        auto it = entries.find(key);
+        if(it == entries.end())
+            return false;
+        entry = it->second;
+        return true;
+    }
+
+    void Put(const dev::h256& key, Entry entry)
+    {
+        entry.usage = MemoryUsage(entry);
+        if(entry.usage > CONTRACT_EXEC_CACHE_SIZE)
+            return;
+        LOCK(cs);
+        if(entries.count(key))
+            return;
+        while(!keys.empty() && cacheUsage + entry.usage > CONTRACT_EXEC_CACHE_SIZE){
+            auto it = entries.find(keys.front());
+            cacheUsage -= it->second.usage;
+            entries.erase(it);
+            keys.pop_front();
+        }
+        keys.push_back(key);
+        cacheUsage += entry.usage;
+        entries.emplace(key, std::move(entry));
+    }
+
+private:
+    /** Approximate memory used by an entry with its map node, the results dominate with their logs and transactions */
+    static size_t MemoryUsage(const Entry& entry)
+    {
+        size_t usage = sizeof(Entry) + sizeof(dev::h256) * 2 + 4 * sizeof(void*);
+        for(const ResultExecute& result : entry.result){
+            usage += sizeof(ResultExecute) + result.execRes.output.size() + RecursiveDynamicUsage(result.tx);
+            for(const dev::eth::LogEntry& log : result.txRec.log()){
+                usage += sizeof(dev::eth::LogEntry) + log.topics.size() * sizeof(dev::h256) + log.data.size();
+            }
+            for(const auto& created : result.txRec.createdContracts()){
+                usage += sizeof(created) + created.second.size();
+            }
+            usage += result.txRec.destructedContracts().size() * sizeof(dev::Address);
+        }
+        return usage;
+    }
+
+    Mutex cs;
+    std::map<dev::h256, Entry> entries GUARDED_BY(cs);
+    std::deque<dev::h256> keys GUARDED_BY(cs);
+    size_t cacheUsage GUARDED_BY(cs) = 0;
+};
+
+ContractExecCache contractExecCache;
+
+bool StateRootAvailable(dev::OverlayDB& db, const dev::h256& root)
+{
+    return root == dev::sha3(dev::rlp("")) || db.exists(root);
+}
+
+/**
+ * Move globalState to the post state of a cached execution if the accounts the execution touched can be
+ * read there, otherwise globalState is left unchanged and the transactions are executed again.
+ */
+bool SetCachedExecutionState(const std::vector<QtumTransaction>& txs, const ContractExecCache::Entry& entry)
+{
+    if(entry.result.size() != txs.size() ||
+            !StateRootAvailable(globalState->db(), entry.hashStateRoot) ||
+            !StateRootAvailable(globalState->dbUtxo(), entry.hashUTXORoot))
+        return false;
+
+    dev::h256 oldHashStateRoot(globalState->rootHash());
+    dev::h256 oldHashUTXORoot(globalState->rootHashUTXO());
+    globalState->setRoot(entry.hashStateRoot);
+    globalState->setRootUTXO(entry.hashUTXORoot);
+    for(size_t i = 0; i < txs.size(); i++){
+        dev::Address contract = txs[i].isCreation() ? entry.result[i].execRes.newAddress : txs[i].receiveAddress();
+        if(!globalState->accountStateAvailable(txs[i].sender()) || !globalState->accountStateAvailable(contract)){
+            LogPrint(BCLog::BENCH, "%s: state of cached contract execution is incomplete, executing again\n", __func__);
+            globalState->setRoot(oldHashStateRoot);
+            globalState->setRootUTXO(oldHashUTXORoot);
+            return false;
+        }
+    }
+    // drop the accounts loaded by the check, execution starts from clean caches
+    globalState->setRoot(entry.hashStateRoot);
+    globalState->setRootUTXO(entry.hashUTXORoot);
+    return true;
+}
+}
  //////////////////////////////
 
 bool CBlockIndexWorkComparator::operator()(const CBlockIndex *pa, const CBlockIndex *pb) const {
@@ -210,6 +324,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 
 std::unique_ptr<CBlockTreeDB> pblocktree;
 std::unique_ptr<StorageResults> pstorageresult;
+std::unique_ptr<FlatState> pflatstate;
 
 // See definition for documentation
 static void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPruneHeight);
@@ -458,6 +573,164 @@ static bool CheckInputsFromMempoolAndCache(const CTransaction& tx, CValidationSt
     return CheckInputs(tx, state, view, flags, cacheSigStore, true, txdata);
 }
 
+/** Values of the chain tip that the mempool checks of the inputs and contracts of a transaction depend on */
+struct MemPoolTipParams
+{
+    int nSpendHeight;
+    unsigned int nMaxTxSigOps;
+    uint64_t nMinGasPrice;
+    uint64_t nBlockGasLimit;
+};
+
+static MemPoolTipParams GetMemPoolTipParams(const CTransaction& tx, int nSpendHeight) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    MemPoolTipParams tip{nSpendHeight, dgpMaxTxSigOps, 0, 0};
+    if (tx.HasCreateOrCall()) {
+        QtumDGP qtumDGP(globalState.get(), fGettingValuesDGP);
+        tip.nMinGasPrice = qtumDGP.getMinGasPrice(::ChainActive().Tip()->nHeight + 1);
+        tip.nBlockGasLimit = qtumDGP.getBlockGasLimit(::ChainActive().Tip()->nHeight + 1);
+    }
+    return tip;
+}
+
+/** Context-free checks of a loose transaction, they do not need cs_main */
+static bool CheckMemPoolTransaction(const CTransaction& tx, CValidationState& state)
+{
+    if (!CheckTransaction(tx, state))
+        return false; // state filled in by CheckTransaction
+
+    // Coinbase is only valid in a block, not as a loose transaction
+    if (tx.IsCoinBase())
+        return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "coinbase");
+
+    // ppcoin: coinstake is also only valid in a block, not as a loose transaction
+    if (tx.IsCoinStake())
+        return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "coinstake");
+
+    // Rather not work on nonstandard transactions (unless -testnet/-regtest)
+    std::string reason;
+    if (fRequireStandard && !IsStandardTx(tx, reason))
+        return state.Invalid(ValidationInvalidReason::TX_NOT_STANDARD, false, REJECT_NONSTANDARD, reason);
+
+    // Do not work on transactions that are too small.
+    // A transaction with 1 segwit input and 1 P2WPHK output has non-witness size of 82 bytes.
+    // Transactions smaller than this are not relayed to mitigate CVE-2017-12842 by not relaying
+    // 64-byte transactions.
+    if (::GetSerializeSize(tx, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS) < MIN_STANDARD_TX_NONWITNESS_SIZE)
+        return state.Invalid(ValidationInvalidReason::TX_NOT_STANDARD, false, REJECT_NONSTANDARD, "tx-size-small");
+
+    return true;
+}
+
+/** Checks of the spent coins and of the contracts of a loose transaction, view holds all its inputs */
+static bool CheckMemPoolInputs(const CTransaction& tx, CValidationState& state, CCoinsViewCache& view, const CChainParams& chainparams,
+                               const MemPoolTipParams& tip, bool rawTx, CAmount nAbsurdFee, CAmount& nFees, int64_t& nSigOpsCost, dev::u256& txMinGasPrice)
+{
+    if (!Consensus::CheckTxInputs(tx, state, view, tip.nSpendHeight, nFees)) {
+        return error("%s: Consensus::CheckTxInputs: %s, %s", __func__, tx.GetHash().ToString(), FormatStateMessage(state));
+    }
+
+    // Check for non-standard pay-to-script-hash in inputs
+    if (fRequireStandard && !AreInputsStandard(tx, view))
+        return state.Invalid(ValidationInvalidReason::TX_NOT_STANDARD, false, REJECT_NONSTANDARD, "bad-txns-nonstandard-inputs");
+
+    // Check for non-standard witness in P2WSH
+    if (tx.HasWitness() && fRequireStandard && !IsWitnessStandard(tx, view))
+        return state.Invalid(ValidationInvalidReason::TX_WITNESS_MUTATED, false, REJECT_NONSTANDARD, "bad-witness-nonstandard");
+
+    nSigOpsCost = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
+    if (nSigOpsCost > tip.nMaxTxSigOps)
+        return state.Invalid(ValidationInvalidReason::TX_NOT_STANDARD, false, REJECT_NONSTANDARD, "bad-txns-too-many-sigops",
+                strprintf("%d", nSigOpsCost));
+
+    //////////////////////////////////////////////////////////// // qtum
+    if(!CheckOpSender(tx, chainparams, tip.nSpendHeight)){
+        return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-txns-invalid-sender");
+    }
+    if(tx.HasCreateOrCall()){
+
+        if(!CheckSenderScript(view, tx)){
+            return state.Invalid(ValidationInvalidReason::TX_INVALID_SENDER_SCRIPT, false, REJECT_INVALID, "bad-txns-invalid-sender-script");
+        }
+
+        const uint64_t minGasPrice = tip.nMinGasPrice;
+        const uint64_t blockGasLimit = tip.nBlockGasLimit;
+        size_t count = 0;
+        for(const CTxOut& o : tx.vout)
+            count += o.scriptPubKey.HasOpCreate() || o.scriptPubKey.HasOpCall() ? 1 : 0;
+        unsigned int contractflags = GetContractScriptFlags(tip.nSpendHeight, chainparams.GetConsensus());
+        QtumTxConverter converter(tx, &view, NULL, contractflags);
+        ExtractQtumTX resultConverter;
+        if(!converter.extractionQtumTransactions(resultConverter)){
+            return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Contract transaction of the wrong format"), REJECT_INVALID, "bad-tx-bad-contract-format");
+        }
+        std::vector<QtumTransaction> qtumTransactions = resultConverter.first;
+        std::vector<EthTransactionParams> qtumETP = resultConverter.second;
+
+        dev::u256 sumGas = dev::u256(0);
+        dev::u256 gasAllTxs = dev::u256(0);
+        for(const QtumTransaction& qtumTransaction : qtumTransactions){
+            sumGas += qtumTransaction.gas() * qtumTransaction.gasPrice();
+
+            if(sumGas > dev::u256(INT64_MAX)) {
+                return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Transaction's gas stipend overflows"), REJECT_INVALID, "bad-tx-gas-stipend-overflow");
+            }
+
+            if(sumGas > dev::u256(nFees)) {
+                return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Transaction fee does not cover the gas stipend"), REJECT_INVALID, "bad-txns-fee-notenough");
+            }
+
+            if(txMinGasPrice != 0) {
+                txMinGasPrice = std::min(txMinGasPrice, qtumTransaction.gasPrice());
+            } else {
+                txMinGasPrice = qtumTransaction.gasPrice();
+            }
+            VersionVM v = qtumTransaction.getVersion();
+            if(v.format!=0)
+                return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Contract execution uses unknown version format"), REJECT_INVALID, "bad-tx-version-format");
+            if(v.rootVM != 1)
+                return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Contract execution uses unknown root VM"), REJECT_INVALID, "bad-tx-version-rootvm");
+            if(v.vmVersion != 0)
+                return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Contract execution uses unknown VM version"), REJECT_INVALID, "bad-tx-version-vmversion");
+            if(v.flagOptions != 0)
+                return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Contract execution uses unknown flag options"), REJECT_INVALID, "bad-tx-version-flags");
+
+            //check gas limit is not less than minimum mempool gas limit
+            if(qtumTransaction.gas() < gArgs.GetArg("-minmempoolgaslimit", MEMPOOL_MIN_GAS_LIMIT))
+                return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Contract execution has lower gas limit than allowed to accept into mempool"), REJECT_INVALID, "bad-tx-too-little-mempool-gas");
+
+            //check gas limit is not less than minimum gas limit (unless it is a no-exec tx)
+            if(qtumTransaction.gas() < MINIMUM_GAS_LIMIT && v.rootVM != 0)
+                return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Contract execution has lower gas limit than allowed"), REJECT_INVALID, "bad-tx-too-little-gas");
+
+            if(qtumTransaction.gas() > UINT32_MAX)
+                return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Contract execution can not specify greater gas limit than can fit in 32-bits"), REJECT_INVALID, "bad-tx-too-much-gas");
+
+            gasAllTxs += qtumTransaction.gas();
+            if(gasAllTxs > dev::u256(blockGasLimit))
+                return state.Invalid(ValidationInvalidReason::TX_GAS_EXCEEDS_LIMIT, false, REJECT_INVALID, "bad-txns-gas-exceeds-blockgaslimit");
+
+            //don't allow less than DGP set minimum gas price to prevent MPoS greedy mining/spammers
+            if(v.rootVM!=0 && (uint64_t)qtumTransaction.gasPrice() < minGasPrice)
+                return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Contract execution has lower gas price than allowed"), REJECT_INVALID, "bad-tx-low-gas-price");
+        }
+
+        if(!CheckMinGasPrice(qtumETP, minGasPrice))
+            return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-txns-small-gasprice");
+
+        if(count > qtumTransactions.size())
+            return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-txns-incorrect-format");
+
+        if (rawTx && nAbsurdFee && dev::u256(nFees) > dev::u256(nAbsurdFee) + sumGas)
+            return state.Invalid(ValidationInvalidReason::TX_NOT_STANDARD, false,
+                REJECT_HIGHFEE, "absurdly-high-fee",
+                strprintf("%d > %d", nFees, nAbsurdFee));
+    }
+    ////////////////////////////////////////////////////////////
+
+    return true;
+}
+
 namespace {
 
 class MemPoolAccept
@@ -489,6 +762,7 @@ public:
         std::vector<COutPoint>& m_coins_to_uncache;
         const bool m_test_accept;
         bool m_raw_tx;
+        const MemPoolPreCheck* m_precheck;
     };
 
     // Single transaction acceptance
@@ -508,6 +782,8 @@ private:
         CAmount m_modified_fees;
         CAmount m_conflicting_fees;
         size_t m_conflicting_size;
+        // The precheck of the transaction is valid for the current tip and spent coins
+        bool m_prechecked = false;
 
         const CTransactionRef& m_ptx;
         const uint256& m_hash;
@@ -593,28 +869,12 @@ bool MemPoolAccept::PreChecks(ATMPArgs& args, Workspace& ws)
         *pfMissingInputs = false;
     }
 
-    if (!CheckTransaction(tx, state))
-        return false; // state filled in by CheckTransaction
-
-    // Coinbase is only valid in a block, not as a loose transaction
-    if (tx.IsCoinBase())
-        return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "coinbase");
-
-    // ppcoin: coinstake is also only valid in a block, not as a loose transaction
-    if (tx.IsCoinStake())
-        return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "coinstake");
-
-    // Rather not work on nonstandard transactions (unless -testnet/-regtest)
-    std::string reason;
-    if (fRequireStandard && !IsStandardTx(tx, reason))
-        return state.Invalid(ValidationInvalidReason::TX_NOT_STANDARD, false, REJECT_NONSTANDARD, reason);
-
-    // Do not work on transactions that are too small.
-    // A transaction with 1 segwit input and 1 P2WPHK output has non-witness size of 82 bytes.
-    // Transactions smaller than this are not relayed to mitigate CVE-2017-12842 by not relaying
-    // 64-byte transactions.
-    if (::GetSerializeSize(tx, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS) < MIN_STANDARD_TX_NONWITNESS_SIZE)
-        return state.Invalid(ValidationInvalidReason::TX_NOT_STANDARD, false, REJECT_NONSTANDARD, "tx-size-small");
+    // A precheck of the same transaction ran the context-free checks
+    const MemPoolPreCheck* precheck = args.m_precheck;
+    if (precheck && precheck->m_wtxid != tx.GetWitnessHash())
+        precheck = nullptr;
+    if (!precheck && !CheckMemPoolTransaction(tx, state))
+        return false; // state filled in by CheckMemPoolTransaction
 
     // Only accept nLockTime-using transactions that can be mined in the next
     // block; we don't want our mempool filled up with transactions that can't
@@ -709,122 +969,38 @@ bool MemPoolAccept::PreChecks(ATMPArgs& args, Workspace& ws)
     // Bring the best block into scope
     m_view.GetBestBlock();
 
-    // we have all inputs cached now, so switch back to dummy (to protect
-    // against bugs where we pull more inputs from disk that miss being added
-    // to coins_to_uncache)
-    m_view.SetBackend(m_dummy);
-
-    // Only accept BIP68 sequence locked transactions that can be mined in the next
-    // block; we don't want our mempool filled up with transactions that can't
-    // be mined yet.
-    // Must keep pool.cs for this unless we change CheckSequenceLocks to take a
-    // CoinsViewCache instead of create its own
-    if (!CheckSequenceLocks(m_pool, tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp))
-        return state.Invalid(ValidationInvalidReason::TX_PREMATURE_SPEND, false, REJECT_NONSTANDARD, "non-BIP68-final");
-
-    CAmount nFees = 0;
-    if (!Consensus::CheckTxInputs(tx, state, m_view, GetSpendHeight(m_view), nFees)) {
-        return error("%s: Consensus::CheckTxInputs: %s, %s", __func__, tx.GetHash().ToString(), FormatStateMessage(state));
-    }
-
-    // Check for non-standard pay-to-script-hash in inputs
-    if (fRequireStandard && !AreInputsStandard(tx, m_view))
-        return state.Invalid(ValidationInvalidReason::TX_NOT_STANDARD, false, REJECT_NONSTANDARD, "bad-txns-nonstandard-inputs");
-
-    // Check for non-standard witness in P2WSH
-    if (tx.HasWitness() && fRequireStandard && !IsWitnessStandard(tx, m_view))
-        return state.Invalid(ValidationInvalidReason::TX_WITNESS_MUTATED, false, REJECT_NONSTANDARD, "bad-witness-nonstandard");
-
-    int64_t nSigOpsCost = GetTransactionSigOpCost(tx, m_view, STANDARD_SCRIPT_VERIFY_FLAGS);
-
-    dev::u256 txMinGasPrice = 0;
-
-    //////////////////////////////////////////////////////////// // qtum
-    if(!CheckOpSender(tx, chainparams, GetSpendHeight(m_view))){
-        return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-txns-invalid-sender");
-    }
-    if(tx.HasCreateOrCall()){
-
-        if(!CheckSenderScript(m_view, tx)){
-            return state.Invalid(ValidationInvalidReason::TX_INVALID_SENDER_SCRIPT, false, REJECT_INVALID, "bad-txns-invalid-sender-script");
-        }
-
-        QtumDGP qtumDGP(globalState.get(), fGettingValuesDGP);
-        uint64_t minGasPrice = qtumDGP.getMinGasPrice(::ChainActive().Tip()->nHeight + 1);
-        uint64_t blockGasLimit = qtumDGP.getBlockGasLimit(::ChainActive().Tip()->nHeight + 1);
-        size_t count = 0;
-        for(const CTxOut& o : tx.vout)
-            count += o.scriptPubKey.HasOpCreate() || o.scriptPubKey.HasOpCall() ? 1 : 0;
-        unsigned int contractflags = GetContractScriptFlags(GetSpendHeight(m_view), chainparams.GetConsensus());
-        QtumTxConverter converter(tx, NULL, NULL, contractflags);
-        ExtractQtumTX resultConverter;
-        if(!converter.extractionQtumTransactions(resultConverter)){
-            return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Contract transaction of the wrong format"), REJECT_INVALID, "bad-tx-bad-contract-format");
-        }
-        std::vector<QtumTransaction> qtumTransactions = resultConverter.first;
-        std::vector<EthTransactionParams> qtumETP = resultConverter.second;
-
-        dev::u256 sumGas = dev::u256(0);
-        dev::u256 gasAllTxs = dev::u256(0);
-        for(const QtumTransaction& qtumTransaction : qtumTransactions){
-            sumGas += qtumTransaction.gas() * qtumTransaction.gasPrice();
-
-            if(sumGas > dev::u256(INT64_MAX)) {
-                return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Transaction's gas stipend overflows"), REJECT_INVALID, "bad-tx-gas-stipend-overflow");
-            }
-
-            if(sumGas > dev::u256(nFees)) {
-                return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Transaction fee does not cover the gas stipend"), REJECT_INVALID, "bad-txns-fee-notenough");
-            }
-
-            if(txMinGasPrice != 0) {
-                txMinGasPrice = std::min(txMinGasPrice, qtumTransaction.gasPrice());
-            } else {
-                txMinGasPrice = qtumTransaction.gasPrice();
-            }
-            VersionVM v = qtumTransaction.getVersion();
-            if(v.format!=0)
-                return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Contract execution uses unknown version format"), REJECT_INVALID, "bad-tx-version-format");
-            if(v.rootVM != 1)
-                return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Contract execution uses unknown root VM"), REJECT_INVALID, "bad-tx-version-rootvm");
-            if(v.vmVersion != 0)
-                return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Contract execution uses unknown VM version"), REJECT_INVALID, "bad-tx-version-vmversion");
-            if(v.flagOptions != 0)
-                return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Contract execution uses unknown flag options"), REJECT_INVALID, "bad-tx-version-flags");
-
-            //check gas limit is not less than minimum mempool gas limit
-            if(qtumTransaction.gas() < gArgs.GetArg("-minmempoolgaslimit", MEMPOOL_MIN_GAS_LIMIT))
-                return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Contract execution has lower gas limit than allowed to accept into mempool"), REJECT_INVALID, "bad-tx-too-little-mempool-gas");
-
-            //check gas limit is not less than minimum gas limit (unless it is a no-exec tx)
-            if(qtumTransaction.gas() < MINIMUM_GAS_LIMIT && v.rootVM != 0)
-                return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Contract execution has lower gas limit than allowed"), REJECT_INVALID, "bad-tx-too-little-gas");
-
-            if(qtumTransaction.gas() > UINT32_MAX)
-                return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Contract execution can not specify greater gas limit than can fit in 32-bits"), REJECT_INVALID, "bad-tx-too-much-gas");
-
-            gasAllTxs += qtumTransaction.gas();
-            if(gasAllTxs > dev::u256(blockGasLimit))
-                return state.Invalid(ValidationInvalidReason::TX_GAS_EXCEEDS_LIMIT, false, REJECT_INVALID, "bad-txns-gas-exceeds-blockgaslimit");
-
-            //don't allow less than DGP set minimum gas price to prevent MPoS greedy mining/spammers
-            if(v.rootVM!=0 && (uint64_t)qtumTransaction.gasPrice() < minGasPrice)
-                return state.Invalid(ValidationInvalidReason::CONSENSUS, error("AcceptToMempool(): Contract execution has lower gas price than allowed"), REJECT_INVALID, "bad-tx-low-gas-price");
-        }
-
-        if(!CheckMinGasPrice(qtumETP, minGasPrice))
-            return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-txns-small-gasprice");
+    // we have all inputs cached now, so switch back to dummy (to protect
+    // against bugs where we pull more inputs from disk that miss being added
+    // to coins_to_uncache)
+    m_view.SetBackend(m_dummy);
 
-        if(count > qtumTransactions.size())
-            return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-txns-incorrect-format");
+    // Only accept BIP68 sequence locked transactions that can be mined in the next
+    // block; we don't want our mempool filled up with transactions that can't
+    // be mined yet.
+    // Must keep pool.cs for this unless we change CheckSequenceLocks to take a
+    // CoinsViewCache instead of create its own
+    if (!CheckSequenceLocks(m_pool, tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp))
+        return state.Invalid(ValidationInvalidReason::TX_PREMATURE_SPEND, false, REJECT_NONSTANDARD, "non-BIP68-final");
 
-        if (rawTx && nAbsurdFee && dev::u256(nFees) > dev::u256(nAbsurdFee) + sumGas)
-            return state.Invalid(ValidationInvalidReason::TX_NOT_STANDARD, false,
-                REJECT_HIGHFEE, "absurdly-high-fee",
-                strprintf("%d > %d", nFees, nAbsurdFee));
+    CAmount nFees = 0;
+    int64_t nSigOpsCost = 0;
+    dev::u256 txMinGasPrice = 0;
+    ws.m_prechecked = precheck && !rawTx && precheck->m_best_block == m_view.GetBestBlock() && precheck->m_spent_coins.size() == tx.vin.size();
+    for (size_t i = 0; i < tx.vin.size() && ws.m_prechecked; i++) {
+        const Coin& coin = m_view.AccessCoin(tx.vin[i].prevout);
+        const Coin& coinSnapshot = precheck->m_spent_coins[i];
+        ws.m_prechecked = coin.out == coinSnapshot.out && coin.nHeight == coinSnapshot.nHeight &&
+            coin.IsCoinBase() == coinSnapshot.IsCoinBase() && coin.IsCoinStake() == coinSnapshot.IsCoinStake();
+    }
+    if (ws.m_prechecked) {
+        // The inputs and contracts were checked against the same coins and tip
+        nFees = precheck->m_fees;
+        nSigOpsCost = precheck->m_sigops_cost;
+        txMinGasPrice = dev::u256(precheck->m_min_gas_price);
+    } else if (!CheckMemPoolInputs(tx, state, m_view, chainparams, GetMemPoolTipParams(tx, GetSpendHeight(m_view)),
+                                   rawTx, nAbsurdFee, nFees, nSigOpsCost, txMinGasPrice)) {
+        return false; // state filled in by CheckMemPoolInputs
     }
-    ////////////////////////////////////////////////////////////
-
 
     // nModifiedFees includes any fee deltas from PrioritiseTransaction
     nModifiedFees = nFees;
@@ -845,10 +1021,6 @@ bool MemPoolAccept::PreChecks(ATMPArgs& args, Workspace& ws)
             fSpendsCoinbase, nSigOpsCost, lp, CAmount(txMinGasPrice)));
     unsigned int nSize = entry->GetTxSize();
 
-    if (nSigOpsCost > dgpMaxTxSigOps)
-        return state.Invalid(ValidationInvalidReason::TX_NOT_STANDARD, false, REJECT_NONSTANDARD, "bad-txns-too-many-sigops",
-                strprintf("%d", nSigOpsCost));
-
     // No transactions are allowed below minRelayTxFee except from disconnected
     // blocks
     if (!bypass_limits && !CheckFeeRate(nSize, nModifiedFees, state)) return false;
@@ -1177,21 +1349,27 @@ bool MemPoolAccept::AcceptSingleTransaction(const CTransactionRef& ptx, ATMPArgs
 
     if (!PreChecks(args, workspace)) return false;
 
-    // Only compute the precomputed transaction data if we need to verify
-    // scripts (ie, other policy checks pass). We perform the inexpensive
-    // checks first and avoid hashing and signature verification unless those
-    // checks pass, to mitigate CPU exhaustion denial-of-service attacks.
-    PrecomputedTransactionData txdata(*ptx);
+    if (!workspace.m_prechecked) {
+        // Only compute the precomputed transaction data if we need to verify
+        // scripts (ie, other policy checks pass). We perform the inexpensive
+        // checks first and avoid hashing and signature verification unless those
+        // checks pass, to mitigate CPU exhaustion denial-of-service attacks.
+        PrecomputedTransactionData txdata(*ptx);
 
-    if (!PolicyScriptChecks(args, workspace, txdata)) return false;
+        if (!PolicyScriptChecks(args, workspace, txdata)) return false;
 
-    if (!ConsensusScriptChecks(args, workspace, txdata)) return false;
+        if (!ConsensusScriptChecks(args, workspace, txdata)) return false;
+    }
 
     // Tx was accepted, but not added
     if (args.m_test_accept) return true;
 
     if (!Finalize(args, workspace)) return false;
 
+    // The scripts of a precheck were verified with the standard and block flags on the mempool check threads
+    if (workspace.m_prechecked)
+        AddSignatureCacheEntries(args.m_precheck->m_sigcache_entries);
+
     GetMainSignals().TransactionAddedToMempool(ptx);
 
     return true;
@@ -1202,10 +1380,14 @@ bool MemPoolAccept::AcceptSingleTransaction(const CTransactionRef& ptx, ATMPArgs
 /** (try to) add transaction to memory pool with a specified acceptance time **/
 static bool AcceptToMemoryPoolWithTime(const CChainParams& chainparams, CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx,
                         bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
-                        bool bypass_limits, const CAmount nAbsurdFee, bool test_accept, bool rawTx = false) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+                        bool bypass_limits, const CAmount nAbsurdFee, bool test_accept, bool rawTx = false,
+                        const MemPoolPreCheck* precheck = nullptr) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     std::vector<COutPoint> coins_to_uncache;
-    MemPoolAccept::ATMPArgs args { chainparams, state, pfMissingInputs, nAcceptTime, plTxnReplaced, bypass_limits, nAbsurdFee, coins_to_uncache, test_accept, rawTx };
+    if (precheck) {
+        coins_to_uncache = precheck->m_coins_to_uncache;
+    }
+    MemPoolAccept::ATMPArgs args { chainparams, state, pfMissingInputs, nAcceptTime, plTxnReplaced, bypass_limits, nAbsurdFee, coins_to_uncache, test_accept, rawTx, precheck };
     bool res = MemPoolAccept(pool).AcceptSingleTransaction(tx, args);
     if (!res) {
         // Remove coins that were not present in the coins cache before calling ATMPW;
@@ -1237,10 +1419,117 @@ bool IsConfirmedInNPrevBlocks(const CDiskTxPos& txindex, const CBlockIndex* pind
 
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx,
                         bool* pfMissingInputs, std::list<CTransactionRef>* plTxnReplaced,
-                        bool bypass_limits, const CAmount nAbsurdFee, bool test_accept, bool rawTx)
+                        bool bypass_limits, const CAmount nAbsurdFee, bool test_accept, bool rawTx,
+                        const MemPoolPreCheck* precheck)
+{
+    const CChainParams& chainparams = Params();
+    return AcceptToMemoryPoolWithTime(chainparams, pool, state, tx, pfMissingInputs, GetTime(), plTxnReplaced, bypass_limits, nAbsurdFee, test_accept, rawTx, precheck);
+}
+
+static CCheckQueue<CScriptCheck> mempoolcheckqueue(128);
+
+void ThreadMemPoolScriptCheck(int worker_num) {
+    util::ThreadRename(strprintf("mempoolch.%i", worker_num));
+    mempoolcheckqueue.Thread();
+}
+
+static void UncacheMemPoolPreCheck(MemPoolPreCheck& precheck)
+{
+    LOCK(cs_main);
+    for (const COutPoint& outpoint : precheck.m_coins_to_uncache)
+        ::ChainstateActive().CoinsTip().Uncache(outpoint);
+    precheck.m_coins_to_uncache.clear();
+}
+
+bool PreCheckMemPoolTransaction(CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx, MemPoolPreCheck& precheck)
 {
+    const CTransaction& tx = *ptx;
     const CChainParams& chainparams = Params();
-    return AcceptToMemoryPoolWithTime(chainparams, pool, state, tx, pfMissingInputs, GetTime(), plTxnReplaced, bypass_limits, nAbsurdFee, test_accept, rawTx);
+    precheck = MemPoolPreCheck();
+    precheck.m_wtxid = tx.GetWitnessHash();
+
+    if (!CheckMemPoolTransaction(tx, state))
+        return false; // state filled in by CheckMemPoolTransaction
+
+    // Take a snapshot of the spent coins and of the tip, the only part under cs_main
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+    MemPoolTipParams tip{};
+    unsigned int nScriptFlags = 0;
+    {
+        LOCK2(cs_main, pool.cs);
+        CCoinsViewCache& coins_cache = ::ChainstateActive().CoinsTip();
+        CCoinsViewMemPool viewmempool(&coins_cache, pool);
+        precheck.m_spent_coins.reserve(tx.vin.size());
+        for (const CTxIn& txin : tx.vin) {
+            if (!coins_cache.HaveCoinInCache(txin.prevout)) {
+                precheck.m_coins_to_uncache.push_back(txin.prevout);
+            }
+            Coin coin;
+            if (!viewmempool.GetCoin(txin.prevout, coin) || coin.IsSpent()) {
+                break;
+            }
+            view.AddCoin(txin.prevout, Coin(coin), false);
+            precheck.m_spent_coins.push_back(std::move(coin));
+        }
+        precheck.m_best_block = coins_cache.GetBestBlock();
+        const CBlockIndex* pindexPrev = LookupBlockIndex(precheck.m_best_block);
+        tip = GetMemPoolTipParams(tx, pindexPrev->nHeight + 1);
+        nScriptFlags = STANDARD_SCRIPT_VERIFY_FLAGS | GetBlockScriptFlags(::ChainActive().Tip(), chainparams.GetConsensus());
+    }
+    view.SetBestBlock(precheck.m_best_block);
+
+    // Missing inputs are left to AcceptToMemoryPool, which keeps the orphan
+    if (precheck.m_spent_coins.size() != tx.vin.size()) {
+        UncacheMemPoolPreCheck(precheck);
+        return false;
+    }
+
+    dev::u256 txMinGasPrice = 0;
+    if (!CheckMemPoolInputs(tx, state, view, chainparams, tip, false, 0, precheck.m_fees, precheck.m_sigops_cost, txMinGasPrice)) {
+        UncacheMemPoolPreCheck(precheck);
+        return false; // state filled in by CheckMemPoolInputs
+    }
+    precheck.m_min_gas_price = CAmount(txMinGasPrice);
+
+    // Verify the scripts on the mempool check threads with both the standard and the block flags,
+    // the signatures are collected per check and stored once the transaction is accepted
+    PrecomputedTransactionData txdata(tx);
+    std::vector<std::vector<uint256>> vSigCacheEntries(tx.vin.size() + tx.vout.size());
+    std::vector<CScriptCheck> vChecks;
+    vChecks.reserve(tx.vin.size());
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        vChecks.emplace_back(precheck.m_spent_coins[i].out, tx, i, nScriptFlags, false, &txdata, &vSigCacheEntries[i]);
+    }
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        if (tx.vout[i].scriptPubKey.HasOpSender()) {
+            vChecks.emplace_back(tx, i, 0, false, &txdata, &vSigCacheEntries[tx.vin.size() + i]);
+        }
+    }
+    bool fScriptsValid = true;
+    if (nScriptCheckThreads) {
+        CCheckQueueControl<CScriptCheck> control(&mempoolcheckqueue);
+        control.Add(vChecks);
+        fScriptsValid = control.Wait();
+    } else {
+        for (CScriptCheck& check : vChecks) {
+            if (!check()) {
+                fScriptsValid = false;
+                break;
+            }
+        }
+    }
+
+    // A script failure is classified by the policy script checks of AcceptToMemoryPool
+    if (!fScriptsValid) {
+        UncacheMemPoolPreCheck(precheck);
+        return false;
+    }
+
+    for (const std::vector<uint256>& entries : vSigCacheEntries)
+        precheck.m_sigcache_entries.insert(precheck.m_sigcache_entries.end(), entries.begin(), entries.end());
+
+    return true;
 }
 
 /**
@@ -1787,13 +2076,13 @@ bool CScriptCheck::operator()() {
         CScript senderPubKey, senderSig;
         if(!ExtractSenderData(ptxTo->vout[nOut].scriptPubKey, &senderPubKey, &senderSig))
             return false;
-        return VerifyScript(senderSig, senderPubKey, nullptr, nFlags, CachingTransactionSignatureOutputChecker(ptxTo, nOut, ptxTo->vout[nOut].nValue, cacheStore, *txdata), &error);
+        return VerifyScript(senderSig, senderPubKey, nullptr, nFlags, CachingTransactionSignatureOutputChecker(ptxTo, nOut, ptxTo->vout[nOut].nValue, cacheStore, *txdata, pvSigCacheDeferred), &error);
     }
 
     // Check the input signature
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
     const CScriptWitness *witness = &ptxTo->vin[nIn].scriptWitness;
-    return VerifyScript(scriptSig, m_tx_out.scriptPubKey, witness, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, m_tx_out.nValue, cacheStore, *txdata), &error);
+    return VerifyScript(scriptSig, m_tx_out.scriptPubKey, witness, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, m_tx_out.nValue, cacheStore, *txdata, pvSigCacheDeferred), &error);
 }
 
 int GetSpendHeight(const CCoinsViewCache& inputs)
@@ -2056,13 +2345,6 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
         return DISCONNECT_FAILED;
     }
 
-#ifdef ENABLE_BITCORE_RPC
-    /////////////////////////////////////////////////////////// // qtum
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
-    ///////////////////////////////////////////////////////////
-#endif
-
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = *(block.vtx[i]);
@@ -2083,31 +2365,6 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
             }
         }
 
-#ifdef ENABLE_BITCORE_RPC
-        /////////////////////////////////////////////////////////// // qtum
-        if (pfClean == NULL && fAddressIndex) {
-
-            for (unsigned int k = tx.vout.size(); k-- > 0;) {
-                const CTxOut &out = tx.vout[k];
-
-                CTxDestination dest;
-                if (ExtractDestination({hash, k}, out.scriptPubKey, dest)) {
-                    valtype bytesID(boost::apply_visitor(DataVisitor(), dest));
-                    if(bytesID.empty()) {
-                        continue;
-                    }
-                    valtype addressBytes(32);
-                    std::copy(bytesID.begin(), bytesID.end(), addressBytes.begin());
-                    // undo receiving activity
-                    addressIndex.push_back(std::make_pair(CAddressIndexKey(dest.which(), uint256(addressBytes), pindex->nHeight, i, hash, k, false), out.nValue));
-                    // undo unspent index
-                    addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(dest.which(), uint256(addressBytes), hash, k), CAddressUnspentValue()));
-                }
-            }
-        }
-        ///////////////////////////////////////////////////////////
-#endif
-
         // restore inputs
         if (i > 0) { // not coinbases
             CTxUndo &txundo = blockUndo.vtxundo[i-1];
@@ -2120,29 +2377,6 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
                 int res = ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out);
                 if (res == DISCONNECT_FAILED) return DISCONNECT_FAILED;
                 fClean = fClean && res != DISCONNECT_UNCLEAN;
-
-#ifdef ENABLE_BITCORE_RPC
-                const auto &undo = txundo.vprevout[j];
-                const bool isTxCoinStake = tx.IsCoinStake();
-                const CTxIn input = tx.vin[j];
-                if (pfClean == NULL && fAddressIndex) {
-                    const CTxOut &prevout = view.GetOutputFor(input);
-
-                    CTxDestination dest;
-                    if (ExtractDestination(input.prevout, prevout.scriptPubKey, dest)) {
-                        valtype bytesID(boost::apply_visitor(DataVisitor(), dest));
-                        if(bytesID.empty()) {
-                            continue;
-                        }
-                        valtype addressBytes(32);
-                        std::copy(bytesID.begin(), bytesID.end(), addressBytes.begin());
-                        // undo spending activity
-                        addressIndex.push_back(std::make_pair(CAddressIndexKey(dest.which(), uint256(addressBytes), pindex->nHeight, i, hash, j, true), prevout.nValue * -1));
-                        // restore unspent index
-                        addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(dest.which(), uint256(addressBytes), input.prevout.hash, input.prevout.n), CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, undo.nHeight, isTxCoinStake)));
-                    }
-                }
-#endif
             }
             // At this point, all of txundo.vprevout should have been moved out.
         }
@@ -2157,23 +2391,12 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
     if(pfClean == NULL && fLogEvents){
         pstorageresult->deleteResults(block.vtx);
         pblocktree->EraseHeightIndex(pindex->nHeight);
+        pblocktree->EraseLogBloom(pindex->nHeight);
     }
-    pblocktree->EraseStakeIndex(pindex->nHeight);
-
-#ifdef ENABLE_BITCORE_RPC
-    //////////////////////////////////////////////////// // qtum
-    if (pfClean == NULL && fAddressIndex) {
-        if (!pblocktree->EraseAddressIndex(addressIndex)) {
-            error("Failed to delete address index");
-            return DISCONNECT_FAILED;
-        }
-        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
-            error("Failed to write address unspent index");
-            return DISCONNECT_FAILED;
-        }
+    if (pfClean == NULL) {
+        g_spent_coins.DisconnectBlock(pindex);
     }
-    ////////////////////////////////////////////////////
-#endif
+    pblocktree->EraseStakeIndex(pindex->nHeight);
 
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
@@ -2221,6 +2444,13 @@ void ThreadScriptCheck(int worker_num) {
     scriptcheckqueue.Thread();
 }
 
+static CCheckQueue<CBlockSignatureCheck> blocksigcheckqueue(128);
+
+void ThreadBlockSignatureCheck(int worker_num) {
+    util::ThreadRename(strprintf("blocksig.%i", worker_num));
+    blocksigcheckqueue.Thread();
+}
+
 VersionBitsCache versionbitscache GUARDED_BY(cs_main);
 
 int32_t ComputeBlockVersion(const CBlockIndex* pindexPrev, const Consensus::Params& params)
@@ -2336,6 +2566,11 @@ unsigned int GetContractScriptFlags(int nHeight, const Consensus::Params& consen
     return flags;
 }
 
+int GetScheduleHeight(int nHeight, const Consensus::Params& consensusparams) {
+    // Before QIP7 the parameters of the next height were used
+    return nHeight + (nHeight + 1 >= consensusparams.QIP7Height ? 0 : 1);
+}
+
 
 static int64_t nTimeCheck = 0;
 static int64_t nTimeForks = 0;
@@ -2409,7 +2644,12 @@ bool GetSpentCoinFromMainChain(const CBlockIndex* pforkPrev, COutPoint prevoutSt
     {
         CBlockIndex* pindex = ChainActive().Tip();
         while(pindex && pindex != pforkBase) {
-            if(GetSpentCoinFromBlock(pindex, prevoutStake, coin)) {
+            // Recent blocks are looked up in memory, only blocks connected before the cache filled up are read
+            if(g_spent_coins.HasBlock(pindex)) {
+                if(g_spent_coins.GetSpentCoin(pindex, prevoutStake, *coin)) {
+                    return true;
+                }
+            } else if(GetSpentCoinFromBlock(pindex, prevoutStake, coin)) {
                 return true;
             }
             pindex = pindex->pprev;
@@ -2536,6 +2776,92 @@ std::vector<ResultExecute> CallContract(const dev::Address& addrContract, std::v
     return exec.getResult();
 }
 
+ContractStateSnapshot::ContractStateSnapshot(const CBlockIndex* pindex) :
+    hashBlock(pindex->GetBlockHash()),
+    state(new QtumState(*globalState, uintToh256(pindex->hashStateRoot), uintToh256(pindex->hashUTXORoot)))
+{
+    AssertLockHeld(cs_main);
+
+    // the DGP values are read at the state of the snapshot
+    {
+        TemporaryState ts(globalState);
+        ts.SetRoot(uintToh256(pindex->hashStateRoot), uintToh256(pindex->hashUTXORoot));
+        QtumDGP qtumDGP(globalState.get(), fGettingValuesDGP);
+        blockGasLimit = qtumDGP.getBlockGasLimit(pindex->nHeight + 1);
+        schedule = qtumDGP.getGasSchedule(pindex->nHeight + 1);
+    }
+
+    // the author is the only field of the environment that needs the block body, read it once per snapshot
+    CBlock block;
+    dev::Address author;
+    if (ReadBlockFromDisk(block, pindex, Params().GetConsensus())) {
+        if (block.IsProofOfStake())
+            author = ByteCodeExec::EthAddrFromScript(block.vtx[1]->vout[1].scriptPubKey);
+        else
+            author = ByteCodeExec::EthAddrFromScript(block.vtx[0]->vout[0].scriptPubKey);
+    }
+
+    header.setNumber(pindex->nHeight + 1);
+    header.setDifficulty(dev::u256(pindex->nBits));
+    header.setGasLimit(blockGasLimit);
+    header.setAuthor(author);
+    lastHashes.set(pindex);
+}
+
+bool ContractStateSnapshot::Call(const dev::Address& addrContract, const std::vector<unsigned char>& opcode, std::vector<ResultExecute>& results, const dev::Address& sender, uint64_t gasLimit) const
+{
+    QtumState callState(*state, state->rootHash(), state->rootHashUTXO());
+    if (!callState.addressInUse(addrContract))
+        return false;
+
+    if (gasLimit == 0) {
+        gasLimit = blockGasLimit - 1;
+    }
+    dev::Address senderAddress = sender == dev::Address() ? dev::Address("ffffffffffffffffffffffffffffffffffffffff") : sender;
+    QtumTransaction callTransaction(0, 1, dev::u256(gasLimit), addrContract, opcode, dev::u256(0));
+    callTransaction.forceSender(senderAddress);
+    callTransaction.setVersion(VersionVM::GetEVMDefault());
+
+    // the seal engine keeps per execution data, so every call gets its own
+    std::unique_ptr<dev::eth::SealEngineFace> sealEngine(dev::eth::SealEngineRegistry::create(globalSealEngine->chainParams()));
+    sealEngine->setQtumSchedule(schedule);
+
+    dev::eth::BlockHeader callHeader(header);
+    callHeader.setTimestamp(GetAdjustedTime());
+    dev::u256 gasUsed;
+    dev::eth::EnvInfo envInfo(callHeader, lastHashes, gasUsed);
+    results.push_back(callState.execute(envInfo, *sealEngine, callTransaction, dev::eth::Permanence::Reverted, OnOpFunc()));
+    return true;
+}
+
+dev::h256 ContractStateSnapshot::StorageRoot(const dev::Address& addr) const
+{
+    // reading the account fills the cache of the state, so it is read from a copy like a call
+    QtumState readState(*state, state->rootHash(), state->rootHashUTXO());
+    return readState.storageRoot(addr);
+}
+
+std::shared_ptr<const ContractStateSnapshot> ContractStateSnapshot::Create(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    if (!globalState->rootsAvailable(uintToh256(pindex->hashStateRoot), uintToh256(pindex->hashUTXORoot)))
+        return nullptr;
+    return std::shared_ptr<const ContractStateSnapshot>(new ContractStateSnapshot(pindex));
+}
+
+static std::shared_ptr<const ContractStateSnapshot> tipContractStateSnapshot GUARDED_BY(cs_main);
+
+std::shared_ptr<const ContractStateSnapshot> GetContractStateSnapshot(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    if (pindex != ::ChainActive().Tip())
+        return ContractStateSnapshot::Create(pindex);
+
+    if (!tipContractStateSnapshot || tipContractStateSnapshot->GetBlockHash() != pindex->GetBlockHash())
+        tipContractStateSnapshot = ContractStateSnapshot::Create(pindex);
+    return tipContractStateSnapshot;
+}
+
 bool CheckMinGasPrice(std::vector<EthTransactionParams>& etps, const uint64_t& minGasPrice){
     for(EthTransactionParams& etp : etps){
         if(etp.gasPrice < dev::u256(minGasPrice))
@@ -2935,6 +3261,17 @@ void LastHashes::clear()
 }
 
 bool ByteCodeExec::performByteCode(dev::eth::Permanence type){
+    bool fUseCache = cacheScheduleHeight >= 0 && type == dev::eth::Permanence::Committed;
+    dev::h256 cacheKey;
+    if(fUseCache){
+        cacheKey = getCacheKey();
+        ContractExecCache::Entry entry;
+        // the post state of the cached execution is only usable while its trie nodes are still stored
+        if(contractExecCache.Get(cacheKey, entry) && SetCachedExecutionState(txs, entry)){
+            result = std::move(entry.result);
+            return true;
+        }
+    }
     for(QtumTransaction& tx : txs){
         //validate VM version
         if(tx.getVersion().toRaw() != VersionVM::GetEVMDefault().toRaw()){
@@ -2953,9 +3290,15 @@ bool ByteCodeExec::performByteCode(dev::eth::Permanence type){
         }
         result.push_back(globalState->execute(envInfo, *globalSealEngine.get(), tx, type, OnOpFunc()));
     }
-    globalState->db().commit();
-    globalState->dbUtxo().commit();
+    if(fCommitDB){
+        globalState->db().commit();
+        globalState->dbUtxo().commit();
+    }
     globalSealEngine.get()->deleteAddresses.clear();
+    // nodes killed by later executions of the block are never written, so uncommitted roots are not cached
+    if(fUseCache && fCommitDB){
+        contractExecCache.Put(cacheKey, ContractExecCache::Entry{result, globalState->rootHash(), globalState->rootHashUTXO(), 0});
+    }
     return true;
 }
 
@@ -3027,6 +3370,21 @@ dev::eth::EnvInfo ByteCodeExec::BuildEVMEnvironment(){
     return env;
 }
 
+dev::h256 ByteCodeExec::getCacheKey(){
+    dev::eth::EnvInfo envInfo(BuildEVMEnvironment());
+    dev::RLPStream s(10);
+    s << globalState->rootHash() << globalState->rootHashUTXO() << uintToh256(pindex->GetBlockHash());
+    s << dev::u256(envInfo.number()) << dev::u256(envInfo.timestamp()) << envInfo.author();
+    s << dev::u256(envInfo.difficulty()) << dev::u256(envInfo.gasLimit()) << dev::u256(cacheScheduleHeight);
+    s.appendList(txs.size());
+    for(QtumTransaction& tx : txs){
+        s.appendList(10);
+        s << tx.getHashWith() << tx.getNVout() << tx.sender() << (unsigned)tx.isCreation() << tx.receiveAddress();
+        s << tx.value() << tx.gasPrice() << tx.gas() << tx.data() << tx.getVersion().toRaw();
+    }
+    return dev::sha3(s.out());
+}
+
 dev::Address ByteCodeExec::EthAddrFromScript(const CScript& script){
     CTxDestination addressBit;
     txnouttype txType=TX_NONSTANDARD;
@@ -3173,10 +3531,11 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
 
     ///////////////////////////////////////////////// // qtum
     QtumDGP qtumDGP(globalState.get(), fGettingValuesDGP);
-    globalSealEngine->setQtumSchedule(qtumDGP.getGasSchedule(pindex->nHeight + (pindex->nHeight+1 >= chainparams.GetConsensus().QIP7Height ? 0 : 1) ));
-    uint32_t sizeBlockDGP = qtumDGP.getBlockSize(pindex->nHeight + (pindex->nHeight+1 >= chainparams.GetConsensus().QIP7Height ? 0 : 1));
-    uint64_t minGasPrice = qtumDGP.getMinGasPrice(pindex->nHeight + (pindex->nHeight+1 >= chainparams.GetConsensus().QIP7Height ? 0 : 1));
-    uint64_t blockGasLimit = qtumDGP.getBlockGasLimit(pindex->nHeight + (pindex->nHeight+1 >= chainparams.GetConsensus().QIP7Height ? 0 : 1));
+    const int nScheduleHeight = GetScheduleHeight(pindex->nHeight, chainparams.GetConsensus());
+    globalSealEngine->setQtumSchedule(qtumDGP.getGasSchedule(nScheduleHeight));
+    uint32_t sizeBlockDGP = qtumDGP.getBlockSize(nScheduleHeight);
+    uint64_t minGasPrice = qtumDGP.getMinGasPrice(nScheduleHeight);
+    uint64_t blockGasLimit = qtumDGP.getBlockGasLimit(nScheduleHeight);
     dgpMaxBlockSize = sizeBlockDGP ? sizeBlockDGP : dgpMaxBlockSize;
     updateBlockSizeParams(dgpMaxBlockSize);
     CBlock checkBlock(block.GetBlockHeader());
@@ -3391,12 +3750,8 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
 
     ///////////////////////////////////////////////////////// // qtum
-#ifdef ENABLE_BITCORE_RPC
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
-    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
-#endif
     std::map<dev::Address, std::pair<CHeightTxIndexKey, std::vector<uint256>>> heightIndexes;
+    dev::h2048 blockLogBloom;
     /////////////////////////////////////////////////////////
 
     std::vector<PrecomputedTransactionData> txdata;
@@ -3445,33 +3800,6 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
                 return state.Invalid(ValidationInvalidReason::CONSENSUS, error("%s: contains a non-BIP68-final transaction", __func__),
                                  REJECT_INVALID, "bad-txns-nonfinal");
             }
-
-#ifdef ENABLE_BITCORE_RPC
-            ////////////////////////////////////////////////////////////////// // qtum
-            if (fAddressIndex)
-            {
-                for (size_t j = 0; j < tx.vin.size(); j++) {
-                    const CTxIn input = tx.vin[j];
-                    const CTxOut &prevout = view.GetOutputFor(tx.vin[j]);
-
-                    CTxDestination dest;
-                    if (ExtractDestination(input.prevout, prevout.scriptPubKey, dest)) {
-                        valtype bytesID(boost::apply_visitor(DataVisitor(), dest));
-                        if(bytesID.empty()) {
-                            continue;
-                        }
-                        valtype addressBytes(32);
-                        std::copy(bytesID.begin(), bytesID.end(), addressBytes.begin());
-                        addressIndex.push_back(std::make_pair(CAddressIndexKey(dest.which(), uint256(addressBytes), pindex->nHeight, i, tx.GetHash(), j, true), prevout.nValue * -1));
-
-                        // remove address from unspent index
-                        addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(dest.which(), uint256(addressBytes), input.prevout.hash, input.prevout.n), CAddressUnspentValue()));
-                        spentIndex.push_back(std::make_pair(CSpentIndexKey(input.prevout.hash, input.prevout.n), CSpentIndexValue(tx.GetHash(), j, pindex->nHeight, prevout.nValue, dest.which(), uint256(addressBytes))));
-                    }
-                }
-            }
-            //////////////////////////////////////////////////////////////////
-#endif
         }
 
         // GetTransactionSigOpCost counts 3 types of sigops:
@@ -3495,7 +3823,10 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
             //note that coinbase and coinstake can not contain any contract opcodes, this is checked in CheckBlock
-            if (fScriptChecks && !CheckInputs(tx, state, view, flags, fCacheResults, fCacheResults, txdata[i], (hasOpSpend || tx.HasCreateOrCall()) ? nullptr : (nScriptCheckThreads ? &vChecks : nullptr))) {//nScriptCheckThreads ? &vChecks : nullptr))
+            //signature checks of create/call transactions only read the spent outputs and the transaction itself,
+            //so they run on the script check threads while the contracts are executed, a failure rejects the whole
+            //block and the state roots are restored by the caller. OP_SPEND transactions are created by the AAL and stay serial
+            if (fScriptChecks && !CheckInputs(tx, state, view, flags, fCacheResults, fCacheResults, txdata[i], hasOpSpend ? nullptr : (nScriptCheckThreads ? &vChecks : nullptr))) {
                 if (state.GetReason() == ValidationInvalidReason::TX_NOT_STANDARD) {
                     // CheckInputs may return NOT_STANDARD for extra flags we passed,
                     // but we can't return that, as it's not defined for a block, so
@@ -3616,6 +3947,8 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
 
             if (!tx.IsCoinStake())
             {
+                exec.enableResultCache(nScheduleHeight);
+                exec.deferDBCommit();
                 if(!exec.performByteCode()){
                     return state.Invalid(ValidationInvalidReason::CONSENSUS, error("ConnectBlock(): Unknown error during contract execution"), REJECT_INVALID, "bad-tx-unknown-error");
                 }
@@ -3631,6 +3964,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
                 {
                     uint64_t countCumulativeGasUsed = blockGasUsed;
                     for(size_t k = 0; k < resultConvertQtumTX.first.size(); k ++){
+                        blockLogBloom |= resultExec[k].txRec.bloom();
                         for(auto& log : resultExec[k].txRec.log()) {
                             if(!heightIndexes.count(log.address)){
                                 heightIndexes[log.address].first = CHeightTxIndexKey(pindex->nHeight, log.address);
@@ -3686,32 +4020,6 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         }
 /////////////////////////////////////////////////////////////////////////////////////////
 
-#ifdef ENABLE_BITCORE_RPC
-        /////////////////////////////////////////////////////////////////////////////////// // qtum
-        if (fAddressIndex) {
-
-            for (unsigned int k = 0; k < tx.vout.size(); k++) {
-                const CTxOut &out = tx.vout[k];
-                const bool isTxCoinStake = tx.IsCoinStake();
-
-                CTxDestination dest;
-                if (ExtractDestination({tx.GetHash(), k}, out.scriptPubKey, dest)) {
-                    valtype bytesID(boost::apply_visitor(DataVisitor(), dest));
-                    if(bytesID.empty()) {
-                        continue;
-                    }
-                    valtype addressBytes(32);
-                    std::copy(bytesID.begin(), bytesID.end(), addressBytes.begin());
-                    // record receiving activity
-                    addressIndex.push_back(std::make_pair(CAddressIndexKey(dest.which(), uint256(addressBytes), pindex->nHeight, i, tx.GetHash(), k, false), out.nValue));
-                    // record unspent output
-                    addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(dest.which(), uint256(addressBytes), tx.GetHash(), k), CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight, isTxCoinStake)));
-                }
-            }
-        }
-        ///////////////////////////////////////////////////////////////////////////////////
-#endif
-
         CTxUndo undoDummy;
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
@@ -3729,6 +4037,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         if (qtumTransactions.size() > 0)
         {
             ByteCodeExec exec(block, qtumTransactions, blockGasLimit, pindex->pprev);
+            exec.deferDBCommit();
             if (!exec.performByteCode())
             {
                 return state.Invalid(ValidationInvalidReason::CONSENSUS, error("ConnectBlock(): Unknown error during contract execution"), REJECT_INVALID, "bad-tx-unknown-error");
@@ -3746,6 +4055,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
             {
                 uint64_t countCumulativeGasUsed = blockGasUsed;
                 for(size_t k = 0; k < qtumTransactions.size(); k ++){
+                    blockLogBloom |= resultExec[k].txRec.bloom();
                     for(auto& log : resultExec[k].txRec.log()) {
                         if(!heightIndexes.count(log.address)){
                             heightIndexes[log.address].first = CHeightTxIndexKey(pindex->nHeight, log.address);
@@ -3797,6 +4107,11 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     }
     ///////////////////////////////////////////////////////////////////////////////////
 
+    // The trie nodes of the contract executions are written once for the block, nodes replaced
+    // by a later transaction of the block never reach the database
+    globalState->db().commit();
+    globalState->dbUtxo().commit();
+
     int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
     LogPrint(BCLog::BENCH, "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs (%.2fms/blk)]\n", (unsigned)block.vtx.size(), MILLI * (nTime3 - nTime2), MILLI * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : MILLI * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * MICRO, nTimeConnect * MILLI / nBlocksTotal);
 
@@ -3895,6 +4210,8 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     if (!WriteUndoDataForBlock(blockundo, state, pindex, chainparams))
         return false;
 
+    g_spent_coins.ConnectBlock(pindex, block, blockundo);
+
     if (!pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
         pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
         setDirtyBlockIndex.insert(pindex);
@@ -3906,6 +4223,8 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
             if (!pblocktree->WriteHeightIndex(e.second.first, e.second.second))
                 return AbortNode(state, "Failed to write height index");
         }
+        if (!heightIndexes.empty() && !pblocktree->WriteLogBloom(pindex->nHeight, blockLogBloom))
+            return AbortNode(state, "Failed to write log bloom");
     }    
     if(block.IsProofOfStake()){
         // Read the public key from the second output
@@ -3922,40 +4241,6 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     }
 
     assert(pindex->phashBlock);
-#ifdef ENABLE_BITCORE_RPC
-    ///////////////////////////////////////////////////////////// // qtum
-    if (fAddressIndex) {
-        if (!pblocktree->WriteAddressIndex(addressIndex)) {
-            return AbortNode(state, "Failed to write address index");
-        }
-        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
-            return AbortNode(state, "Failed to write address unspent index");
-        }
-
-        if (!pblocktree->UpdateSpentIndex(spentIndex))
-            return AbortNode(state, "Failed to write transaction index");
-
-        unsigned int logicalTS = pindex->nTime;
-        unsigned int prevLogicalTS = 0;
-
-        // retrieve logical timestamp of the previous block
-        if (pindex->pprev)
-            if (!pblocktree->ReadTimestampBlockIndex(pindex->pprev->GetBlockHash(), prevLogicalTS))
-                LogPrintf("%s: Failed to read previous block's logical timestamp\n", __func__);
-
-        if (logicalTS <= prevLogicalTS) {
-            logicalTS = prevLogicalTS + 1;
-            LogPrintf("%s: Previous logical timestamp is newer Actual[%d] prevLogical[%d] Logical[%d]\n", __func__, pindex->nTime, prevLogicalTS, logicalTS);
-        }
-
-        if (!pblocktree->WriteTimestampIndex(CTimestampIndexKey(logicalTS, pindex->GetBlockHash())))
-            return AbortNode(state, "Failed to write timestamp index");
-
-        if (!pblocktree->WriteTimestampBlockIndex(CTimestampBlockIndexKey(pindex->GetBlockHash()), CTimestampBlockIndexValue(logicalTS)))
-            return AbortNode(state, "Failed to write blockhash index");
-    }
-    /////////////////////////////////////////////////////////////
-#endif
 
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
@@ -4212,6 +4497,11 @@ void static UpdateTip(const CBlockIndex* pindexNew, const CChainParams& chainPar
     }
     ///////////////////////////////////////////////////////////// // metrix
     UpdateFeesFromDGP(pindexNew->nHeight);
+    if (pflatstate && !pflatstate->IsRebuilding() && !pflatstate->Sync(globalState->db(), uintToh256(pindexNew->hashStateRoot))) {
+        // the RPCs read the trie until the copy is built again, which does not hold up block connection
+        LogPrintf("%s: unable to update the flat contract state\n", __func__);
+        pflatstate->StartRebuild(std::make_shared<const dev::OverlayDB>(globalState->db()), uintToh256(pindexNew->hashStateRoot));
+    }
     /////////////////////////////////////////////////////////////
     LogPrintf("%s: new best=%s height=%d version=0x%08x log2_work=%.8g tx=%lu date='%s' progress=%f cache=%.1fMiB(%utxo)%s\n", __func__,
       pindexNew->GetBlockHash().ToString(), pindexNew->nHeight, pindexNew->nVersion,
@@ -5102,7 +5392,7 @@ bool CheckFirstCoinstakeOutput(const CBlock& block)
 #ifdef ENABLE_WALLET
 
 // novacoin: attempt to generate suitable proof-of-stake
-bool SignBlock(std::shared_ptr<CBlock> pblock, CWallet& wallet, const CAmount& nTotalFees, uint32_t nTime, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoins)
+bool SignBlock(std::shared_ptr<CBlock> pblock, CWallet& wallet, const CAmount& nTotalFees, uint32_t nTime, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoins, const COutPoint* pprevoutKernel)
 {
     // if we are trying to sign
     //    something except proof-of-stake block template
@@ -5123,7 +5413,7 @@ bool SignBlock(std::shared_ptr<CBlock> pblock, CWallet& wallet, const CAmount& n
     //IsProtocolV2 mean POS 2 or higher, so the modified line is:
     auto locked_chain = wallet.chain().lock();
     LOCK(wallet.cs_wallet);
-    if (wallet.CreateCoinStake(*locked_chain, wallet, pblock->nBits, nTotalFees, nTimeBlock, txCoinStake, key, setCoins))
+    if (wallet.CreateCoinStake(*locked_chain, wallet, pblock->nBits, nTotalFees, nTimeBlock, txCoinStake, key, setCoins, pprevoutKernel))
     {
         if (nTimeBlock >= ::ChainActive().Tip()->GetMedianTimePast()+1)
         {
@@ -5214,7 +5504,62 @@ bool GetBlockPublicKey(const CBlock& block, std::vector<unsigned char>& vchPubKe
     return false;
 }
 
-bool CheckBlockSignature(const CBlock& block)
+/**
+ * Block signatures that were verified on the block signature check queue, so the block is not verified
+ * again when it is checked on connection, by TestBlockValidity or by VerifyDB after being checked on arrival.
+ * Only signatures that also pass CheckCanonicalBlockSignature are stored, so an entry stands for
+ * both checks. The encoding check itself is a DER parse without any curve operation and is not
+ * looked up here, it runs on the header before the block body is known.
+ */
+class CBlockSignatureCache
+{
+public:
+    CBlockSignatureCache() : nonce(GetRandHash())
+    {
+        cache.setup_bytes(BLOCK_SIGNATURE_CACHE_SIZE);
+    }
+
+    /** The entry commits to the signed hash, the signature and the key, which come from the block body */
+    uint256 ComputeEntry(const uint256& hash, const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& vchPubKey) const
+    {
+        uint256 entry;
+        CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(vchSig.data(), vchSig.size()).Write(vchPubKey.data(), vchPubKey.size()).Finalize(entry.begin());
+        return entry;
+    }
+
+    bool Get(const uint256& entry)
+    {
+        LOCK(cs);
+        return cache.contains(entry, false);
+    }
+
+    void Set(const uint256& entry)
+    {
+        LOCK(cs);
+        cache.insert(entry);
+    }
+
+private:
+    //! Enough for the blocks downloaded ahead of the tip during initial sync
+    static const size_t BLOCK_SIGNATURE_CACHE_SIZE = 1 << 20;
+
+    const uint256 nonce;
+    Mutex cs;
+    CuckooCache::cache<uint256, SignatureCacheHasher> cache GUARDED_BY(cs);
+};
+
+static CBlockSignatureCache blockSignatureCache;
+
+bool CBlockSignatureCheck::operator()() {
+    if (!CPubKey(vchPubKey).Verify(hash, vchSig))
+        return false;
+
+    if (cacheStore)
+        blockSignatureCache.Set(cacheEntry);
+    return true;
+}
+
+bool GetBlockSignatureChecks(const CBlock& block, std::vector<CBlockSignatureCheck>& vChecks)
 {
     if (block.IsProofOfWork())
         return block.vchBlockSig.empty();
@@ -5225,7 +5570,26 @@ bool CheckBlockSignature(const CBlock& block)
         return false;
     }
 
-    return CPubKey(vchPubKey).Verify(block.GetHashWithoutSign(), block.vchBlockSig);
+    uint256 hash = block.GetHashWithoutSign();
+    uint256 entry = blockSignatureCache.ComputeEntry(hash, block.vchBlockSig, vchPubKey);
+    if (blockSignatureCache.Get(entry))
+        return true;
+
+    vChecks.emplace_back(hash, block.vchBlockSig, vchPubKey, entry, CheckCanonicalBlockSignature(&block));
+    return true;
+}
+
+bool CheckBlockSignature(const CBlock& block)
+{
+    std::vector<CBlockSignatureCheck> vChecks;
+    if (!GetBlockSignatureChecks(block, vChecks))
+        return false;
+
+    for (CBlockSignatureCheck& check : vChecks) {
+        if (!check())
+            return false;
+    }
+    return true;
 }
 
 static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckPOS = true)
@@ -5239,6 +5603,13 @@ static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state,
         // May occur if behind on block chain sync
         return state.Invalid(ValidationInvalidReason::BLOCK_INVALID_HEADER, false, REJECT_INVALID, "bad-cb-header", "proof of stake failed");
 
+    // During initial sync the kernel is checked when the stake coin is already known, so bad header chains are not downloaded
+    if (fCheckPOS && ::ChainstateActive().IsInitialBlockDownload() && block.IsProofOfStake()) {
+        BlockMap::iterator mi = ::BlockIndex().find(block.hashPrevBlock);
+        if (mi != ::BlockIndex().end() && !CheckHeaderKernel(mi->second, block, ::ChainstateActive().CoinsTip()))
+            return state.Invalid(ValidationInvalidReason::BLOCK_HEADER_SYNC, false, REJECT_INVALID, "bad-cs-kernel", "proof of stake kernel failed"); // may occur if the coin was spent on another chain
+    }
+
     return true;
 }
 
@@ -5314,9 +5685,18 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
             return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-cs-contract", "coinstake must not contain non-dgp OP_SPEND, OP_CALL, OP_CREATE or OP_SENDER");
     }
 
-    // Check proof-of-stake block signature
-    if (fCheckSig && !CheckBlockSignature(block))
-        return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-blk-signature", "bad proof-of-stake block signature");
+    // Check proof-of-stake block signature, it is verified on the block signature
+    // check queue while the transactions are checked
+    CCheckQueueControl<CBlockSignatureCheck> control(fCheckSig && nScriptCheckThreads ? &blocksigcheckqueue : nullptr);
+    if (fCheckSig) {
+        std::vector<CBlockSignatureCheck> vChecks;
+        if (!GetBlockSignatureChecks(block, vChecks))
+            return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-blk-signature", "bad proof-of-stake block signature");
+        if (nScriptCheckThreads)
+            control.Add(vChecks);
+        else if (!vChecks.empty() && !vChecks[0]())
+            return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-blk-signature", "bad proof-of-stake block signature");
+    }
 
     bool lastWasContract=false;
     // Check transactions
@@ -5344,6 +5724,9 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
     if (nSigOps * WITNESS_SCALE_FACTOR > dgpMaxBlockSigOps)
         return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-blk-sigops", "out-of-bounds SigOpCount");
 
+    if (!control.Wait())
+        return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-blk-signature", "bad proof-of-stake block signature");
+
     if (fCheckPOW && fCheckMerkleRoot)
         block.fChecked = true;
 
@@ -6355,12 +6738,6 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams) EXCLUSIVE_LOCKS_RE
     pblocktree->ReadReindexing(fReindexing);
     if(fReindexing) fReindex = true;
 
-#ifdef ENABLE_BITCORE_RPC
-    ///////////////////////////////////////////////////////////// // qtum
-    pblocktree->ReadFlag("addrindex", fAddressIndex);
-    LogPrintf("LoadBlockIndexDB(): address index %s\n", fAddressIndex ? "enabled" : "disabled");
-    /////////////////////////////////////////////////////////////
-#endif
     // Check whether we have a transaction index
     pblocktree->ReadFlag("logevents", fLogEvents);
     LogPrintf("%s: log events index %s\n", __func__, fLogEvents ? "enabled" : "disabled");
@@ -6787,6 +7164,7 @@ void UnloadBlockIndex()
     pindexBestInvalid = nullptr;
     pindexBestHeader = nullptr;
     mempool.clear();
+    g_spent_coins.Clear();
     vinfoBlockFile.clear();
     nLastBlockFile = 0;
     setDirtyBlockIndex.clear();
@@ -6821,12 +7199,6 @@ bool LoadBlockIndex(const CChainParams& chainparams)
         // Use the provided setting for -logevents in the new database
         fLogEvents = gArgs.GetBoolArg("-logevents", DEFAULT_LOGEVENTS);
         pblocktree->WriteFlag("logevents", fLogEvents);
-#ifdef ENABLE_BITCORE_RPC
-        /////////////////////////////////////////////////////////////// // qtum
-        fAddressIndex = gArgs.GetBoolArg("-addrindex", DEFAULT_ADDRINDEX);
-        pblocktree->WriteFlag("addrindex", fAddressIndex);
-        ///////////////////////////////////////////////////////////////
-#endif
     }
     return true;
 }
@@ -7440,26 +7812,37 @@ static CMainCleanup instance_of_cmaincleanup;
 
 #ifdef ENABLE_BITCORE_RPC
 ////////////////////////////////////////////////////////////////////////////////// // qtum
-bool GetAddressIndex(uint256 addressHash, int type, std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex, int start, int end)
+bool GetAddressIndex(uint256 addressHash, int type, std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex, int start, int end, size_t nLimit, CAddressIndexKey* pCursor)
 {
-    if (!fAddressIndex)
+    if (!g_addressindex)
         return error("address index not enabled");
 
-    if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end))
+    if (!g_addressindex->FindAddressIndex(addressHash, type, addressIndex, start, end, nLimit, pCursor))
         return error("unable to get txids for address");
 
     return true;
 }
 
+bool GetAddressSummary(uint256 addressHash, int type, CAddressSummary &summary)
+{
+    if (!g_addressindex)
+        return error("address index not enabled");
+
+    if (!g_addressindex->FindAddressSummary(addressHash, type, summary))
+        return error("unable to get summary for address");
+
+    return true;
+}
+
 bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
 {
-    if (!fAddressIndex)
+    if (!g_addressindex)
         return false;
 
     if (mempool.getSpentIndex(key, value))
         return true;
 
-    if (!pblocktree->ReadSpentIndex(key, value))
+    if (!g_addressindex->FindSpent(key, value))
         return false;
 
     return true;
@@ -7467,10 +7850,10 @@ bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
 
 bool GetAddressUnspent(uint256 addressHash, int type, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs)
 {
-    if (!fAddressIndex)
+    if (!g_addressindex)
         return error("address index not enabled");
 
-    if (!pblocktree->ReadAddressUnspentIndex(addressHash, type, unspentOutputs))
+    if (!g_addressindex->FindAddressUnspent(addressHash, type, unspentOutputs))
         return error("unable to get txids for address");
 
     return true;
@@ -7478,10 +7861,10 @@ bool GetAddressUnspent(uint256 addressHash, int type, std::vector<std::pair<CAdd
 
 bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &hashes)
 {
-    if (!fAddressIndex)
+    if (!g_addressindex)
         return error("Timestamp index not enabled");
 
-    if (!pblocktree->ReadTimestampIndex(high, low, fActiveOnly, hashes))
+    if (!g_addressindex->FindTimestamps(high, low, fActiveOnly, hashes))
         return error("Unable to get hashes for timestamps");
 
     return true;
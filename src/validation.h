@@ -37,6 +37,7 @@
 
 /////////////////////////////////////////// qtum
 class CWalletTx;
+class FlatState;
 
 #include <qtum/qtumstate.h>
 #include <qtum/qtumDGP.h>
@@ -175,6 +176,9 @@ static const CAmount MAX_RPC_GAS_PRICE=2*DEFAULT_GAS_PRICE;
 
 static const size_t MAX_CONTRACT_VOUTS = 1000; // qtum
 
+/** Memory in bytes used to keep committed contract executions for reuse by a later identical execution */
+static const size_t CONTRACT_EXEC_CACHE_SIZE = 32 << 20;
+
 struct BlockHasher
 {
     // this used to call `GetCheapHash()` in uint256, which was later moved; the
@@ -294,6 +298,10 @@ bool LoadBlockIndex(const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck(int worker_num);
+/** Run an instance of the block signature checking thread */
+void ThreadBlockSignatureCheck(int worker_num);
+/** Run an instance of the mempool script checking thread */
+void ThreadMemPoolScriptCheck(int worker_num);
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 bool GetTransaction(const uint256& hash, CTransactionRef& tx, const Consensus::Params& params, uint256& hashBlock, const CBlockIndex* const blockIndex = nullptr, bool fAllowSlow = false);
 /**
@@ -331,11 +339,44 @@ void PruneBlockFilesManual(int nManualPruneHeight);
 bool IsConfirmedInNPrevBlocks(const CDiskTxPos& txindex, const CBlockIndex* pindexFrom, int nMaxDepth, int& nActualDepth);
 
 
+/** Checks of a transaction that PreCheckMemPoolTransaction ran outside cs_main against a snapshot of its spent coins */
+struct MemPoolPreCheck
+{
+    //! Witness hash of the checked transaction
+    uint256 m_wtxid;
+    //! Best block of the coins snapshot
+    uint256 m_best_block;
+    //! Coins spent by the inputs in the snapshot
+    std::vector<Coin> m_spent_coins;
+    //! Results of the input and contract checks
+    CAmount m_fees = 0;
+    int64_t m_sigops_cost = 0;
+    CAmount m_min_gas_price = 0;
+    //! Signature cache entries of the verified signatures, not stored yet
+    std::vector<uint256> m_sigcache_entries;
+    //! Coins the snapshot added to the coins cache
+    std::vector<COutPoint> m_coins_to_uncache;
+};
+
 /** (try to) add transaction to memory pool
- * plTxnReplaced will be appended to with all transactions replaced from mempool **/
+ * plTxnReplaced will be appended to with all transactions replaced from mempool
+ * precheck skips the checks it ran when the tip and the spent coins are unchanged **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx,
                         bool* pfMissingInputs, std::list<CTransactionRef>* plTxnReplaced,
-                        bool bypass_limits, const CAmount nAbsurdFee, bool test_accept=false, bool rawTx = false) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+                        bool bypass_limits, const CAmount nAbsurdFee, bool test_accept=false, bool rawTx = false,
+                        const MemPoolPreCheck* precheck = nullptr) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+/**
+ * Run the checks of AcceptToMemoryPool that do not depend on the mempool without cs_main: the
+ * context-free checks, the input and contract checks against a snapshot of the spent coins and
+ * the script checks on the mempool check threads. cs_main is only held to take the snapshot.
+ * Returns true when all checks passed, AcceptToMemoryPool then only runs the conflict checks and
+ * the insert. Returns false with an invalid state when the transaction is rejected, and with a
+ * valid state when it is left to AcceptToMemoryPool (missing inputs or failed scripts, whose
+ * failure AcceptToMemoryPool classifies). The verified signatures are stored in the signature
+ * cache by AcceptToMemoryPool once the transaction is accepted.
+ */
+bool PreCheckMemPoolTransaction(CTxMemPool& pool, CValidationState& state, const CTransactionRef& tx, MemPoolPreCheck& precheck) LOCKS_EXCLUDED(cs_main);
 
 /** Get the BIP9 state for a given deployment at the current tip. */
 ThresholdState VersionBitsTipState(const Consensus::Params& params, Consensus::DeploymentPos pos);
@@ -382,6 +423,7 @@ bool CheckSequenceLocks(const CTxMemPool& pool, const CTransaction& tx, int flag
 /**
  * Closure representing one script verification
  * Note that this stores references to the spending transaction
+ * When pvSigCacheDeferred is set, the verified signatures are collected there instead of being cached
  */
 class CScriptCheck
 {
@@ -394,13 +436,14 @@ private:
     ScriptError error;
     PrecomputedTransactionData *txdata;
     int nOut;
+    std::vector<uint256> *pvSigCacheDeferred;
 
 public:
-    CScriptCheck(): ptxTo(nullptr), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR), nOut(-1) {}
-    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
-        m_tx_out(outIn), ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn), nOut(-1) { }
-    CScriptCheck(const CTransaction& txToIn, int nOutIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
-        ptxTo(&txToIn), nIn(0), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn), nOut(nOutIn) { }
+    CScriptCheck(): ptxTo(nullptr), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR), nOut(-1), pvSigCacheDeferred(nullptr) {}
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn, std::vector<uint256>* pvSigCacheDeferredIn = nullptr) :
+        m_tx_out(outIn), ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn), nOut(-1), pvSigCacheDeferred(pvSigCacheDeferredIn) { }
+    CScriptCheck(const CTransaction& txToIn, int nOutIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn, std::vector<uint256>* pvSigCacheDeferredIn = nullptr) :
+        ptxTo(&txToIn), nIn(0), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn), nOut(nOutIn), pvSigCacheDeferred(pvSigCacheDeferredIn) { }
 
     bool operator()();
 
@@ -413,6 +456,7 @@ public:
         std::swap(error, check.error);
         std::swap(txdata, check.txdata);
         std::swap(nOut, check.nOut);
+        std::swap(pvSigCacheDeferred, check.pvSigCacheDeferred);
     }
 
     ScriptError GetScriptError() const { return error; }
@@ -420,6 +464,35 @@ public:
     bool checkOutput() const { return nOut > -1; }
 };
 
+/**
+ * Closure representing the verification of a proof-of-stake block signature
+ * Canonically encoded signatures are stored in the block signature cache once verified
+ */
+class CBlockSignatureCheck
+{
+private:
+    uint256 hash;
+    std::vector<unsigned char> vchSig;
+    std::vector<unsigned char> vchPubKey;
+    uint256 cacheEntry;
+    bool cacheStore;
+
+public:
+    CBlockSignatureCheck(): cacheStore(false) {}
+    CBlockSignatureCheck(const uint256& hashIn, const std::vector<unsigned char>& vchSigIn, const std::vector<unsigned char>& vchPubKeyIn, const uint256& cacheEntryIn, bool cacheIn) :
+        hash(hashIn), vchSig(vchSigIn), vchPubKey(vchPubKeyIn), cacheEntry(cacheEntryIn), cacheStore(cacheIn) { }
+
+    bool operator()();
+
+    void swap(CBlockSignatureCheck &check) {
+        std::swap(hash, check.hash);
+        vchSig.swap(check.vchSig);
+        vchPubKey.swap(check.vchPubKey);
+        std::swap(cacheEntry, check.cacheEntry);
+        std::swap(cacheStore, check.cacheStore);
+    }
+};
+
 /** Initializes the script-execution cache */
 void InitScriptExecutionCache();
 
@@ -427,7 +500,9 @@ void InitScriptExecutionCache();
 ///////////////////////////////////////////////////////////////// // qtum
 bool GetAddressIndex(uint256 addressHash, int type,
                      std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                     int start = 0, int end = 0);
+                     int start = 0, int end = 0, size_t nLimit = 0, CAddressIndexKey* pCursor = nullptr);
+
+bool GetAddressSummary(uint256 addressHash, int type, CAddressSummary &summary);
 
 bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
 
@@ -455,7 +530,11 @@ bool CheckIndexProof(const CBlockIndex& block, const Consensus::Params& consensu
 /** Context-independent validity checks */
 bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckSig=true);
 bool GetBlockPublicKey(const CBlock& block, std::vector<unsigned char>& vchPubKey);
-bool SignBlock(std::shared_ptr<CBlock> pblock, CWallet& wallet, const CAmount& nTotalFees, uint32_t nTime, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoins);
+/** Verify the signature of a proof-of-stake block, verified signatures are cached */
+bool CheckBlockSignature(const CBlock& block);
+/** Append the verification of the block signature to vChecks unless it is cached, false if the block can not carry a valid signature */
+bool GetBlockSignatureChecks(const CBlock& block, std::vector<CBlockSignatureCheck>& vChecks);
+bool SignBlock(std::shared_ptr<CBlock> pblock, CWallet& wallet, const CAmount& nTotalFees, uint32_t nTime, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoins, const COutPoint* pprevoutKernel = nullptr);
 bool CheckCanonicalBlockSignature(const CBlockHeader* pblock);
 
 /** Check a block is completely valid from start to finish (only works on top of our current best block) */
@@ -489,6 +568,9 @@ CBlockIndex* LookupBlockIndex(const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_m
 
 extern std::unique_ptr<StorageResults> pstorageresult;
 
+/** Flat copy of the contract state at the tip, only set with -flatstate and used under cs_main */
+extern std::unique_ptr<FlatState> pflatstate;
+
 bool CheckReward(const CBlock& block, CValidationState& state, int nHeight, const Consensus::Params& consensusParams, CAmount nFees, CAmount gasRefunds, CAmount nActualStakeReward, const std::vector<CTxOut>& vouts);
 
 bool RemoveStateBlockIndex(CBlockIndex *pindex);
@@ -500,6 +582,9 @@ bool GetSpentCoinFromMainChain(const CBlockIndex* pforkPrev, COutPoint prevoutSt
 
 unsigned int GetContractScriptFlags(int nHeight, const Consensus::Params& consensusparams);
 
+/** Height of the DGP parameters (gas schedule, block size, gas price and gas limit) a block at nHeight is connected with */
+int GetScheduleHeight(int nHeight, const Consensus::Params& consensusparams);
+
 std::vector<ResultExecute> CallContract(const dev::Address& addrContract, std::vector<unsigned char> opcode, const dev::Address& sender = dev::Address(), uint64_t gasLimit=0, uint64_t blockGasLimit=0);
 
 std::vector<ResultExecute> CallContract(const dev::Address& addrContract, std::vector<unsigned char> opcode, int blockHeight, const dev::Address& sender = dev::Address(), uint64_t gasLimit = 0, uint64_t blockGasLimit=0);
@@ -594,11 +679,20 @@ public:
 
     std::vector<ResultExecute>& getResult(){ return result; }
 
+    /** Reuse the results of an identical committed execution, nScheduleHeight is the height the gas schedule was loaded for */
+    void enableResultCache(int nScheduleHeight){ cacheScheduleHeight = nScheduleHeight; }
+
+    /** Leave the trie nodes in the memory of the state databases, the caller commits them once for the block.
+     *  The tries themselves are still updated and hashed after every transaction, see QtumState::execute */
+    void deferDBCommit(){ fCommitDB = false; }
+
+    static dev::Address EthAddrFromScript(const CScript& scriptIn);
+
 private:
 
     dev::eth::EnvInfo BuildEVMEnvironment();
 
-    dev::Address EthAddrFromScript(const CScript& scriptIn);
+    dev::h256 getCacheKey();
 
     std::vector<QtumTransaction> txs;
 
@@ -611,8 +705,55 @@ private:
     CBlockIndex* pindex;
 
     LastHashes lastHashes;
+
+    int cacheScheduleHeight = -1;
+
+    bool fCommitDB = true;
+};
+
+/**
+ * Immutable view of the contract state after a block, used for read-only contract calls.
+ * Every call executes on its own copy of the state with its own seal engine, so calls can run
+ * concurrently without cs_main and without touching globalState.
+ */
+class ContractStateSnapshot {
+
+public:
+
+    /** Snapshot of the state after a block, nullptr if the state of the block was pruned */
+    static std::shared_ptr<const ContractStateSnapshot> Create(const CBlockIndex* pindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+    /** Execute a call on top of the snapshot, return false if the contract does not exist */
+    bool Call(const dev::Address& addrContract, const std::vector<unsigned char>& opcode, std::vector<ResultExecute>& results, const dev::Address& sender = dev::Address(), uint64_t gasLimit = 0) const;
+
+    /** Storage root of the account in the snapshot, the empty trie root if it has no storage */
+    dev::h256 StorageRoot(const dev::Address& addr) const;
+
+    const uint256& GetBlockHash() const { return hashBlock; }
+
+private:
+
+    explicit ContractStateSnapshot(const CBlockIndex* pindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+    uint256 hashBlock;
+
+    std::unique_ptr<QtumState> state;
+
+    dev::eth::BlockHeader header;
+
+    dev::eth::EVMSchedule schedule;
+
+    uint64_t blockGasLimit;
+
+    LastHashes lastHashes;
 };
 
+/**
+ * Get a snapshot of the contract state after a block, the snapshot of the active tip is reused until the tip changes.
+ * Returns nullptr if the state of the block is not available.
+ */
+std::shared_ptr<const ContractStateSnapshot> GetContractStateSnapshot(const CBlockIndex* pindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
 /** Find the last common block between the parameter chain and a locator. */
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
@@ -10,8 +10,10 @@
 
 #include <consensus/validation.h>
 #include <interfaces/chain.h>
+#include <key_io.h>
 #include <policy/policy.h>
 #include <rpc/server.h>
+#include <test/qtumtests/test_utils.h>
 #include <test/setup_common.h>
 #include <validation.h>
 #include <wallet/coincontrol.h>
@@ -463,6 +465,359 @@ BOOST_FIXTURE_TEST_CASE(ListCoins, ListCoinsTestingSetup)
     BOOST_CHECK_EQUAL(list.begin()->second.size(), 2U);
 }
 
+BOOST_FIXTURE_TEST_CASE(AvailableCoinsForStaking, ListCoinsTestingSetup)
+{
+    // Only the first coinbase is mature.
+    std::vector<COutput> available;
+    {
+        auto locked_chain = m_chain->lock();
+        LOCK(wallet->cs_wallet);
+        wallet->AvailableCoinsForStaking(*locked_chain, available);
+        BOOST_CHECK_EQUAL(available.size(), 1U);
+        BOOST_CHECK(available[0].tx->m_confirm.hashBlock == ::ChainActive()[1]->GetBlockHash());
+    }
+    COutPoint firstCoin(available[0].tx->GetHash(), available[0].i);
+
+    // A locked coin can not stake.
+    {
+        auto locked_chain = m_chain->lock();
+        LOCK(wallet->cs_wallet);
+        wallet->LockCoin(firstCoin);
+        wallet->AvailableCoinsForStaking(*locked_chain, available);
+        BOOST_CHECK_EQUAL(available.size(), 0U);
+        wallet->UnlockCoin(firstCoin);
+    }
+
+    // Spending the coin removes it, the next coinbase matures with the new block
+    // and the new outputs are not mature yet.
+    AddTx(CRecipient{GetScriptForRawPubKey({}), 1 * COIN, false /* subtract fee */});
+    {
+        auto locked_chain = m_chain->lock();
+        LOCK(wallet->cs_wallet);
+        wallet->AvailableCoinsForStaking(*locked_chain, available);
+        BOOST_CHECK_EQUAL(available.size(), 1U);
+        BOOST_CHECK(available[0].tx->m_confirm.hashBlock == ::ChainActive()[2]->GetBlockHash());
+    }
+
+    // Rebuilding the candidates from mapWallet gives the same coins.
+    std::vector<COutput> rebuilt;
+    wallet->MarkDirty();
+    {
+        auto locked_chain = m_chain->lock();
+        LOCK(wallet->cs_wallet);
+        wallet->AvailableCoinsForStaking(*locked_chain, rebuilt);
+    }
+    BOOST_CHECK_EQUAL(rebuilt.size(), available.size());
+    BOOST_CHECK(rebuilt[0].tx == available[0].tx && rebuilt[0].i == available[0].i);
+}
+
+BOOST_FIXTURE_TEST_CASE(settled_balance, ListCoinsTestingSetup)
+{
+    // The mature coinbase is settled on the first call.
+    CWallet::Balance balance = wallet->GetBalance();
+    BOOST_CHECK_EQUAL(balance.m_mine_trusted, 20000 * COIN);
+    BOOST_CHECK_EQUAL(balance.m_mine_trusted, wallet->GetAvailableBalance());
+
+    // Spending the settled coin makes it dirty, the next coinbase matures with the new block.
+    AddTx(CRecipient{GetScriptForRawPubKey({}), 1 * COIN, false /* subtract fee */});
+    balance = wallet->GetBalance();
+    BOOST_CHECK(balance.m_mine_trusted > 20000 * COIN);
+    BOOST_CHECK(balance.m_mine_trusted < 40000 * COIN - 1 * COIN);
+    BOOST_CHECK_EQUAL(balance.m_mine_trusted, wallet->GetAvailableBalance());
+
+    // Rebuilding the balance from mapWallet gives the same amounts.
+    wallet->MarkDirty();
+    CWallet::Balance rebuilt = wallet->GetBalance();
+    BOOST_CHECK_EQUAL(rebuilt.m_mine_trusted, balance.m_mine_trusted);
+    BOOST_CHECK_EQUAL(rebuilt.m_mine_immature, balance.m_mine_immature);
+    BOOST_CHECK_EQUAL(rebuilt.m_mine_untrusted_pending, balance.m_mine_untrusted_pending);
+}
+
+/* The balance and the available coins of a wallet whose caches are kept up to date */
+class SettledBalanceTestingSetup : public ListCoinsTestingSetup
+{
+public:
+    CTransactionRef CreateTx(const CRecipient& recipient)
+    {
+        CTransactionRef tx;
+        CAmount fee;
+        int changePos = -1;
+        std::string error;
+        CCoinControl dummy;
+        auto locked_chain = m_chain->lock();
+        BOOST_CHECK(wallet->CreateTransaction(*locked_chain, {recipient}, tx, fee, changePos, error, dummy));
+        return tx;
+    }
+
+    CAmount GetTrusted()
+    {
+        return wallet->GetBalance().m_mine_trusted;
+    }
+
+    std::set<COutPoint> GetCoins()
+    {
+        std::vector<COutput> available;
+        auto locked_chain = m_chain->lock();
+        LOCK(wallet->cs_wallet);
+        wallet->AvailableCoins(*locked_chain, available);
+        std::set<COutPoint> coins;
+        for (const COutput& out : available)
+            coins.emplace(out.tx->GetHash(), out.i);
+        return coins;
+    }
+
+    int GetDepth(const uint256& hash)
+    {
+        auto locked_chain = m_chain->lock();
+        LOCK(wallet->cs_wallet);
+        return wallet->mapWallet.at(hash).GetDepthInMainChain(*locked_chain);
+    }
+
+    /* Rebuilding the caches from mapWallet gives the same balance and coins */
+    void CheckRebuilt()
+    {
+        CWallet::Balance balance = wallet->GetBalance();
+        std::set<COutPoint> coins = GetCoins();
+        wallet->MarkDirty();
+        CWallet::Balance rebuilt = wallet->GetBalance();
+        BOOST_CHECK_EQUAL(rebuilt.m_mine_trusted, balance.m_mine_trusted);
+        BOOST_CHECK_EQUAL(rebuilt.m_mine_immature, balance.m_mine_immature);
+        BOOST_CHECK_EQUAL(rebuilt.m_mine_untrusted_pending, balance.m_mine_untrusted_pending);
+        BOOST_CHECK(GetCoins() == coins);
+    }
+};
+
+BOOST_FIXTURE_TEST_CASE(settled_balance_abandon_conflict_reorg, SettledBalanceTestingSetup)
+{
+    const CRecipient recipient{GetScriptForRawPubKey({}), 1 * COIN, false /* subtract fee */};
+    const COutPoint matureCoin(m_coinbase_txns[0]->GetHash(), 0);
+    BOOST_CHECK_EQUAL(GetTrusted(), 20000 * COIN);
+    BOOST_CHECK(GetCoins() == std::set<COutPoint>{matureCoin});
+
+    // A spend outside the mempool makes the settled coin dirty, abandoning it gives the coin back.
+    CTransactionRef txAbandoned = CreateTx(recipient);
+    {
+        LOCK(wallet->cs_wallet);
+        wallet->AddToWallet(CWalletTx(wallet.get(), txAbandoned));
+    }
+    BOOST_CHECK_EQUAL(GetTrusted(), 0);
+    BOOST_CHECK(GetCoins().empty());
+    {
+        auto locked_chain = m_chain->lock();
+        BOOST_CHECK(wallet->AbandonTransaction(*locked_chain, txAbandoned->GetHash()));
+    }
+    BOOST_CHECK_EQUAL(GetTrusted(), 20000 * COIN);
+    BOOST_CHECK(GetCoins() == std::set<COutPoint>{matureCoin});
+    CheckRebuilt();
+
+    // A block spending the coin in another transaction conflicts the wallet spend.
+    CTransactionRef txMined = CreateTx(recipient);
+    CTransactionRef txConflicted = CreateTx(CRecipient{GetScriptForRawPubKey({}), 2 * COIN, false /* subtract fee */});
+    BOOST_CHECK(txMined->GetHash() != txConflicted->GetHash());
+    {
+        LOCK(wallet->cs_wallet);
+        wallet->AddToWallet(CWalletTx(wallet.get(), txConflicted));
+    }
+    BOOST_CHECK(GetCoins().empty());
+    CBlock block = CreateAndProcessBlock({CMutableTransaction(*txMined)}, GetScriptForRawPubKey(coinbaseKey.GetPubKey()));
+    wallet->BlockConnected(block, {});
+    BOOST_CHECK(GetDepth(txConflicted->GetHash()) < 0);
+    BOOST_CHECK_EQUAL(GetDepth(txMined->GetHash()), 1);
+    std::set<COutPoint> coins = GetCoins();
+    BOOST_CHECK(!coins.count(matureCoin));
+    BOOST_CHECK(coins.count(COutPoint(m_coinbase_txns[1]->GetHash(), 0)));
+    for (const COutPoint& coin : coins)
+        BOOST_CHECK(coin.hash != txConflicted->GetHash());
+    CheckRebuilt();
+
+    // Disconnecting the block makes its spend unconfirmed and the next coinbase immature again.
+    {
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(state, Params(), ::ChainActive().Tip()));
+    }
+    wallet->BlockDisconnected(block);
+    BOOST_CHECK_EQUAL(GetDepth(txMined->GetHash()), 0);
+    BOOST_CHECK_EQUAL(GetTrusted(), 0);
+    BOOST_CHECK(GetCoins().empty());
+    CheckRebuilt();
+
+    // The coin spent by the disconnected block is available again once its spends are abandoned,
+    // the block conflicted the abandoned spend too.
+    {
+        auto locked_chain = m_chain->lock();
+        BOOST_CHECK(wallet->AbandonTransaction(*locked_chain, txMined->GetHash()));
+        BOOST_CHECK(wallet->AbandonTransaction(*locked_chain, txConflicted->GetHash()));
+        BOOST_CHECK(wallet->AbandonTransaction(*locked_chain, txAbandoned->GetHash()));
+    }
+    BOOST_CHECK_EQUAL(GetTrusted(), 20000 * COIN);
+    BOOST_CHECK(GetCoins() == std::set<COutPoint>{matureCoin});
+    CheckRebuilt();
+}
+
+BOOST_FIXTURE_TEST_CASE(settled_balance_avoid_reuse, SettledBalanceTestingSetup)
+{
+    wallet->SetWalletFlag(WALLET_FLAG_AVOID_REUSE);
+    CBlock block = CreateAndProcessBlock({}, GetScriptForRawPubKey(coinbaseKey.GetPubKey()));
+    wallet->BlockConnected(block, {});
+    BOOST_CHECK_EQUAL(wallet->GetBalance(0, /* avoid_reuse */ true).m_mine_trusted, 40000 * COIN);
+
+    // Spending one of the settled coinbases makes the other one used too, both pay the coinbase key.
+    CTransactionRef tx = CreateTx(CRecipient{GetScriptForRawPubKey({}), 1 * COIN, false /* subtract fee */});
+    {
+        LOCK(wallet->cs_wallet);
+        wallet->AddToWallet(CWalletTx(wallet.get(), tx));
+    }
+    BOOST_CHECK_EQUAL(wallet->GetBalance(0, /* avoid_reuse */ false).m_mine_trusted, 20000 * COIN);
+    BOOST_CHECK_EQUAL(wallet->GetBalance(0, /* avoid_reuse */ true).m_mine_trusted, 0);
+
+    wallet->MarkDirty();
+    BOOST_CHECK_EQUAL(wallet->GetBalance(0, /* avoid_reuse */ false).m_mine_trusted, 20000 * COIN);
+    BOOST_CHECK_EQUAL(wallet->GetBalance(0, /* avoid_reuse */ true).m_mine_trusted, 0);
+}
+
+/* Tokens of the wallet key, with contracts executed into the blocks of the test chain */
+class TokenTestingSetup : public ListCoinsTestingSetup
+{
+public:
+    CTokenInfo AddToken(const dev::Address& contract, const CTxDestination& sender, const CBlockIndex* pindexSynced)
+    {
+        CTokenInfo token;
+        token.strContractAddress = contract.hex();
+        token.strSenderAddress = EncodeDestination(sender);
+        if (pindexSynced) {
+            token.blockHash = pindexSynced->GetBlockHash();
+            token.blockNumber = pindexSynced->nHeight;
+        }
+        BOOST_CHECK(wallet->AddTokenEntry(token));
+        return token;
+    }
+
+    CTokenInfo GetToken(const uint256& tokenHash)
+    {
+        LOCK(wallet->cs_wallet);
+        return wallet->mapToken.at(tokenHash);
+    }
+
+    /* Execute the contract transactions on the state of the tip and connect a block with the new state */
+    void ExecuteInBlock(const std::vector<QtumTransaction>& txs)
+    {
+        {
+            LOCK(cs_main);
+            executeBC(txs);
+            CBlockIndex* pindexTip = ::ChainActive().Tip();
+            pindexTip->hashStateRoot = h256Touint(globalState->rootHash());
+            pindexTip->hashUTXORoot = h256Touint(globalState->rootHashUTXO());
+        }
+        CreateAndProcessBlock({}, GetScriptForRawPubKey(coinbaseKey.GetPubKey()));
+    }
+};
+
+static dev::h256 AddressTopic(const dev::Address& address)
+{
+    dev::h256 topic;
+    std::copy(address.begin(), address.end(), topic.begin() + 12);
+    return topic;
+}
+
+static dev::eth::LogEntry TransferLog(const dev::Address& contract, const dev::Address& from, const dev::Address& to, int64_t value)
+{
+    dev::h256 topic("ddf252ad1be2c89b69c2b068fc378daa952ba7f163c4a11628f55a4df523b3ef");
+    return dev::eth::LogEntry(contract, {topic, AddressTopic(from), AddressTopic(to)}, dev::h256(value).asBytes());
+}
+
+BOOST_FIXTURE_TEST_CASE(token_sync_transfers, TokenTestingSetup)
+{
+    const PKHash sender(coinbaseKey.GetPubKey());
+    const dev::Address senderAddress(valtype(sender.begin(), sender.end()));
+    const dev::Address receiverAddress(0x1234);
+    const dev::Address contract(0xabcd);
+    const uint256 hashSynced = AddToken(contract, sender, ::ChainActive().Tip()).GetHash();
+    const uint256 hashGap = AddToken(dev::Address(0xabce), sender, ::ChainActive().Tip()->pprev).GetHash();
+
+    // A block with a call to the token, its receipt holds two transfers to the same address and one of another token
+    CBlock block = CreateAndProcessBlock({}, GetScriptForRawPubKey(coinbaseKey.GetPubKey()));
+    CMutableTransaction txCall;
+    txCall.vout.emplace_back(0, CScript() << CScriptNum(VersionVM::GetEVMDefault().toRaw()) << CScriptNum(500000) << CScriptNum(40) << valtype{} << contract.asBytes() << OP_CALL);
+    block.vtx.push_back(MakeTransactionRef(txCall));
+    std::vector<TransactionReceiptInfo> receipts{TransactionReceiptInfo{
+        block.GetHash(), (uint32_t)::ChainActive().Height(), txCall.GetHash(), 1, 0,
+        senderAddress, contract,
+        30000, 30000, contract,
+        {TransferLog(contract, senderAddress, receiverAddress, 3), TransferLog(contract, senderAddress, receiverAddress, 4),
+         TransferLog(dev::Address(0xabcf), senderAddress, receiverAddress, 5)},
+        dev::eth::TransactionException::None, "",
+        globalState->rootHash(), globalState->rootHashUTXO(),
+        {}, {}
+    }};
+    pstorageresult->addResult(uintToh256(txCall.GetHash()), receipts);
+    pstorageresult->commitResults();
+
+    // Without event indexing the tokens are left to the event search of the GUI
+    fLogEvents = false;
+    wallet->BlockConnected(block, {});
+    BOOST_CHECK(GetToken(hashSynced).blockHash == block.hashPrevBlock);
+    {
+        LOCK(wallet->cs_wallet);
+        BOOST_CHECK(wallet->mapTokenTx.empty());
+    }
+
+    // With event indexing the transfers are added and the synced token moves to the block, so the GUI skips its search
+    fLogEvents = true;
+    wallet->BlockConnected(block, {});
+    fLogEvents = false;
+    BOOST_CHECK(GetToken(hashSynced).blockHash == block.GetHash());
+    BOOST_CHECK_EQUAL(GetToken(hashSynced).blockNumber, ::ChainActive().Height());
+    BOOST_CHECK_EQUAL(GetToken(hashGap).blockNumber, ::ChainActive().Height() - 2);
+    {
+        LOCK(wallet->cs_wallet);
+        BOOST_CHECK_EQUAL(wallet->mapTokenTx.size(), 1U);
+        const CTokenTx& tokenTx = wallet->mapTokenTx.begin()->second;
+        BOOST_CHECK_EQUAL(tokenTx.strContractAddress, contract.hex());
+        BOOST_CHECK_EQUAL(tokenTx.strSenderAddress, EncodeDestination(sender));
+        BOOST_CHECK_EQUAL(tokenTx.strReceiverAddress, EncodeDestination(PKHash(uint160(receiverAddress.asBytes()))));
+        BOOST_CHECK(tokenTx.transactionHash == txCall.GetHash());
+        BOOST_CHECK(tokenTx.nValue == u256Touint(7));
+    }
+
+    // Disconnecting the block moves the token back to the parent, the GUI searches from there again
+    {
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(state, Params(), ::ChainActive().Tip()));
+    }
+    wallet->BlockDisconnected(block);
+    BOOST_CHECK(GetToken(hashSynced).blockHash == block.hashPrevBlock);
+    BOOST_CHECK_EQUAL(GetToken(hashSynced).blockNumber, ::ChainActive().Height());
+}
+
+BOOST_FIXTURE_TEST_CASE(token_balance_cache, TokenTestingSetup)
+{
+    // A contract that returns storage slot 0 for every call, except that a call with one word of data stores it there
+    const valtype code = ParseHex("601a80600b6000396000f33660201460125760005460005260206000f35b60003560005500");
+    const dev::h256 hashCreate(ParseHex("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"));
+    const dev::h256 hashCall(ParseHex("bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb"));
+    ExecuteInBlock({createQtumTransaction(code, 0, dev::u256(500000), dev::u256(1), hashCreate, dev::Address())});
+    const dev::Address contract = createQtumAddress(hashCreate, 0);
+
+    const uint256 tokenHash = AddToken(contract, PKHash(coinbaseKey.GetPubKey()), nullptr).GetHash();
+    uint256 balance;
+    BOOST_CHECK(wallet->GetTokenBalance(tokenHash, balance));
+    BOOST_CHECK(balance == uint256());
+
+    // A change of the token storage without any event is seen with the next block
+    ExecuteInBlock({createQtumTransaction(dev::h256(5).asBytes(), 0, dev::u256(500000), dev::u256(1), hashCall, contract)});
+    BOOST_CHECK(wallet->GetTokenBalance(tokenHash, balance));
+    BOOST_CHECK(balance == u256Touint(5));
+
+    // A block that does not change the token storage keeps the balance
+    CreateAndProcessBlock({}, GetScriptForRawPubKey(coinbaseKey.GetPubKey()));
+    BOOST_CHECK(wallet->GetTokenBalance(tokenHash, balance));
+    BOOST_CHECK(balance == u256Touint(5));
+
+    // A removed token has no balance
+    BOOST_CHECK(wallet->RemoveTokenEntry(tokenHash));
+    BOOST_CHECK(!wallet->GetTokenBalance(tokenHash, balance));
+}
+
 BOOST_FIXTURE_TEST_CASE(wallet_disableprivkeys, TestChain100Setup)
 {
     auto chain = interfaces::MakeChain();
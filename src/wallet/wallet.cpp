@@ -831,6 +831,7 @@ void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
     mapTxSpends.insert(std::make_pair(outpoint, wtxid));
 
     setLockedCoins.erase(outpoint);
+    MarkBalanceDirty(outpoint.hash);
 
     std::pair<TxSpends::iterator, TxSpends::iterator> range;
     range = mapTxSpends.equal_range(outpoint);
@@ -847,6 +848,7 @@ void CWallet::RemoveFromSpends(const COutPoint& outpoint, const uint256& wtxid)
         if(it->second == wtxid)
         {
             mapTxSpends.erase(it);
+            MarkBalanceDirty(outpoint.hash);
             break;
         }
     }
@@ -1049,6 +1051,9 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         for (std::pair<const uint256, CWalletTx>& item : mapWallet)
             item.second.MarkDirty();
+        // the outputs that are mine may have changed
+        fWalletCoinsValid = false;
+        m_balance_valid = false;
     }
 }
 
@@ -1081,7 +1086,7 @@ bool CWallet::MarkReplaced(const uint256& originalHash, const uint256& newHash)
     return success;
 }
 
-void CWallet::SetUsedDestinationState(const uint256& hash, unsigned int n, bool used)
+void CWallet::SetUsedDestinationState(const uint256& hash, unsigned int n, bool used, std::set<CTxDestination>& tx_destinations)
 {
     const CWalletTx* srctx = GetWalletTx(hash);
     if (!srctx) return;
@@ -1091,7 +1096,9 @@ void CWallet::SetUsedDestinationState(const uint256& hash, unsigned int n, bool
         if (::IsMine(*this, dst)) {
             LOCK(cs_wallet);
             if (used && !GetDestData(dst, "used", nullptr)) {
-                AddDestData(dst, "used", "p"); // p for "present", opposite of absent (null)
+                if (AddDestData(dst, "used", "p")) { // p for "present", opposite of absent (null)
+                    tx_destinations.insert(dst);
+                }
             } else if (!used && GetDestData(dst, "used", nullptr)) {
                 EraseDestData(dst, "used");
             }
@@ -1099,6 +1106,22 @@ void CWallet::SetUsedDestinationState(const uint256& hash, unsigned int n, bool
     }
 }
 
+void CWallet::MarkDestinationsDirty(const std::set<CTxDestination>& destinations)
+{
+    AssertLockHeld(cs_wallet);
+    for (std::pair<const uint256, CWalletTx>& item : mapWallet) {
+        CWalletTx& wtx = item.second;
+        for (const CTxOut& txout : wtx.tx->vout) {
+            CTxDestination dst;
+            if (ExtractDestination(txout.scriptPubKey, dst) && destinations.count(dst)) {
+                wtx.MarkDirty();
+                MarkBalanceDirty(item.first);
+                break;
+            }
+        }
+    }
+}
+
 bool CWallet::IsUsedDestination(const CTxDestination& dst) const
 {
     LOCK(cs_wallet);
@@ -1122,10 +1145,15 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
 
     if (IsWalletFlagSet(WALLET_FLAG_AVOID_REUSE)) {
         // Mark used destinations
+        std::set<CTxDestination> tx_destinations;
+
         for (const CTxIn& txin : wtxIn.tx->vin) {
             const COutPoint& op = txin.prevout;
-            SetUsedDestinationState(op.hash, op.n, true);
+            SetUsedDestinationState(op.hash, op.n, true, tx_destinations);
         }
+
+        // outputs of other transactions to these destinations are used now
+        MarkDestinationsDirty(tx_destinations);
     }
 
     // Inserts only if not already there, returns tx inserted or tx found
@@ -1139,6 +1167,10 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
         wtx.m_it_wtxOrdered = wtxOrdered.insert(std::make_pair(wtx.nOrderPos, &wtx));
         wtx.nTimeSmart = ComputeTimeSmart(wtx);
         AddToSpends(hash);
+        if (fWalletCoinsValid)
+            AddWalletCoins(wtx);
+        if (m_balance_valid)
+            UnsettleTransaction(hash);
     }
 
     bool fUpdated = false;
@@ -1171,6 +1203,9 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
         {
             AddToSpends(hash);
         }
+        // a new block, abandoned or conflicted state changes the credit of the transaction
+        if (fUpdated && m_balance_valid)
+            UnsettleTransaction(hash);
     }
 
     //// debug print
@@ -1305,6 +1340,7 @@ void CWallet::MarkInputsDirty(const CTransactionRef& tx)
         auto it = mapWallet.find(txin.prevout.hash);
         if (it != mapWallet.end()) {
             it->second.MarkDirty();
+            MarkBalanceDirty(txin.prevout.hash);
         }
     }
 }
@@ -1346,6 +1382,8 @@ bool CWallet::AbandonTransaction(interfaces::Chain::Lock& locked_chain, const ui
             wtx.m_confirm.nIndex = 0;
             wtx.setAbandoned();
             wtx.MarkDirty();
+            if (m_balance_valid)
+                UnsettleTransaction(now);
             batch.WriteTx(wtx);
             NotifyTransactionChanged(this, wtx.GetHash(), CT_UPDATED);
             // Iterate over all its outputs, and mark transactions in the wallet that spend them abandoned too
@@ -1401,6 +1439,8 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
             wtx.m_confirm.hashBlock = hashBlock;
             wtx.setConflicted();
             wtx.MarkDirty();
+            if (m_balance_valid)
+                UnsettleTransaction(now);
             batch.WriteTx(wtx);
             // Iterate over all its outputs, and mark transactions in the wallet that spend them conflicted too
             TxSpends::const_iterator iter = mapTxSpends.lower_bound(COutPoint(now, 0));
@@ -1449,6 +1489,11 @@ void CWallet::TransactionAddedToMempool(const CTransactionRef& ptx) {
     if (it != mapWallet.end()) {
         it->second.fInMempool = true;
     }
+
+    // coins spent by the mempool can not stake
+    for (const CTxIn& txin : ptx->vin) {
+        stakeCache.Remove(txin.prevout);
+    }
 }
 
 void CWallet::TransactionRemovedFromMempool(const CTransactionRef &ptx) {
@@ -1464,13 +1509,25 @@ void CWallet::BlockConnected(const CBlock& block, const std::vector<CTransaction
     auto locked_chain = chain().lock();
     LOCK(cs_wallet);
 
+    Optional<int> height = locked_chain->getBlockHeight(block_hash);
+    bool fStakeCache = gArgs.GetBoolArg("-stakecache", DEFAULT_STAKE_CACHE);
     for (size_t i = 0; i < block.vtx.size(); i++) {
         SyncTransaction(block.vtx[i], CWalletTx::Status::CONFIRMED, block_hash, i);
         TransactionRemovedFromMempool(block.vtx[i]);
+        if (height && fStakeCache) {
+            UpdateStakeCache(*block.vtx[i], block.nTime, *height);
+        }
+        // coins spent by the chain can not be spent again unless the block is disconnected
+        for (const CTxIn& txin : block.vtx[i]->vin) {
+            setWalletCoins.erase(txin.prevout);
+        }
     }
     for (const CTransactionRef& ptx : vtxConflicted) {
         TransactionRemovedFromMempool(ptx);
     }
+    if (height) {
+        SyncTokenTxs(block, *height);
+    }
 
     m_last_block_processed = block_hash;
 }
@@ -1486,6 +1543,27 @@ void CWallet::BlockDisconnected(const CBlock& block) {
     for (const CTransactionRef& ptx : block.vtx) {
         int posInBlock = ptx->IsCoinStake() ? -1 : 0;
         SyncTransaction(ptx, CWalletTx::Status::UNCONFIRMED, {} /* block hash */, posInBlock /* position in block */);
+        // the spent coins are read again on demand with the time of their own block
+        UpdateStakeCache(*ptx, 0, -1);
+        if (fWalletCoinsValid) {
+            for (const CTxIn& txin : ptx->vin) {
+                auto it = mapWallet.find(txin.prevout.hash);
+                if (it != mapWallet.end() && txin.prevout.n < it->second.tx->vout.size())
+                    AddWalletCoin(it->second, txin.prevout.n);
+            }
+        }
+    }
+    // the tokens synced with the disconnected block search its parent again
+    if (!mapToken.empty()) {
+        WalletBatch batch(*database, "r+", false);
+        for (auto& entry : mapToken) {
+            CTokenInfo& token = entry.second;
+            if (token.blockHash == block.GetHash()) {
+                token.blockHash = block.hashPrevBlock;
+                token.blockNumber--;
+                batch.WriteToken(token);
+            }
+        }
     }
 }
 
@@ -2477,6 +2555,95 @@ void MaybeResendWalletTxs()
  */
 
 
+void CWallet::MarkBalanceDirty(const uint256& hash)
+{
+    AssertLockHeld(cs_wallet);
+    if (m_balance_valid && m_settled_credit.count(hash))
+        m_balance_dirty.insert(hash);
+}
+
+void CWallet::UnsettleTransaction(const uint256& hash) const
+{
+    AssertLockHeld(cs_wallet);
+    auto it = m_settled_credit.find(hash);
+    if (it != m_settled_credit.end()) {
+        for (size_t i = 0; i < m_settled_balance.size(); i++)
+            m_settled_balance[i] -= it->second.second[i];
+        m_settled_heights.erase(std::make_pair(it->second.first, hash));
+        m_settled_credit.erase(it);
+    }
+    auto mi = mapWallet.find(hash);
+    if (mi != mapWallet.end() && !mi->second.isAbandoned() && !mi->second.isConflicted())
+        m_unsettled_txs.insert(hash);
+    else
+        m_unsettled_txs.erase(hash);
+}
+
+void CWallet::UpdateSettledBalance(interfaces::Chain::Lock& locked_chain) const
+{
+    AssertLockHeld(cs_wallet);
+
+    // without a tip nothing is settled, the balance is built again with the chain
+    const Optional<int> tip_height = locked_chain.getHeight();
+    if (!tip_height)
+        m_balance_valid = false;
+
+    if (!m_balance_valid) {
+        m_settled_credit.clear();
+        m_settled_heights.clear();
+        m_settled_balance.fill(0);
+        m_unsettled_txs.clear();
+        m_balance_dirty.clear();
+        for (const auto& entry : mapWallet) {
+            if (!entry.second.isAbandoned() && !entry.second.isConflicted())
+                m_unsettled_txs.insert(entry.first);
+        }
+        if (!tip_height)
+            return;
+        m_balance_valid = true;
+    }
+
+    for (const uint256& hash : m_balance_dirty)
+        UnsettleTransaction(hash);
+    m_balance_dirty.clear();
+
+    // the settled transactions of disconnected blocks were updated by AddToWallet, those below them
+    // are recent again when the chain is shorter
+    while (!m_settled_heights.empty()) {
+        const std::pair<int, uint256> last = *m_settled_heights.rbegin();
+        if (*tip_height - last.first + 1 > COINBASE_MATURITY)
+            break;
+        UnsettleTransaction(last.second);
+    }
+
+    for (auto it = m_unsettled_txs.begin(); it != m_unsettled_txs.end();) {
+        auto mi = mapWallet.find(*it);
+        if (mi == mapWallet.end()) {
+            it = m_unsettled_txs.erase(it);
+            continue;
+        }
+        const CWalletTx& wtx = mi->second;
+        const int depth = wtx.GetDepthInMainChain(locked_chain);
+        if (depth <= COINBASE_MATURITY) {
+            ++it;
+            continue;
+        }
+        // the cached credit of the transaction may predate the spend that made it dirty
+        SettledCredit credit;
+        for (int avoid_reuse = 0; avoid_reuse < 2; avoid_reuse++) {
+            isminefilter reuse_filter = avoid_reuse ? ISMINE_NO : ISMINE_USED;
+            credit[avoid_reuse * 2] = wtx.GetAvailableCredit(locked_chain, /* fUseCache */ false, ISMINE_SPENDABLE | reuse_filter);
+            credit[avoid_reuse * 2 + 1] = wtx.GetAvailableCredit(locked_chain, /* fUseCache */ false, ISMINE_WATCH_ONLY | reuse_filter);
+        }
+        for (size_t i = 0; i < m_settled_balance.size(); i++)
+            m_settled_balance[i] += credit[i];
+        const int height = *tip_height - depth + 1;
+        m_settled_credit.emplace(*it, std::make_pair(height, credit));
+        m_settled_heights.emplace(height, *it);
+        it = m_unsettled_txs.erase(it);
+    }
+}
+
 CWallet::Balance CWallet::GetBalance(const int min_depth, bool avoid_reuse) const
 {
     Balance ret;
@@ -2484,9 +2651,7 @@ CWallet::Balance CWallet::GetBalance(const int min_depth, bool avoid_reuse) cons
     {
         auto locked_chain = chain().lock();
         LOCK(cs_wallet);
-        for (const auto& entry : mapWallet)
-        {
-            const CWalletTx& wtx = entry.second;
+        auto add_tx = [&](const CWalletTx& wtx) {
             const bool is_trusted{wtx.IsTrusted(*locked_chain)};
             const int tx_depth{wtx.GetDepthInMainChain(*locked_chain)};
             const CAmount tx_credit_mine{wtx.GetAvailableCredit(*locked_chain, /* fUseCache */ true, ISMINE_SPENDABLE | reuse_filter)};
@@ -2503,7 +2668,20 @@ CWallet::Balance CWallet::GetBalance(const int min_depth, bool avoid_reuse) cons
             ret.m_watchonly_immature += wtx.GetImmatureWatchOnlyCredit(*locked_chain);
             ret.m_mine_stake += wtx.GetStakeCredit(*locked_chain);
             ret.m_watchonly_stake += wtx.GetStakeWatchOnlyCredit(*locked_chain);
+        };
+
+        if (min_depth > COINBASE_MATURITY + 1) {
+            // settled transactions may not be deep enough
+            for (const auto& entry : mapWallet)
+                add_tx(entry.second);
+            return ret;
         }
+
+        UpdateSettledBalance(*locked_chain);
+        ret.m_mine_trusted += m_settled_balance[avoid_reuse * 2];
+        ret.m_watchonly_trusted += m_settled_balance[avoid_reuse * 2 + 1];
+        for (const uint256& hash : m_unsettled_txs)
+            add_tx(mapWallet.at(hash));
     }
     return ret;
 }
@@ -2536,28 +2714,25 @@ void CWallet::AvailableCoins(interfaces::Chain::Lock& locked_chain, std::vector<
     const int min_depth = {coinControl ? coinControl->m_min_depth : DEFAULT_MIN_DEPTH};
     const int max_depth = {coinControl ? coinControl->m_max_depth : DEFAULT_MAX_DEPTH};
 
-    for (const auto& entry : mapWallet)
-    {
-        const uint256& wtxid = entry.first;
-        const CWalletTx& wtx = entry.second;
-
+    // Checks shared by the coins of a transaction, false if none of them is available
+    auto check_tx = [&](const CWalletTx& wtx, int& nDepth, bool& safeTx) {
         if (!locked_chain.checkFinalTx(*wtx.tx)) {
-            continue;
+            return false;
         }
 
         if (wtx.IsImmature(locked_chain))
-            continue;
+            return false;
 
-        int nDepth = wtx.GetDepthInMainChain(locked_chain);
+        nDepth = wtx.GetDepthInMainChain(locked_chain);
         if (nDepth < 0)
-            continue;
+            return false;
 
         // We should not consider coins which aren't at least in our mempool
         // It's possible for these to be conflicted via ancestors which we may never be able to detect
         if (nDepth == 0 && !wtx.InMempool())
-            continue;
+            return false;
 
-        bool safeTx = wtx.IsTrusted(locked_chain);
+        safeTx = wtx.IsTrusted(locked_chain);
 
         // We should not consider coins from transactions that are replacing
         // other transactions.
@@ -2591,56 +2766,112 @@ void CWallet::AvailableCoins(interfaces::Chain::Lock& locked_chain, std::vector<
         }
 
         if (fOnlySafe && !safeTx) {
-            continue;
+            return false;
         }
 
         if (nDepth < min_depth || nDepth > max_depth) {
-            continue;
+            return false;
         }
+        return true;
+    };
 
-        for (unsigned int i = 0; i < wtx.tx->vout.size(); i++) {
-            if (wtx.tx->vout[i].nValue < nMinimumAmount || wtx.tx->vout[i].nValue > nMaximumAmount)
-                continue;
+    LoadWalletCoins(locked_chain);
 
-            if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(COutPoint(entry.first, i)))
-                continue;
+    // The coins are ordered by transaction, the checks of a transaction are done once for all its coins
+    uint256 wtxid;
+    const CWalletTx* pwtx = nullptr;
+    int nDepth = 0;
+    bool safeTx = false;
+    for (const COutPoint& coin : setWalletCoins)
+    {
+        if (coin.hash != wtxid) {
+            wtxid = coin.hash;
+            std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(wtxid);
+            pwtx = it != mapWallet.end() && check_tx(it->second, nDepth, safeTx) ? &it->second : nullptr;
+        }
+        if (!pwtx)
+            continue;
 
-            if (IsLockedCoin(entry.first, i))
-                continue;
+        const CWalletTx& wtx = *pwtx;
+        unsigned int i = coin.n;
+        if (wtx.tx->vout[i].nValue < nMinimumAmount || wtx.tx->vout[i].nValue > nMaximumAmount)
+            continue;
 
-            if (IsSpent(locked_chain, wtxid, i))
-                continue;
+        if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(coin))
+            continue;
 
-            isminetype mine = IsMine(wtx.tx->vout[i]);
+        if (IsLockedCoin(wtxid, i))
+            continue;
 
-            if (mine == ISMINE_NO) {
-                continue;
-            }
+        if (IsSpent(locked_chain, wtxid, i))
+            continue;
 
-            if (!allow_used_addresses && IsUsedDestination(wtxid, i)) {
-                continue;
-            }
+        isminetype mine = IsMine(wtx.tx->vout[i]);
 
-            bool solvable = IsSolvable(*this, wtx.tx->vout[i].scriptPubKey);
-            bool spendable = ((mine & ISMINE_SPENDABLE) != ISMINE_NO) || (((mine & ISMINE_WATCH_ONLY) != ISMINE_NO) && (coinControl && coinControl->fAllowWatchOnly && solvable));
+        if (mine == ISMINE_NO) {
+            continue;
+        }
+
+        if (!allow_used_addresses && IsUsedDestination(wtxid, i)) {
+            continue;
+        }
 
-            vCoins.push_back(COutput(&wtx, i, nDepth, spendable, solvable, safeTx, (coinControl && coinControl->fAllowWatchOnly)));
+        bool solvable = IsSolvable(*this, wtx.tx->vout[i].scriptPubKey);
+        bool spendable = ((mine & ISMINE_SPENDABLE) != ISMINE_NO) || (((mine & ISMINE_WATCH_ONLY) != ISMINE_NO) && (coinControl && coinControl->fAllowWatchOnly && solvable));
 
-            // Checks the sum amount of all UTXO's.
-            if (nMinimumSumAmount != MAX_MONEY) {
-                nTotal += wtx.tx->vout[i].nValue;
+        vCoins.push_back(COutput(&wtx, i, nDepth, spendable, solvable, safeTx, (coinControl && coinControl->fAllowWatchOnly)));
 
-                if (nTotal >= nMinimumSumAmount) {
-                    return;
-                }
-            }
+        // Checks the sum amount of all UTXO's.
+        if (nMinimumSumAmount != MAX_MONEY) {
+            nTotal += wtx.tx->vout[i].nValue;
 
-            // Checks the maximum number of UTXO's.
-            if (nMaximumCount > 0 && vCoins.size() >= nMaximumCount) {
+            if (nTotal >= nMinimumSumAmount) {
                 return;
             }
         }
+
+        // Checks the maximum number of UTXO's.
+        if (nMaximumCount > 0 && vCoins.size() >= nMaximumCount) {
+            return;
+        }
+    }
+}
+
+void CWallet::AddWalletCoin(const CWalletTx& wtx, unsigned int n) const
+{
+    AssertLockHeld(cs_wallet);
+    if (IsMine(wtx.tx->vout[n]) != ISMINE_NO)
+        setWalletCoins.insert(COutPoint(wtx.GetHash(), n));
+}
+
+void CWallet::AddWalletCoins(const CWalletTx& wtx) const
+{
+    for (unsigned int i = 0; i < wtx.tx->vout.size(); i++)
+        AddWalletCoin(wtx, i);
+}
+
+void CWallet::LoadWalletCoins(interfaces::Chain::Lock& locked_chain) const
+{
+    AssertLockHeld(cs_wallet);
+    if (fWalletCoinsValid)
+        return;
+
+    setWalletCoins.clear();
+    for (const std::pair<const uint256, CWalletTx>& item : mapWallet) {
+        const CWalletTx& wtx = item.second;
+        for (unsigned int i = 0; i < wtx.tx->vout.size(); i++) {
+            // skip the coins spent by the chain, coins spent in the mempool are filtered when read
+            bool fSpentInChain = false;
+            auto range = mapTxSpends.equal_range(COutPoint(item.first, i));
+            for (TxSpends::const_iterator it = range.first; it != range.second && !fSpentInChain; ++it) {
+                auto mit = mapWallet.find(it->second);
+                fSpentInChain = mit != mapWallet.end() && mit->second.GetDepthInMainChain(locked_chain) > 0;
+            }
+            if (!fSpentInChain)
+                AddWalletCoin(wtx, i);
+        }
     }
+    fWalletCoinsValid = true;
 }
 
 void CWallet::AvailableCoinsForStaking(interfaces::Chain::Lock& locked_chain, std::vector<COutput>& vCoins) const
@@ -2650,11 +2881,24 @@ void CWallet::AvailableCoinsForStaking(interfaces::Chain::Lock& locked_chain, st
 
     vCoins.clear();
 
-    for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+    LoadWalletCoins(locked_chain);
+
+    // The coins are ordered by transaction like mapWallet, the depth is looked up once per transaction
+    const CWalletTx* pcoin = nullptr;
+    int nDepth = 0;
+    for (const COutPoint& prevout : setWalletCoins)
     {
-        const uint256& wtxid = it->first;
-        const CWalletTx* pcoin = &(*it).second;
-        int nDepth = pcoin->GetDepthInMainChain(locked_chain);
+        if (!pcoin || pcoin->GetHash() != prevout.hash) {
+            std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(prevout.hash);
+            if (it == mapWallet.end()) {
+                pcoin = nullptr;
+                continue;
+            }
+            pcoin = &(*it).second;
+            nDepth = pcoin->GetDepthInMainChain(locked_chain);
+            if (nDepth >= COINBASE_MATURITY && pcoin->GetBlocksToMaturity(locked_chain) > 0)
+                nDepth = 0;
+        }
 
         if (nDepth < 1)
             continue;
@@ -2662,18 +2906,16 @@ void CWallet::AvailableCoinsForStaking(interfaces::Chain::Lock& locked_chain, st
         if (nDepth < COINBASE_MATURITY)
             continue;
 
-        if (pcoin->GetBlocksToMaturity(locked_chain) > 0)
+        unsigned int i = prevout.n;
+        const CTxOut& txout = pcoin->tx->vout[i];
+        if (txout.nValue <= 0 || txout.scriptPubKey.HasOpCall() || txout.scriptPubKey.HasOpCreate())
             continue;
 
-        for (unsigned int i = 0; i < pcoin->tx->vout.size(); i++) {
-            isminetype mine = IsMine(pcoin->tx->vout[i]);
-            bool solvable = IsSolvable(*this, pcoin->tx->vout[i].scriptPubKey);
-            bool spendable = ((mine & ISMINE_SPENDABLE) != ISMINE_NO) || (((mine & ISMINE_WATCH_ONLY) != ISMINE_NO) && solvable);
-            if (!(IsSpent(locked_chain, wtxid, i)) && mine != ISMINE_NO &&
-                !IsLockedCoin((*it).first, i) && (pcoin->tx->vout[i].nValue > 0) &&
-                !pcoin->tx->vout[i].scriptPubKey.HasOpCall() && !pcoin->tx->vout[i].scriptPubKey.HasOpCreate())
-                    vCoins.push_back(COutput(pcoin, i, nDepth, spendable, solvable, pcoin->IsTrusted(locked_chain)));
-        }
+        isminetype mine = IsMine(txout);
+        bool solvable = IsSolvable(*this, txout.scriptPubKey);
+        bool spendable = ((mine & ISMINE_SPENDABLE) != ISMINE_NO) || (((mine & ISMINE_WATCH_ONLY) != ISMINE_NO) && solvable);
+        if (!(IsSpent(locked_chain, prevout.hash, i)) && mine != ISMINE_NO && !IsLockedCoin(prevout.hash, i))
+            vCoins.push_back(COutput(pcoin, i, nDepth, spendable, solvable, pcoin->IsTrusted(locked_chain)));
     }
 }
 
@@ -3540,7 +3782,56 @@ uint64_t CWallet::GetStakeWeight(interfaces::Chain::Lock& locked_chain) const
     return nWeight;
 }
 
-bool CWallet::CreateCoinStake(interfaces::Chain::Lock& locked_chain, const FillableSigningProvider& keystore, unsigned int nBits, const CAmount& nTotalFees, uint32_t nTimeBlock, CMutableTransaction& tx, CKey& key, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoins)
+void CWallet::GetStakeKernels(interfaces::Chain::Lock& locked_chain, const std::set<std::pair<const CWalletTx*,unsigned int> >& setCoins, std::vector<std::pair<COutPoint, CStakeCache> >& vKernels)
+{
+    CBlockIndex* pindexPrev = ::ChainActive().Tip();
+    bool fStakeCache = gArgs.GetBoolArg("-stakecache", DEFAULT_STAKE_CACHE);
+    CStakeCacheMap tmpCache;
+    CStakeCacheMap& cache = fStakeCache ? stakeCache : tmpCache;
+
+    vKernels.clear();
+    vKernels.reserve(setCoins.size());
+    for(const std::pair<const CWalletTx*,unsigned int> &pcoin : setCoins)
+    {
+        boost::this_thread::interruption_point();
+        COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
+        const CStakeCache* pstake = cache.Find(prevoutStake);
+        if(!pstake)
+        {
+            // only coins missed by the notifications, like the ones of a disconnected block, are read from disk
+            CacheKernel(cache, prevoutStake, pindexPrev, ::ChainstateActive().CoinsTip());
+            pstake = cache.Find(prevoutStake);
+        }
+        if(pstake && pindexPrev->nHeight + 1 - pstake->nHeight >= COINBASE_MATURITY)
+            vKernels.emplace_back(prevoutStake, *pstake);
+    }
+}
+
+void CWallet::UpdateStakeCache(const CTransaction& tx, uint32_t nBlockTime, int nHeight)
+{
+    AssertLockHeld(cs_wallet);
+    for(const CTxIn& txin : tx.vin)
+        stakeCache.Remove(txin.prevout);
+
+    if(nHeight < 0)
+    {
+        // disconnected, the outputs no longer exist
+        for(unsigned int i = 0; i < tx.vout.size(); i++)
+            stakeCache.Remove(COutPoint(tx.GetHash(), i));
+        return;
+    }
+
+    if(!mapWallet.count(tx.GetHash()))
+        return;
+    for(unsigned int i = 0; i < tx.vout.size(); i++)
+    {
+        const CTxOut& txout = tx.vout[i];
+        if(txout.nValue > 0 && (IsMine(txout) & ISMINE_SPENDABLE))
+            stakeCache.Add(COutPoint(tx.GetHash(), i), CStakeCache(nBlockTime, txout.nValue, nHeight));
+    }
+}
+
+bool CWallet::CreateCoinStake(interfaces::Chain::Lock& locked_chain, const FillableSigningProvider& keystore, unsigned int nBits, const CAmount& nTotalFees, uint32_t nTimeBlock, CMutableTransaction& tx, CKey& key, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoins, const COutPoint* pprevoutKernel)
 {
     CBlockIndex* pindexPrev = ::ChainActive().Tip();
     arith_uint256 bnTargetPerCoinDay;
@@ -3566,18 +3857,14 @@ bool CWallet::CreateCoinStake(interfaces::Chain::Lock& locked_chain, const Filla
     if (setCoins.empty())
         return false;
 
-    if(stakeCache.size() > setCoins.size() + 100){
-        //Determining if the cache is still valid is harder than just clearing it when it gets too big, so instead just clear it
-        //when it has more than 100 entries more than the actual setCoins.
-        stakeCache.clear();
-    }
-    if(gArgs.GetBoolArg("-stakecache", DEFAULT_STAKE_CACHE)) {
+    // A kernel found by the staker is checked directly, no need to cache the other coins
+    if(gArgs.GetBoolArg("-stakecache", DEFAULT_STAKE_CACHE) && !pprevoutKernel) {
 
         for(const std::pair<const CWalletTx*,unsigned int> &pcoin : setCoins)
         {
             boost::this_thread::interruption_point();
             COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
-            CacheKernel(stakeCache, prevoutStake, pindexPrev, ::ChainstateActive().CoinsTip()); //this will do a 2 disk loads per op
+            CacheKernel(stakeCache, prevoutStake, pindexPrev, ::ChainstateActive().CoinsTip()); //only reads from disk for coins not in the cache yet
         }
     }
     int64_t nCredit = 0;
@@ -3591,6 +3878,8 @@ bool CWallet::CreateCoinStake(interfaces::Chain::Lock& locked_chain, const Filla
         // Search backward in time from the given txNew timestamp
         // Search nSearchInterval seconds back up to nMaxStakeSearchInterval
         COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
+        if (pprevoutKernel && prevoutStake != *pprevoutKernel)
+            continue;
         if (CheckKernel(pindexPrev, nBits, nTimeBlock, prevoutStake, ::ChainstateActive().CoinsTip(), stakeCache))
         {
             // Found a kernel
@@ -5150,7 +5439,7 @@ bool CWallet::AddTokenEntry(const CTokenInfo &token, bool fFlushOnClose)
 
     // Write to disk
     CTokenInfo wtoken = token;
-    if(!fInsertedNew)
+    if(fInsertedNew)
     {
         wtoken.nCreateTime = chain().getAdjustedTime();
     }
@@ -5620,6 +5909,8 @@ bool CWallet::RemoveTokenEntry(const uint256 &tokenHash, bool fFlushOnClose)
 {
     LOCK(cs_wallet);
 
+    mapTokenBalance.erase(tokenHash);
+
     WalletBatch batch(*database, "r+", fFlushOnClose);
 
     bool fFound = false;
@@ -5714,6 +6005,136 @@ bool CWallet::CleanTokenTxEntries(bool fFlushOnClose)
     return true;
 }
 
+//! Topic of the Transfer(address,address,uint256) event of the tokens
+static const dev::h256 TOKEN_TRANSFER_TOPIC("ddf252ad1be2c89b69c2b068fc378daa952ba7f163c4a11628f55a4df523b3ef");
+
+static bool GetTokenAddresses(const CTokenInfo& token, dev::Address& contract, dev::Address& sender)
+{
+    CTxDestination dest = DecodeDestination(token.strSenderAddress);
+    const PKHash* keyid = boost::get<PKHash>(&dest);
+    if (!keyid || token.strContractAddress.size() != 40 || !IsHex(token.strContractAddress))
+        return false;
+    contract = dev::Address(token.strContractAddress);
+    sender = dev::Address(valtype(keyid->begin(), keyid->end()));
+    return true;
+}
+
+void CWallet::SyncTokenTxs(const CBlock& block, int nHeight)
+{
+    AssertLockHeld(cs_wallet);
+    if (!fLogEvents || mapToken.empty() || !pstorageresult)
+        return;
+
+    // Addresses of the wallet for each watched token contract
+    std::map<dev::Address, std::set<dev::Address>> watched;
+    for (const auto& entry : mapToken) {
+        dev::Address contract, sender;
+        if (GetTokenAddresses(entry.second, contract, sender))
+            watched[contract].insert(sender);
+    }
+
+    // The transfers between the same addresses in a transaction are summed, like the event search of the GUI
+    std::vector<CTokenTx> tokenTxs;
+    const uint256 blockHash = block.GetHash();
+    for (const CTransactionRef& tx : block.vtx) {
+        if (!tx->HasCreateOrCall())
+            continue;
+        for (const TransactionReceiptInfo& receipt : pstorageresult->getResult(uintToh256(tx->GetHash()))) {
+            for (const dev::eth::LogEntry& log : receipt.logs) {
+                auto it = watched.find(log.address);
+                if (it == watched.end())
+                    continue;
+                if (log.topics.size() < 3 || log.topics[0] != TOKEN_TRANSFER_TOPIC || log.data.size() < 32)
+                    continue;
+                dev::Address from = dev::right160(log.topics[1]);
+                dev::Address to = dev::right160(log.topics[2]);
+                if (!it->second.count(from) && !it->second.count(to))
+                    continue;
+
+                CTokenTx tokenTx;
+                tokenTx.strContractAddress = log.address.hex();
+                tokenTx.strSenderAddress = EncodeDestination(PKHash(uint160(from.asBytes())));
+                tokenTx.strReceiverAddress = EncodeDestination(PKHash(uint160(to.asBytes())));
+                tokenTx.transactionHash = tx->GetHash();
+                tokenTx.blockHash = blockHash;
+                tokenTx.blockNumber = nHeight;
+                dev::u256 value = dev::fromBigEndian<dev::u256>(dev::bytesConstRef(log.data.data(), 32));
+
+                auto same = std::find_if(tokenTxs.begin(), tokenTxs.end(), [&](const CTokenTx& other) {
+                    return other.strContractAddress == tokenTx.strContractAddress && other.strSenderAddress == tokenTx.strSenderAddress &&
+                        other.strReceiverAddress == tokenTx.strReceiverAddress && other.transactionHash == tokenTx.transactionHash;
+                });
+                if (same != tokenTxs.end()) {
+                    same->nValue = u256Touint(uintTou256(same->nValue) + value);
+                } else {
+                    tokenTx.nValue = u256Touint(value);
+                    tokenTxs.push_back(tokenTx);
+                }
+            }
+        }
+    }
+
+    for (const CTokenTx& tokenTx : tokenTxs) {
+        AddTokenTxEntry(tokenTx, false);
+    }
+
+    WalletBatch batch(*database, "r+", false);
+    for (auto& entry : mapToken) {
+        CTokenInfo& token = entry.second;
+        // A token synced with the previous block does not need to search the events of this one
+        if (token.blockNumber == nHeight - 1 && token.blockHash == block.hashPrevBlock) {
+            token.blockHash = blockHash;
+            token.blockNumber = nHeight;
+            batch.WriteToken(token);
+        }
+    }
+}
+
+bool CWallet::GetTokenBalance(const uint256& tokenHash, uint256& balance)
+{
+    dev::Address contract, sender;
+    {
+        LOCK(cs_wallet);
+        auto it = mapToken.find(tokenHash);
+        if (it == mapToken.end() || !GetTokenAddresses(it->second, contract, sender))
+            return false;
+    }
+
+    // cs_main is only needed to pick the snapshot, the storage root and the call are read without the chain and wallet locks
+    std::shared_ptr<const ContractStateSnapshot> snapshot;
+    {
+        LOCK(cs_main);
+        snapshot = GetContractStateSnapshot(::ChainActive().Tip());
+    }
+    if (!snapshot)
+        return false;
+
+    // The balance is read from the storage of the token contract, it changes with that storage whether or not
+    // the change emitted an event, for example when another contract calls the token
+    uint256 storageRoot = h256Touint(snapshot->StorageRoot(contract));
+    {
+        LOCK(cs_wallet);
+        auto it = mapTokenBalance.find(tokenHash);
+        if (it != mapTokenBalance.end() && it->second.first == storageRoot) {
+            balance = it->second.second;
+            return true;
+        }
+    }
+
+    // balanceOf(address)
+    std::vector<ResultExecute> execResults;
+    std::vector<unsigned char> data = ParseHex("70a08231000000000000000000000000" + sender.hex());
+    if (!snapshot->Call(contract, data, execResults, sender) || execResults.empty() ||
+        execResults[0].execRes.excepted != dev::eth::TransactionException::None || execResults[0].execRes.output.size() < 32)
+        return false;
+
+    balance = u256Touint(dev::fromBigEndian<dev::u256>(dev::bytesConstRef(execResults[0].execRes.output.data(), 32)));
+    LOCK(cs_wallet);
+    if (mapToken.count(tokenHash))
+        mapTokenBalance[tokenHash] = std::make_pair(storageRoot, balance);
+    return true;
+}
+
 bool CWallet::SetContractBook(const std::string &strAddress, const std::string &strName, const std::string &strAbi)
 {
     bool fUpdated = false;
@@ -26,6 +26,7 @@
 #include <pos.h>
 
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <map>
 #include <memory>
@@ -788,7 +789,50 @@ private:
     // Local time that the tip block was received. Used to schedule wallet rebroadcasts.
     std::atomic<int64_t> m_best_block_time {0};
 
-    std::map<COutPoint, CStakeCache> stakeCache;
+    //! Stake kernel data of the wallet coins, updated as blocks are connected and disconnected
+    CStakeCacheMap stakeCache;
+
+    /** Update the stake cache with the outputs created and spent by a transaction */
+    void UpdateStakeCache(const CTransaction& tx, uint32_t nBlockTime, int nHeight) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+
+    //! Balances of the tokens with the storage root of the token contract they were read at
+    std::map<uint256, std::pair<uint256, uint256>> mapTokenBalance GUARDED_BY(cs_wallet);
+
+    /** Add the Transfer events of the tokens in the block and move the tokens that were synced with the previous block to it */
+    void SyncTokenTxs(const CBlock& block, int nHeight) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+
+    //! Outputs of the wallet that are mine and not spent by the active chain, ordered like mapWallet.
+    //! Built on first use and kept up to date as transactions are added and blocks connected, so coin
+    //! selection and the staker do not walk all of mapWallet.
+    mutable std::set<COutPoint> setWalletCoins GUARDED_BY(cs_wallet);
+    mutable bool fWalletCoinsValid GUARDED_BY(cs_wallet) = false;
+
+    /** Add the outputs of a wallet transaction that are mine to the wallet coins */
+    void AddWalletCoins(const CWalletTx& wtx) const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    void AddWalletCoin(const CWalletTx& wtx, unsigned int n) const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    /** Build the wallet coins from mapWallet if they are not valid */
+    void LoadWalletCoins(interfaces::Chain::Lock& locked_chain) const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+
+    //! Available credit of a transaction for GetBalance, mine and watch-only, with and without the used outputs
+    typedef std::array<CAmount, 4> SettledCredit;
+
+    //! Transactions confirmed deeper than the coinbase maturity are trusted and mature, their credit only
+    //! changes when their outputs are spent. It is kept with its sum, GetBalance walks the other transactions.
+    //! Abandoned and conflicted transactions have no credit and are in neither set.
+    mutable std::map<uint256, std::pair<int, SettledCredit>> m_settled_credit GUARDED_BY(cs_wallet);
+    //! Height of the block of the settled transactions, to find those made recent again by a disconnected block
+    mutable std::set<std::pair<int, uint256>> m_settled_heights GUARDED_BY(cs_wallet);
+    mutable SettledCredit m_settled_balance GUARDED_BY(cs_wallet);
+    mutable std::set<uint256> m_unsettled_txs GUARDED_BY(cs_wallet);
+    //! Settled transactions with outputs spent or unspent since the last GetBalance
+    mutable std::set<uint256> m_balance_dirty GUARDED_BY(cs_wallet);
+    mutable bool m_balance_valid GUARDED_BY(cs_wallet) = false;
+
+    /** Compute the credit of the dirty transactions and of those that became settled */
+    void UpdateSettledBalance(interfaces::Chain::Lock& locked_chain) const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    void MarkBalanceDirty(const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    /** Remove the credit of a transaction from the settled balance, it is walked again unless abandoned or conflicted */
+    void UnsettleTransaction(const uint256& hash) const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
 
     /**
      * Used to keep track of spent outpoints, and
@@ -1040,7 +1084,10 @@ public:
     // Whether this or any UTXO with the same CTxDestination has been spent.
     bool IsUsedDestination(const CTxDestination& dst) const;
     bool IsUsedDestination(const uint256& hash, unsigned int n) const;
-    void SetUsedDestinationState(const uint256& hash, unsigned int n, bool used);
+    void SetUsedDestinationState(const uint256& hash, unsigned int n, bool used, std::set<CTxDestination>& tx_destinations);
+
+    /** Mark the transactions with outputs to destinations whose used state changed as dirty */
+    void MarkDestinationsDirty(const std::set<CTxDestination>& destinations) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
 
     std::vector<OutputGroup> GroupOutputs(const std::vector<COutput>& outputs, bool single_coin) const;
 
@@ -1195,7 +1242,9 @@ public:
     bool CommitTransaction(CTransactionRef tx, mapValue_t mapValue, std::vector<std::pair<std::string, std::string>> orderForm, CValidationState& state);
 
     uint64_t GetStakeWeight(interfaces::Chain::Lock& locked_chain) const;
-    bool CreateCoinStake(interfaces::Chain::Lock& locked_chain, const FillableSigningProvider &keystore, unsigned int nBits, const CAmount& nTotalFees, uint32_t nTimeBlock, CMutableTransaction& tx, CKey& key, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoins);
+    /** Collect the block time and amount of the mature coins selected for staking, used to search for a kernel */
+    void GetStakeKernels(interfaces::Chain::Lock& locked_chain, const std::set<std::pair<const CWalletTx*,unsigned int> >& setCoins, std::vector<std::pair<COutPoint, CStakeCache> >& vKernels);
+    bool CreateCoinStake(interfaces::Chain::Lock& locked_chain, const FillableSigningProvider &keystore, unsigned int nBits, const CAmount& nTotalFees, uint32_t nTimeBlock, CMutableTransaction& tx, CKey& key, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoins, const COutPoint* pprevoutKernel = nullptr);
 
     bool DummySignTx(CMutableTransaction &txNew, const std::set<CTxOut> &txouts, bool use_max_sig = false) const
     {
@@ -1507,6 +1556,9 @@ public:
     /* Clean token transaction entries in the wallet */
     bool CleanTokenTxEntries(bool fFlushOnClose=true);
 
+    /* Get the balance of the token address at the tip, computed again when the storage of the token contract changes */
+    bool GetTokenBalance(const uint256& tokenHash, uint256& balance);
+
     /* Start staking MRX */
     void StartStake(CConnman* connman = CWallet::defaultConnman);
 
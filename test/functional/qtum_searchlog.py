@@ -82,6 +82,22 @@ class QtumRPCSearchlogsTest(BitcoinTestFramework):
 
         assert_equal(self.nodes[0].searchlogs(604,604,addresses,topics),[])
 
+        # A limit returns pages that end at a block boundary and together cover the range
+        logs = []
+        fromBlock = 600
+        pages = 0
+        while True:
+            page = self.nodes[0].searchlogs(fromBlock,604,{},{},0,1)
+            pages += 1
+            logs += page['logs']
+            if 'nextBlock' not in page:
+                break
+            assert(len(page['logs']) >= 1)
+            assert(all(log['blockNumber'] < page['nextBlock'] for log in page['logs']))
+            fromBlock = page['nextBlock']
+        assert_equal(logs, self.nodes[0].searchlogs(600,604))
+        assert(pages > 1)
+
 
 if __name__ == '__main__':
     QtumRPCSearchlogsTest().main()